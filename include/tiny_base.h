@@ -1,12 +1,39 @@
 // tiny_base.h 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
 #if defined(_DEBUG)
 #define TF_DEBUG                (1)
 #endif
 
+#if defined(_WIN32)
 #define TF_PLATFORM_WINDOWS     (1)
+#elif defined(__linux__)
+#define TF_PLATFORM_LINUX       (1)
+#endif
+
+#if defined(_MSC_VER)
 #define TF_COMPILER_MSVC        (1)
+#elif defined(__clang__)
+#define TF_COMPILER_CLANG       (1)
+#elif defined(__GNUC__)
+#define TF_COMPILER_GCC         (1)
+#endif
 
 #if defined(TF_COMPILER_MSVC)
     #define TF_FORCE_INLINE                 __forceinline
@@ -16,7 +43,7 @@
     #define TF_THREAD_LS                    __declspec(thread)
     #define TF_LIKELY(cond)                 (cond)
     #define TF_UNLIKELY(cond)               (cond)
-    #define TF_CACHELINE_SIZE               16
+    #define TF_CACHELINE_SIZE               64
     #define TF_CACHELINE_ALIGNED            __declspec(align(TF_CACHELINE_SIZE))
     #define TF_FUNCTION                     __FUNCSIG__
 #elif defined(TF_COMPILER_GCC) || defined(TF_COMPILER_CLANG)
@@ -27,7 +54,7 @@
     #define TF_THREAD_LS                    __thread
     #define TF_LIKELY(cond)                 __builtin_expect(!!(cond), 1)
     #define TF_UNLIKELY(cond)               __builtin_expect((cond), 0)
-    #define TF_CACHELINE_SIZE               32
+    #define TF_CACHELINE_SIZE               64
     #define TF_CACHELINE_ALIGNED            __attribute__((aligned(TF_CACHELINE_SIZE)))
     #define TF_FUNCTION                     __PRETTY_FUNCTION__
 #endif
@@ -44,6 +71,63 @@
 
 #define TF_DEFAULT_ALIGNMENT_SIZE           (16)
 
+// Allocation tracking (tags, counters, histograms), compiled out unless enabled. 
+#if !defined(TF_MEMORY_TRACKING)
+    #if defined(TF_DEBUG)
+        #define TF_MEMORY_TRACKING          (1)
+    #else
+        #define TF_MEMORY_TRACKING          (0)
+    #endif
+#endif
+
+// Number of frames in flight, shared by the frame based resources. 
+#if !defined(BUFFERING_COUNT)
+#define BUFFERING_COUNT                     (2)
+#endif
+
+#if defined(TF_PLATFORM_WINDOWS)
+#include <malloc.h>
+#endif
+
+// std::pmr needs C++17 library support. 
+#if !defined(TF_HAS_MEMORY_RESOURCE)
+    #if defined(__has_include)
+        #if __has_include(<memory_resource>) && (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L))
+            #define TF_HAS_MEMORY_RESOURCE  (1)
+        #endif
+    #endif
+#endif
+#if defined(TF_HAS_MEMORY_RESOURCE)
+#include <memory_resource>
+#endif
+
+// SIMD instruction sets available to the header-only containers. 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define TF_SIMD_SSE2                    (1)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+    #define TF_SIMD_NEON                    (1)
+    #include <arm_neon.h>
+#endif
+#if defined(TF_COMPILER_MSVC)
+#include <intrin.h>
+#endif
+
+// Spin-wait hint: lets the sibling hyper-thread run and saves power in busy loops. 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #if defined(TF_COMPILER_MSVC)
+        #define TF_CPU_PAUSE()              _mm_pause()
+    #else
+        #define TF_CPU_PAUSE()              __builtin_ia32_pause()
+    #endif
+#elif defined(_M_ARM64) || defined(_M_ARM)
+    #define TF_CPU_PAUSE()                  __yield()
+#elif defined(__aarch64__) || defined(__arm__)
+    #define TF_CPU_PAUSE()                  __asm__ __volatile__("yield")
+#else
+    #define TF_CPU_PAUSE()                  ((void)0)
+#endif
+
 // Cӂ̌^̋E𒲂ׂ. 
 #if defined(__cplusplus)
     template <typename T> class TfAlignof
@@ -97,6 +181,249 @@ namespace tf
         return ScopeExit<T>(func);
     }
 
+    //! Index of the lowest set bit, value must not be zero. 
+    TF_FORCE_INLINE uint32_t CountTrailingZeros(uint64_t value)
+    {
+        assert(value != 0);
+#if defined(TF_COMPILER_MSVC)
+        unsigned long index;
+    #if defined(_M_X64) || defined(_M_ARM64)
+        _BitScanForward64(&index, value);
+    #else
+        if (!_BitScanForward(&index, static_cast<unsigned long>(value)))
+        {
+            _BitScanForward(&index, static_cast<unsigned long>(value >> 32));
+            index += 32;
+        }
+    #endif
+        return static_cast<uint32_t>(index);
+#else
+        return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+    }
+
+    //! std::atomic with the memory order spelled out at every access: no implicit seq_cst operators. 
+    template<typename T> class Atomic : private NonCopyable
+    {
+    public:
+        //! Operand of FetchAdd() and FetchSub(), an element count for pointers. 
+        typedef typename std::conditional<std::is_pointer<T>::value, ptrdiff_t, T>::type DifferenceType;
+
+    private:
+        std::atomic<T>                  m_value;
+
+    public:
+        Atomic()
+            : m_value()
+        {
+        }
+
+        explicit Atomic(T value)
+            : m_value(value)
+        {
+        }
+
+        T                               Load(std::memory_order order) const
+        {
+            return m_value.load(order);
+        }
+
+        void                            Store(T value, std::memory_order order)
+        {
+            m_value.store(value, order);
+        }
+
+        T                               Exchange(T value, std::memory_order order)
+        {
+            return m_value.exchange(value, order);
+        }
+
+        //! On failure expected receives the current value. 
+        bool                            CompareExchange(T& expected, T desired, std::memory_order success, std::memory_order failure)
+        {
+            return m_value.compare_exchange_strong(expected, desired, success, failure);
+        }
+
+        //! May fail spuriously, for retry loops. 
+        bool                            CompareExchangeWeak(T& expected, T desired, std::memory_order success, std::memory_order failure)
+        {
+            return m_value.compare_exchange_weak(expected, desired, success, failure);
+        }
+
+        T                               FetchAdd(DifferenceType value, std::memory_order order)
+        {
+            return m_value.fetch_add(value, order);
+        }
+
+        T                               FetchSub(DifferenceType value, std::memory_order order)
+        {
+            return m_value.fetch_sub(value, order);
+        }
+
+        T                               FetchAnd(T value, std::memory_order order)
+        {
+            return m_value.fetch_and(value, order);
+        }
+
+        T                               FetchOr(T value, std::memory_order order)
+        {
+            return m_value.fetch_or(value, order);
+        }
+
+        //! Address of the value itself, for FutexWait() and FutexWake(). 
+        const void*                     GetAddress() const
+        {
+            return &m_value;
+        }
+    }; // class Atomic 
+
+    //! Block while address (an Atomic<uint32_t>) still holds expected. May return spuriously, callers 
+    //! check the value again. futex on Linux, WaitOnAddress on Windows, a yield elsewhere. 
+    void                                FutexWait(const Atomic<uint32_t>& address, uint32_t expected);
+
+    //! Wake one, or every thread blocked in FutexWait() on address. 
+    void                                FutexWake(const Atomic<uint32_t>& address, bool all);
+
+    //! Test and test-and-set lock for short critical sections. Waiters spin on a plain load (the line 
+    //! stays shared until the owner releases it) with an exponential pause backoff, then yield. 
+    //! Never sleeps in the kernel; use Mutex when the lock can be held long. 
+    class SpinLock : private NonCopyable
+    {
+    private:
+        Atomic<uint32_t>                m_locked;
+
+        void                            LockSlow();
+
+    public:
+        SpinLock()
+            : m_locked(0)
+        {
+        }
+
+        void                            Lock()
+        {
+            if (m_locked.Exchange(1, std::memory_order_acquire) != 0)
+            {
+                LockSlow();
+            }
+        }
+
+        bool                            TryLock()
+        {
+            return m_locked.Load(std::memory_order_relaxed) == 0 && m_locked.Exchange(1, std::memory_order_acquire) == 0;
+        }
+
+        void                            Unlock()
+        {
+            m_locked.Store(0, std::memory_order_release);
+        }
+
+        // BasicLockable, for std::lock_guard and std::unique_lock. 
+        void                            lock()      { Lock(); }
+        bool                            try_lock()  { return TryLock(); }
+        void                            unlock()    { Unlock(); }
+
+    }; // class SpinLock 
+
+    //! Four byte mutex: one CAS to lock and one exchange to unlock while uncontended, a short spin 
+    //! and then a sleep on FutexWait() under contention. Not recursive. 
+    class Mutex : private NonCopyable
+    {
+    private:
+        // 0 unlocked, 1 locked, 2 locked and maybe waited on (Unlock() must wake). 
+        Atomic<uint32_t>                m_state;
+
+        void                            LockSlow();
+
+    public:
+        Mutex()
+            : m_state(0)
+        {
+        }
+
+        void                            Lock()
+        {
+            uint32_t expected = 0;
+            if (!m_state.CompareExchange(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                LockSlow();
+            }
+        }
+
+        bool                            TryLock()
+        {
+            uint32_t expected = 0;
+            return m_state.CompareExchange(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+        }
+
+        void                            Unlock()
+        {
+            if (m_state.Exchange(0, std::memory_order_release) == 2)
+            {
+                FutexWake(m_state, false);
+            }
+        }
+
+        // BasicLockable, for std::lock_guard and std::unique_lock. 
+        void                            lock()      { Lock(); }
+        bool                            try_lock()  { return TryLock(); }
+        void                            unlock()    { Unlock(); }
+
+    }; // class Mutex 
+
+    //! Event on FutexWait(), like a Win32 event. An auto reset event lets one Wait() through per Set(), 
+    //! a manual reset event stays set and releases every waiter until Reset(). Set() only enters the 
+    //! kernel when a thread is blocked. 
+    class Event : private NonCopyable
+    {
+    private:
+        Atomic<uint32_t>                m_signaled;
+        Atomic<uint32_t>                m_waiterCount;
+        bool                            m_manualReset;
+
+        void                            WaitSlow();
+
+    public:
+        explicit Event(bool manualReset=false, bool signaled=false)
+            : m_signaled    (signaled ? 1 : 0)
+            , m_waiterCount (0)
+            , m_manualReset (manualReset)
+        {
+        }
+
+        void                            Set();
+
+        void                            Reset()
+        {
+            m_signaled.Store(0, std::memory_order_relaxed);
+        }
+
+        //! Returns without blocking when the event is set, consuming it when auto reset. 
+        bool                            TryWait()
+        {
+            if (m_manualReset)
+            {
+                return m_signaled.Load(std::memory_order_acquire) != 0;
+            }
+            uint32_t expected = 1;
+            return m_signaled.CompareExchange(expected, 0, std::memory_order_acquire, std::memory_order_relaxed);
+        }
+
+        void                            Wait()
+        {
+            if (!TryWait())
+            {
+                WaitSlow();
+            }
+        }
+
+        bool                            IsSet() const
+        {
+            return m_signaled.Load(std::memory_order_acquire) != 0;
+        }
+
+    }; // class Event 
+
     //! Memory allocator base class. 
     class Allocator
     {
@@ -107,6 +434,23 @@ namespace tf
         virtual void*                   Allocate(size_t size, size_t alignment=TF_DEFAULT_ALIGNMENT_SIZE)=0;
         virtual void                    Free(void* block)=0;
 
+        //! Resize a block, keeping its first min(oldSize, newSize) bytes. 
+        //! Returns the (possibly moved) block, or nullptr on failure, in which case the block is left untouched. 
+        //! alignment must be the one the block was allocated with. A null block allocates, a zero newSize frees. 
+        //! The default tries TryExpandInPlace() and then falls back to Allocate + memcpy + Free. 
+        virtual void*                   Reallocate(void* block, size_t oldSize, size_t newSize, size_t alignment=TF_DEFAULT_ALIGNMENT_SIZE);
+
+        //! Grow or shrink a block without moving it. Returns false if the block must move. 
+        //! The default only accepts shrinking, which keeps the block as it is. 
+        virtual bool                    TryExpandInPlace(void* block, size_t oldSize, size_t newSize);
+
+        //! Allocate count blocks of the same size into blocks[], one virtual call for the whole batch. 
+        //! Returns the number of blocks allocated, which is less than count only when out of memory. 
+        virtual size_t                  AllocateBatch(size_t count, size_t size, size_t alignment, void** blocks);
+
+        //! Free count blocks, null entries are skipped. 
+        virtual void                    FreeBatch(void** blocks, size_t count);
+
     }; // class Allocator 
 
 
@@ -114,10 +458,3626 @@ namespace tf
     //! Retrieve default allocator. 
     Allocator& DefaultAllocator();
 
-} // namespace tf 
+    //! Replace the process default allocator, returns the previous one. 
+    //! Call at startup before anything allocates from DefaultAllocator(); existing blocks are not migrated. 
+    Allocator& SetDefaultAllocator(Allocator& allocator);
 
-// Scope exit macro. 
-#define TF_SCOPE_EXIT(code) auto TF_CONCAT(scopeExit, __LINE__) = tf::MakeScopeExit([&](){code;})
+    //! Per-frame linear (bump-pointer) allocator. 
+    //! Keeps BUFFERING_COUNT regions. The region for a frame is reset in bulk by BeginFrame(), 
+    //! which must be called after SynchronizationObject::MoveToNextFrame() returned that frame index, 
+    //! i.e. once the GPU has finished with everything allocated during the previous use of the region. 
+    //! Free() is a no-op. Not thread safe. 
+    class FrameArenaAllocator : public Allocator, private NonCopyable
+    {
+    private:
+        struct OverflowBlock
+        {
+            OverflowBlock*              m_next;
+            size_t                      m_size;
+        }; // struct OverflowBlock 
+
+        struct Region
+        {
+            uint8_t*                    m_begin;
+            uint8_t*                    m_current;
+            uint8_t*                    m_limit;
+            size_t                      m_size;
+            size_t                      m_usedBytes;
+            OverflowBlock*              m_overflow;
+        }; // struct Region 
+
+        Allocator&                      m_backing;
+        Region                          m_regions[BUFFERING_COUNT];
+        int                             m_frameIndex;
+        size_t                          m_highWaterBytes;
+        uint32_t                        m_overflowCount;
+
+        void                            ResetRegion(Region& region);
+        void*                           AllocateOverflow(Region& region, size_t size, size_t alignment);
+
+    public:
+                 FrameArenaAllocator(size_t regionSize, Allocator& backing=DefaultAllocator());
+        virtual ~FrameArenaAllocator();
+
+        virtual void*                   Allocate(size_t size, size_t alignment=TF_DEFAULT_ALIGNMENT_SIZE) override;
+        virtual void                    Free(void* block) override;
+
+        //! Only the most recent allocation of the frame can grow or shrink in place. 
+        virtual bool                    TryExpandInPlace(void* block, size_t oldSize, size_t newSize) override;
+
+        //! Carves the whole batch with a single bump when it fits in the region. 
+        virtual size_t                  AllocateBatch(size_t count, size_t size, size_t alignment, void** blocks) override;
+        virtual void                    FreeBatch(void** blocks, size_t count) override;
+
+        void                            BeginFrame(int frameIndex);
+        void                            Reset();
+
+        int                             GetFrameIndex() const
+        {
+            return m_frameIndex;
+        }
+
+        size_t                          GetUsedBytes() const
+        {
+            return m_regions[m_frameIndex].m_usedBytes;
+        }
+
+        size_t                          GetRegionSize() const
+        {
+            return m_regions[m_frameIndex].m_size;
+        }
+
+        //! Largest amount of memory used by a single frame so far (including overflow). 
+        size_t                          GetHighWaterBytes() const;
+
+        //! Number of times a region ran out of space and chained an overflow block. 
+        uint32_t                        GetOverflowCount() const
+        {
+            return m_overflowCount;
+        }
+
+    }; // class FrameArenaAllocator 
+
+    //! Fixed-size block pool allocator. 
+    //! Blocks are kept in an intrusive free list, so Allocate()/Free() are O(1). The pool grows 
+    //! in page-sized chunks taken from the backing allocator and never returns them until Release(). 
+    //! Not thread safe. 
+    template<size_t BlockSize, size_t Alignment=TF_DEFAULT_ALIGNMENT_SIZE>
+    class PoolAllocator : public Allocator, private NonCopyable
+    {
+    public:
+        static const size_t kBlockSize      = TF_ALIGNMENT((BlockSize < sizeof(void*)) ? sizeof(void*) : BlockSize, Alignment);
+        static const size_t kPageSize       = 4096;
+
+    private:
+        struct FreeBlock
+        {
+            FreeBlock*                  m_next;
+        }; // struct FreeBlock 
+
+        struct Chunk
+        {
+            Chunk*                      m_next;
+            size_t                      m_blockCount;
+        }; // struct Chunk 
+
+        static const size_t kChunkHeaderSize = TF_ALIGNMENT(sizeof(Chunk), Alignment);
+
+        Allocator&                      m_backing;
+        FreeBlock*                      m_freeList;
+        Chunk*                          m_chunks;
+        size_t                          m_chunkSize;
+        size_t                          m_capacity;
+        size_t                          m_usedCount;
+
+        //! Chunk size actually used for a requested one: room for a block at least, whole pages. 
+        static size_t                   GetChunkSize(size_t chunkSize)
+        {
+            return TF_ALIGNMENT(((chunkSize < kChunkHeaderSize + kBlockSize) ? (kChunkHeaderSize + kBlockSize) : chunkSize), kPageSize);
+        }
+
+        uint8_t*                        GetFirstBlock(Chunk* chunk) const
+        {
+            return reinterpret_cast<uint8_t*>(chunk) + kChunkHeaderSize;
+        }
+
+        void                            PushChunkBlocks(Chunk* chunk)
+        {
+            uint8_t* block = GetFirstBlock(chunk);
+            for (size_t i = 0; i < chunk->m_blockCount; ++i)
+            {
+                FreeBlock* freeBlock = reinterpret_cast<FreeBlock*>(block + (chunk->m_blockCount - 1 - i) * kBlockSize);
+                freeBlock->m_next = m_freeList;
+                m_freeList = freeBlock;
+            }
+        }
+
+        bool                            Grow()
+        {
+            Chunk* chunk = static_cast<Chunk*>(m_backing.Allocate(m_chunkSize, (Alignment > TF_DEFAULT_ALIGNMENT_SIZE) ? Alignment : TF_DEFAULT_ALIGNMENT_SIZE));
+            if (chunk == nullptr)
+            {
+                return false;
+            }
+            chunk->m_next       = m_chunks;
+            chunk->m_blockCount = GetChunkBlockCount(m_chunkSize);
+            m_chunks            = chunk;
+            m_capacity         += chunk->m_blockCount;
+            PushChunkBlocks(chunk);
+            return true;
+        }
+
+    public:
+        PoolAllocator(size_t chunkSize=kPageSize, Allocator& backing=DefaultAllocator())
+            : m_backing     (backing)
+            , m_freeList    (nullptr)
+            , m_chunks      (nullptr)
+            , m_chunkSize   (GetChunkSize(chunkSize))
+            , m_capacity    (0)
+            , m_usedCount   (0)
+        {
+        }
+
+        virtual ~PoolAllocator()
+        {
+            Release();
+        }
+
+        virtual void*                   Allocate(size_t size, size_t alignment=TF_DEFAULT_ALIGNMENT_SIZE) override
+        {
+            assert(size <= kBlockSize && alignment <= Alignment);
+            if (TF_UNLIKELY(size > kBlockSize || alignment > Alignment))
+            {
+                return nullptr;
+            }
+            if (TF_UNLIKELY(m_freeList == nullptr) && !Grow())
+            {
+                return nullptr;
+            }
+            FreeBlock* block = m_freeList;
+            m_freeList = block->m_next;
+            m_usedCount++;
+            return block;
+        }
+
+        virtual void                    Free(void* block) override
+        {
+            if (block == nullptr)
+            {
+                return;
+            }
+            assert(m_usedCount > 0);
+            FreeBlock* freeBlock = static_cast<FreeBlock*>(block);
+            freeBlock->m_next = m_freeList;
+            m_freeList = freeBlock;
+            m_usedCount--;
+        }
+
+        virtual bool                    TryExpandInPlace(void* block, size_t oldSize, size_t newSize) override
+        {
+            TF_UNUSED(block);
+            TF_UNUSED(oldSize);
+            return newSize <= kBlockSize;
+        }
+
+        virtual size_t                  AllocateBatch(size_t count, size_t size, size_t alignment, void** blocks) override
+        {
+            assert(size <= kBlockSize && alignment <= Alignment);
+            if (TF_UNLIKELY(size > kBlockSize || alignment > Alignment))
+            {
+                return 0;
+            }
+            size_t allocated = 0;
+            for (; allocated < count; ++allocated)
+            {
+                if (TF_UNLIKELY(m_freeList == nullptr) && !Grow())
+                {
+                    break;
+                }
+                blocks[allocated] = m_freeList;
+                m_freeList = m_freeList->m_next;
+            }
+            m_usedCount += allocated;
+            return allocated;
+        }
+
+        virtual void                    FreeBatch(void** blocks, size_t count) override
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (blocks[i] == nullptr)
+                {
+                    continue;
+                }
+                assert(m_usedCount > 0);
+                FreeBlock* freeBlock = static_cast<FreeBlock*>(blocks[i]);
+                freeBlock->m_next = m_freeList;
+                m_freeList = freeBlock;
+                m_usedCount--;
+            }
+        }
+
+        //! Return every block to the pool at once, keeping the chunks. 
+        void                            Reset()
+        {
+            m_freeList  = nullptr;
+            m_usedCount = 0;
+            for (Chunk* chunk = m_chunks; chunk != nullptr; chunk = chunk->m_next)
+            {
+                PushChunkBlocks(chunk);
+            }
+        }
+
+        //! Return every chunk to the backing allocator. 
+        void                            Release()
+        {
+            while (m_chunks)
+            {
+                Chunk* next = m_chunks->m_next;
+                m_backing.Free(m_chunks);
+                m_chunks = next;
+            }
+            m_freeList  = nullptr;
+            m_capacity  = 0;
+            m_usedCount = 0;
+        }
+
+        size_t                          GetCapacity() const
+        {
+            return m_capacity;
+        }
+
+        size_t                          GetUsedCount() const
+        {
+            return m_usedCount;
+        }
+
+        //! Blocks carved from each chunk by a pool constructed with chunkSize. 
+        static size_t                   GetChunkBlockCount(size_t chunkSize=kPageSize)
+        {
+            return (GetChunkSize(chunkSize) - kChunkHeaderSize) / kBlockSize;
+        }
+
+    }; // class PoolAllocator 
+
+    //! Thread caching allocator front-end. 
+    //! Small requests are served from per-thread size-class magazines reached through TF_THREAD_LS, 
+    //! so the steady state never touches the wrapped allocator. A block freed by another thread is 
+    //! pushed to its owner's remote list, and the owner takes the whole list back in one batch on 
+    //! its next miss. A thread reaches its cache through one of kMaxInstanceCount thread local slots; 
+    //! instances sharing a slot find their cache again by a search of their per-thread caches. 
+    class ThreadCachingAllocator : public Allocator, private NonCopyable
+    {
+    public:
+        static const size_t kSizeClassCount     = 8;
+        static const size_t kMinClassSize       = 16;
+        static const size_t kMaxCachedSize      = kMinClassSize << (kSizeClassCount - 1);
+        static const size_t kMagazineCapacity   = 64;
+        static const size_t kMaxInstanceCount   = 8;
+
+        struct ThreadStatistics
+        {
+            uint64_t                    m_hitCount;
+            uint64_t                    m_missCount;
+            uint64_t                    m_remoteFreeCount;
+            size_t                      m_cachedBytes;
+        }; // struct ThreadStatistics 
+
+    private:
+        struct ThreadCache;
+
+        Allocator&                      m_backing;
+        uint64_t                        m_serial;
+        std::atomic<ThreadCache*>       m_threadCaches;
+
+        ThreadCache*                    GetThreadCache();
+        ThreadCache*                    FindThreadCache() const;
+        void                            ReleaseBlocks(ThreadCache& cache, size_t sizeClass, size_t count);
+        void                            ReclaimRemoteBlocks(ThreadCache& cache);
+
+    public:
+        explicit ThreadCachingAllocator(Allocator& backing=DefaultAllocator());
+        virtual ~ThreadCachingAllocator();
+
+        virtual void*                   Allocate(size_t size, size_t alignment=TF_DEFAULT_ALIGNMENT_SIZE) override;
+        virtual void                    Free(void* block) override;
+
+        //! Serves the batch from one magazine, the misses go to the wrapped allocator as one batch. 
+        virtual size_t                  AllocateBatch(size_t count, size_t size, size_t alignment, void** blocks) override;
+        virtual void                    FreeBatch(void** blocks, size_t count) override;
+
+        //! Return the calling thread's cached blocks to the wrapped allocator (call before a thread exits). 
+        void                            FlushThreadCache();
+
+        //! Statistics of the calling thread. 
+        ThreadStatistics                GetThreadStatistics() const;
+
+        //! Copy statistics of every thread that used this allocator, returns the number of threads. 
+        size_t                          CollectThreadStatistics(ThreadStatistics* statistics, size_t maxCount) const;
+
+    }; // class ThreadCachingAllocator 
+
+    //! Two-Level Segregated Fit allocator over a user-supplied memory block. 
+    //! Free blocks are binned by a two-level (power of two / linear subdivision) index with a bitmap 
+    //! per level, so Allocate() and Free() finish in a bounded number of steps whatever the heap state. 
+    //! The memory block is not owned. Not thread safe. 
+    class TlsfAllocator : public Allocator, private NonCopyable
+    {
+    public:
+        static const size_t kAlignSizeLog2      = 4;
+        static const size_t kAlignSize          = static_cast<size_t>(1) << kAlignSizeLog2;
+        static const size_t kSecondLevelLog2    = 5;
+        static const size_t kSecondLevelCount   = static_cast<size_t>(1) << kSecondLevelLog2;
+        static const size_t kFirstLevelMax      = 32;
+        static const size_t kFirstLevelShift    = kSecondLevelLog2 + kAlignSizeLog2;
+        static const size_t kFirstLevelCount    = kFirstLevelMax - kFirstLevelShift + 1;
+        static const size_t kSmallBlockSize     = static_cast<size_t>(1) << kFirstLevelShift;
+
+        struct Statistics
+        {
+            size_t                      m_totalBytes;
+            size_t                      m_usedBytes;
+            size_t                      m_freeBytes;
+            size_t                      m_largestFreeBlock;
+            size_t                      m_freeBlockCount;
+            size_t                      m_allocationCount;
+            float                       m_fragmentation;    //!< 1 - largest free block / free bytes.
+        }; // struct Statistics 
+
+    private:
+        struct BlockHeader;
+
+        BlockHeader*                    m_blocks[kFirstLevelCount][kSecondLevelCount];
+        uint32_t                        m_firstLevelBitmap;
+        uint32_t                        m_secondLevelBitmap[kFirstLevelCount];
+        BlockHeader*                    m_firstBlock;
+        size_t                          m_totalBytes;
+        size_t                          m_usedBytes;
+        size_t                          m_allocationCount;
+
+        void                            InsertFreeBlock(BlockHeader* block);
+        void                            RemoveFreeBlock(BlockHeader* block);
+        BlockHeader*                    FindFreeBlock(size_t size);
+        BlockHeader*                    SplitBlock(BlockHeader* block, size_t size);
+        BlockHeader*                    MergeBlock(BlockHeader* block);
+
+    public:
+                 TlsfAllocator(void* memory, size_t size);
+        virtual ~TlsfAllocator();
+
+        virtual void*                   Allocate(size_t size, size_t alignment=TF_DEFAULT_ALIGNMENT_SIZE) override;
+        virtual void                    Free(void* block) override;
+
+        //! Grows into the next physical block when it is free, shrinking gives the tail back. 
+        virtual bool                    TryExpandInPlace(void* block, size_t oldSize, size_t newSize) override;
+
+        size_t                          GetLargestFreeBlock() const;
+        Statistics                      GetStatistics() const;
+
+        //! Walk every physical block and check the heap invariants. 
+        bool                            Validate() const;
+
+    }; // class TlsfAllocator 
+
+    //! Virtual memory arena. 
+    //! Reserves a large address range once and commits pages on demand (mmap/mprotect on Linux, 
+    //! VirtualAlloc on Windows), so the arena grows in place without copying. Reset() rewinds the 
+    //! arena and decommits the pages above the decommit watermark. Free() is a no-op. Not thread safe. 
+    class VirtualArena : public Allocator, private NonCopyable
+    {
+    public:
+        static const size_t kCommitGranularity          = 64 * 1024;
+        static const size_t kHugePageSize               = 2 * 1024 * 1024;
+        static const size_t kDefaultDecommitWatermark   = 4 * 1024 * 1024;
+
+    private:
+        uint8_t*                        m_reservedBegin;
+        uint8_t*                        m_begin;
+        uint8_t*                        m_current;
+        uint8_t*                        m_committedEnd;
+        uint8_t*                        m_end;
+        size_t                          m_reservedBytes;
+        size_t                          m_decommitWatermark;
+        size_t                          m_commitGranularity;
+        size_t                          m_highWaterBytes;
+        bool                            m_useHugePages;
+
+        bool                            Commit(uint8_t* end);
+
+    public:
+        //! useHugePages asks for transparent huge pages on Linux; it is ignored on Windows, 
+        //! where large pages need a privilege and cannot be committed on demand. 
+                 VirtualArena(size_t reserveSize, size_t decommitWatermark=kDefaultDecommitWatermark, bool useHugePages=false);
+        virtual ~VirtualArena();
+
+        virtual void*                   Allocate(size_t size, size_t alignment=TF_DEFAULT_ALIGNMENT_SIZE) override;
+        virtual void                    Free(void* block) override;
+
+        //! Only the most recent allocation can grow or shrink in place, committing pages as needed. 
+        virtual bool                    TryExpandInPlace(void* block, size_t oldSize, size_t newSize) override;
+
+        //! Carves the whole batch with a single bump and commit. 
+        virtual size_t                  AllocateBatch(size_t count, size_t size, size_t alignment, void** blocks) override;
+        virtual void                    FreeBatch(void** blocks, size_t count) override;
+
+        void                            Reset();
+
+        uint8_t*                        GetBase() const
+        {
+            return m_begin;
+        }
+
+        size_t                          GetUsedBytes() const
+        {
+            return static_cast<size_t>(m_current - m_begin);
+        }
+
+        size_t                          GetCommittedBytes() const
+        {
+            return static_cast<size_t>(m_committedEnd - m_begin);
+        }
+
+        size_t                          GetReservedBytes() const
+        {
+            return static_cast<size_t>(m_end - m_begin);
+        }
+
+        size_t                          GetHighWaterBytes() const
+        {
+            return (GetUsedBytes() > m_highWaterBytes) ? GetUsedBytes() : m_highWaterBytes;
+        }
+
+        static size_t                   GetPageSize();
+
+    }; // class VirtualArena 
+
+    //! Size-class slab allocator, a general purpose replacement for the CRT heap. 
+    //! Small requests are served from kPageSize pages, each carved into blocks of one size class. 
+    //! Pages live in one reserved address range, so Free() finds the page metadata from the address 
+    //! alone and blocks carry no header. Each size class has its own cache-line aligned lock, empty 
+    //! pages are decommitted, and large requests go to the backing allocator. Thread safe. 
+    //! Can be installed as the process default with SetDefaultAllocator(). 
+    class SlabAllocator : public Allocator, private NonCopyable
+    {
+    public:
+        static const size_t kPageShift          = 16;
+        static const size_t kPageSize           = static_cast<size_t>(1) << kPageShift;
+        static const size_t kMaxSmallSize       = 8192;
+        static const size_t kSizeClassCount     = 32;
+        static const size_t kDefaultReserveSize = static_cast<size_t>(1024) * 1024 * 1024;
+
+    private:
+        struct Page;
+        struct PageHeap;
+        struct SizeClass;
+
+        Allocator&                      m_backing;
+        uint8_t*                        m_reservedBegin;
+        size_t                          m_reservedBytes;
+        uint8_t*                        m_base;
+        Page*                           m_pages;
+        size_t                          m_pageCount;
+        PageHeap*                       m_pageHeap;
+        SizeClass*                      m_sizeClasses;
+
+        void*                           AllocateBlock(size_t sizeClass);
+        void                            FreeBlock(Page* page, void* block);
+        Page*                           AcquirePage(size_t sizeClass);
+        void                            ReleasePage(Page* page);
+        Page*                           FindPage(const void* block) const;
+        uint8_t*                        GetPageAddress(const Page* page) const;
+        size_t                          GetAllocationClass(size_t size, size_t alignment) const;
+
+    public:
+        explicit SlabAllocator(size_t reserveSize=kDefaultReserveSize, Allocator& backing=DefaultAllocator());
+        virtual ~SlabAllocator();
+
+        virtual void*                   Allocate(size_t size, size_t alignment=TF_DEFAULT_ALIGNMENT_SIZE) override;
+        virtual void                    Free(void* block) override;
+
+        //! Any size up to the size class of the block fits in place. 
+        virtual bool                    TryExpandInPlace(void* block, size_t oldSize, size_t newSize) override;
+
+        //! Takes the size class lock once for the whole batch. 
+        virtual size_t                  AllocateBatch(size_t count, size_t size, size_t alignment, void** blocks) override;
+
+        //! Takes the size class lock once per run of blocks from the same class. 
+        virtual void                    FreeBatch(void** blocks, size_t count) override;
+
+        //! Block size of a size class, and the class serving a request of the given size. 
+        static size_t                   GetSizeClassSize(size_t sizeClass);
+        static size_t                   GetSizeClass(size_t size);
+
+        //! Usable size of a block from this allocator, 0 for blocks passed to the backing allocator. 
+        size_t                          GetBlockSize(const void* block) const;
+
+        //! Bytes held by live small blocks (rounded up to their size class). 
+        size_t                          GetUsedBytes() const;
+
+        //! Bytes of page memory currently committed. 
+        size_t                          GetCommittedBytes() const;
+
+        size_t                          GetReservedBytes() const
+        {
+            return m_pageCount * kPageSize;
+        }
+
+    }; // class SlabAllocator 
+
+    //! Handle based allocator whose blocks can be moved to compact the heap. 
+    //! Clients keep 32-bit handles (index + generation) and call Resolve() at the use site; a pointer 
+    //! stays valid until the next Defragment(). Blocks live in one buffer, holes are coalesced and 
+    //! reused lowest address first, and Defragment() moves the highest blocks down into the holes a 
+    //! bounded number of bytes per call, shrinking the footprint. Stale handles resolve to nullptr. 
+    //! Not thread safe. 
+    class RelocatableAllocator : private NonCopyable
+    {
+    public:
+        typedef uint32_t Handle;
+
+        static const Handle kInvalidHandle      = 0;
+        static const size_t kIndexBits          = 20;
+        static const size_t kMaxHandleCount     = static_cast<size_t>(1) << kIndexBits;
+        static const size_t kAlignment          = TF_DEFAULT_ALIGNMENT_SIZE;
+
+    private:
+        struct HandleEntry
+        {
+            size_t                      m_offset;       //!< Block offset from the buffer start.
+            uint32_t                    m_generation;
+            uint32_t                    m_nextFree;
+        }; // struct HandleEntry 
+
+        Allocator&                      m_backing;
+        uint8_t*                        m_buffer;
+        size_t                          m_capacity;
+        size_t                          m_top;
+        size_t                          m_lastBytes;    //!< Size of the block right below the top.
+        size_t                          m_holes;
+        size_t                          m_holeBytes;
+        size_t                          m_usedBytes;
+        size_t                          m_liveCount;
+        HandleEntry*                    m_handles;
+        size_t                          m_handleCount;
+        uint32_t                        m_freeHandle;
+
+        const HandleEntry*              FindEntry(Handle handle) const;
+        void                            InsertHole(size_t offset);
+        void                            RemoveHole(size_t offset);
+        size_t                          FindHole(size_t blockBytes, size_t limit) const;
+        void                            PlaceBlock(size_t holeOffset, size_t blockBytes);
+        void                            SetPrevBytes(size_t offset, size_t prevBytes);
+        void                            MakeHole(size_t offset);
+
+    public:
+                 RelocatableAllocator(size_t capacity, size_t maxHandleCount=4096, Allocator& backing=DefaultAllocator());
+                ~RelocatableAllocator();
+
+        //! Returns kInvalidHandle when there is no room (call Defragment() and retry) or no free handle. 
+        Handle                          Allocate(size_t size);
+        void                            Free(Handle handle);
+
+        //! Current address of the block, nullptr for a stale or invalid handle. 
+        void*                           Resolve(Handle handle) const;
+
+        template<typename T> T*         Resolve(Handle handle) const
+        {
+            return static_cast<T*>(Resolve(handle));
+        }
+
+        bool                            IsValid(Handle handle) const
+        {
+            return FindEntry(handle) != nullptr;
+        }
+
+        //! Usable size of the block (rounded up to kAlignment), 0 for a stale handle. 
+        size_t                          GetSize(Handle handle) const;
+
+        //! Move live blocks down into the holes, stopping once about maxBytes have been moved. 
+        //! Invalidates pointers returned by Resolve(). Returns the number of bytes moved. 
+        size_t                          Defragment(size_t maxBytes);
+
+        //! True when there are no holes below the top. 
+        bool                            IsCompact() const
+        {
+            return m_holeBytes == 0;
+        }
+
+        //! Bytes held by live blocks, including their headers. 
+        size_t                          GetUsedBytes() const
+        {
+            return m_usedBytes;
+        }
+
+        //! Bytes in holes below the top. 
+        size_t                          GetHoleBytes() const
+        {
+            return m_holeBytes;
+        }
+
+        //! Bytes from the start of the buffer to the end of the last block. 
+        size_t                          GetFootprintBytes() const
+        {
+            return m_top;
+        }
+
+        size_t                          GetCapacity() const
+        {
+            return m_capacity;
+        }
+
+        size_t                          GetLiveCount() const
+        {
+            return m_liveCount;
+        }
+
+    }; // class RelocatableAllocator 
+
+    //! Ring buffer mapped twice back to back, so a record never has to be split at the wrap point. 
+    //! The same physical pages appear at [data, data + capacity) and [data + capacity, data + 2 * capacity) 
+    //! (memfd_create + mmap on Linux, a pagefile section mapped twice on Windows). Records of any size 
+    //! up to the capacity are written and read with one contiguous memcpy. 
+    //! Producers use either the single producer (BeginWrite/Write) or the multi producer 
+    //! (BeginWriteConcurrent/WriteConcurrent) calls, never both at once; there is one consumer. 
+    class MirroredRingBuffer : private NonCopyable
+    {
+    public:
+        static const size_t kRecordAlignment    = 8;
+
+    private:
+        uint8_t*                        m_data;
+        size_t                          m_capacity;
+        intptr_t                        m_mapping;
+        TF_CACHELINE_ALIGNED std::atomic<uint64_t>  m_writeIndex;
+        TF_CACHELINE_ALIGNED std::atomic<uint64_t>  m_readIndex;
+
+        void*                           Reserve(uint64_t writeIndex, size_t size);
+
+    public:
+        //! capacity is rounded up to a power of two multiple of the system allocation granularity. 
+        explicit MirroredRingBuffer(size_t capacity);
+                ~MirroredRingBuffer();
+
+        bool                            IsValid() const
+        {
+            return m_data != nullptr;
+        }
+
+        size_t                          GetCapacity() const
+        {
+            return m_capacity;
+        }
+
+        //! Start of the first mapping, the second one follows at GetData() + GetCapacity(). 
+        uint8_t*                        GetData() const
+        {
+            return m_data;
+        }
+
+        //! Bytes reserved by producers and not yet consumed, record headers included. 
+        size_t                          GetUsedBytes() const
+        {
+            return static_cast<size_t>(m_writeIndex.load(std::memory_order_acquire) - m_readIndex.load(std::memory_order_acquire));
+        }
+
+        //! Reserve a record of size bytes and return its payload, nullptr when the ring is full. 
+        //! The record becomes visible to the consumer at EndWrite(). Single producer only. 
+        void*                           BeginWrite(size_t size);
+
+        //! As BeginWrite(), safe to call from any number of producer threads. 
+        void*                           BeginWriteConcurrent(size_t size);
+
+        //! Publish a record returned by BeginWrite() or BeginWriteConcurrent(). 
+        void                            EndWrite(void* payload);
+
+        bool                            Write(const void* data, size_t size);
+        bool                            WriteConcurrent(const void* data, size_t size);
+
+        //! Next published record, or nullptr when there is none (or the next one is still being written). 
+        const void*                     BeginRead(size_t& size);
+
+        //! Release the record returned by BeginRead(). 
+        void                            EndRead();
+
+    }; // class MirroredRingBuffer 
+
+    //! Hierarchical bitmap of free indices in [0, capacity), e.g. descriptor slots or entity IDs. 
+    //! Level 0 has a bit per index, set while the index is free. Bit i of level n + 1 is set while 
+    //! word i of level n has a free bit, up to a single root word, so finding a free index is one 
+    //! tzcnt per level and a search skips 64^n used indices per summary bit. Allocate() returns the 
+    //! lowest free index, AllocateRange() the lowest run of free indices (first fit). Not thread safe. 
+    class BitmapAllocator : private NonCopyable
+    {
+    public:
+        static const uint32_t           kInvalidIndex   = 0xffffffff;
+        static const uint32_t           kMaxLevelCount  = 6;
+
+    private:
+        Allocator&                      m_allocator;
+        uint64_t*                       m_levels[kMaxLevelCount];
+        uint32_t                        m_levelBitCounts[kMaxLevelCount];
+        uint32_t                        m_levelCount;
+        uint32_t                        m_capacity;
+        uint32_t                        m_usedCount;
+
+        void                            Propagate(uint32_t wordIndex, bool wasEmpty);
+        uint32_t                        FindNextFree(uint32_t level, uint32_t from) const;
+        uint32_t                        FindNextUsed(uint32_t from, uint32_t limit) const;
+        void                            MarkRange(uint32_t first, uint32_t count, bool free);
+
+    public:
+        explicit BitmapAllocator(uint32_t capacity=0, Allocator& allocator=DefaultAllocator());
+        ~BitmapAllocator();
+
+        //! Resize to capacity indices, all free. Returns false when out of memory. 
+        bool                            Reset(uint32_t capacity);
+
+        //! Lowest free index, kInvalidIndex when full. 
+        uint32_t                        Allocate();
+
+        //! First index of the lowest run of count free indices, kInvalidIndex if there is none. 
+        uint32_t                        AllocateRange(uint32_t count);
+
+        void                            Free(uint32_t index);
+        void                            FreeRange(uint32_t first, uint32_t count);
+
+        bool                            IsAllocated(uint32_t index) const
+        {
+            assert(index < m_capacity);
+            return (m_levels[0][index >> 6] & (1ull << (index & 63))) == 0;
+        }
+
+        uint32_t                        GetCapacity() const
+        {
+            return m_capacity;
+        }
+
+        uint32_t                        GetUsedCount() const
+        {
+            return m_usedCount;
+        }
+
+    }; // class BitmapAllocator 
+
+    //! Lock-free bitmap of free indices, any number of threads may allocate and free concurrently. 
+    //! Two levels: leaf words change with a CAS, and a summary bit per leaf word is kept as a hint that 
+    //! the word may have free bits. The summary can briefly lag a concurrent Free(), so before reporting 
+    //! failure the leaves are scanned once more. Ranges are limited to 64 indices within one leaf word. 
+    class AtomicBitmapAllocator : private NonCopyable
+    {
+    public:
+        static const uint32_t           kInvalidIndex   = 0xffffffff;
+        static const uint32_t           kMaxRangeCount  = 64;
+
+    private:
+        Allocator&                      m_allocator;
+        std::atomic<uint64_t>*          m_summary;
+        std::atomic<uint64_t>*          m_leaves;
+        uint32_t                        m_capacity;
+        uint32_t                        m_leafCount;
+        uint32_t                        m_summaryCount;
+        std::atomic<uint32_t>           m_usedCount;
+
+        uint32_t                        TryAllocate(uint32_t leafIndex, uint32_t count);
+
+    public:
+        explicit AtomicBitmapAllocator(uint32_t capacity, Allocator& allocator=DefaultAllocator());
+        ~AtomicBitmapAllocator();
+
+        uint32_t                        Allocate()
+        {
+            return AllocateRange(1);
+        }
+
+        //! First index of count (up to kMaxRangeCount) free indices in one leaf word, kInvalidIndex if none. 
+        uint32_t                        AllocateRange(uint32_t count);
+
+        void                            Free(uint32_t index)
+        {
+            FreeRange(index, 1);
+        }
+
+        void                            FreeRange(uint32_t first, uint32_t count);
+
+        bool                            IsAllocated(uint32_t index) const
+        {
+            assert(index < m_capacity);
+            return (m_leaves[index >> 6].load(std::memory_order_acquire) & (1ull << (index & 63))) == 0;
+        }
+
+        uint32_t                        GetCapacity() const
+        {
+            return m_capacity;
+        }
+
+        uint32_t                        GetUsedCount() const
+        {
+            return m_usedCount.load(std::memory_order_relaxed);
+        }
+
+    }; // class AtomicBitmapAllocator 
+
+    //! Memory tag, attributes allocations to a subsystem in TrackingAllocator statistics. 
+    typedef uint32_t MemoryTag;
+
+    static const MemoryTag  kMemoryTagDefault   = 0;
+    static const size_t     kMaxMemoryTagCount  = 32;
+
+    //! Register a tag name (the string must stay valid), returns kMemoryTagDefault when the table is full. 
+    MemoryTag               RegisterMemoryTag(const char* name);
+    const char*             GetMemoryTagName(MemoryTag tag);
+
+    //! Tag applied to the calling thread's allocations, returns the previous tag. 
+    MemoryTag               SetCurrentMemoryTag(MemoryTag tag);
+    MemoryTag               GetCurrentMemoryTag();
+
+    class MemoryTagScope : private NonCopyable
+    {
+    private:
+        MemoryTag                       m_previous;
+    public:
+        explicit MemoryTagScope(MemoryTag tag)
+            : m_previous(SetCurrentMemoryTag(tag))
+        {
+        }
+        ~MemoryTagScope()
+        {
+            SetCurrentMemoryTag(m_previous);
+        }
+    }; // class MemoryTagScope 
+
+    //! Allocation tracking decorator. 
+    //! Each allocation is attributed to the current memory tag (see TF_MEMORY_TAG_SCOPE) and counted 
+    //! in per-thread counters that only their owner thread writes, so tracking takes no lock. 
+    //! Live and peak bytes, allocations per frame and a size histogram are aggregated on request. 
+    //! Peak bytes follow a shared live byte count per tag, so a spike freed within a frame still counts. 
+    //! With TF_MEMORY_TRACKING disabled it only forwards; hand out GetAllocator() to skip it entirely. 
+    class TrackingAllocator : public Allocator, private NonCopyable
+    {
+    public:
+        static const size_t kHistogramBucketCount = 16;
+
+        struct TagStatistics
+        {
+            int64_t                     m_liveBytes;
+            int64_t                     m_peakBytes;
+            int64_t                     m_liveCount;
+            uint64_t                    m_allocationCount;
+            uint64_t                    m_frameAllocationCount;     //!< Allocations during the last frame.
+            uint64_t                    m_frameAllocatedBytes;      //!< Bytes allocated during the last frame.
+        }; // struct TagStatistics 
+
+    private:
+        Allocator&                      m_backing;
+#if TF_MEMORY_TRACKING
+        struct ThreadCounters;
+
+        uint64_t                        m_serial;
+        std::atomic<ThreadCounters*>    m_threadCounters;
+        std::atomic<int64_t>            m_liveBytes[kMaxMemoryTagCount];
+        std::atomic<int64_t>            m_peakBytes[kMaxMemoryTagCount];
+        uint64_t                        m_frameBeginAllocationCount[kMaxMemoryTagCount];
+        uint64_t                        m_frameBeginAllocatedBytes[kMaxMemoryTagCount];
+        uint64_t                        m_frameAllocationCount[kMaxMemoryTagCount];
+        uint64_t                        m_frameAllocatedBytes[kMaxMemoryTagCount];
+
+        ThreadCounters*                 GetThreadCounters();
+        void                            SumTagCounters(MemoryTag tag, uint64_t counters[4]) const;
+#endif // TF_MEMORY_TRACKING 
+
+    public:
+        explicit TrackingAllocator(Allocator& backing=DefaultAllocator());
+        virtual ~TrackingAllocator();
+
+        virtual void*                   Allocate(size_t size, size_t alignment=TF_DEFAULT_ALIGNMENT_SIZE) override;
+        virtual void                    Free(void* block) override;
+
+        void*                           AllocateTagged(MemoryTag tag, size_t size, size_t alignment=TF_DEFAULT_ALIGNMENT_SIZE);
+
+        //! The allocator to hand to tracked code: this decorator, or with TF_MEMORY_TRACKING disabled 
+        //! the backing allocator itself, so the disabled configuration adds no call. 
+        Allocator&                      GetAllocator()
+        {
+#if TF_MEMORY_TRACKING
+            return *this;
+#else
+            return m_backing;
+#endif // TF_MEMORY_TRACKING 
+        }
+
+        //! Close the current frame: sample per-frame allocation rates. 
+        void                            NextFrame();
+
+        TagStatistics                   GetTagStatistics(MemoryTag tag) const;
+
+        //! Bucket i counts allocations up to GetHistogramBucketLimit(i) bytes, the last bucket is open ended. 
+        void                            GetSizeHistogram(uint64_t histogram[kHistogramBucketCount]) const;
+
+        static size_t                   GetHistogramBucketLimit(size_t bucket)
+        {
+            return static_cast<size_t>(16) << bucket;
+        }
+
+    }; // class TrackingAllocator 
+
+    //! Sampling heap profiler decorator. 
+    //! Captures the call stack of roughly one allocation per samplingInterval bytes. The distance 
+    //! between samples is drawn from an exponential distribution (a Poisson process over allocated 
+    //! bytes), and each sample is weighted by size / (1 - exp(-size / interval)), so the totals are 
+    //! unbiased estimates. Every thread counts the distance down per instance, so instances with 
+    //! different intervals do not disturb each other. Only the sampled path takes a lock. Profiles 
+    //! are written as folded stacks (flame graph input) or in the gperftools heap profile text 
+    //! format that pprof reads. 
+    class SamplingAllocator : public Allocator, private NonCopyable
+    {
+    public:
+        static const size_t kMaxStackDepth              = 32;
+        static const size_t kDefaultSamplingInterval    = 512 * 1024;
+
+    private:
+        struct SampleTable;
+        struct ThreadSampler;
+
+        Allocator&                      m_backing;
+        SampleTable*                    m_samples;
+        size_t                          m_samplingInterval;
+        uint64_t                        m_serial;
+        std::atomic<ThreadSampler*>     m_threadSamplers;
+
+        ThreadSampler*                  GetThreadSampler();
+        void*                           AllocateSampled(size_t size, size_t alignment);
+
+    public:
+        explicit SamplingAllocator(Allocator& backing=DefaultAllocator(), size_t samplingInterval=kDefaultSamplingInterval);
+        virtual ~SamplingAllocator();
+
+        virtual void*                   Allocate(size_t size, size_t alignment=TF_DEFAULT_ALIGNMENT_SIZE) override;
+        virtual void                    Free(void* block) override;
+
+        size_t                          GetSamplingInterval() const
+        {
+            return m_samplingInterval;
+        }
+
+        //! Number of samples taken, and how many of them are still allocated. 
+        size_t                          GetSampleCount() const;
+        size_t                          GetLiveSampleCount() const;
+
+        //! Estimated bytes currently allocated, from the live samples. 
+        uint64_t                        GetEstimatedLiveBytes() const;
+
+        //! Write "frame;frame;... bytes" lines, outermost frame first. 
+        bool                            WriteFoldedStacks(const char* path, bool liveOnly=true) const;
+
+        //! Write a gperftools heap profile ("heap_v2") that pprof can read. 
+        bool                            WriteHeapProfile(const char* path) const;
+
+    }; // class SamplingAllocator 
+
+    //! Aligned heap allocation policy for StaticAllocator. 
+    struct HeapAllocatorPolicy
+    {
+        TF_FORCE_INLINE void*           Allocate(size_t size, size_t alignment)
+        {
+#if defined(TF_PLATFORM_WINDOWS)
+            return _aligned_malloc(size, alignment);
+#else
+            void* block = nullptr;
+            return (posix_memalign(&block, (alignment < sizeof(void*)) ? sizeof(void*) : alignment, size) == 0) ? block : nullptr;
+#endif
+        }
+
+        TF_FORCE_INLINE void            Free(void* block)
+        {
+#if defined(TF_PLATFORM_WINDOWS)
+            _aligned_free(block);
+#else
+            free(block);
+#endif
+        }
+    }; // struct HeapAllocatorPolicy 
+
+    //! Owns a concrete tf::Allocator and calls it without going through the vtable. 
+    //! Allocators defined in this header (e.g. PoolAllocator) inline completely. 
+    template<typename AllocatorType>
+    class ConcreteAllocatorPolicy
+    {
+    private:
+        AllocatorType                   m_allocator;
+
+    public:
+        template<typename... Args>
+        explicit ConcreteAllocatorPolicy(Args&&... args)
+            : m_allocator   (std::forward<Args>(args)...)
+        {
+        }
+
+        TF_FORCE_INLINE void*           Allocate(size_t size, size_t alignment)
+        {
+            return m_allocator.AllocatorType::Allocate(size, alignment);
+        }
+
+        TF_FORCE_INLINE void            Free(void* block)
+        {
+            m_allocator.AllocatorType::Free(block);
+        }
+
+        AllocatorType&                  GetAllocator()
+        {
+            return m_allocator;
+        }
+    }; // class ConcreteAllocatorPolicy 
+
+    //! Forwards to any tf::Allocator through the vtable, for code that only knows the interface. 
+    class VirtualAllocatorPolicy
+    {
+    private:
+        Allocator*                      m_allocator;
+
+    public:
+        explicit VirtualAllocatorPolicy(Allocator& allocator=DefaultAllocator())
+            : m_allocator   (&allocator)
+        {
+        }
+
+        TF_FORCE_INLINE void*           Allocate(size_t size, size_t alignment)
+        {
+            return m_allocator->Allocate(size, alignment);
+        }
+
+        TF_FORCE_INLINE void            Free(void* block)
+        {
+            m_allocator->Free(block);
+        }
+
+        Allocator&                      GetAllocator()
+        {
+            return *m_allocator;
+        }
+    }; // class VirtualAllocatorPolicy 
+
+    //! Allocator held by type. 
+    //! Policy provides non-virtual Allocate(size, alignment) and Free(block); the calls are resolved at 
+    //! compile time and inlined into the caller. Use StaticAllocatorAdapter where a tf::Allocator& is needed. 
+    template<typename Policy>
+    class StaticAllocator : private NonCopyable
+    {
+    private:
+        Policy                          m_policy;
+
+    public:
+        template<typename... Args>
+        explicit StaticAllocator(Args&&... args)
+            : m_policy      (std::forward<Args>(args)...)
+        {
+        }
+
+        TF_FORCE_INLINE void*           Allocate(size_t size, size_t alignment=TF_DEFAULT_ALIGNMENT_SIZE)
+        {
+            assert((alignment & (alignment - 1)) == 0); // alignment must be power of two.
+            return m_policy.Allocate(size, alignment);
+        }
+
+        TF_FORCE_INLINE void            Free(void* block)
+        {
+            m_policy.Free(block);
+        }
+
+        Policy&                         GetPolicy()
+        {
+            return m_policy;
+        }
+    }; // class StaticAllocator 
+
+    //! Exposes a StaticAllocator through the virtual tf::Allocator interface. 
+    template<typename Policy>
+    class StaticAllocatorAdapter : public Allocator, private NonCopyable
+    {
+    private:
+        StaticAllocator<Policy>         m_allocator;
+
+    public:
+        template<typename... Args>
+        explicit StaticAllocatorAdapter(Args&&... args)
+            : m_allocator   (std::forward<Args>(args)...)
+        {
+        }
+
+        virtual ~StaticAllocatorAdapter()
+        {
+        }
+
+        virtual void*                   Allocate(size_t size, size_t alignment=TF_DEFAULT_ALIGNMENT_SIZE) override
+        {
+            return m_allocator.Allocate(size, alignment);
+        }
+
+        virtual void                    Free(void* block) override
+        {
+            m_allocator.Free(block);
+        }
+
+        StaticAllocator<Policy>&        GetStaticAllocator()
+        {
+            return m_allocator;
+        }
+    }; // class StaticAllocatorAdapter 
+
+    //! Standard library allocator over a tf::Allocator, e.g. std::vector<int, tf::StlAllocator<int> >. 
+    //! Copies and rebinds share the wrapped allocator, which must outlive the container. 
+    //! Throws std::bad_alloc on failure as the standard containers expect. 
+    template<typename T>
+    class StlAllocator
+    {
+    private:
+        template<typename U> friend class StlAllocator;
+
+        Allocator*                      m_allocator;
+
+    public:
+        typedef T                       value_type;
+        typedef std::false_type         propagate_on_container_copy_assignment;
+        typedef std::true_type          propagate_on_container_move_assignment;
+        typedef std::true_type          propagate_on_container_swap;
+
+        StlAllocator(Allocator& allocator=DefaultAllocator()) noexcept
+            : m_allocator   (&allocator)
+        {
+        }
+
+        template<typename U>
+        StlAllocator(const StlAllocator<U>& other) noexcept
+            : m_allocator   (other.m_allocator)
+        {
+        }
+
+        T*                              allocate(size_t count)
+        {
+            static const size_t kAlignment = (alignof(T) > TF_DEFAULT_ALIGNMENT_SIZE) ? alignof(T) : TF_DEFAULT_ALIGNMENT_SIZE;
+            if (count > static_cast<size_t>(-1) / sizeof(T))
+            {
+                throw std::bad_alloc();
+            }
+            void* block = m_allocator->Allocate(count * sizeof(T), kAlignment);
+            if (block == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            return static_cast<T*>(block);
+        }
+
+        void                            deallocate(T* block, size_t count) noexcept
+        {
+            TF_UNUSED(count);
+            m_allocator->Free(block);
+        }
+
+        Allocator&                      GetAllocator() const
+        {
+            return *m_allocator;
+        }
+
+        template<typename U>
+        bool                            operator==(const StlAllocator<U>& other) const noexcept
+        {
+            return m_allocator == other.m_allocator;
+        }
+
+        template<typename U>
+        bool                            operator!=(const StlAllocator<U>& other) const noexcept
+        {
+            return m_allocator != other.m_allocator;
+        }
+    }; // class StlAllocator 
+
+#if defined(TF_HAS_MEMORY_RESOURCE)
+    //! std::pmr::memory_resource over a tf::Allocator, for std::pmr containers. 
+    //! Two resources compare equal when they wrap the same allocator. 
+    class MemoryResource : public std::pmr::memory_resource, private NonCopyable
+    {
+    private:
+        Allocator&                      m_allocator;
+
+    protected:
+        virtual void*                   do_allocate(size_t bytes, size_t alignment) override
+        {
+            void* block = m_allocator.Allocate(bytes, (alignment > TF_DEFAULT_ALIGNMENT_SIZE) ? alignment : TF_DEFAULT_ALIGNMENT_SIZE);
+            if (block == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            return block;
+        }
+
+        virtual void                    do_deallocate(void* block, size_t bytes, size_t alignment) override
+        {
+            TF_UNUSED(bytes);
+            TF_UNUSED(alignment);
+            m_allocator.Free(block);
+        }
+
+        virtual bool                    do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+        {
+            const MemoryResource* resource = dynamic_cast<const MemoryResource*>(&other);
+            return (resource != nullptr) && (&resource->m_allocator == &m_allocator);
+        }
+
+    public:
+        explicit MemoryResource(Allocator& allocator=DefaultAllocator())
+            : m_allocator   (allocator)
+        {
+        }
+
+        virtual ~MemoryResource()
+        {
+        }
+
+        Allocator&                      GetAllocator() const
+        {
+            return m_allocator;
+        }
+    }; // class MemoryResource 
+#endif // TF_HAS_MEMORY_RESOURCE 
+
+    //! Elements of a trivially relocatable type can be moved to new memory with memcpy, the source is 
+    //! then treated as raw memory (no destructor call). Specialize for types with owning pointers that 
+    //! do not point into themselves, e.g. template<> struct IsTriviallyRelocatable<MyHandle> : std::true_type {}; 
+    template<typename T>
+    struct IsTriviallyRelocatable : std::integral_constant<bool, std::is_trivially_copyable<T>::value>
+    {
+    }; // struct IsTriviallyRelocatable 
+
+    //! Inline element storage of tf::Vector. 
+    template<typename T, size_t InlineCapacity>
+    struct VectorInlineStorage
+    {
+        alignas(T) unsigned char        m_bytes[sizeof(T) * InlineCapacity];
+
+        T*                              GetData()
+        {
+            return reinterpret_cast<T*>(m_bytes);
+        }
+
+        const T*                        GetData() const
+        {
+            return reinterpret_cast<const T*>(m_bytes);
+        }
+    }; // struct VectorInlineStorage 
+
+    template<typename T>
+    struct VectorInlineStorage<T, 0>
+    {
+        T*                              GetData() const
+        {
+            return nullptr;
+        }
+    }; // struct VectorInlineStorage 
+
+    //! Dynamic array over a tf::Allocator with room for InlineCapacity elements inside the object. 
+    //! Nothing is allocated until the inline storage overflows. Growth relocates trivially relocatable 
+    //! elements with memcpy and first asks the allocator to resize the block (Allocator::Reallocate), 
+    //! so a block that can expand in place is not copied at all. 
+    //! The interface follows std::vector. Running out of memory while growing is fatal; use reserve() 
+    //! up front to handle it. The allocator must outlive the vector. Not thread safe. 
+    template<typename T, size_t InlineCapacity=0>
+    class Vector
+    {
+    public:
+        typedef T                       value_type;
+        typedef size_t                  size_type;
+        typedef ptrdiff_t               difference_type;
+        typedef T&                      reference;
+        typedef const T&                const_reference;
+        typedef T*                      pointer;
+        typedef const T*                const_pointer;
+        typedef T*                      iterator;
+        typedef const T*                const_iterator;
+
+        static const size_t kInlineCapacity = InlineCapacity;
+
+    private:
+        static const size_t kAlignment  = (alignof(T) > TF_DEFAULT_ALIGNMENT_SIZE) ? alignof(T) : TF_DEFAULT_ALIGNMENT_SIZE;
+
+        T*                              m_data;
+        size_t                          m_size;
+        size_t                          m_capacity;
+        Allocator*                      m_allocator;
+        VectorInlineStorage<T, InlineCapacity> m_inline;
+
+        static void                     Relocate(T* dest, T* source, size_t count)
+        {
+            if (IsTriviallyRelocatable<T>::value)
+            {
+                if (count > 0)
+                {
+                    memcpy(static_cast<void*>(dest), static_cast<const void*>(source), count * sizeof(T));
+                }
+                return;
+            }
+            for (size_t i = 0; i < count; ++i)
+            {
+                new (dest + i) T(std::move(source[i]));
+                source[i].~T();
+            }
+        }
+
+        static void                     Destroy(T* first, T* last)
+        {
+            if (!std::is_trivially_destructible<T>::value)
+            {
+                for (; first != last; ++first)
+                {
+                    first->~T();
+                }
+            }
+        }
+
+        //! Move the elements to a buffer of newCapacity (>= size) elements. 
+        bool                            SetCapacity(size_t newCapacity)
+        {
+            assert(newCapacity >= m_size);
+            if (newCapacity <= InlineCapacity)
+            {
+                if (!IsInline())
+                {
+                    T* data = m_inline.GetData();
+                    if (InlineCapacity > 0)
+                    {
+                        Relocate(data, m_data, m_size);
+                    }
+                    m_allocator->Free(m_data);
+                    m_data = data;
+                    m_capacity = InlineCapacity;
+                }
+                return true;
+            }
+            if (newCapacity > static_cast<size_t>(-1) / sizeof(T))
+            {
+                return false;
+            }
+            if (IsTriviallyRelocatable<T>::value && !IsInline())
+            {
+                void* block = m_allocator->Reallocate(m_data, m_capacity * sizeof(T), newCapacity * sizeof(T), kAlignment);
+                if (block == nullptr)
+                {
+                    return false;
+                }
+                m_data = static_cast<T*>(block);
+                m_capacity = newCapacity;
+                return true;
+            }
+            T* data = static_cast<T*>(m_allocator->Allocate(newCapacity * sizeof(T), kAlignment));
+            if (data == nullptr)
+            {
+                return false;
+            }
+            Relocate(data, m_data, m_size);
+            if (!IsInline())
+            {
+                m_allocator->Free(m_data);
+            }
+            m_data = data;
+            m_capacity = newCapacity;
+            return true;
+        }
+
+        //! Make room for count more elements, growing by half the capacity at least. 
+        void                            Grow(size_t count)
+        {
+            size_t newCapacity = m_capacity + m_capacity / 2;
+            newCapacity = (newCapacity < m_size + count) ? m_size + count : newCapacity;
+            newCapacity = (newCapacity < 4) ? 4 : newCapacity;
+            if (!SetCapacity(newCapacity))
+            {
+                assert(!"tf::Vector: out of memory.");
+                TF_PLATFORM_DEBUG_BREAK();
+            }
+        }
+
+        //! Take the elements of other, which is left empty. 
+        void                            Steal(Vector& other)
+        {
+            m_allocator = other.m_allocator;
+            if (other.IsInline())
+            {
+                m_data = m_inline.GetData();
+                m_capacity = InlineCapacity;
+                Relocate(m_data, other.m_data, other.m_size);
+            }
+            else
+            {
+                m_data = other.m_data;
+                m_capacity = other.m_capacity;
+                other.m_data = other.m_inline.GetData();
+                other.m_capacity = InlineCapacity;
+            }
+            m_size = other.m_size;
+            other.m_size = 0;
+        }
+
+        void                            Release()
+        {
+            clear();
+            if (!IsInline())
+            {
+                m_allocator->Free(m_data);
+                m_data = m_inline.GetData();
+                m_capacity = InlineCapacity;
+            }
+        }
+
+    public:
+        explicit Vector(Allocator& allocator=DefaultAllocator())
+            : m_data        (nullptr)
+            , m_size        (0)
+            , m_capacity    (InlineCapacity)
+            , m_allocator   (&allocator)
+        {
+            m_data = m_inline.GetData();
+        }
+
+        explicit Vector(size_t count, Allocator& allocator=DefaultAllocator())
+            : Vector(allocator)
+        {
+            resize(count);
+        }
+
+        Vector(size_t count, const T& value, Allocator& allocator=DefaultAllocator())
+            : Vector(allocator)
+        {
+            resize(count, value);
+        }
+
+        Vector(std::initializer_list<T> values, Allocator& allocator=DefaultAllocator())
+            : Vector(allocator)
+        {
+            if (values.size() > m_capacity)
+            {
+                Grow(values.size());
+            }
+            for (const T& value : values)
+            {
+                new (m_data + m_size) T(value);
+                m_size++;
+            }
+        }
+
+        Vector(const Vector& other)
+            : Vector(other, *other.m_allocator)
+        {
+        }
+
+        Vector(const Vector& other, Allocator& allocator)
+            : Vector(allocator)
+        {
+            if (other.m_size > m_capacity)
+            {
+                Grow(other.m_size);
+            }
+            for (size_t i = 0; i < other.m_size; ++i)
+            {
+                new (m_data + i) T(other.m_data[i]);
+            }
+            m_size = other.m_size;
+        }
+
+        Vector(Vector&& other) noexcept
+            : Vector(*other.m_allocator)
+        {
+            Steal(other);
+        }
+
+        ~Vector()
+        {
+            Release();
+        }
+
+        //! Copies keep the allocator of this vector. 
+        Vector&                         operator=(const Vector& other)
+        {
+            if (this != &other)
+            {
+                clear();
+                if (other.m_size > m_capacity)
+                {
+                    Grow(other.m_size);
+                }
+                for (size_t i = 0; i < other.m_size; ++i)
+                {
+                    new (m_data + i) T(other.m_data[i]);
+                }
+                m_size = other.m_size;
+            }
+            return *this;
+        }
+
+        //! Moves take the allocator of other along with its block. 
+        Vector&                         operator=(Vector&& other) noexcept
+        {
+            if (this != &other)
+            {
+                Release();
+                Steal(other);
+            }
+            return *this;
+        }
+
+        Allocator&                      GetAllocator() const
+        {
+            return *m_allocator;
+        }
+
+        //! True while the elements live in the inline storage (or nowhere yet), i.e. no block is allocated. 
+        bool                            IsInline() const
+        {
+            return m_data == m_inline.GetData();
+        }
+
+        iterator                        begin()             { return m_data; }
+        const_iterator                  begin() const       { return m_data; }
+        iterator                        end()               { return m_data + m_size; }
+        const_iterator                  end() const         { return m_data + m_size; }
+        T*                              data()              { return m_data; }
+        const T*                        data() const        { return m_data; }
+        size_t                          size() const        { return m_size; }
+        size_t                          capacity() const    { return m_capacity; }
+        bool                            empty() const       { return m_size == 0; }
+
+        T&                              operator[](size_t index)
+        {
+            assert(index < m_size);
+            return m_data[index];
+        }
+
+        const T&                        operator[](size_t index) const
+        {
+            assert(index < m_size);
+            return m_data[index];
+        }
+
+        T&                              front()             { assert(m_size > 0); return m_data[0]; }
+        const T&                        front() const       { assert(m_size > 0); return m_data[0]; }
+        T&                              back()              { assert(m_size > 0); return m_data[m_size - 1]; }
+        const T&                        back() const        { assert(m_size > 0); return m_data[m_size - 1]; }
+
+        //! Returns false when out of memory, the vector is left unchanged. 
+        bool                            reserve(size_t count)
+        {
+            return (count <= m_capacity) || SetCapacity(count);
+        }
+
+        //! Back to the inline storage when the elements fit, otherwise to a block of exactly size() elements. 
+        void                            shrink_to_fit()
+        {
+            if (m_capacity > m_size && !IsInline())
+            {
+                SetCapacity(m_size);
+            }
+        }
+
+        void                            clear()
+        {
+            Destroy(m_data, m_data + m_size);
+            m_size = 0;
+        }
+
+        void                            resize(size_t count)
+        {
+            if (count > m_capacity)
+            {
+                Grow(count - m_size);
+            }
+            for (size_t i = m_size; i < count; ++i)
+            {
+                new (m_data + i) T();
+            }
+            Destroy(m_data + ((count < m_size) ? count : m_size), m_data + m_size);
+            m_size = count;
+        }
+
+        void                            resize(size_t count, const T& value)
+        {
+            if (count > m_capacity)
+            {
+                const T copy(value); // value may live in this vector.
+                Grow(count - m_size);
+                for (size_t i = m_size; i < count; ++i)
+                {
+                    new (m_data + i) T(copy);
+                }
+            }
+            else
+            {
+                for (size_t i = m_size; i < count; ++i)
+                {
+                    new (m_data + i) T(value);
+                }
+            }
+            Destroy(m_data + ((count < m_size) ? count : m_size), m_data + m_size);
+            m_size = count;
+        }
+
+        //! Resize without constructing the new elements, for trivial types filled right after. 
+        void                            resize_uninitialized(size_t count)
+        {
+            static_assert(std::is_trivial<T>::value, "resize_uninitialized needs a trivial type.");
+            if (count > m_capacity)
+            {
+                Grow(count - m_size);
+            }
+            m_size = count;
+        }
+
+        template<typename... Args>
+        T&                              emplace_back(Args&&... args)
+        {
+            if (TF_UNLIKELY(m_size == m_capacity))
+            {
+                // args may refer to elements of this vector, so construct the value before growing. 
+                typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+                T* value = new (&storage) T(std::forward<Args>(args)...);
+                Grow(1);
+                Relocate(m_data + m_size, value, 1);
+            }
+            else
+            {
+                new (m_data + m_size) T(std::forward<Args>(args)...);
+            }
+            return m_data[m_size++];
+        }
+
+        //! Append an element without constructing it, for trivial types written right after. 
+        T&                              emplace_back_uninitialized()
+        {
+            static_assert(std::is_trivial<T>::value, "emplace_back_uninitialized needs a trivial type.");
+            if (TF_UNLIKELY(m_size == m_capacity))
+            {
+                Grow(1);
+            }
+            return m_data[m_size++];
+        }
+
+        void                            push_back(const T& value)
+        {
+            emplace_back(value);
+        }
+
+        void                            push_back(T&& value)
+        {
+            emplace_back(std::move(value));
+        }
+
+        void                            pop_back()
+        {
+            assert(m_size > 0);
+            m_data[--m_size].~T();
+        }
+
+        template<typename... Args>
+        iterator                        emplace(const_iterator position, Args&&... args)
+        {
+            assert(position >= m_data && position <= m_data + m_size);
+            const size_t index = static_cast<size_t>(position - m_data);
+            if (index == m_size)
+            {
+                emplace_back(std::forward<Args>(args)...);
+                return m_data + index;
+            }
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+            T* value = new (&storage) T(std::forward<Args>(args)...);
+            if (m_size == m_capacity)
+            {
+                Grow(1);
+            }
+            T* slot = m_data + index;
+            if (IsTriviallyRelocatable<T>::value)
+            {
+                memmove(static_cast<void*>(slot + 1), static_cast<const void*>(slot), (m_size - index) * sizeof(T));
+                Relocate(slot, value, 1);
+            }
+            else
+            {
+                new (m_data + m_size) T(std::move(m_data[m_size - 1]));
+                for (T* element = m_data + m_size - 1; element != slot; --element)
+                {
+                    *element = std::move(*(element - 1));
+                }
+                *slot = std::move(*value);
+                value->~T();
+            }
+            m_size++;
+            return slot;
+        }
+
+        iterator                        insert(const_iterator position, const T& value)
+        {
+            return emplace(position, value);
+        }
+
+        iterator                        insert(const_iterator position, T&& value)
+        {
+            return emplace(position, std::move(value));
+        }
+
+        iterator                        erase(const_iterator first, const_iterator last)
+        {
+            assert(first >= m_data && first <= last && last <= m_data + m_size);
+            T* dest = const_cast<T*>(first);
+            T* source = const_cast<T*>(last);
+            const size_t count = static_cast<size_t>(source - dest);
+            if (count == 0)
+            {
+                return dest;
+            }
+            if (IsTriviallyRelocatable<T>::value)
+            {
+                Destroy(dest, source);
+                memmove(static_cast<void*>(dest), static_cast<const void*>(source), (m_data + m_size - source) * sizeof(T));
+            }
+            else
+            {
+                T* end = m_data + m_size;
+                for (T* element = dest; source != end; ++element, ++source)
+                {
+                    *element = std::move(*source);
+                }
+                Destroy(end - count, end);
+            }
+            m_size -= count;
+            return dest;
+        }
+
+        iterator                        erase(const_iterator position)
+        {
+            return erase(position, position + 1);
+        }
+
+        //! Erase by moving the last element into the hole, O(1) but does not keep the order. 
+        void                            erase_unordered(const_iterator position)
+        {
+            assert(position >= m_data && position < m_data + m_size);
+            T* element = const_cast<T*>(position);
+            T* last = m_data + m_size - 1;
+            if (element != last)
+            {
+                *element = std::move(*last);
+            }
+            last->~T();
+            m_size--;
+        }
+
+        void                            swap(Vector& other) noexcept
+        {
+            Vector temp(std::move(other));
+            other = std::move(*this);
+            *this = std::move(temp);
+        }
+    }; // class Vector 
+
+    //! Byte string hash (64-bit FNV-1a). 
+    size_t HashBytes(const void* data, size_t size);
+
+    //! Transparent string hash and equality, e.g. FlatHashMap<std::string, T, StringHash, StringEqual> 
+    //! can be searched with a const char* without building a std::string. 
+    struct StringHash
+    {
+        typedef void is_transparent;
+
+        size_t                          operator()(const char* string) const
+        {
+            return HashBytes(string, strlen(string));
+        }
+
+        size_t                          operator()(const std::string& string) const
+        {
+            return HashBytes(string.data(), string.size());
+        }
+    }; // struct StringHash 
+
+    struct StringEqual
+    {
+        typedef void is_transparent;
+
+        bool                            operator()(const std::string& a, const std::string& b) const
+        {
+            return a == b;
+        }
+
+        bool                            operator()(const std::string& a, const char* b) const
+        {
+            return a == b;
+        }
+
+        bool                            operator()(const char* a, const std::string& b) const
+        {
+            return b == a;
+        }
+    }; // struct StringEqual 
+
+    //! 16 control bytes of FlatHashMap, compared at once with SSE2 or NEON. 
+    //! A control byte is kEmpty, kDeleted, kSentinel (end of the table) or the 7-bit hash tag of a full slot. 
+    //! Match masks have one bit per slot at (slot << kShift). 
+    class HashMapGroup
+    {
+    public:
+        static const size_t             kWidth      = 16;
+        static const int8_t             kEmpty      = -128;
+        static const int8_t             kDeleted    = -2;
+        static const int8_t             kSentinel   = -1;
+#if defined(TF_SIMD_NEON)
+        static const uint32_t           kShift      = 2;
+#else
+        static const uint32_t           kShift      = 0;
+#endif
+
+    private:
+#if defined(TF_SIMD_SSE2)
+        __m128i                         m_control;
+#elif defined(TF_SIMD_NEON)
+        int8x16_t                       m_control;
+
+        static uint64_t                 ToMask(uint8x16_t match)
+        {
+            const uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(match), 4);
+            return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0) & 0x8888888888888888ull;
+        }
+#else
+        const int8_t*                   m_control;
+#endif
+
+    public:
+        explicit HashMapGroup(const int8_t* control)
+#if defined(TF_SIMD_SSE2)
+            : m_control     (_mm_loadu_si128(reinterpret_cast<const __m128i*>(control)))
+#elif defined(TF_SIMD_NEON)
+            : m_control     (vld1q_s8(control))
+#else
+            : m_control     (control)
+#endif
+        {
+        }
+
+        //! Slots whose control byte equals tag. 
+        TF_FORCE_INLINE uint64_t        Match(int8_t tag) const
+        {
+#if defined(TF_SIMD_SSE2)
+            return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(m_control, _mm_set1_epi8(tag))));
+#elif defined(TF_SIMD_NEON)
+            return ToMask(vceqq_s8(m_control, vdupq_n_s8(tag)));
+#else
+            uint64_t mask = 0;
+            for (size_t i = 0; i < kWidth; ++i)
+            {
+                mask |= static_cast<uint64_t>(m_control[i] == tag) << i;
+            }
+            return mask;
+#endif
+        }
+
+        TF_FORCE_INLINE uint64_t        MatchEmpty() const
+        {
+            return Match(kEmpty);
+        }
+
+        //! Empty and deleted are the only control values below kSentinel. 
+        TF_FORCE_INLINE uint64_t        MatchEmptyOrDeleted() const
+        {
+#if defined(TF_SIMD_SSE2)
+            return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(kSentinel), m_control)));
+#elif defined(TF_SIMD_NEON)
+            return ToMask(vcltq_s8(m_control, vdupq_n_s8(kSentinel)));
+#else
+            uint64_t mask = 0;
+            for (size_t i = 0; i < kWidth; ++i)
+            {
+                mask |= static_cast<uint64_t>(m_control[i] < kSentinel) << i;
+            }
+            return mask;
+#endif
+        }
+
+        static TF_FORCE_INLINE size_t   LowestSlot(uint64_t mask)
+        {
+            return CountTrailingZeros(mask) >> kShift;
+        }
+    }; // class HashMapGroup 
+
+    //! Open addressing hash map in the Swiss table layout. 
+    //! One block from a tf::Allocator holds a control byte per slot followed by the slots themselves, 
+    //! so a lookup touches the control bytes of one group (16 slots compared with a single SIMD 
+    //! compare on the 7-bit hash tag) and usually a single slot. No per-element allocation. 
+    //! Capacity is a power of two minus one and the map grows at 7/8 load. Erase leaves a tombstone; when 
+    //! tombstones rather than elements fill the table it is rehashed in place instead of growing. 
+    //! When Hash and Equal both define is_transparent, find/count/contains/erase accept any key type 
+    //! they support (heterogeneous lookup). Iterators and references are invalidated by inserts that 
+    //! rehash. Running out of memory on insert is fatal; use reserve() up front to handle it. Not thread safe. 
+    template<typename Key, typename Value, typename Hash=std::hash<Key>, typename Equal=std::equal_to<Key> >
+    class FlatHashMap
+    {
+    public:
+        typedef Key                     key_type;
+        typedef Value                   mapped_type;
+        typedef std::pair<const Key, Value> value_type;
+        typedef size_t                  size_type;
+
+        template<typename Slot>
+        class Iterator
+        {
+        private:
+            friend class FlatHashMap;
+
+            const int8_t*               m_control;
+            Slot*                       m_slot;
+
+            void                        SkipEmpty()
+            {
+                // Stops at a full slot or at the sentinel, control[capacity]. 
+                while (*m_control < HashMapGroup::kSentinel)
+                {
+                    ++m_control;
+                    ++m_slot;
+                }
+            }
+
+        public:
+            Iterator(const int8_t* control, Slot* slot)
+                : m_control     (control)
+                , m_slot        (slot)
+            {
+            }
+
+            template<typename Other>
+            Iterator(const Iterator<Other>& other)
+                : m_control     (other.m_control)
+                , m_slot        (other.m_slot)
+            {
+            }
+
+            Slot&                       operator*() const   { return *m_slot; }
+            Slot*                       operator->() const  { return m_slot; }
+
+            Iterator&                   operator++()
+            {
+                ++m_control;
+                ++m_slot;
+                SkipEmpty();
+                return *this;
+            }
+
+            template<typename Other>
+            bool                        operator==(const Iterator<Other>& other) const { return m_slot == other.m_slot; }
+            template<typename Other>
+            bool                        operator!=(const Iterator<Other>& other) const { return m_slot != other.m_slot; }
+
+            template<typename> friend class Iterator;
+        }; // class Iterator 
+
+        typedef Iterator<value_type>    iterator;
+        typedef Iterator<const value_type> const_iterator;
+
+    private:
+        static const size_t             kWidth      = HashMapGroup::kWidth;
+        static const size_t             kAlignment  = (alignof(value_type) > TF_DEFAULT_ALIGNMENT_SIZE) ? alignof(value_type) : TF_DEFAULT_ALIGNMENT_SIZE;
+
+        int8_t*                         m_control;
+        value_type*                     m_slots;
+        size_t                          m_capacity;
+        size_t                          m_size;
+        size_t                          m_growthLeft;
+        Allocator*                      m_allocator;
+        Hash                            m_hash;
+        Equal                           m_equal;
+
+        static int8_t*                  GetEmptyControl()
+        {
+            // Shared by all empty maps so that begin() == end() without a branch. 
+            static const int8_t s_control[1] = { HashMapGroup::kSentinel };
+            return const_cast<int8_t*>(s_control);
+        }
+
+        static size_t                   GetMaxLoad(size_t capacity)
+        {
+            return capacity - capacity / 8;
+        }
+
+        //! A control byte per slot, the sentinel and a copy of the first kWidth - 1 bytes. 
+        static size_t                   GetControlBytes(size_t capacity)
+        {
+            return TF_ALIGNMENT(capacity + kWidth, kAlignment);
+        }
+
+        // Spread the bits of the user hash, std::hash of integers is the identity. 
+        template<typename K>
+        uint64_t                        HashOf(const K& key) const
+        {
+            uint64_t hash = static_cast<uint64_t>(m_hash(key));
+            hash ^= hash >> 33;
+            hash *= 0xff51afd7ed558ccdull;
+            hash ^= hash >> 33;
+            return hash;
+        }
+
+        static int8_t                   GetTag(uint64_t hash)
+        {
+            return static_cast<int8_t>(hash & 0x7f);
+        }
+
+        void                            SetControl(size_t index, int8_t control)
+        {
+            m_control[index] = control;
+            // Mirror the first bytes after the sentinel, so a group load never wraps. 
+            if (index < kWidth - 1)
+            {
+                m_control[m_capacity + 1 + index] = control;
+            }
+        }
+
+        template<typename K>
+        size_t                          FindIndex(const K& key, uint64_t hash) const
+        {
+            if (m_capacity == 0)
+            {
+                return m_capacity;
+            }
+            const size_t mask = m_capacity;
+            const int8_t tag = GetTag(hash);
+            size_t position = static_cast<size_t>(hash >> 7) & mask;
+            for (size_t step = kWidth; ; step += kWidth)
+            {
+                const HashMapGroup group(m_control + position);
+                for (uint64_t match = group.Match(tag); match != 0; match &= match - 1)
+                {
+                    const size_t index = (position + HashMapGroup::LowestSlot(match)) & mask;
+                    if (TF_LIKELY(m_equal(m_slots[index].first, key)))
+                    {
+                        return index;
+                    }
+                }
+                if (TF_LIKELY(group.MatchEmpty() != 0))
+                {
+                    return m_capacity;
+                }
+                position = (position + step) & mask;
+            }
+        }
+
+        //! First empty or deleted slot on the probe sequence of hash. 
+        size_t                          FindInsertIndex(uint64_t hash) const
+        {
+            const size_t mask = m_capacity;
+            size_t position = static_cast<size_t>(hash >> 7) & mask;
+            for (size_t step = kWidth; ; step += kWidth)
+            {
+                const uint64_t match = HashMapGroup(m_control + position).MatchEmptyOrDeleted();
+                if (match != 0)
+                {
+                    return (position + HashMapGroup::LowestSlot(match)) & mask;
+                }
+                position = (position + step) & mask;
+            }
+        }
+
+        static void                     Relocate(value_type* dest, value_type* source)
+        {
+            if (IsTriviallyRelocatable<Key>::value && IsTriviallyRelocatable<Value>::value)
+            {
+                memcpy(static_cast<void*>(dest), static_cast<const void*>(source), sizeof(value_type));
+                return;
+            }
+            new (dest) value_type(std::move(const_cast<Key&>(source->first)), std::move(source->second));
+            source->~value_type();
+        }
+
+        //! Move every element into a new table of newCapacity slots, dropping the tombstones. 
+        bool                            Rehash(size_t newCapacity)
+        {
+            assert(newCapacity >= kWidth - 1 && ((newCapacity + 1) & newCapacity) == 0);
+            assert(m_size <= GetMaxLoad(newCapacity));
+            const size_t controlBytes = GetControlBytes(newCapacity);
+            if (newCapacity > (static_cast<size_t>(-1) - controlBytes) / sizeof(value_type))
+            {
+                return false;
+            }
+            uint8_t* block = static_cast<uint8_t*>(m_allocator->Allocate(controlBytes + newCapacity * sizeof(value_type), kAlignment));
+            if (block == nullptr)
+            {
+                return false;
+            }
+
+            int8_t* oldControl = m_control;
+            value_type* oldSlots = m_slots;
+            const size_t oldCapacity = m_capacity;
+
+            m_control = reinterpret_cast<int8_t*>(block);
+            m_slots = reinterpret_cast<value_type*>(block + controlBytes);
+            m_capacity = newCapacity;
+            memset(m_control, static_cast<uint8_t>(HashMapGroup::kEmpty), newCapacity + kWidth);
+            m_control[newCapacity] = HashMapGroup::kSentinel;
+
+            for (size_t i = 0; i < oldCapacity; ++i)
+            {
+                if (oldControl[i] >= 0)
+                {
+                    const uint64_t hash = HashOf(oldSlots[i].first);
+                    const size_t index = FindInsertIndex(hash);
+                    SetControl(index, GetTag(hash));
+                    Relocate(m_slots + index, oldSlots + i);
+                }
+            }
+            m_growthLeft = GetMaxLoad(newCapacity) - m_size;
+            if (oldCapacity > 0)
+            {
+                m_allocator->Free(oldControl);
+            }
+            return true;
+        }
+
+        //! Slot count that holds count elements below the maximum load. 
+        static size_t                   GetCapacityFor(size_t count)
+        {
+            size_t capacity = kWidth - 1;
+            while (GetMaxLoad(capacity) < count)
+            {
+                capacity = capacity * 2 + 1;
+            }
+            return capacity;
+        }
+
+        template<typename K, typename... Args>
+        std::pair<iterator, bool>       TryEmplace(K&& key, Args&&... args)
+        {
+            const uint64_t hash = HashOf(key);
+            size_t index = FindIndex(key, hash);
+            if (index != m_capacity)
+            {
+                return std::make_pair(iterator(m_control + index, m_slots + index), false);
+            }
+            if (m_capacity == 0)
+            {
+                if (!Rehash(kWidth - 1))
+                {
+                    assert(!"tf::FlatHashMap: out of memory.");
+                    TF_PLATFORM_DEBUG_BREAK();
+                }
+            }
+            index = FindInsertIndex(hash);
+            if (TF_UNLIKELY(m_growthLeft == 0 && m_control[index] == HashMapGroup::kEmpty))
+            {
+                // Enough tombstones among the used slots: clean up in place, otherwise double. 
+                const size_t newCapacity = (m_size * 32 <= m_capacity * 25) ? m_capacity : m_capacity * 2 + 1;
+                if (!Rehash(newCapacity))
+                {
+                    assert(!"tf::FlatHashMap: out of memory.");
+                    TF_PLATFORM_DEBUG_BREAK();
+                }
+                index = FindInsertIndex(hash);
+            }
+            if (m_control[index] == HashMapGroup::kEmpty)
+            {
+                m_growthLeft--;
+            }
+            new (m_slots + index) value_type(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+            SetControl(index, GetTag(hash));
+            m_size++;
+            return std::make_pair(iterator(m_control + index, m_slots + index), true);
+        }
+
+        void                            EraseIndex(size_t index)
+        {
+            m_slots[index].~value_type();
+            SetControl(index, HashMapGroup::kDeleted);
+            m_size--;
+        }
+
+        void                            Release()
+        {
+            clear();
+            if (m_capacity > 0)
+            {
+                m_allocator->Free(m_control);
+            }
+            m_control = GetEmptyControl();
+            m_slots = nullptr;
+            m_capacity = 0;
+            m_growthLeft = 0;
+        }
+
+        void                            Steal(FlatHashMap& other)
+        {
+            m_control = other.m_control;
+            m_slots = other.m_slots;
+            m_capacity = other.m_capacity;
+            m_size = other.m_size;
+            m_growthLeft = other.m_growthLeft;
+            m_allocator = other.m_allocator;
+            m_hash = std::move(other.m_hash);
+            m_equal = std::move(other.m_equal);
+            other.m_control = GetEmptyControl();
+            other.m_slots = nullptr;
+            other.m_capacity = 0;
+            other.m_size = 0;
+            other.m_growthLeft = 0;
+        }
+
+    public:
+        explicit FlatHashMap(Allocator& allocator=DefaultAllocator(), const Hash& hash=Hash(), const Equal& equal=Equal())
+            : m_control     (GetEmptyControl())
+            , m_slots       (nullptr)
+            , m_capacity    (0)
+            , m_size        (0)
+            , m_growthLeft  (0)
+            , m_allocator   (&allocator)
+            , m_hash        (hash)
+            , m_equal       (equal)
+        {
+        }
+
+        FlatHashMap(const FlatHashMap& other)
+            : FlatHashMap(*other.m_allocator, other.m_hash, other.m_equal)
+        {
+            *this = other;
+        }
+
+        FlatHashMap(FlatHashMap&& other) noexcept
+            : FlatHashMap(*other.m_allocator)
+        {
+            Steal(other);
+        }
+
+        ~FlatHashMap()
+        {
+            Release();
+        }
+
+        //! Copies keep the allocator of this map. 
+        FlatHashMap&                    operator=(const FlatHashMap& other)
+        {
+            if (this != &other)
+            {
+                clear();
+                reserve(other.m_size);
+                for (const value_type& value : other)
+                {
+                    TryEmplace(value.first, value.second);
+                }
+            }
+            return *this;
+        }
+
+        //! Moves take the allocator of other along with its table. 
+        FlatHashMap&                    operator=(FlatHashMap&& other) noexcept
+        {
+            if (this != &other)
+            {
+                Release();
+                Steal(other);
+            }
+            return *this;
+        }
+
+        Allocator&                      GetAllocator() const
+        {
+            return *m_allocator;
+        }
+
+        iterator                        begin()
+        {
+            iterator it(m_control, m_slots);
+            it.SkipEmpty();
+            return it;
+        }
+
+        const_iterator                  begin() const
+        {
+            const_iterator it(m_control, m_slots);
+            it.SkipEmpty();
+            return it;
+        }
+
+        iterator                        end()               { return iterator(m_control + m_capacity, m_slots + m_capacity); }
+        const_iterator                  end() const         { return const_iterator(m_control + m_capacity, m_slots + m_capacity); }
+        size_t                          size() const        { return m_size; }
+        size_t                          capacity() const    { return m_capacity; }
+        bool                            empty() const       { return m_size == 0; }
+
+        //! Make room for count elements, returns false when out of memory (the map is left unchanged). 
+        bool                            reserve(size_t count)
+        {
+            if (count <= m_size + m_growthLeft)
+            {
+                return true;
+            }
+            const size_t capacity = GetCapacityFor(count);
+            return (capacity <= m_capacity) ? Rehash(m_capacity) : Rehash(capacity);
+        }
+
+        //! Destroy the elements, the table keeps its capacity. 
+        void                            clear()
+        {
+            if (m_capacity == 0)
+            {
+                return;
+            }
+            if (!std::is_trivially_destructible<value_type>::value)
+            {
+                for (size_t i = 0; i < m_capacity; ++i)
+                {
+                    if (m_control[i] >= 0)
+                    {
+                        m_slots[i].~value_type();
+                    }
+                }
+            }
+            memset(m_control, static_cast<uint8_t>(HashMapGroup::kEmpty), m_capacity + kWidth);
+            m_control[m_capacity] = HashMapGroup::kSentinel;
+            m_size = 0;
+            m_growthLeft = GetMaxLoad(m_capacity);
+        }
+
+        iterator                        find(const Key& key)
+        {
+            const size_t index = FindIndex(key, HashOf(key));
+            return iterator(m_control + index, m_slots + index);
+        }
+
+        const_iterator                  find(const Key& key) const
+        {
+            const size_t index = FindIndex(key, HashOf(key));
+            return const_iterator(m_control + index, m_slots + index);
+        }
+
+        template<typename K, typename H=Hash, typename E=Equal, typename=typename H::is_transparent, typename=typename E::is_transparent>
+        iterator                        find(const K& key)
+        {
+            const size_t index = FindIndex(key, HashOf(key));
+            return iterator(m_control + index, m_slots + index);
+        }
+
+        template<typename K, typename H=Hash, typename E=Equal, typename=typename H::is_transparent, typename=typename E::is_transparent>
+        const_iterator                  find(const K& key) const
+        {
+            const size_t index = FindIndex(key, HashOf(key));
+            return const_iterator(m_control + index, m_slots + index);
+        }
+
+        bool                            contains(const Key& key) const
+        {
+            return FindIndex(key, HashOf(key)) != m_capacity;
+        }
+
+        template<typename K, typename H=Hash, typename E=Equal, typename=typename H::is_transparent, typename=typename E::is_transparent>
+        bool                            contains(const K& key) const
+        {
+            return FindIndex(key, HashOf(key)) != m_capacity;
+        }
+
+        size_t                          count(const Key& key) const
+        {
+            return contains(key) ? 1 : 0;
+        }
+
+        template<typename K, typename H=Hash, typename E=Equal, typename=typename H::is_transparent, typename=typename E::is_transparent>
+        size_t                          count(const K& key) const
+        {
+            return contains(key) ? 1 : 0;
+        }
+
+        //! Insert Value(args...) unless key is present; never constructs a value for a present key. 
+        template<typename... Args>
+        std::pair<iterator, bool>       try_emplace(const Key& key, Args&&... args)
+        {
+            return TryEmplace(key, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        std::pair<iterator, bool>       try_emplace(Key&& key, Args&&... args)
+        {
+            return TryEmplace(std::move(key), std::forward<Args>(args)...);
+        }
+
+        std::pair<iterator, bool>       insert(const value_type& value)
+        {
+            return TryEmplace(value.first, value.second);
+        }
+
+        Value&                          operator[](const Key& key)
+        {
+            return TryEmplace(key).first->second;
+        }
+
+        Value&                          operator[](Key&& key)
+        {
+            return TryEmplace(std::move(key)).first->second;
+        }
+
+        //! Returns the iterator following position. 
+        iterator                        erase(const_iterator position)
+        {
+            assert(position.m_slot >= m_slots && position.m_slot < m_slots + m_capacity);
+            const size_t index = static_cast<size_t>(position.m_slot - m_slots);
+            EraseIndex(index);
+            iterator next(m_control + index, m_slots + index);
+            next.SkipEmpty();
+            return next;
+        }
+
+        // Without it the heterogeneous erase(const K&) is the better match for an iterator. 
+        iterator                        erase(iterator position)
+        {
+            return erase(const_iterator(position));
+        }
+
+        size_t                          erase(const Key& key)
+        {
+            const size_t index = FindIndex(key, HashOf(key));
+            if (index == m_capacity)
+            {
+                return 0;
+            }
+            EraseIndex(index);
+            return 1;
+        }
+
+        template<typename K, typename H=Hash, typename E=Equal, typename=typename H::is_transparent, typename=typename E::is_transparent>
+        size_t                          erase(const K& key)
+        {
+            const size_t index = FindIndex(key, HashOf(key));
+            if (index == m_capacity)
+            {
+                return 0;
+            }
+            EraseIndex(index);
+            return 1;
+        }
+    }; // class FlatHashMap 
+
+    //! 32-bit handle to an element of a SlotMap<T>: the slot index in the low kIndexBits bits and the 
+    //! slot generation above them. Generations start at one, so the default (zero) handle is invalid. 
+    template<typename T>
+    struct SlotHandle
+    {
+        static const uint32_t           kIndexBits      = 20;
+        static const uint32_t           kIndexMask      = (1u << kIndexBits) - 1;
+        static const uint32_t           kGenerationMask = (1u << (32 - kIndexBits)) - 1;
+
+        uint32_t                        m_value;
+
+        SlotHandle()
+            : m_value       (0)
+        {
+        }
+
+        SlotHandle(uint32_t index, uint32_t generation)
+            : m_value       (index | (generation << kIndexBits))
+        {
+            assert(index <= kIndexMask && generation <= kGenerationMask);
+        }
+
+        bool                            IsValid() const
+        {
+            return m_value != 0;
+        }
+
+        uint32_t                        GetIndex() const
+        {
+            return m_value & kIndexMask;
+        }
+
+        uint32_t                        GetGeneration() const
+        {
+            return m_value >> kIndexBits;
+        }
+
+        bool                            operator==(const SlotHandle& other) const
+        {
+            return m_value == other.m_value;
+        }
+
+        bool                            operator!=(const SlotHandle& other) const
+        {
+            return m_value != other.m_value;
+        }
+    }; // struct SlotHandle 
+
+    //! Generational slot map. 
+    //! Elements are stored densely (no holes) in insertion order until an erase moves the last element 
+    //! into the erased one's place, so iterating begin()..end() walks live elements linearly. A sparse 
+    //! slot array maps handles to dense indices; erasing bumps the generation of the slot, so every 
+    //! handle to it stops resolving (Get() returns nullptr) instead of aliasing the next occupant. 
+    //! Freed slots are reused in FIFO order to spread generations. Insert, erase and lookup are O(1). 
+    //! Pointers to elements are invalidated by Insert and Erase, handles only by erasing their element. 
+    //! Holds at most 2^kIndexBits slots. Not thread safe. 
+    template<typename T>
+    class SlotMap : private NonCopyable
+    {
+    public:
+        typedef SlotHandle<T>           Handle;
+
+    private:
+        static const uint32_t           kNone   = 0xffffffff;
+
+        //! m_denseIndex links the free list while the slot is free. 
+        struct Slot
+        {
+            uint32_t                    m_denseIndex;
+            uint32_t                    m_generation;
+        }; // struct Slot 
+
+        Vector<T>                       m_values;
+        Vector<uint32_t>                m_denseSlots;
+        Vector<Slot>                    m_slots;
+        uint32_t                        m_freeHead;
+        uint32_t                        m_freeTail;
+
+        const Slot*                     FindSlot(Handle handle) const
+        {
+            const uint32_t index = handle.GetIndex();
+            if (index >= m_slots.size() || m_slots[index].m_generation != handle.GetGeneration())
+            {
+                return nullptr;
+            }
+            // A generation that wrapped around can match a free slot, only an occupied one resolves. 
+            const uint32_t denseIndex = m_slots[index].m_denseIndex;
+            if (denseIndex >= m_denseSlots.size() || m_denseSlots[denseIndex] != index)
+            {
+                return nullptr;
+            }
+            return &m_slots[index];
+        }
+
+        void                            ReleaseSlot(uint32_t index)
+        {
+            Slot& slot = m_slots[index];
+            slot.m_generation = (slot.m_generation + 1) & Handle::kGenerationMask;
+            slot.m_generation = (slot.m_generation == 0) ? 1 : slot.m_generation;
+            slot.m_denseIndex = kNone;
+            if (m_freeTail == kNone)
+            {
+                m_freeHead = index;
+            }
+            else
+            {
+                m_slots[m_freeTail].m_denseIndex = index;
+            }
+            m_freeTail = index;
+        }
+
+    public:
+        explicit SlotMap(Allocator& allocator=DefaultAllocator())
+            : m_values      (allocator)
+            , m_denseSlots  (allocator)
+            , m_slots       (allocator)
+            , m_freeHead    (kNone)
+            , m_freeTail    (kNone)
+        {
+        }
+
+        //! Returns an invalid handle when all slots are in use. 
+        template<typename... Args>
+        Handle                          Emplace(Args&&... args)
+        {
+            uint32_t index = m_freeHead;
+            if (index == kNone)
+            {
+                if (m_slots.size() > Handle::kIndexMask)
+                {
+                    assert(!"tf::SlotMap: out of slots.");
+                    return Handle();
+                }
+                index = static_cast<uint32_t>(m_slots.size());
+                Slot& slot = m_slots.emplace_back_uninitialized();
+                slot.m_generation = 1;
+            }
+            else
+            {
+                m_freeHead = m_slots[index].m_denseIndex;
+                m_freeTail = (m_freeHead == kNone) ? kNone : m_freeTail;
+            }
+            m_values.emplace_back(std::forward<Args>(args)...);
+            m_denseSlots.push_back(index);
+
+            Slot& slot = m_slots[index];
+            slot.m_denseIndex = static_cast<uint32_t>(m_values.size() - 1);
+            return Handle(index, slot.m_generation);
+        }
+
+        Handle                          Insert(const T& value)
+        {
+            return Emplace(value);
+        }
+
+        Handle                          Insert(T&& value)
+        {
+            return Emplace(std::move(value));
+        }
+
+        //! Returns false for a stale or invalid handle. 
+        bool                            Erase(Handle handle)
+        {
+            const Slot* slot = FindSlot(handle);
+            if (slot == nullptr)
+            {
+                return false;
+            }
+            const uint32_t denseIndex = slot->m_denseIndex;
+            const uint32_t lastIndex = static_cast<uint32_t>(m_values.size() - 1);
+            if (denseIndex != lastIndex)
+            {
+                m_values[denseIndex] = std::move(m_values[lastIndex]);
+                m_denseSlots[denseIndex] = m_denseSlots[lastIndex];
+                m_slots[m_denseSlots[denseIndex]].m_denseIndex = denseIndex;
+            }
+            m_values.pop_back();
+            m_denseSlots.pop_back();
+            ReleaseSlot(handle.GetIndex());
+            return true;
+        }
+
+        //! nullptr for a stale or invalid handle. 
+        T*                              Get(Handle handle)
+        {
+            const Slot* slot = FindSlot(handle);
+            return (slot != nullptr) ? &m_values[slot->m_denseIndex] : nullptr;
+        }
+
+        const T*                        Get(Handle handle) const
+        {
+            const Slot* slot = FindSlot(handle);
+            return (slot != nullptr) ? &m_values[slot->m_denseIndex] : nullptr;
+        }
+
+        bool                            Contains(Handle handle) const
+        {
+            return FindSlot(handle) != nullptr;
+        }
+
+        //! Handle of the element at denseIndex in begin()..end(). 
+        Handle                          GetHandle(size_t denseIndex) const
+        {
+            const uint32_t index = m_denseSlots[denseIndex];
+            return Handle(index, m_slots[index].m_generation);
+        }
+
+        //! Erase every element, all handles stop resolving. 
+        void                            Clear()
+        {
+            for (uint32_t index : m_denseSlots)
+            {
+                ReleaseSlot(index);
+            }
+            m_values.clear();
+            m_denseSlots.clear();
+        }
+
+        //! Make room for count elements, returns false when out of memory. 
+        bool                            Reserve(size_t count)
+        {
+            return m_values.reserve(count) && m_denseSlots.reserve(count) && m_slots.reserve(count);
+        }
+
+        T*                              begin()             { return m_values.begin(); }
+        const T*                        begin() const       { return m_values.begin(); }
+        T*                              end()               { return m_values.end(); }
+        const T*                        end() const         { return m_values.end(); }
+
+        T*                              GetData()           { return m_values.data(); }
+        const T*                        GetData() const     { return m_values.data(); }
+        size_t                          GetSize() const     { return m_values.size(); }
+        bool                            IsEmpty() const     { return m_values.empty(); }
+
+        Allocator&                      GetAllocator() const
+        {
+            return m_values.GetAllocator();
+        }
+    }; // class SlotMap 
+
+    //! Largest of a list of compile time values. 
+    template<size_t... Values> struct StaticMax;
+
+    template<size_t Value>
+    struct StaticMax<Value> : std::integral_constant<size_t, Value>
+    {
+    }; // struct StaticMax 
+
+    template<size_t A, size_t B, size_t... Rest>
+    struct StaticMax<A, B, Rest...> : StaticMax<((A > B) ? A : B), Rest...>
+    {
+    }; // struct StaticMax 
+
+    //! Typed column pointers of a SoA<Fields...> (or any parallel arrays), for kernels. 
+    //! A view does not own its data and is invalidated when the container reallocates. 
+    template<typename... Columns>
+    class SoAView
+    {
+    private:
+        std::tuple<Columns*...>         m_columns;
+        size_t                          m_size;
+
+        template<size_t... I>
+        SoAView                         Offset(size_t begin, size_t count, std::index_sequence<I...>) const
+        {
+            return SoAView(std::tuple<Columns*...>((std::get<I>(m_columns) + begin)...), count);
+        }
+
+    public:
+        SoAView(const std::tuple<Columns*...>& columns, size_t size)
+            : m_columns     (columns)
+            , m_size        (size)
+        {
+        }
+
+        template<size_t I>
+        typename std::tuple_element<I, std::tuple<Columns...> >::type* Get() const
+        {
+            return std::get<I>(m_columns);
+        }
+
+        size_t                          GetSize() const
+        {
+            return m_size;
+        }
+
+        //! Rows [begin, begin + count), e.g. to split a kernel across jobs. Columns keep their 
+        //! alignment only when begin is a multiple of the row granularity. 
+        SoAView                         Slice(size_t begin, size_t count) const
+        {
+            assert(begin + count <= m_size);
+            return Offset(begin, count, std::index_sequence_for<Columns...>());
+        }
+    }; // class SoAView 
+
+    //! Struct of arrays: each field of a row lives in its own column, e.g. 
+    //! SoA<float, float, float, uint32_t> for x, y, z and a flag, with Get<0>() the x column. 
+    //! The columns share one block from a tf::Allocator. Each column starts on a kAlignment 
+    //! (at least TF_CACHELINE_SIZE) boundary and the capacity is a multiple of kRowGranularity, 
+    //! so a SIMD kernel may run over GetSize() rounded up to kRowGranularity rows. 
+    //! Fields must be trivially copyable; rows are moved with memcpy. Growth failure in PushBack is 
+    //! fatal, use Reserve() up front to handle it. Not thread safe. 
+    template<typename... Fields>
+    class SoA : private NonCopyable
+    {
+    public:
+        typedef SoAView<Fields...>      View;
+        typedef SoAView<const Fields...> ConstView;
+
+        static const size_t             kFieldCount         = sizeof...(Fields);
+        static const size_t             kRowGranularity     = 16;
+        static const size_t             kAlignment          = StaticMax<TF_CACHELINE_SIZE, TF_DEFAULT_ALIGNMENT_SIZE, alignof(Fields)...>::value;
+
+    private:
+        typedef std::index_sequence_for<Fields...> FieldIndices;
+
+        std::tuple<Fields*...>          m_columns;
+        size_t                          m_size;
+        size_t                          m_capacity;
+        Allocator*                      m_allocator;
+
+        static size_t                   GetColumnBytes(size_t elementSize, size_t capacity)
+        {
+            return TF_ALIGNMENT(elementSize * capacity, kAlignment);
+        }
+
+        template<size_t... I>
+        static void                     Partition(uint8_t* block, size_t capacity, std::tuple<Fields*...>& columns, std::index_sequence<I...>)
+        {
+            size_t offset = 0;
+            int expand[] = { 0, ((std::get<I>(columns) = reinterpret_cast<Fields*>(block + offset)), offset += GetColumnBytes(sizeof(Fields), capacity), 0)... };
+            TF_UNUSED(expand);
+        }
+
+        template<size_t... I>
+        void                            CopyRows(std::tuple<Fields*...>& dest, size_t count, std::index_sequence<I...>) const
+        {
+            int expand[] = { 0, (memcpy(std::get<I>(dest), std::get<I>(m_columns), sizeof(Fields) * count), 0)... };
+            TF_UNUSED(expand);
+        }
+
+        template<size_t... I>
+        void                            ClearRows(size_t begin, size_t end, std::index_sequence<I...>)
+        {
+            int expand[] = { 0, (memset(std::get<I>(m_columns) + begin, 0, sizeof(Fields) * (end - begin)), 0)... };
+            TF_UNUSED(expand);
+        }
+
+        template<size_t... I>
+        void                            MoveRow(size_t dest, size_t source, std::index_sequence<I...>)
+        {
+            int expand[] = { 0, ((std::get<I>(m_columns)[dest] = std::get<I>(m_columns)[source]), 0)... };
+            TF_UNUSED(expand);
+        }
+
+        template<size_t... I>
+        void                            StoreRow(size_t row, std::index_sequence<I...>, const Fields&... values)
+        {
+            int expand[] = { 0, ((std::get<I>(m_columns)[row] = values), 0)... };
+            TF_UNUSED(expand);
+        }
+
+        template<size_t... I>
+        void                            StoreRow(size_t row, std::index_sequence<I...>, const std::tuple<Fields...>& values)
+        {
+            int expand[] = { 0, ((std::get<I>(m_columns)[row] = std::get<I>(values)), 0)... };
+            TF_UNUSED(expand);
+        }
+
+        bool                            SetCapacity(size_t newCapacity)
+        {
+            assert(newCapacity >= m_size);
+            newCapacity = TF_ALIGNMENT(newCapacity, kRowGranularity);
+            size_t bytes = 0;
+            const size_t sizes[] = { sizeof(Fields)... };
+            for (size_t size : sizes)
+            {
+                if (newCapacity > static_cast<size_t>(-1) / 2 / size / kFieldCount)
+                {
+                    return false;
+                }
+                bytes += GetColumnBytes(size, newCapacity);
+            }
+            uint8_t* block = static_cast<uint8_t*>(m_allocator->Allocate(bytes, kAlignment));
+            if (block == nullptr)
+            {
+                return false;
+            }
+            std::tuple<Fields*...> columns;
+            Partition(block, newCapacity, columns, FieldIndices());
+            if (m_size > 0)
+            {
+                CopyRows(columns, m_size, FieldIndices());
+            }
+            if (m_capacity > 0)
+            {
+                m_allocator->Free(std::get<0>(m_columns));
+            }
+            m_columns = columns;
+            m_capacity = newCapacity;
+            return true;
+        }
+
+    public:
+        explicit SoA(Allocator& allocator=DefaultAllocator())
+            : m_columns     ()
+            , m_size        (0)
+            , m_capacity    (0)
+            , m_allocator   (&allocator)
+        {
+            static_assert(kFieldCount > 0, "SoA needs at least one field.");
+            static_assert(StaticMax<0, (std::is_trivially_copyable<Fields>::value ? 0 : 1)...>::value == 0, "SoA fields must be trivially copyable.");
+        }
+
+        ~SoA()
+        {
+            if (m_capacity > 0)
+            {
+                m_allocator->Free(std::get<0>(m_columns));
+            }
+        }
+
+        //! Column of field I. 
+        template<size_t I>
+        typename std::tuple_element<I, std::tuple<Fields...> >::type* Get()
+        {
+            return std::get<I>(m_columns);
+        }
+
+        template<size_t I>
+        const typename std::tuple_element<I, std::tuple<Fields...> >::type* Get() const
+        {
+            return std::get<I>(m_columns);
+        }
+
+        View                            GetView()
+        {
+            return View(m_columns, m_size);
+        }
+
+        ConstView                       GetView() const
+        {
+            return ConstView(std::tuple<const Fields*...>(m_columns), m_size);
+        }
+
+        size_t                          GetSize() const     { return m_size; }
+        size_t                          GetCapacity() const { return m_capacity; }
+        bool                            IsEmpty() const     { return m_size == 0; }
+
+        Allocator&                      GetAllocator() const
+        {
+            return *m_allocator;
+        }
+
+        //! Returns false when out of memory, the container is left unchanged. 
+        bool                            Reserve(size_t count)
+        {
+            return (count <= m_capacity) || SetCapacity(count);
+        }
+
+        //! New rows are zero filled. Returns false when out of memory. 
+        bool                            Resize(size_t count)
+        {
+            if (!Reserve(count))
+            {
+                return false;
+            }
+            if (count > m_size)
+            {
+                ClearRows(m_size, count, FieldIndices());
+            }
+            m_size = count;
+            return true;
+        }
+
+        //! Append a row, returns its index. 
+        size_t                          PushBack(const Fields&... values)
+        {
+            if (TF_UNLIKELY(m_size == m_capacity))
+            {
+                // values may refer into the columns SetCapacity frees, copy the row first. 
+                const std::tuple<Fields...> row(values...);
+                const size_t growth = m_capacity / 2;
+                if (!SetCapacity(m_capacity + ((growth > kRowGranularity) ? growth : kRowGranularity)))
+                {
+                    assert(!"tf::SoA: out of memory.");
+                    TF_PLATFORM_DEBUG_BREAK();
+                }
+                StoreRow(m_size, FieldIndices(), row);
+                return m_size++;
+            }
+            StoreRow(m_size, FieldIndices(), values...);
+            return m_size++;
+        }
+
+        void                            PopBack()
+        {
+            assert(m_size > 0);
+            m_size--;
+        }
+
+        //! Remove a row by moving the last row into its place, O(1) but does not keep the order. 
+        void                            SwapErase(size_t index)
+        {
+            assert(index < m_size);
+            if (index != m_size - 1)
+            {
+                MoveRow(index, m_size - 1, FieldIndices());
+            }
+            m_size--;
+        }
+
+        void                            Clear()
+        {
+            m_size = 0;
+        }
+    }; // class SoA 
+
+    class JobCounter;
+
+    //! Job entry point, receives the data pointer the job was declared with. 
+    typedef void (*JobFunction)(void* data);
+
+    struct JobDecl
+    {
+        JobFunction                     m_function;
+        void*                           m_data;
+    }; // struct JobDecl 
+
+    //! A queued job, the counter (may be null) is decremented once it has run. 
+    struct Job
+    {
+        JobFunction                     m_function;
+        void*                           m_data;
+        JobCounter*                     m_counter;
+    }; // struct Job 
+
+    //! Number of unfinished jobs of a group, see JobSystem::Run() and JobSystem::WaitForCounter(). 
+    //! Must outlive the jobs that reference it. 
+    class JobCounter : private NonCopyable
+    {
+        friend class JobSystem;
+    private:
+        std::atomic<int32_t>            m_value;
+    public:
+        JobCounter()
+            : m_value(0)
+        {
+        }
+
+        int32_t                         GetValue() const
+        {
+            return m_value.load(std::memory_order_acquire);
+        }
+
+        bool                            IsDone() const
+        {
+            return GetValue() == 0;
+        }
+    }; // class JobCounter 
+
+    //! Chase-Lev work-stealing deque with a fixed power of two capacity. 
+    //! The owner thread pushes and pops at the bottom (LIFO, the most recent job is still in cache), 
+    //! any other thread steals from the top (FIFO, the oldest and usually largest piece of work). 
+    //! Only the last job is contended, where the owner and the thieves race with a CAS on the top. 
+    class JobDeque : private NonCopyable
+    {
+    private:
+        // Fields are atomics because a thief may read a slot the owner is refilling; it then loses the CAS. 
+        struct Slot
+        {
+            std::atomic<JobFunction>    m_function;
+            std::atomic<void*>          m_data;
+            std::atomic<JobCounter*>    m_counter;
+        }; // struct Slot 
+
+        TF_CACHELINE_ALIGNED std::atomic<int64_t>  m_top;
+        TF_CACHELINE_ALIGNED std::atomic<int64_t>  m_bottom;
+        Allocator&                      m_allocator;
+        Slot*                           m_slots;
+        int64_t                         m_mask;
+
+    public:
+        explicit JobDeque(uint32_t capacity, Allocator& allocator=DefaultAllocator());
+        ~JobDeque();
+
+        //! Owner thread only. Returns false when the deque is full. 
+        bool                            Push(const Job& job);
+
+        //! Owner thread only. Takes the most recently pushed job. 
+        bool                            Pop(Job& job);
+
+        //! Any thread. Takes the oldest job, false when empty or when another thread won the race. 
+        bool                            Steal(Job& job);
+
+        //! Approximate when other threads are stealing. 
+        uint32_t                        GetSize() const
+        {
+            const int64_t size = m_bottom.load(std::memory_order_relaxed) - m_top.load(std::memory_order_relaxed);
+            return (size > 0) ? static_cast<uint32_t>(size) : 0;
+        }
+
+        uint32_t                        GetCapacity() const
+        {
+            return static_cast<uint32_t>(m_mask + 1);
+        }
+    }; // class JobDeque 
+
+    struct JobSystemDesc
+    {
+        static const uint32_t           kDefaultFiberStackSize = 64 * 1024;
+
+        uint32_t                        m_workerCount;      //!< 0 for one worker per hardware thread.
+        uint32_t                        m_fiberCount;       //!< 0 runs jobs on the worker stacks.
+        uint32_t                        m_fiberStackSize;
+
+        explicit JobSystemDesc(uint32_t workerCount=0, uint32_t fiberCount=0)
+            : m_workerCount     (workerCount)
+            , m_fiberCount      (fiberCount)
+            , m_fiberStackSize  (kDefaultFiberStackSize)
+        {
+        }
+
+    }; // struct JobSystemDesc 
+
+    //! Work-stealing job system with one worker per core. 
+    //! The thread that creates the system is worker 0 and the others run on their own threads, 
+    //! each owning a JobDeque. Jobs run from a worker go to its own deque, jobs run from any other 
+    //! thread go to a shared queue. Idle workers steal from a random victim, then sleep until new 
+    //! jobs are queued. WaitForCounter() runs jobs until the counter drops, so a job may wait for 
+    //! the jobs it spawned without blocking its thread. Must be destroyed by the thread that 
+    //! created it, after every job has finished. 
+    //! 
+    //! With fibers (JobSystemDesc::m_fiberCount > 0) jobs run on a pool of fibers instead, each with 
+    //! its own stack and a guard page below it. WaitForCounter() from a job suspends its fiber and 
+    //! the worker goes on with another one; the waiting fiber is resumed by whichever worker sees 
+    //! the counter drop, so a job may continue on a different thread after a wait. Thread local 
+    //! variables must not be cached across a wait (MSVC builds need /GT, fiber-safe TLS). 
+    //! When every fiber is in use WaitForCounter() falls back to running jobs on the waiting stack. 
+    class JobSystem : private NonCopyable
+    {
+    public:
+        static const uint32_t           kInvalidWorkerIndex = 0xffffffff;
+        static const uint32_t           kMaxWorkerCount     = 64;
+        static const uint32_t           kDequeCapacity      = 4096;
+
+    private:
+        struct Worker;
+        struct Shared;
+        struct Fiber;
+        struct ThreadWait;
+        struct ThreadState;
+
+        Allocator&                      m_allocator;
+        Worker*                         m_workers;
+        Shared*                         m_shared;
+        uint32_t                        m_workerCount;
+        uint32_t                        m_fiberCount;
+        std::atomic<int32_t>            m_queuedCount;
+        std::atomic<int32_t>            m_sleepingCount;
+        std::atomic<bool>               m_quit;
+        JobSystem*                      m_previousSystem;
+        uint32_t                        m_previousWorkerIndex;
+
+        static ThreadState&             GetThreadState();
+        static void                     FiberEntry(void* fiber);
+
+        bool                            TryGetJob(uint32_t workerIndex, Job& job);
+        void                            Execute(const Job& job);
+        void                            WakeWorkers(uint32_t count);
+        void                            WaitForWork();
+        void                            WorkerMain(uint32_t workerIndex);
+
+        void                            CreateFibers(uint32_t fiberCount, size_t stackSize);
+        void                            DestroyFibers();
+        Fiber*                          AcquireFiber();
+        Fiber*                          TakeReadyFiber();
+        bool                            HasReadyFiber() const;
+        bool                            RunFibers(ThreadWait& wait);
+        void                            SwitchTo(Fiber* fiber);
+        void                            FinishSwitch();
+        void                            FiberMain();
+
+    public:
+        //! workerCount 0 means one worker per hardware thread. 
+        explicit JobSystem(uint32_t workerCount=0, Allocator& allocator=DefaultAllocator());
+        explicit JobSystem(const JobSystemDesc& desc, Allocator& allocator=DefaultAllocator());
+        ~JobSystem();
+
+        //! Queue count jobs. When counter is not null it is incremented by count now and decremented 
+        //! as each job finishes. 
+        void                            Run(const JobDecl* jobs, uint32_t count, JobCounter* counter);
+
+        void                            Run(JobFunction function, void* data, JobCounter* counter)
+        {
+            const JobDecl job = { function, data };
+            Run(&job, 1, counter);
+        }
+
+        //! Wait until counter drops to value or below. Suspends the calling fiber when fibers are 
+        //! enabled, otherwise runs queued jobs on the calling thread meanwhile. 
+        void                            WaitForCounter(JobCounter& counter, int32_t value=0);
+
+        uint32_t                        GetWorkerCount() const
+        {
+            return m_workerCount;
+        }
+
+        uint32_t                        GetFiberCount() const
+        {
+            return m_fiberCount;
+        }
+
+        //! Fibers suspended in WaitForCounter(). 
+        uint32_t                        GetWaitingFiberCount() const;
+
+        //! Jobs queued and not started yet, a hint to split work only when workers are short of it. 
+        uint32_t                        GetQueuedJobCount() const
+        {
+            const int32_t count = m_queuedCount.load(std::memory_order_relaxed);
+            return (count > 0) ? static_cast<uint32_t>(count) : 0;
+        }
+
+        //! Index of the calling thread in this system, kInvalidWorkerIndex for other threads. 
+        uint32_t                        GetCurrentWorkerIndex() const;
+
+    }; // class JobSystem 
+
+    //! Anything a task reads or writes, any stable id, e.g. MakeTaskResource("skinning.matrices"). 
+    typedef uint32_t TaskResource;
+    typedef uint32_t TaskId;
+
+    inline TaskResource MakeTaskResource(const char* name)
+    {
+        return static_cast<TaskResource>(HashBytes(name, strlen(name)));
+    }
+
+    //! Per-frame graph of tasks with declared inputs, outputs and explicit dependencies. 
+    //! Compile() orders the tasks by their data hazards in declaration order (a read after a write, 
+    //! a write after reads or after a write), adds the explicit dependencies and gives every task the 
+    //! cost of the longest path from it to the end of the frame. The compiled schedule is cached: 
+    //! declaring the same tasks again on the next frame (the functions and data may change) only 
+    //! compares a hash. Run() hands the tasks to the job system through a priority queue, so a free 
+    //! worker always picks the ready task on the critical path. Not thread safe to build. 
+    class TaskGraph : private NonCopyable
+    {
+    public:
+        static const TaskId             kInvalidTaskId  = 0xffffffff;
+
+    private:
+        struct Task
+        {
+            const char*                 m_name;
+            JobFunction                 m_function;
+            void*                       m_data;
+            uint32_t                    m_cost;
+        }; // struct Task 
+
+        struct Access
+        {
+            TaskId                      m_task;
+            TaskResource                m_resource;
+            uint32_t                    m_write;
+        }; // struct Access 
+
+        struct Edge
+        {
+            TaskId                      m_from;
+            TaskId                      m_to;
+        }; // struct Edge 
+
+        struct Node
+        {
+            uint64_t                    m_priority;
+            uint32_t                    m_successorBegin;
+            uint32_t                    m_successorCount;
+            uint32_t                    m_dependencyCount;
+        }; // struct Node 
+
+        struct RunState;
+
+        Allocator&                      m_allocator;
+        Vector<Task>                    m_tasks;
+        Vector<Access>                  m_accesses;
+        Vector<Edge>                    m_dependencies;
+
+        // Compiled schedule. 
+        Vector<Node>                    m_nodes;
+        Vector<TaskId>                  m_successors;
+        Vector<TaskId>                  m_roots;
+        Vector<TaskId>                  m_order;
+        uint64_t                        m_topologyHash;
+        uint64_t                        m_criticalPathCost;
+        uint32_t                        m_compileCount;
+        bool                            m_compiled;
+        RunState*                       m_runState;
+
+        uint64_t                        HashTopology() const;
+        bool                            Build();
+
+        // Max heap order of ready tasks: the longest remaining path first, then declaration order. 
+        bool                            IsLowerPriority(TaskId a, TaskId b) const
+        {
+            const uint64_t priorityA = m_nodes[a].m_priority;
+            const uint64_t priorityB = m_nodes[b].m_priority;
+            return (priorityA != priorityB) ? (priorityA < priorityB) : (a > b);
+        }
+
+        static void                     RunnerMain(void* graph);
+
+    public:
+        explicit TaskGraph(Allocator& allocator=DefaultAllocator());
+        ~TaskGraph();
+
+        //! Drop the declared tasks to declare the next frame, the compiled schedule stays cached. 
+        void                            Clear();
+
+        //! cost is a relative estimate, only used to find the critical path. 
+        TaskId                          AddTask(const char* name, JobFunction function, void* data, uint32_t cost=1);
+        void                            Read(TaskId task, TaskResource resource);
+        void                            Write(TaskId task, TaskResource resource);
+        void                            DependOn(TaskId task, TaskId dependency);
+
+        //! Rebuilds the schedule when the topology changed. Returns false on a dependency cycle. 
+        bool                            Compile();
+
+        //! Run every task once and wait for them. Tasks may run and wait for jobs themselves. 
+        void                            Run(JobSystem& jobSystem);
+
+        //! Run every task on the calling thread, in a valid order that favours the critical path. 
+        void                            RunSerial();
+
+        uint32_t                        GetTaskCount() const
+        {
+            return static_cast<uint32_t>(m_tasks.size());
+        }
+
+        const char*                     GetTaskName(TaskId task) const
+        {
+            assert(task < m_tasks.size());
+            return m_tasks[task].m_name;
+        }
+
+        //! Cost of the longest path from the task to the end of the graph, the task included. 
+        uint64_t                        GetPriority(TaskId task) const
+        {
+            assert(m_compiled && task < m_nodes.size());
+            return m_nodes[task].m_priority;
+        }
+
+        uint64_t                        GetCriticalPathCost() const
+        {
+            return m_criticalPathCost;
+        }
+
+        //! Number of times the schedule was actually rebuilt. 
+        uint32_t                        GetCompileCount() const
+        {
+            return m_compileCount;
+        }
+
+    }; // class TaskGraph 
+
+    //! Tuning shared by the parallel algorithms. 
+    struct ParallelDesc
+    {
+        static const size_t             kDefaultSerialThreshold = 2048;
+
+        size_t                          m_grainSize;        //!< elements per piece, 0 to derive it from the size and the worker count.
+        size_t                          m_serialThreshold;  //!< up to this many elements run on the calling thread.
+
+        explicit ParallelDesc(size_t grainSize=0, size_t serialThreshold=kDefaultSerialThreshold)
+            : m_grainSize       (grainSize)
+            , m_serialThreshold (serialThreshold)
+        {
+        }
+    }; // struct ParallelDesc 
+
+    //! True when count elements are not worth the job system: below the threshold or a single worker. 
+    inline bool IsParallelSerial(const JobSystem& system, size_t count, const ParallelDesc& desc)
+    {
+        return count <= desc.m_serialThreshold || system.GetWorkerCount() < 2;
+    }
+
+    //! The grain size of desc, or about eight pieces per worker. 
+    inline size_t GetParallelGrainSize(const JobSystem& system, size_t count, const ParallelDesc& desc)
+    {
+        if (desc.m_grainSize > 0)
+        {
+            return desc.m_grainSize;
+        }
+        const size_t pieceCount = static_cast<size_t>(system.GetWorkerCount()) * 8;
+        const size_t grainSize = (count + pieceCount - 1) / pieceCount;
+        return (grainSize > 0) ? grainSize : 1;
+    }
+
+    //! Body of ParallelForRange(), called with disjoint [begin, end) pieces. 
+    typedef void (*ParallelRangeFunction)(void* data, size_t begin, size_t end);
+
+    //! Calls function over [begin, end) in pieces of the grain size and returns once all ran. The range 
+    //! is only split on demand: a worker hands the back half of its range to the job system while fewer 
+    //! jobs are queued than there are workers, so idle workers steal large halves and busy ones keep 
+    //! their range. May be called from a job. 
+    void ParallelForRange(JobSystem& system, size_t begin, size_t end, ParallelRangeFunction function, void* data, const ParallelDesc& desc=ParallelDesc());
+
+    //! function(size_t begin, size_t end). 
+    template<typename Function>
+    void ParallelForRange(JobSystem& system, size_t begin, size_t end, const Function& function, const ParallelDesc& desc=ParallelDesc())
+    {
+        ParallelRangeFunction body = [](void* data, size_t first, size_t last)
+        {
+            (*static_cast<const Function*>(data))(first, last);
+        };
+        ParallelForRange(system, begin, end, body, const_cast<Function*>(&function), desc);
+    }
+
+    //! function(size_t index) for every index in [begin, end). 
+    template<typename Function>
+    void ParallelFor(JobSystem& system, size_t begin, size_t end, const Function& function, const ParallelDesc& desc=ParallelDesc())
+    {
+        ParallelForRange(system, begin, end, [&function](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; ++i)
+            {
+                function(i);
+            }
+        }, desc);
+    }
+
+    //! combine(... combine(combine(identity, map(begin)), map(begin + 1)) ..., map(end - 1)) for an 
+    //! associative combine. Pieces of the grain size are reduced in parallel and their results combined 
+    //! in index order, so for a given grain size the result does not depend on the scheduling. 
+    //! The partial results come from allocator, e.g. a frame arena inside frame code. 
+    template<typename T, typename Map, typename Combine>
+    T ParallelReduce(JobSystem& system, size_t begin, size_t end, const T& identity, const Map& map, const Combine& combine, const ParallelDesc& desc=ParallelDesc(), Allocator& allocator=DefaultAllocator())
+    {
+        const size_t count = (end > begin) ? (end - begin) : 0;
+        if (IsParallelSerial(system, count, desc))
+        {
+            T result = identity;
+            for (size_t i = begin; i < end; ++i)
+            {
+                result = combine(result, map(i));
+            }
+            return result;
+        }
+        const size_t grainSize = GetParallelGrainSize(system, count, desc);
+        const size_t pieceCount = (count + grainSize - 1) / grainSize;
+        Vector<T> partials(allocator);
+        partials.resize(pieceCount, identity);
+        ParallelForRange(system, 0, pieceCount, [&](size_t firstPiece, size_t lastPiece)
+        {
+            for (size_t piece = firstPiece; piece < lastPiece; ++piece)
+            {
+                const size_t first = begin + piece * grainSize;
+                const size_t last = (piece + 1 < pieceCount) ? (first + grainSize) : end;
+                T result = identity;
+                for (size_t i = first; i < last; ++i)
+                {
+                    result = combine(result, map(i));
+                }
+                partials[piece] = std::move(result);
+            }
+        }, ParallelDesc(1, 0));
+
+        T result = identity;
+        for (const T& partial : partials)
+        {
+            result = combine(result, partial);
+        }
+        return result;
+    }
+
+    //! output[i] = combine(... combine(input[0], input[1]) ..., input[i]) for an associative combine. 
+    //! Two passes over the data: the sum of every piece, then every piece scanned again from the sum 
+    //! of the pieces before it. input and output may be the same array. The piece sums come from allocator. 
+    template<typename T, typename Combine>
+    void ParallelInclusiveScan(JobSystem& system, const T* input, T* output, size_t count, const Combine& combine, const ParallelDesc& desc=ParallelDesc(), Allocator& allocator=DefaultAllocator())
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        if (IsParallelSerial(system, count, desc))
+        {
+            T sum = input[0];
+            output[0] = sum;
+            for (size_t i = 1; i < count; ++i)
+            {
+                sum = combine(sum, input[i]);
+                output[i] = sum;
+            }
+            return;
+        }
+        const size_t grainSize = GetParallelGrainSize(system, count, desc);
+        const size_t pieceCount = (count + grainSize - 1) / grainSize;
+        Vector<T> sums(allocator);
+        sums.resize(pieceCount, input[0]);
+        ParallelForRange(system, 0, pieceCount, [&](size_t firstPiece, size_t lastPiece)
+        {
+            for (size_t piece = firstPiece; piece < lastPiece; ++piece)
+            {
+                const size_t first = piece * grainSize;
+                const size_t last = (piece + 1 < pieceCount) ? (first + grainSize) : count;
+                T sum = input[first];
+                for (size_t i = first + 1; i < last; ++i)
+                {
+                    sum = combine(sum, input[i]);
+                }
+                sums[piece] = std::move(sum);
+            }
+        }, ParallelDesc(1, 0));
+
+        for (size_t piece = 1; piece < pieceCount; ++piece)
+        {
+            sums[piece] = combine(sums[piece - 1], sums[piece]);
+        }
+
+        ParallelForRange(system, 0, pieceCount, [&](size_t firstPiece, size_t lastPiece)
+        {
+            for (size_t piece = firstPiece; piece < lastPiece; ++piece)
+            {
+                const size_t first = piece * grainSize;
+                const size_t last = (piece + 1 < pieceCount) ? (first + grainSize) : count;
+                T sum = (piece > 0) ? combine(sums[piece - 1], input[first]) : input[first];
+                output[first] = sum;
+                for (size_t i = first + 1; i < last; ++i)
+                {
+                    sum = combine(sum, input[i]);
+                    output[i] = sum;
+                }
+            }
+        }, ParallelDesc(1, 0));
+    }
+
+    //! Sorts [first, last), not stable. Pieces of the grain size (by default a power of two count of 
+    //! at least twice the workers) are sorted with std::sort, then merged pairwise into a buffer and 
+    //! back. Every merge pass cuts its output evenly with a binary search along the merge path, so all 
+    //! workers take part in the last, largest merges too. T must be default constructible and movable. 
+    //! The merge buffer of count elements comes from allocator. 
+    template<typename T, typename Less>
+    void ParallelSort(JobSystem& system, T* first, T* last, const Less& less, const ParallelDesc& desc=ParallelDesc(), Allocator& allocator=DefaultAllocator())
+    {
+        const size_t count = static_cast<size_t>(last - first);
+        if (IsParallelSerial(system, count, desc))
+        {
+            std::sort(first, last, less);
+            return;
+        }
+        size_t blockSize = desc.m_grainSize;
+        if (blockSize == 0)
+        {
+            size_t blockCount = 1;
+            while (blockCount < static_cast<size_t>(system.GetWorkerCount()) * 2)
+            {
+                blockCount *= 2;
+            }
+            blockSize = (count + blockCount - 1) / blockCount;
+        }
+        const size_t blockCount = (count + blockSize - 1) / blockSize;
+        ParallelForRange(system, 0, blockCount, [&](size_t firstBlock, size_t lastBlock)
+        {
+            for (size_t block = firstBlock; block < lastBlock; ++block)
+            {
+                const size_t blockEnd = (block + 1) * blockSize;
+                std::sort(first + block * blockSize, first + ((blockEnd < count) ? blockEnd : count), less);
+            }
+        }, ParallelDesc(1, 0));
+        if (blockCount == 1)
+        {
+            return;
+        }
+
+        Vector<T> buffer(allocator);
+        buffer.resize(count);
+        T* source = first;
+        T* dest = buffer.data();
+        const ParallelDesc mergeDesc(GetParallelGrainSize(system, count, ParallelDesc()), 0);
+        for (size_t width = blockSize; width < count; width *= 2)
+        {
+            // Output [begin, end) of the pass: the part of every pair of runs [a, a + width) and 
+            // [a + width, a + 2 * width) that lands there. 
+            ParallelForRange(system, 0, count, [&](size_t begin, size_t end)
+            {
+                for (size_t pair = begin - begin % (2 * width); pair < end; pair += 2 * width)
+                {
+                    const T* a = source + pair;
+                    const size_t aCount = (count - pair < width) ? (count - pair) : width;
+                    const T* b = a + aCount;
+                    const size_t bCount = (count - pair - aCount < width) ? (count - pair - aCount) : width;
+
+                    // Elements of a among the first k of the stable merge of a and b. 
+                    auto split = [&](size_t k)
+                    {
+                        size_t low = (k > bCount) ? (k - bCount) : 0;
+                        size_t high = (k < aCount) ? k : aCount;
+                        while (low < high)
+                        {
+                            const size_t i = low + (high - low) / 2;
+                            if (less(b[k - i - 1], a[i]))
+                            {
+                                high = i;
+                            }
+                            else
+                            {
+                                low = i + 1;
+                            }
+                        }
+                        return low;
+                    };
+                    const size_t kBegin = (begin > pair) ? (begin - pair) : 0;
+                    const size_t kEnd = ((end - pair < aCount + bCount) ? (end - pair) : (aCount + bCount));
+                    const size_t aBegin = split(kBegin);
+                    const size_t aEnd = split(kEnd);
+                    std::merge(std::make_move_iterator(source + pair + aBegin), std::make_move_iterator(source + pair + aEnd),
+                               std::make_move_iterator(source + pair + aCount + (kBegin - aBegin)), std::make_move_iterator(source + pair + aCount + (kEnd - aEnd)),
+                               dest + pair + kBegin, less);
+                }
+            }, mergeDesc);
+            std::swap(source, dest);
+        }
+        if (source != first)
+        {
+            ParallelForRange(system, 0, count, [&](size_t begin, size_t end)
+            {
+                std::move(source + begin, source + end, first + begin);
+            }, mergeDesc);
+        }
+    }
+
+    template<typename T>
+    void ParallelSort(JobSystem& system, T* first, T* last)
+    {
+        ParallelSort(system, first, last, std::less<T>());
+    }
+
+} // namespace tf 
+
+// Scope exit macro. 
+#define TF_SCOPE_EXIT(code) auto TF_CONCAT(scopeExit, __LINE__) = tf::MakeScopeExit([&](){code;})
+
+// Memory tag scope macro. 
+#if TF_MEMORY_TRACKING
+#define TF_MEMORY_TAG_SCOPE(tag) tf::MemoryTagScope TF_CONCAT(memoryTagScope, __LINE__)(tag)
+#else
+#define TF_MEMORY_TAG_SCOPE(tag)
+#endif
 
 
 
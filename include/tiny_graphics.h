@@ -2,7 +2,6 @@
 // Description : Graphics related definition. 
 #pragma once
 #define WIN32_LEAN_AND_MEAN
-#define BUFFERING_COUNT (2)
 
 #include "tiny_base.h"
 
@@ -23,6 +22,11 @@ namespace tf
         int                         m_frameLeft;
         uint16_t                    m_width;
         uint16_t                    m_height;
+        JobSystem*                  m_jobSystem;
+        TaskGraph                   m_updateGraph;
+        TaskGraph                   m_renderGraph;
+
+        void                        RunGraph(TaskGraph& graph);
 
     public:
         ApplicationAdapter(const std::wstring& name);
@@ -32,6 +36,24 @@ namespace tf
         virtual void                Render()     = 0;
         virtual void                Terminate()  = 0;
 
+        //! Declare the frame's update or render passes in graph (already cleared) and return true to 
+        //! run them instead of Update() or Render(). The compiled graph is reused while the passes and 
+        //! their inputs and outputs stay the same. 
+        virtual bool                BuildUpdateGraph(TaskGraph& graph)
+        {
+            (void)(graph);
+            return false;
+        }
+
+        virtual bool                BuildRenderGraph(TaskGraph& graph)
+        {
+            (void)(graph);
+            return false;
+        }
+
+        //! One frame: the update graph (or Update()) then the render graph (or Render()). 
+        void                        RunFrame();
+
     public:
         uint16_t                    GetWidth()
         {
@@ -48,6 +70,12 @@ namespace tf
             return m_name.c_str();
         }
 
+        //! Graphs run on the job system when set, on the window thread otherwise. 
+        void                        SetJobSystem(JobSystem* jobSystem)
+        {
+            m_jobSystem = jobSystem;
+        }
+
         void                        SetFrameCount(int frameCount);
         void                        DeclementFrameCount();
         bool                        FinishByFrameLimit() const;
@@ -85,6 +113,11 @@ namespace gpu
     class SwapChain;
     class SynchronizationObject;
 
+    // Handles stay safe to keep after the object is destroyed, they just stop resolving. 
+    typedef SlotHandle<CommandContext>          CommandContextHandle;
+    typedef SlotHandle<SwapChain>               SwapChainHandle;
+    typedef SlotHandle<SynchronizationObject>   SynchronizationObjectHandle;
+
     struct CommandContextDesc
     {
         uint32_t                        m_dummy0;
@@ -130,6 +163,16 @@ namespace gpu
         SwapChain*                      CreateSwapChain(Allocator& alloc, CommandContext& command, const SwapChainDesc& desc=SwapChainDesc());
         SynchronizationObject*          CreateSynchronizationObject(Allocator& alloc);
 
+        // Objects must be destroyed with the allocator they were created with. 
+        void                            Destroy(CommandContext* command, Allocator& alloc);
+        void                            Destroy(SwapChain* swapChain, Allocator& alloc);
+        void                            Destroy(SynchronizationObject* synchronizationObject, Allocator& alloc);
+
+        // Live object of a handle, nullptr once it has been destroyed. 
+        CommandContext*                 Resolve(CommandContextHandle handle) const;
+        SwapChain*                      Resolve(SwapChainHandle handle) const;
+        SynchronizationObject*          Resolve(SynchronizationObjectHandle handle) const;
+
         DeviceImpl*                     GetImpl() const;
 
     }; // class Device 
@@ -142,8 +185,9 @@ namespace gpu
         friend class DeviceImpl;
 
         CommandContextImpl*             m_impl;
+        CommandContextHandle            m_handle;
 
-                 CommandContext();
+                 CommandContext(CommandContextImpl* impl);
         virtual ~CommandContext();
 
     public:
@@ -158,6 +202,7 @@ namespace gpu
 
         void                            ExecuteList();
 
+        CommandContextHandle            GetHandle() const;
         CommandContextImpl*             GetImpl() const;
 
     }; // class CommandContext 
@@ -169,8 +214,9 @@ namespace gpu
         friend class DeviceImpl;
 
         SwapChainImpl*                  m_impl;
+        SwapChainHandle                 m_handle;
 
-                 SwapChain();
+                 SwapChain(SwapChainImpl* impl);
         virtual ~SwapChain();
 
     public:
@@ -178,6 +224,7 @@ namespace gpu
         int                             GetCurrentFrameBufferIndex() const;
         void                            Present();
 
+        SwapChainHandle                 GetHandle() const;
         SwapChainImpl*                  GetImpl() const;
 
     }; // class SwapChain 
@@ -188,8 +235,9 @@ namespace gpu
         friend class DeviceImpl;
 
         SynchronizationObjectImpl*      m_impl;
+        SynchronizationObjectHandle     m_handle;
 
-                 SynchronizationObject();
+                 SynchronizationObject(SynchronizationObjectImpl* impl);
         virtual ~SynchronizationObject();
 
     public:
@@ -198,6 +246,7 @@ namespace gpu
         void                            WaitForGpu(CommandContext& command, int frameIndex);
         void                            MoveToNextFrame(CommandContext& command, SwapChain& swapChain, int& frameIndex);
 
+        SynchronizationObjectHandle     GetHandle() const;
         SynchronizationObjectImpl*      GetImpl() const;
 
     }; // class SynchronizationObject 
@@ -6,8 +6,46 @@
 
 #include <tiny_base.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 using namespace testing;
 
+namespace tf_unittest
+{
+    // Counts copies and moves, declared trivially relocatable below so that tf::Vector never calls them. 
+    struct RelocationCounter
+    {
+        static int  s_moveCount;
+        int         m_value;
+
+        explicit RelocationCounter(int value) : m_value(value) {}
+        RelocationCounter(const RelocationCounter& other) : m_value(other.m_value) { s_moveCount++; }
+        RelocationCounter(RelocationCounter&& other) : m_value(other.m_value) { s_moveCount++; }
+        RelocationCounter& operator=(const RelocationCounter& other) { m_value = other.m_value; s_moveCount++; return *this; }
+        RelocationCounter& operator=(RelocationCounter&& other) { m_value = other.m_value; s_moveCount++; return *this; }
+    }; // struct RelocationCounter 
+
+    int RelocationCounter::s_moveCount = 0;
+} // namespace tf_unittest 
+
+namespace tf
+{
+    template<> struct IsTriviallyRelocatable<tf_unittest::RelocationCounter> : std::true_type {};
+} // namespace tf 
+
 namespace tf_unittest
 {
     TEST(tiny_base, alignment)
@@ -42,6 +80,3022 @@ namespace tf_unittest
 
     }
 
+    TEST(tiny_base, frame_arena_allocator)
+    {
+        tf::FrameArenaAllocator alloc(1024);
+        alloc.BeginFrame(0);
+        {
+            void* a = alloc.Allocate(100);
+            void* b = alloc.Allocate(100, 64);
+            EXPECT_NE(a, nullptr);
+            EXPECT_NE(b, nullptr);
+            EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % TF_DEFAULT_ALIGNMENT_SIZE, 0u);
+            EXPECT_EQ(reinterpret_cast<uintptr_t>(b) % 64, 0u);
+            EXPECT_GE(alloc.GetUsedBytes(), 200u);
+            alloc.Free(a);
+            alloc.Free(b);
+        }
+
+        // Overflow chaining. 
+        {
+            void* big = alloc.Allocate(4096);
+            EXPECT_NE(big, nullptr);
+            EXPECT_EQ(alloc.GetOverflowCount(), 1u);
+            EXPECT_GE(alloc.GetHighWaterBytes(), 4096u);
+        }
+
+        // The other frame's region is untouched, and this frame's region grows on reuse. 
+        alloc.BeginFrame(1);
+        EXPECT_EQ(alloc.GetUsedBytes(), 0u);
+        alloc.BeginFrame(0);
+        EXPECT_EQ(alloc.GetUsedBytes(), 0u);
+        EXPECT_GE(alloc.GetRegionSize(), 4096u);
+        {
+            void* big = alloc.Allocate(4096);
+            EXPECT_NE(big, nullptr);
+            EXPECT_EQ(alloc.GetOverflowCount(), 1u);
+        }
+    }
+
+
+    TEST(tiny_base, pool_allocator)
+    {
+        tf::PoolAllocator<48> pool;
+        EXPECT_EQ(pool.kBlockSize % TF_DEFAULT_ALIGNMENT_SIZE, 0u);
+
+        void* a = pool.Allocate(48);
+        void* b = pool.Allocate(16);
+        EXPECT_NE(a, nullptr);
+        EXPECT_NE(b, nullptr);
+        EXPECT_NE(a, b);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % TF_DEFAULT_ALIGNMENT_SIZE, 0u);
+        EXPECT_EQ(pool.GetUsedCount(), 2u);
+
+        // LIFO free list hands the last freed block back first. 
+        pool.Free(a);
+        EXPECT_EQ(pool.Allocate(48), a);
+
+        // Grows past the first chunk. 
+        const size_t capacity = pool.GetCapacity();
+        std::vector<void*> blocks;
+        for (size_t i = 0; i < capacity * 2; ++i)
+        {
+            blocks.push_back(pool.Allocate(48));
+            EXPECT_NE(blocks.back(), nullptr);
+        }
+        EXPECT_GT(pool.GetCapacity(), capacity);
+
+        pool.Reset();
+        EXPECT_EQ(pool.GetUsedCount(), 0u);
+        EXPECT_NE(pool.Allocate(48), nullptr);
+    }
+
+    template<typename Alloc> double MeasureAllocFreeThroughput(Alloc& alloc, size_t size)
+    {
+        static const int kIterationCount = 200;
+        static const int kLiveCount      = 1000;
+        void* blocks[kLiveCount];
+
+        const auto begin = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < kIterationCount; ++i)
+        {
+            for (int j = 0; j < kLiveCount; ++j)
+            {
+                blocks[j] = alloc.Allocate(size);
+            }
+            for (int j = 0; j < kLiveCount; ++j)
+            {
+                alloc.Free(blocks[(j * 7) % kLiveCount]);
+            }
+        }
+        const auto end = std::chrono::high_resolution_clock::now();
+
+        const double seconds = std::chrono::duration<double>(end - begin).count();
+        return (kIterationCount * kLiveCount) / seconds;
+    }
+
+    TEST(tiny_base, pool_allocator_throughput)
+    {
+        tf::PoolAllocator<64> pool;
+        const double poolRate    = MeasureAllocFreeThroughput(pool, 64);
+        const double defaultRate = MeasureAllocFreeThroughput(tf::DefaultAllocator(), 64);
+        printf("alloc/free pairs per second: pool %.0f, default %.0f\n", poolRate, defaultRate);
+        EXPECT_GT(poolRate, 0.0);
+        EXPECT_GT(defaultRate, 0.0);
+    }
+
+    TEST(tiny_base, thread_caching_allocator)
+    {
+        tf::ThreadCachingAllocator alloc;
+
+        void* a = alloc.Allocate(24);
+        EXPECT_NE(a, nullptr);
+        alloc.Free(a);
+        void* b = alloc.Allocate(24);
+        EXPECT_EQ(a, b);
+        alloc.Free(b);
+
+        tf::ThreadCachingAllocator::ThreadStatistics statistics = alloc.GetThreadStatistics();
+        EXPECT_EQ(statistics.m_missCount, 1u);
+        EXPECT_EQ(statistics.m_hitCount, 1u);
+
+        // Large and over-aligned blocks bypass the cache. 
+        void* large = alloc.Allocate(64 * 1024);
+        void* aligned = alloc.Allocate(32, 256);
+        EXPECT_NE(large, nullptr);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % 256, 0u);
+        alloc.Free(large);
+        alloc.Free(aligned);
+
+        alloc.FlushThreadCache();
+        EXPECT_EQ(alloc.GetThreadStatistics().m_cachedBytes, 0u);
+    }
+
+    TEST(tiny_base, thread_caching_allocator_remote_free)
+    {
+        tf::ThreadCachingAllocator alloc;
+        static const int kBlockCount = 100;
+        void* blocks[kBlockCount];
+        for (int i = 0; i < kBlockCount; ++i)
+        {
+            blocks[i] = alloc.Allocate(100);
+        }
+
+        // Free from another thread, the blocks go back to this thread in one batch. 
+        std::thread remote([&]()
+        {
+            for (int i = 0; i < kBlockCount; ++i)
+            {
+                alloc.Free(blocks[i]);
+            }
+        });
+        remote.join();
+        EXPECT_EQ(alloc.GetThreadStatistics().m_remoteFreeCount, static_cast<uint64_t>(kBlockCount));
+
+        const uint64_t missCount = alloc.GetThreadStatistics().m_missCount;
+        for (int i = 0; i < kBlockCount / 2; ++i)
+        {
+            blocks[i] = alloc.Allocate(100);
+        }
+        EXPECT_EQ(alloc.GetThreadStatistics().m_missCount, missCount);
+        for (int i = 0; i < kBlockCount / 2; ++i)
+        {
+            alloc.Free(blocks[i]);
+        }
+
+        tf::ThreadCachingAllocator::ThreadStatistics statistics[4];
+        EXPECT_EQ(alloc.CollectThreadStatistics(statistics, TF_ARRAY_SIZE(statistics)), 1u);
+    }
+
+    TEST(tiny_base, thread_caching_allocator_shared_slot)
+    {
+        // Serials 0 and kMaxInstanceCount apart share a thread local slot. 
+        tf::ThreadCachingAllocator allocators[tf::ThreadCachingAllocator::kMaxInstanceCount + 1];
+        tf::ThreadCachingAllocator& first = allocators[0];
+        tf::ThreadCachingAllocator& last = allocators[tf::ThreadCachingAllocator::kMaxInstanceCount];
+        for (int i = 0; i < 1000; ++i)
+        {
+            first.Free(first.Allocate(32));
+            last.Free(last.Allocate(32));
+        }
+        tf::ThreadCachingAllocator::ThreadStatistics statistics[4];
+        EXPECT_EQ(first.CollectThreadStatistics(statistics, 4), 1u);
+        EXPECT_EQ(statistics[0].m_missCount, 1u);
+        EXPECT_EQ(statistics[0].m_remoteFreeCount, 0u);
+        EXPECT_EQ(last.CollectThreadStatistics(statistics, 4), 1u);
+        EXPECT_EQ(statistics[0].m_hitCount, 999u);
+        EXPECT_EQ(statistics[0].m_remoteFreeCount, 0u);
+    }
+
+    TEST(tiny_base, tlsf_allocator)
+    {
+        std::vector<uint8_t> memory(1024 * 1024);
+        tf::TlsfAllocator alloc(memory.data(), memory.size());
+        EXPECT_TRUE(alloc.Validate());
+
+        const tf::TlsfAllocator::Statistics initial = alloc.GetStatistics();
+        EXPECT_EQ(initial.m_freeBlockCount, 1u);
+        EXPECT_EQ(initial.m_largestFreeBlock, initial.m_freeBytes);
+
+        void* a = alloc.Allocate(100);
+        void* b = alloc.Allocate(3000, 256);
+        void* c = alloc.Allocate(5000);
+        EXPECT_NE(a, nullptr);
+        EXPECT_NE(b, nullptr);
+        EXPECT_NE(c, nullptr);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % TF_DEFAULT_ALIGNMENT_SIZE, 0u);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(b) % 256, 0u);
+        EXPECT_TRUE(alloc.Validate());
+
+        // A hole in the middle shows up as fragmentation. 
+        alloc.Free(b);
+        EXPECT_TRUE(alloc.Validate());
+        const tf::TlsfAllocator::Statistics fragmented = alloc.GetStatistics();
+        EXPECT_EQ(fragmented.m_allocationCount, 2u);
+        EXPECT_GT(fragmented.m_fragmentation, 0.0f);
+
+        alloc.Free(a);
+        alloc.Free(c);
+        EXPECT_TRUE(alloc.Validate());
+        const tf::TlsfAllocator::Statistics merged = alloc.GetStatistics();
+        EXPECT_EQ(merged.m_freeBlockCount, 1u);
+        EXPECT_EQ(merged.m_freeBytes, initial.m_freeBytes);
+        EXPECT_EQ(merged.m_usedBytes, 0u);
+
+        EXPECT_EQ(alloc.Allocate(2 * 1024 * 1024), nullptr);
+    }
+
+    TEST(tiny_base, tlsf_allocator_latency)
+    {
+        static const int    kOperationCount = 200000;
+        static const size_t kLiveCount      = 2048;
+
+        std::vector<uint8_t> memory(32 * 1024 * 1024);
+        tf::TlsfAllocator alloc(memory.data(), memory.size());
+
+        std::mt19937 random(12345);
+        std::vector<void*> live(kLiveCount, nullptr);
+        std::vector<double> latencies;
+        latencies.reserve(kOperationCount);
+
+        for (int i = 0; i < kOperationCount; ++i)
+        {
+            void*& slot = live[random() % kLiveCount];
+            const auto begin = std::chrono::high_resolution_clock::now();
+            if (slot)
+            {
+                alloc.Free(slot);
+                slot = nullptr;
+            }
+            else
+            {
+                const size_t size      = 16 + random() % 8192;
+                const size_t alignment = (random() % 8 == 0) ? 128 : TF_DEFAULT_ALIGNMENT_SIZE;
+                slot = alloc.Allocate(size, alignment);
+                EXPECT_NE(slot, nullptr);
+            }
+            const auto end = std::chrono::high_resolution_clock::now();
+            latencies.push_back(std::chrono::duration<double, std::nano>(end - begin).count());
+        }
+        EXPECT_TRUE(alloc.Validate());
+
+        std::sort(latencies.begin(), latencies.end());
+        const double p999  = latencies[static_cast<size_t>(latencies.size() * 0.999)];
+        const double worst = latencies.back();
+        const tf::TlsfAllocator::Statistics statistics = alloc.GetStatistics();
+        printf("tlsf latency: p99.9 %.0f ns, worst %.0f ns, fragmentation %.3f, largest free block %zu\n",
+               p999, worst, statistics.m_fragmentation, statistics.m_largestFreeBlock);
+
+        for (size_t i = 0; i < kLiveCount; ++i)
+        {
+            alloc.Free(live[i]);
+        }
+        EXPECT_EQ(alloc.GetStatistics().m_freeBlockCount, 1u);
+    }
+
+    TEST(tiny_base, virtual_arena)
+    {
+        static const size_t kReserveSize = 256 * 1024 * 1024;
+        tf::VirtualArena arena(kReserveSize, 1024 * 1024);
+        EXPECT_EQ(arena.GetReservedBytes(), kReserveSize);
+        EXPECT_EQ(arena.GetCommittedBytes(), 0u);
+
+        // Grows in place: consecutive allocations stay contiguous across commits. 
+        uint8_t* first = static_cast<uint8_t*>(arena.Allocate(1000));
+        EXPECT_EQ(first, arena.GetBase());
+        uint8_t* previous = first;
+        for (int i = 0; i < 64; ++i)
+        {
+            uint8_t* block = static_cast<uint8_t*>(arena.Allocate(100 * 1024));
+            EXPECT_NE(block, nullptr);
+            EXPECT_GT(block, previous);
+            memset(block, 0xcd, 100 * 1024);
+            previous = block;
+        }
+        EXPECT_GE(arena.GetCommittedBytes(), arena.GetUsedBytes());
+        EXPECT_GT(arena.GetCommittedBytes(), 1024u * 1024u);
+
+        // Reset decommits above the watermark. 
+        const size_t used = arena.GetUsedBytes();
+        arena.Reset();
+        EXPECT_EQ(arena.GetUsedBytes(), 0u);
+        EXPECT_EQ(arena.GetCommittedBytes(), 1024u * 1024u);
+        EXPECT_EQ(arena.GetHighWaterBytes(), used);
+        EXPECT_EQ(arena.Allocate(1000), first);
+
+        EXPECT_EQ(arena.Allocate(kReserveSize), nullptr);
+    }
+
+    TEST(tiny_base, virtual_arena_huge_pages)
+    {
+        tf::VirtualArena arena(64 * 1024 * 1024, 0, true);
+        void* block = arena.Allocate(8 * 1024 * 1024);
+        EXPECT_NE(block, nullptr);
+        memset(block, 0, 8 * 1024 * 1024);
+        arena.Reset();
+        EXPECT_EQ(arena.GetCommittedBytes(), 0u);
+    }
+
+    TEST(tiny_base, tracking_allocator)
+    {
+        tf::TrackingAllocator alloc;
+        static const tf::MemoryTag kTag = tf::RegisterMemoryTag("unittest");
+        EXPECT_STREQ(tf::GetMemoryTagName(kTag), "unittest");
+
+        void* untagged = alloc.Allocate(100);
+        void* tagged[3] = {};
+        {
+            TF_MEMORY_TAG_SCOPE(kTag);
+            tagged[0] = alloc.Allocate(1000);
+            tagged[1] = alloc.Allocate(2000, 64);
+        }
+        tagged[2] = alloc.AllocateTagged(kTag, 3000);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(tagged[1]) % 64, 0u);
+
+        alloc.NextFrame();
+        alloc.Free(tagged[0]);
+        alloc.Free(tagged[1]);
+
+#if TF_MEMORY_TRACKING
+        const tf::TrackingAllocator::TagStatistics statistics = alloc.GetTagStatistics(kTag);
+        EXPECT_EQ(statistics.m_liveBytes, 3000);
+        EXPECT_EQ(statistics.m_liveCount, 1);
+        EXPECT_EQ(statistics.m_peakBytes, 6000);
+        EXPECT_EQ(statistics.m_allocationCount, 3u);
+        EXPECT_EQ(statistics.m_frameAllocationCount, 3u);
+        EXPECT_EQ(statistics.m_frameAllocatedBytes, 6000u);
+        EXPECT_EQ(alloc.GetTagStatistics(tf::kMemoryTagDefault).m_liveBytes, 100);
+
+        uint64_t histogram[tf::TrackingAllocator::kHistogramBucketCount];
+        alloc.GetSizeHistogram(histogram);
+        EXPECT_EQ(histogram[3], 1u);    // 100 bytes: (64, 128]
+        EXPECT_EQ(histogram[6], 1u);    // 1000 bytes: (512, 1024]
+
+        alloc.NextFrame();
+        EXPECT_EQ(alloc.GetTagStatistics(kTag).m_frameAllocationCount, 0u);
+
+        // A spike freed within the frame still raises the peak. 
+        alloc.Free(alloc.AllocateTagged(kTag, 100000));
+        EXPECT_EQ(alloc.GetTagStatistics(kTag).m_peakBytes, 103000);
+        EXPECT_EQ(&alloc.GetAllocator(), static_cast<tf::Allocator*>(&alloc));
+#else
+        EXPECT_EQ(&alloc.GetAllocator(), &tf::DefaultAllocator());
+#endif // TF_MEMORY_TRACKING 
+
+        alloc.Free(tagged[2]);
+        alloc.Free(untagged);
+    }
+
+    TEST(tiny_base, tracking_allocator_shared_slot)
+    {
+        struct CountingAllocator : public tf::Allocator
+        {
+            size_t                      m_allocationCount = 0;
+
+            virtual void* Allocate(size_t size, size_t alignment) override
+            {
+                ++m_allocationCount;
+                return tf::DefaultAllocator().Allocate(size, alignment);
+            }
+
+            virtual void Free(void* block) override
+            {
+                tf::DefaultAllocator().Free(block);
+            }
+        };
+        // Serials 0 and 8 apart share a thread local slot, each keeps the counters of this thread. 
+        CountingAllocator backing;
+        std::vector<std::unique_ptr<tf::TrackingAllocator>> allocators;
+        for (int i = 0; i < 9; ++i)
+        {
+            allocators.emplace_back(new tf::TrackingAllocator(backing));
+        }
+        for (int i = 0; i < 1000; ++i)
+        {
+            allocators[0]->Free(allocators[0]->Allocate(32));
+            allocators[8]->Free(allocators[8]->Allocate(32));
+        }
+#if TF_MEMORY_TRACKING
+        EXPECT_EQ(backing.m_allocationCount, 2000u + 2u);
+        EXPECT_EQ(allocators[0]->GetTagStatistics(tf::kMemoryTagDefault).m_allocationCount, 1000u);
+#else
+        EXPECT_EQ(backing.m_allocationCount, 2000u);
+#endif // TF_MEMORY_TRACKING 
+    }
+
+    TEST(tiny_base, sampling_allocator)
+    {
+        static const size_t kInterval   = 4096;
+        static const size_t kBlockSize  = 64;
+        static const size_t kBlockCount = 64 * 1024;
+
+        tf::SamplingAllocator alloc(tf::DefaultAllocator(), kInterval);
+        std::vector<void*> blocks(kBlockCount);
+        for (size_t i = 0; i < kBlockCount; ++i)
+        {
+            blocks[i] = alloc.Allocate(kBlockSize);
+        }
+
+        // One sample per interval on average, and the weights give an unbiased estimate. 
+        const double expectedSamples = static_cast<double>(kBlockSize * kBlockCount) / kInterval;
+        EXPECT_GT(alloc.GetSampleCount(), expectedSamples * 0.8);
+        EXPECT_LT(alloc.GetSampleCount(), expectedSamples * 1.2);
+        const double estimate = static_cast<double>(alloc.GetEstimatedLiveBytes());
+        EXPECT_GT(estimate, kBlockSize * kBlockCount * 0.8);
+        EXPECT_LT(estimate, kBlockSize * kBlockCount * 1.2);
+
+        EXPECT_TRUE(alloc.WriteFoldedStacks("tiny_base_sampling.folded"));
+        EXPECT_TRUE(alloc.WriteHeapProfile("tiny_base_sampling.heap"));
+        FILE* file = fopen("tiny_base_sampling.folded", "r");
+        ASSERT_NE(file, nullptr);
+        char line[4096] = {};
+        EXPECT_NE(fgets(line, sizeof(line), file), nullptr);
+        EXPECT_NE(strrchr(line, ' '), nullptr);
+        fclose(file);
+        remove("tiny_base_sampling.folded");
+        remove("tiny_base_sampling.heap");
+
+        for (size_t i = 0; i < kBlockCount; ++i)
+        {
+            alloc.Free(blocks[i]);
+        }
+        EXPECT_EQ(alloc.GetLiveSampleCount(), 0u);
+        EXPECT_EQ(alloc.GetEstimatedLiveBytes(), 0u);
+    }
+
+    TEST(tiny_base, sampling_allocator_churn)
+    {
+        struct LargestAllocator : public tf::Allocator
+        {
+            size_t                      m_largest = 0;
+
+            virtual void* Allocate(size_t size, size_t alignment) override
+            {
+                m_largest = (size > m_largest) ? size : m_largest;
+                return tf::DefaultAllocator().Allocate(size, alignment);
+            }
+
+            virtual void Free(void* block) override
+            {
+                tf::DefaultAllocator().Free(block);
+            }
+        };
+        // Every allocation is sampled but few are live at once, freed records are reused. 
+        LargestAllocator backing;
+        tf::SamplingAllocator alloc(backing, 1);
+        void* blocks[16] = {};
+        for (size_t i = 0; i < 100000; ++i)
+        {
+            alloc.Free(blocks[i % 16]);
+            blocks[i % 16] = alloc.Allocate(64);
+        }
+        const size_t sampleCount = alloc.GetSampleCount();
+        EXPECT_EQ(sampleCount, 100000u);
+        EXPECT_EQ(alloc.GetLiveSampleCount(), 16u);
+        EXPECT_LT(backing.m_largest, 1024u * 1024u);
+
+        // Freed samples still count in the profile totals. 
+        EXPECT_TRUE(alloc.WriteHeapProfile("tiny_base_sampling_churn.heap"));
+        FILE* file = fopen("tiny_base_sampling_churn.heap", "r");
+        ASSERT_NE(file, nullptr);
+        unsigned long long totals[4] = {};
+        EXPECT_EQ(fscanf(file, "heap profile: %llu: %llu [%llu: %llu]", &totals[0], &totals[1], &totals[2], &totals[3]), 4);
+        fclose(file);
+        remove("tiny_base_sampling_churn.heap");
+        EXPECT_EQ(totals[0], 16u);
+        EXPECT_EQ(totals[2], sampleCount);
+        EXPECT_EQ(totals[3], sampleCount * 64);
+
+        for (void* block : blocks)
+        {
+            alloc.Free(block);
+        }
+        EXPECT_EQ(alloc.GetLiveSampleCount(), 0u);
+
+        // Instances with very different intervals on one thread keep their own rates. 
+        tf::SamplingAllocator dense(tf::DefaultAllocator(), 1);
+        tf::SamplingAllocator sparse(tf::DefaultAllocator(), static_cast<size_t>(1) << 40);
+        for (int i = 0; i < 1000; ++i)
+        {
+            dense.Free(dense.Allocate(64));
+            sparse.Free(sparse.Allocate(64));
+        }
+        EXPECT_EQ(dense.GetSampleCount(), 1000u);
+        EXPECT_EQ(sparse.GetSampleCount(), 0u);
+    }
+
+    TEST(tiny_base, reallocate)
+    {
+        // Default fallback keeps the contents when the block moves. 
+        tf::PoolAllocator<64> pool;
+        uint8_t* block = static_cast<uint8_t*>(pool.Reallocate(nullptr, 0, 32));
+        ASSERT_NE(block, nullptr);
+        memset(block, 0x5a, 32);
+        EXPECT_EQ(pool.Reallocate(block, 32, 64), block);
+        EXPECT_EQ(pool.Reallocate(block, 64, 0), nullptr);
+        EXPECT_EQ(pool.GetUsedCount(), 0u);
+
+        uint8_t* heapBlock = static_cast<uint8_t*>(tf::DefaultAllocator().Allocate(100));
+        for (int i = 0; i < 100; ++i)
+        {
+            heapBlock[i] = static_cast<uint8_t>(i);
+        }
+        heapBlock = static_cast<uint8_t*>(tf::DefaultAllocator().Reallocate(heapBlock, 100, 100000));
+        ASSERT_NE(heapBlock, nullptr);
+        for (int i = 0; i < 100; ++i)
+        {
+            EXPECT_EQ(heapBlock[i], static_cast<uint8_t>(i));
+        }
+        tf::DefaultAllocator().Free(heapBlock);
+
+        heapBlock = static_cast<uint8_t*>(tf::DefaultAllocator().Allocate(200, 256));
+        heapBlock[199] = 199;
+        heapBlock = static_cast<uint8_t*>(tf::DefaultAllocator().Reallocate(heapBlock, 200, 100000, 256));
+        ASSERT_NE(heapBlock, nullptr);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(heapBlock) % 256, 0u);
+        EXPECT_EQ(heapBlock[199], 199);
+        tf::DefaultAllocator().Free(heapBlock);
+
+        // Arenas extend only the most recent allocation. 
+        tf::FrameArenaAllocator arena(1024);
+        void* a = arena.Allocate(100);
+        EXPECT_TRUE(arena.TryExpandInPlace(a, 100, 500));
+        EXPECT_EQ(arena.GetUsedBytes(), 500u);
+        EXPECT_TRUE(arena.TryExpandInPlace(a, 500, 200));
+        EXPECT_EQ(arena.GetUsedBytes(), 200u);
+        EXPECT_FALSE(arena.TryExpandInPlace(a, 200, 2000));
+        void* b = arena.Allocate(16);
+        EXPECT_FALSE(arena.TryExpandInPlace(a, 200, 300));
+        EXPECT_TRUE(arena.TryExpandInPlace(b, 16, 32));
+
+        tf::VirtualArena virtualArena(16 * 1024 * 1024);
+        void* c = virtualArena.Allocate(1000);
+        EXPECT_TRUE(virtualArena.TryExpandInPlace(c, 1000, 8 * 1024 * 1024));
+        EXPECT_GE(virtualArena.GetCommittedBytes(), 8u * 1024 * 1024);
+        EXPECT_FALSE(virtualArena.TryExpandInPlace(c, 8 * 1024 * 1024, 32 * 1024 * 1024));
+
+        // TLSF absorbs a free neighbour and gives the tail back on shrink. 
+        std::vector<uint8_t> memory(1024 * 1024);
+        tf::TlsfAllocator tlsf(memory.data(), memory.size());
+        void* d = tlsf.Allocate(1000);
+        void* e = tlsf.Allocate(1000);
+        void* f = tlsf.Allocate(1000);
+        EXPECT_FALSE(tlsf.TryExpandInPlace(d, 1000, 2000));
+        tlsf.Free(e);
+        EXPECT_TRUE(tlsf.TryExpandInPlace(d, 1000, 2000));
+        EXPECT_TRUE(tlsf.Validate());
+        EXPECT_TRUE(tlsf.TryExpandInPlace(d, 2000, 100));
+        EXPECT_TRUE(tlsf.Validate());
+        EXPECT_TRUE(tlsf.TryExpandInPlace(f, 1000, 500 * 1024));
+        EXPECT_TRUE(tlsf.Validate());
+        tlsf.Free(d);
+        tlsf.Free(f);
+        EXPECT_EQ(tlsf.GetStatistics().m_freeBlockCount, 1u);
+    }
+
+    // Grows a buffer by 1.5x like a vector would, with an unrelated allocation between some of the steps. 
+    // Returns the number of bytes the reallocations had to copy. 
+    static uint64_t MeasureGrowthCopyBytes(tf::Allocator& alloc, size_t maxSize, int interleave, uint64_t& naiveCopyBytes)
+    {
+        std::vector<void*> others;
+        uint64_t copyBytes = 0;
+        naiveCopyBytes = 0;
+
+        size_t size = 64;
+        void* block = alloc.Allocate(size);
+        for (int step = 0; size < maxSize; ++step)
+        {
+            const size_t newSize = size + size / 2;
+            void* newBlock = alloc.Reallocate(block, size, newSize);
+            EXPECT_NE(newBlock, nullptr);
+            if (newBlock != block)
+            {
+                copyBytes += size;
+            }
+            naiveCopyBytes += size;
+            block = newBlock;
+            size  = newSize;
+            if (interleave > 0 && step % interleave == 0)
+            {
+                others.push_back(alloc.Allocate(48));
+            }
+        }
+        alloc.Free(block);
+        for (void* other : others)
+        {
+            alloc.Free(other);
+        }
+        return copyBytes;
+    }
+
+    TEST(tiny_base, reallocate_growth_copy_bytes)
+    {
+        static const size_t kMaxSize = 8 * 1024 * 1024;
+
+        std::vector<uint8_t> memory(64 * 1024 * 1024);
+        tf::TlsfAllocator tlsf(memory.data(), memory.size());
+        tf::VirtualArena virtualArena(256 * 1024 * 1024);
+        tf::FrameArenaAllocator frameArena(32 * 1024 * 1024);
+
+        struct Case
+        {
+            const char*     m_name;
+            tf::Allocator*  m_alloc;
+        } cases[] =
+        {
+            { "default",        &tf::DefaultAllocator() },
+            { "tlsf",           &tlsf },
+            { "virtual arena",  &virtualArena },
+            { "frame arena",    &frameArena },
+        };
+
+        for (const Case& c : cases)
+        {
+            for (int interleave = 0; interleave <= 4; interleave += 4)
+            {
+                uint64_t naiveCopyBytes = 0;
+                const auto begin = std::chrono::high_resolution_clock::now();
+                const uint64_t copyBytes = MeasureGrowthCopyBytes(*c.m_alloc, kMaxSize, interleave, naiveCopyBytes);
+                const auto end = std::chrono::high_resolution_clock::now();
+                printf("growth to %zu bytes (%s, interleave %d): copied %llu of %llu bytes (%.1f%% saved), %.1f us\n",
+                       kMaxSize, c.m_name, interleave, static_cast<unsigned long long>(copyBytes), static_cast<unsigned long long>(naiveCopyBytes),
+                       100.0 * static_cast<double>(naiveCopyBytes - copyBytes) / static_cast<double>(naiveCopyBytes),
+                       std::chrono::duration<double, std::micro>(end - begin).count());
+                EXPECT_LE(copyBytes, naiveCopyBytes);
+            }
+            frameArena.Reset();
+            virtualArena.Reset();
+        }
+        EXPECT_TRUE(tlsf.Validate());
+    }
+
+
+    TEST(tiny_base, allocate_batch)
+    {
+        void* blocks[100];
+
+        tf::PoolAllocator<32> pool;
+        EXPECT_EQ(pool.AllocateBatch(100, 32, TF_DEFAULT_ALIGNMENT_SIZE, blocks), 100u);
+        EXPECT_EQ(pool.GetUsedCount(), 100u);
+        std::vector<void*> sorted(blocks, blocks + 100);
+        std::sort(sorted.begin(), sorted.end());
+        EXPECT_TRUE(std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end());
+        pool.FreeBatch(blocks, 100);
+        EXPECT_EQ(pool.GetUsedCount(), 0u);
+
+        tf::FrameArenaAllocator arena(1024);
+        EXPECT_EQ(arena.AllocateBatch(10, 20, 32, blocks), 10u);
+        for (int i = 0; i < 10; ++i)
+        {
+            EXPECT_EQ(reinterpret_cast<uintptr_t>(blocks[i]) % 32, 0u);
+            EXPECT_EQ(static_cast<uint8_t*>(blocks[i]) - static_cast<uint8_t*>(blocks[0]), i * 32);
+        }
+        // A batch larger than the region chains overflow blocks. 
+        EXPECT_EQ(arena.AllocateBatch(100, 64, TF_DEFAULT_ALIGNMENT_SIZE, blocks), 100u);
+        EXPECT_GT(arena.GetOverflowCount(), 0u);
+
+        tf::VirtualArena virtualArena(1024 * 1024);
+        EXPECT_EQ(virtualArena.AllocateBatch(100, 1000, TF_DEFAULT_ALIGNMENT_SIZE, blocks), 100u);
+        EXPECT_EQ(virtualArena.GetUsedBytes(), 99u * 1008 + 1000);
+        EXPECT_EQ(virtualArena.AllocateBatch(100, 16 * 1024, TF_DEFAULT_ALIGNMENT_SIZE, blocks), 57u);
+
+        tf::ThreadCachingAllocator caching;
+        EXPECT_EQ(caching.AllocateBatch(100, 48, TF_DEFAULT_ALIGNMENT_SIZE, blocks), 100u);
+        caching.FreeBatch(blocks, 50);
+        EXPECT_EQ(caching.AllocateBatch(50, 40, TF_DEFAULT_ALIGNMENT_SIZE, blocks), 50u);
+        EXPECT_EQ(caching.GetThreadStatistics().m_hitCount, 50u);
+        caching.FreeBatch(blocks, 100);
+
+        // Runs of two size classes and large blocks from the backing allocator in one batch. 
+        tf::SlabAllocator slab(16 * tf::SlabAllocator::kPageSize);
+        EXPECT_EQ(slab.AllocateBatch(40, 64, TF_DEFAULT_ALIGNMENT_SIZE, blocks), 40u);
+        EXPECT_EQ(slab.AllocateBatch(40, 256, TF_DEFAULT_ALIGNMENT_SIZE, blocks + 40), 40u);
+        EXPECT_EQ(slab.AllocateBatch(20, 64 * 1024, TF_DEFAULT_ALIGNMENT_SIZE, blocks + 80), 20u);
+        EXPECT_EQ(slab.GetUsedBytes(), 40u * 64 + 40u * 256);
+        void* single = blocks[10];
+        blocks[10] = nullptr;
+        slab.FreeBatch(blocks, 100);
+        EXPECT_EQ(slab.GetUsedBytes(), 64u);
+        slab.Free(single);
+        EXPECT_EQ(slab.GetUsedBytes(), 0u);
+
+        std::vector<uint8_t> memory(64 * 1024);
+        tf::TlsfAllocator tlsf(memory.data(), memory.size());
+        EXPECT_LT(tlsf.AllocateBatch(100, 1024, TF_DEFAULT_ALIGNMENT_SIZE, blocks), 100u);
+    }
+
+    // Allocates and frees kBatchSize blocks per iteration, one call per block or one per batch. 
+    static double MeasureBatchThroughput(tf::Allocator& alloc, bool batched, void (*reset)(tf::Allocator&))
+    {
+        static const int    kIterationCount = 2000;
+        static const size_t kBatchSize      = 256;
+        void* blocks[kBatchSize];
+
+        const auto begin = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < kIterationCount; ++i)
+        {
+            if (batched)
+            {
+                alloc.AllocateBatch(kBatchSize, 64, TF_DEFAULT_ALIGNMENT_SIZE, blocks);
+                alloc.FreeBatch(blocks, kBatchSize);
+            }
+            else
+            {
+                for (size_t j = 0; j < kBatchSize; ++j)
+                {
+                    blocks[j] = alloc.Allocate(64);
+                }
+                for (size_t j = 0; j < kBatchSize; ++j)
+                {
+                    alloc.Free(blocks[j]);
+                }
+            }
+            reset(alloc);
+        }
+        const auto end = std::chrono::high_resolution_clock::now();
+
+        const double seconds = std::chrono::duration<double>(end - begin).count();
+        return (kIterationCount * kBatchSize) / seconds;
+    }
+
+    TEST(tiny_base, allocate_batch_throughput)
+    {
+        tf::PoolAllocator<64> pool;
+        tf::FrameArenaAllocator arena(64 * 1024);
+        tf::ThreadCachingAllocator caching;
+        void (*noReset)(tf::Allocator&) = [](tf::Allocator&) {};
+        void (*arenaReset)(tf::Allocator&) = [](tf::Allocator& alloc) { static_cast<tf::FrameArenaAllocator&>(alloc).Reset(); };
+
+        printf("blocks per second (single / batch): pool %.0f / %.0f, frame arena %.0f / %.0f, thread caching %.0f / %.0f\n",
+               MeasureBatchThroughput(pool, false, noReset), MeasureBatchThroughput(pool, true, noReset),
+               MeasureBatchThroughput(arena, false, arenaReset), MeasureBatchThroughput(arena, true, arenaReset),
+               MeasureBatchThroughput(caching, false, noReset), MeasureBatchThroughput(caching, true, noReset));
+        EXPECT_EQ(pool.GetUsedCount(), 0u);
+    }
+
+
+    TEST(tiny_base, static_allocator)
+    {
+        tf::StaticAllocator<tf::HeapAllocatorPolicy> heap;
+        void* block = heap.Allocate(100, 64);
+        ASSERT_NE(block, nullptr);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % 64, 0u);
+        heap.Free(block);
+
+        tf::StaticAllocator<tf::ConcreteAllocatorPolicy<tf::PoolAllocator<32> > > pool;
+        void* a = pool.Allocate(32);
+        void* b = pool.Allocate(16);
+        EXPECT_NE(a, b);
+        EXPECT_EQ(pool.GetPolicy().GetAllocator().GetUsedCount(), 2u);
+        pool.Free(a);
+        pool.Free(b);
+        EXPECT_EQ(pool.GetPolicy().GetAllocator().GetUsedCount(), 0u);
+
+        // Arguments are forwarded to the wrapped allocator. 
+        tf::StaticAllocator<tf::ConcreteAllocatorPolicy<tf::FrameArenaAllocator> > arena(1024);
+        EXPECT_NE(arena.Allocate(100), nullptr);
+        EXPECT_EQ(arena.GetPolicy().GetAllocator().GetUsedBytes(), 100u);
+
+        tf::PoolAllocator<64> backing;
+        tf::StaticAllocator<tf::VirtualAllocatorPolicy> virtualAlloc(backing);
+        virtualAlloc.Free(virtualAlloc.Allocate(64));
+        EXPECT_EQ(backing.GetCapacity(), tf::PoolAllocator<64>::GetChunkBlockCount());
+
+        // The adapter is usable wherever a tf::Allocator is expected. 
+        tf::StaticAllocatorAdapter<tf::ConcreteAllocatorPolicy<tf::PoolAllocator<64> > > adapter;
+        tf::Allocator& alloc = adapter;
+        void* c = alloc.Allocate(64);
+        EXPECT_EQ(adapter.GetStaticAllocator().GetPolicy().GetAllocator().GetUsedCount(), 1u);
+        alloc.Free(c);
+    }
+
+    TEST(tiny_base, static_allocator_throughput)
+    {
+        tf::PoolAllocator<64> virtualPool;
+        tf::StaticAllocator<tf::ConcreteAllocatorPolicy<tf::PoolAllocator<64> > > staticPool;
+        tf::StaticAllocator<tf::HeapAllocatorPolicy> staticHeap;
+
+        const double virtualPoolRate = MeasureAllocFreeThroughput(static_cast<tf::Allocator&>(virtualPool), 64);
+        const double staticPoolRate  = MeasureAllocFreeThroughput(staticPool, 64);
+        const double virtualHeapRate = MeasureAllocFreeThroughput(tf::DefaultAllocator(), 64);
+        const double staticHeapRate  = MeasureAllocFreeThroughput(staticHeap, 64);
+        printf("alloc/free pairs per second (virtual / static): pool %.0f / %.0f, heap %.0f / %.0f\n",
+               virtualPoolRate, staticPoolRate, virtualHeapRate, staticHeapRate);
+        EXPECT_GT(staticPoolRate, 0.0);
+        EXPECT_GT(staticHeapRate, 0.0);
+    }
+
+
+    TEST(tiny_base, slab_allocator)
+    {
+        const size_t pageSize       = tf::SlabAllocator::kPageSize;
+        const size_t sizeClassCount = tf::SlabAllocator::kSizeClassCount;
+
+        // Every size maps to the smallest class that holds it. 
+        for (size_t size = 1; size <= tf::SlabAllocator::kMaxSmallSize; ++size)
+        {
+            const size_t sizeClass = tf::SlabAllocator::GetSizeClass(size);
+            ASSERT_LT(sizeClass, sizeClassCount);
+            EXPECT_GE(tf::SlabAllocator::GetSizeClassSize(sizeClass), size);
+            EXPECT_TRUE(sizeClass == 0 || tf::SlabAllocator::GetSizeClassSize(sizeClass - 1) < size);
+        }
+
+        tf::SlabAllocator alloc(64 * 1024 * 1024);
+        EXPECT_EQ(alloc.GetReservedBytes(), 64u * 1024 * 1024);
+        EXPECT_EQ(alloc.GetCommittedBytes(), 0u);
+
+        void* a = alloc.Allocate(24);
+        void* b = alloc.Allocate(24);
+        EXPECT_EQ(static_cast<uint8_t*>(b) - static_cast<uint8_t*>(a), 32);
+        EXPECT_EQ(alloc.GetBlockSize(a), 32u);
+        EXPECT_EQ(alloc.GetUsedBytes(), 64u);
+        EXPECT_EQ(alloc.GetCommittedBytes(), pageSize);
+        EXPECT_TRUE(alloc.TryExpandInPlace(a, 24, 32));
+        EXPECT_FALSE(alloc.TryExpandInPlace(a, 32, 33));
+        alloc.Free(a);
+        EXPECT_EQ(alloc.Allocate(30), a);
+
+        void* aligned = alloc.Allocate(100, 256);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % 256, 0u);
+        alloc.Free(aligned);
+
+        // Large blocks come from the backing allocator. 
+        void* large = alloc.Allocate(100000);
+        ASSERT_NE(large, nullptr);
+        EXPECT_EQ(alloc.GetBlockSize(large), 0u);
+        alloc.Free(large);
+
+        // Empty pages are decommitted, apart from the last one of each class. 
+        std::vector<void*> blocks;
+        for (int i = 0; i < 10000; ++i)
+        {
+            blocks.push_back(alloc.Allocate(64));
+        }
+        const size_t committed = alloc.GetCommittedBytes();
+        EXPECT_GE(committed, 10000u * 64);
+        for (void* block : blocks)
+        {
+            alloc.Free(block);
+        }
+        EXPECT_EQ(alloc.GetCommittedBytes(), 3 * pageSize);
+
+        alloc.Free(a);
+        alloc.Free(b);
+        EXPECT_EQ(alloc.GetUsedBytes(), 0u);
+    }
+
+    TEST(tiny_base, slab_allocator_threads)
+    {
+        static const int kThreadCount = 4;
+        tf::SlabAllocator alloc(256 * 1024 * 1024);
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kThreadCount; ++t)
+        {
+            threads.emplace_back([&alloc, t]()
+            {
+                std::mt19937 random(t);
+                std::vector<void*> live(512, nullptr);
+                for (int i = 0; i < 100000; ++i)
+                {
+                    void*& slot = live[random() % live.size()];
+                    if (slot)
+                    {
+                        alloc.Free(slot);
+                        slot = nullptr;
+                    }
+                    else
+                    {
+                        const size_t size = 1 + random() % 2048;
+                        slot = alloc.Allocate(size);
+                        memset(slot, t, size);
+                    }
+                }
+                for (void* block : live)
+                {
+                    alloc.Free(block);
+                }
+            });
+        }
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+        EXPECT_EQ(alloc.GetUsedBytes(), 0u);
+    }
+
+    TEST(tiny_base, slab_allocator_default)
+    {
+        tf::SlabAllocator slab;
+        tf::Allocator& previous = tf::SetDefaultAllocator(slab);
+        EXPECT_EQ(&tf::DefaultAllocator(), &slab);
+
+        // Allocators created afterwards use the slab allocator as their backing. 
+        {
+            tf::PoolAllocator<64> pool;
+            EXPECT_NE(pool.Allocate(64), nullptr);
+            EXPECT_EQ(slab.GetCommittedBytes(), static_cast<size_t>(tf::SlabAllocator::kPageSize));
+        }
+
+        EXPECT_EQ(&tf::SetDefaultAllocator(previous), &slab);
+        EXPECT_EQ(&tf::DefaultAllocator(), &previous);
+    }
+
+    TEST(tiny_base, slab_allocator_latency)
+    {
+        static const int    kOperationCount = 200000;
+        static const size_t kLiveCount      = 4096;
+
+        tf::SlabAllocator slab;
+        tf::Allocator* allocators[] = { &slab, &tf::DefaultAllocator() };
+        const char* names[] = { "slab", "default" };
+        for (size_t a = 0; a < TF_ARRAY_SIZE(allocators); ++a)
+        {
+            tf::Allocator& alloc = *allocators[a];
+            std::mt19937 random(12345);
+            std::vector<void*> live(kLiveCount, nullptr);
+
+            const auto begin = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < kOperationCount; ++i)
+            {
+                void*& slot = live[random() % kLiveCount];
+                if (slot)
+                {
+                    alloc.Free(slot);
+                    slot = nullptr;
+                }
+                else
+                {
+                    slot = alloc.Allocate(16 + random() % 1024);
+                }
+            }
+            const auto end = std::chrono::high_resolution_clock::now();
+            printf("%s: %.1f ns per operation\n", names[a], std::chrono::duration<double, std::nano>(end - begin).count() / kOperationCount);
+            if (&alloc == &slab)
+            {
+                printf("slab: used %zu bytes, committed %zu bytes\n", slab.GetUsedBytes(), slab.GetCommittedBytes());
+            }
+
+            for (void* block : live)
+            {
+                alloc.Free(block);
+            }
+        }
+        EXPECT_EQ(slab.GetUsedBytes(), 0u);
+    }
+
+
+    TEST(tiny_base, stl_allocator)
+    {
+        // Node based containers on a pool. 
+        tf::PoolAllocator<64> pool;
+        {
+            std::list<int, tf::StlAllocator<int> > list{ tf::StlAllocator<int>(pool) };
+            for (int i = 0; i < 100; ++i)
+            {
+                list.push_back(i);
+            }
+            EXPECT_EQ(pool.GetUsedCount(), 100u);
+            EXPECT_EQ(list.back(), 99);
+        }
+        EXPECT_EQ(pool.GetUsedCount(), 0u);
+
+        // Per-frame scratch containers on a frame arena. 
+        tf::FrameArenaAllocator arena(64 * 1024);
+        typedef std::basic_string<wchar_t, std::char_traits<wchar_t>, tf::StlAllocator<wchar_t> > ArenaString;
+        ArenaString name(L"tiny framework application name", tf::StlAllocator<wchar_t>(arena));
+        EXPECT_GT(arena.GetUsedBytes(), 0u);
+
+        typedef tf::StlAllocator<std::pair<const int, int> > MapAllocator;
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, MapAllocator> map(16, std::hash<int>(), std::equal_to<int>(), MapAllocator(arena));
+        const size_t usedBytes = arena.GetUsedBytes();
+        for (int i = 0; i < 1000; ++i)
+        {
+            map[i] = i * 2;
+        }
+        EXPECT_EQ(map[500], 1000);
+        EXPECT_GT(arena.GetUsedBytes(), usedBytes);
+
+        // Allocators compare equal when they share the wrapped allocator, also across rebinds. 
+        EXPECT_TRUE(tf::StlAllocator<int>(arena) == tf::StlAllocator<double>(arena));
+        EXPECT_TRUE(tf::StlAllocator<int>(arena) != tf::StlAllocator<int>(pool));
+        EXPECT_EQ(&map.get_allocator().GetAllocator(), &arena);
+
+        const tf::StlAllocator<int> arenaAllocator(arena);
+        std::vector<int, tf::StlAllocator<int> > moved(arenaAllocator);
+        moved = std::vector<int, tf::StlAllocator<int> >(100, 1, tf::StlAllocator<int>(tf::DefaultAllocator()));
+        EXPECT_EQ(&moved.get_allocator().GetAllocator(), &tf::DefaultAllocator());
+    }
+
+#if defined(TF_HAS_MEMORY_RESOURCE)
+    TEST(tiny_base, memory_resource)
+    {
+        tf::FrameArenaAllocator arena(64 * 1024);
+        tf::MemoryResource resource(arena);
+        tf::MemoryResource other(arena);
+        tf::MemoryResource heap;
+        EXPECT_TRUE(resource.is_equal(other));
+        EXPECT_FALSE(resource.is_equal(heap));
+
+        std::pmr::vector<std::pmr::string> strings(&resource);
+        for (int i = 0; i < 100; ++i)
+        {
+            strings.emplace_back(std::to_string(i) + " some text longer than the small string buffer");
+        }
+        EXPECT_EQ(strings[42].get_allocator().resource(), &resource);
+        EXPECT_GT(arena.GetUsedBytes(), 100u * 40);
+
+        void* aligned = resource.allocate(100, 256);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % 256, 0u);
+        resource.deallocate(aligned, 100, 256);
+    }
+#endif
+
+
+    TEST(tiny_base, relocatable_allocator)
+    {
+        typedef tf::RelocatableAllocator::Handle Handle;
+        const Handle invalidHandle = tf::RelocatableAllocator::kInvalidHandle;
+        tf::RelocatableAllocator alloc(4096, 64);
+
+        Handle handles[8];
+        for (int i = 0; i < 8; ++i)
+        {
+            handles[i] = alloc.Allocate(100);
+            ASSERT_NE(handles[i], invalidHandle);
+            memset(alloc.Resolve(handles[i]), i, 100);
+        }
+        EXPECT_EQ(alloc.GetSize(handles[0]), 112u);
+        EXPECT_TRUE(alloc.IsCompact());
+
+        // Punch holes, then a large block only fits after compaction. 
+        for (int i = 0; i < 8; i += 2)
+        {
+            alloc.Free(handles[i]);
+        }
+        EXPECT_FALSE(alloc.IsValid(handles[0]));
+        EXPECT_EQ(alloc.Resolve(handles[0]), nullptr);
+        EXPECT_FALSE(alloc.IsCompact());
+        const size_t footprint = alloc.GetFootprintBytes();
+        EXPECT_EQ(alloc.Allocate(3500), invalidHandle);
+
+        // A small budget moves one block per step. 
+        EXPECT_EQ(alloc.Defragment(1), 128u);
+        EXPECT_FALSE(alloc.IsCompact());
+        while (!alloc.IsCompact())
+        {
+            alloc.Defragment(1);
+        }
+        EXPECT_LT(alloc.GetFootprintBytes(), footprint);
+        EXPECT_EQ(alloc.GetFootprintBytes(), alloc.GetUsedBytes());
+        for (int i = 1; i < 8; i += 2)
+        {
+            const uint8_t* data = alloc.Resolve<uint8_t>(handles[i]);
+            EXPECT_EQ(data[0], i);
+            EXPECT_EQ(data[99], i);
+        }
+        const Handle large = alloc.Allocate(3500);
+        EXPECT_NE(large, invalidHandle);
+        alloc.Free(large);
+
+        // Holes are reused first-fit once the top is full. 
+        Handle filler = alloc.Allocate(alloc.GetCapacity() - alloc.GetFootprintBytes() - 16);
+        ASSERT_NE(filler, invalidHandle);
+        void* hole = alloc.Resolve(handles[3]);
+        alloc.Free(handles[3]);
+        handles[3] = alloc.Allocate(40);
+        EXPECT_EQ(alloc.Resolve(handles[3]), hole);
+
+        // Generations reject handles to a reused slot. 
+        const Handle stale = handles[5];
+        alloc.Free(handles[5]);
+        const Handle reused = alloc.Allocate(16);
+        const Handle indexMask = tf::RelocatableAllocator::kMaxHandleCount - 1;
+        EXPECT_EQ(reused & indexMask, stale & indexMask);
+        EXPECT_FALSE(alloc.IsValid(stale));
+        EXPECT_TRUE(alloc.IsValid(reused));
+    }
+
+    TEST(tiny_base, relocatable_allocator_long_session)
+    {
+        static const size_t kCapacity   = 16 * 1024 * 1024;
+        static const int    kFrameCount = 1000;
+        static const size_t kLiveCount  = 1024;
+        static const size_t kBudget     = 256 * 1024;
+
+        size_t footprints[2] = {};
+        for (int defragment = 0; defragment < 2; ++defragment)
+        {
+            typedef tf::RelocatableAllocator::Handle Handle;
+            const Handle invalidHandle = tf::RelocatableAllocator::kInvalidHandle;
+            tf::RelocatableAllocator alloc(kCapacity, kLiveCount);
+            std::vector<Handle> live(kLiveCount, invalidHandle);
+            std::mt19937 random(12345);
+            size_t failures = 0;
+            size_t movedBytes = 0;
+            size_t peakFootprint = 0;
+
+            const auto begin = std::chrono::high_resolution_clock::now();
+            for (int frame = 0; frame < kFrameCount; ++frame)
+            {
+                for (int i = 0; i < 32; ++i)
+                {
+                    const size_t slot = random() % kLiveCount;
+                    if (live[slot] != invalidHandle)
+                    {
+                        const uint8_t* data = alloc.Resolve<uint8_t>(live[slot]);
+                        ASSERT_EQ(data[0], static_cast<uint8_t>(slot));
+                        alloc.Free(live[slot]);
+                    }
+                    const size_t size = 64 + random() % 8192;
+                    live[slot] = alloc.Allocate(size);
+                    if (live[slot] == invalidHandle)
+                    {
+                        failures++;
+                        continue;
+                    }
+                    *alloc.Resolve<uint8_t>(live[slot]) = static_cast<uint8_t>(slot);
+                }
+                if (defragment)
+                {
+                    movedBytes += alloc.Defragment(kBudget);
+                }
+                peakFootprint = (alloc.GetFootprintBytes() > peakFootprint) ? alloc.GetFootprintBytes() : peakFootprint;
+            }
+            const auto end = std::chrono::high_resolution_clock::now();
+            printf("%s: peak footprint %zu bytes, used %zu bytes, holes %zu bytes, failed allocations %zu, moved %zu bytes, %.2f ms\n",
+                   defragment ? "defragment 256KB/frame" : "no defragment", peakFootprint, alloc.GetUsedBytes(), alloc.GetHoleBytes(),
+                   failures, movedBytes, std::chrono::duration<double, std::milli>(end - begin).count());
+            footprints[defragment] = peakFootprint;
+
+            // Once the churn stops, a few steps compact the heap completely. 
+            while (!alloc.IsCompact())
+            {
+                alloc.Defragment(kBudget);
+            }
+            EXPECT_EQ(alloc.GetFootprintBytes(), alloc.GetUsedBytes());
+            for (size_t slot = 0; slot < kLiveCount; ++slot)
+            {
+                if (live[slot] != invalidHandle)
+                {
+                    EXPECT_EQ(*alloc.Resolve<uint8_t>(live[slot]), static_cast<uint8_t>(slot));
+                }
+            }
+        }
+        EXPECT_LE(footprints[1], footprints[0]);
+    }
+
+    TEST(tiny_base, mirrored_ring_buffer)
+    {
+        tf::MirroredRingBuffer ring(64 * 1024);
+        ASSERT_TRUE(ring.IsValid());
+        const size_t capacity = ring.GetCapacity();
+        EXPECT_GE(capacity, static_cast<size_t>(64 * 1024));
+        EXPECT_EQ(capacity & (capacity - 1), static_cast<size_t>(0));
+
+        // Both mappings alias the same memory. 
+        ring.GetData()[3] = 0x5a;
+        EXPECT_EQ(ring.GetData()[capacity + 3], 0x5a);
+        ring.GetData()[capacity + 7] = 0xa5;
+        EXPECT_EQ(ring.GetData()[7], 0xa5);
+        ring.GetData()[3] = 0;
+        ring.GetData()[7] = 0;
+
+        // Variable size records wrap around the end and are still read in one piece. 
+        std::vector<uint8_t> source(5000);
+        std::vector<uint8_t> expected;
+        size_t size = 0;
+        uint32_t sequence = 0;
+        uint32_t consumed = 0;
+        for (int round = 0; round < 2000; ++round)
+        {
+            const size_t recordSize = 1 + (round * 977) % source.size();
+            for (size_t i = 0; i < recordSize; ++i)
+            {
+                source[i] = static_cast<uint8_t>(sequence + i);
+            }
+            if (!ring.Write(source.data(), recordSize))
+            {
+                // Full, drain half of what is pending. 
+                const size_t used = ring.GetUsedBytes();
+                while (ring.GetUsedBytes() > used / 2)
+                {
+                    const uint8_t* record = static_cast<const uint8_t*>(ring.BeginRead(size));
+                    ASSERT_NE(record, nullptr);
+                    for (size_t i = 0; i < size; ++i)
+                    {
+                        ASSERT_EQ(record[i], static_cast<uint8_t>(consumed + i));
+                    }
+                    ring.EndRead();
+                    consumed++;
+                }
+                ASSERT_TRUE(ring.Write(source.data(), recordSize));
+            }
+            sequence++;
+        }
+        while (const uint8_t* record = static_cast<const uint8_t*>(ring.BeginRead(size)))
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                ASSERT_EQ(record[i], static_cast<uint8_t>(consumed + i));
+            }
+            ring.EndRead();
+            consumed++;
+        }
+        EXPECT_EQ(consumed, sequence);
+        EXPECT_EQ(ring.GetUsedBytes(), static_cast<size_t>(0));
+
+        // Records larger than the ring never fit. 
+        EXPECT_EQ(ring.BeginWrite(capacity), nullptr);
+        EXPECT_EQ(ring.BeginWriteConcurrent(capacity), nullptr);
+
+        // An unpublished record blocks the consumer. 
+        void* payload = ring.BeginWrite(16);
+        ASSERT_NE(payload, nullptr);
+        EXPECT_EQ(ring.BeginRead(size), nullptr);
+        ring.EndWrite(payload);
+        EXPECT_NE(ring.BeginRead(size), nullptr);
+        EXPECT_EQ(size, static_cast<size_t>(16));
+        ring.EndRead();
+    }
+
+    TEST(tiny_base, mirrored_ring_buffer_producers)
+    {
+        struct Message
+        {
+            uint32_t    m_producer;
+            uint32_t    m_sequence;
+            uint32_t    m_padding[6];
+        };
+        const int kProducerCount = 4;
+        const uint32_t kMessageCount = 200000;
+
+        tf::MirroredRingBuffer ring(64 * 1024);
+        ASSERT_TRUE(ring.IsValid());
+
+        std::vector<std::thread> producers;
+        const auto begin = std::chrono::high_resolution_clock::now();
+        for (int producer = 0; producer < kProducerCount; ++producer)
+        {
+            producers.emplace_back([&ring, producer, kMessageCount]()
+            {
+                for (uint32_t sequence = 0; sequence < kMessageCount; ++sequence)
+                {
+                    // Vary the size so records land on every offset of the ring. 
+                    const size_t size = sizeof(uint32_t) * 2 + (sequence % 7) * sizeof(uint32_t);
+                    void* payload;
+                    while ((payload = ring.BeginWriteConcurrent(size)) == nullptr)
+                    {
+                        std::this_thread::yield();
+                    }
+                    Message* message = static_cast<Message*>(payload);
+                    message->m_producer = static_cast<uint32_t>(producer);
+                    message->m_sequence = sequence;
+                    ring.EndWrite(payload);
+                }
+            });
+        }
+
+        std::vector<uint32_t> nextSequence(kProducerCount, 0);
+        uint64_t received = 0;
+        bool ordered = true;
+        while (received < static_cast<uint64_t>(kProducerCount) * kMessageCount)
+        {
+            size_t size = 0;
+            const Message* message = static_cast<const Message*>(ring.BeginRead(size));
+            if (message == nullptr)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            ordered &= (size == sizeof(uint32_t) * 2 + (message->m_sequence % 7) * sizeof(uint32_t));
+            ordered &= (message->m_producer < static_cast<uint32_t>(kProducerCount));
+            ordered &= (message->m_sequence == nextSequence[message->m_producer % kProducerCount]++);
+            ring.EndRead();
+            received++;
+        }
+        for (auto& producer : producers)
+        {
+            producer.join();
+        }
+        const auto end = std::chrono::high_resolution_clock::now();
+
+        EXPECT_TRUE(ordered);
+        EXPECT_EQ(ring.GetUsedBytes(), static_cast<size_t>(0));
+        const double ms = std::chrono::duration<double, std::milli>(end - begin).count();
+        printf("mirrored ring buffer: %d producers, %llu records in %.2f ms (%.1f M records/s)\n",
+               kProducerCount, static_cast<unsigned long long>(received), ms, received / ms / 1000.0);
+    }
+
+    TEST(tiny_base, vector)
+    {
+        tf::FrameArenaAllocator arena(64 * 1024);
+
+        // Nothing is allocated while the elements fit inline. 
+        tf::Vector<int, 8> small(arena);
+        for (int i = 0; i < 8; ++i)
+        {
+            small.push_back(i);
+        }
+        EXPECT_TRUE(small.IsInline());
+        EXPECT_EQ(arena.GetUsedBytes(), 0u);
+        small.push_back(8);
+        EXPECT_FALSE(small.IsInline());
+        EXPECT_GT(arena.GetUsedBytes(), 0u);
+        for (int i = 0; i < 9; ++i)
+        {
+            EXPECT_EQ(small[i], i);
+        }
+        small.erase(small.begin() + 2, small.begin() + 4);
+        small.insert(small.begin(), -1);
+        small.erase_unordered(small.begin() + 1);
+        const int expected[] = { -1, 8, 1, 4, 5, 6, 7 };
+        ASSERT_EQ(small.size(), TF_ARRAY_SIZE(expected));
+        EXPECT_TRUE(std::equal(small.begin(), small.end(), expected));
+        small.shrink_to_fit();
+        EXPECT_TRUE(small.IsInline());
+
+        // Elements referring to the vector itself survive growth. 
+        tf::Vector<std::string> strings;
+        strings.push_back("a string long enough to live on the heap");
+        for (int i = 0; i < 100; ++i)
+        {
+            strings.push_back(strings.back());
+            strings.emplace(strings.begin() + i / 2, std::to_string(i));
+        }
+        EXPECT_EQ(strings.size(), 201u);
+        EXPECT_EQ(strings[0], "1");
+        EXPECT_EQ(strings.back(), "a string long enough to live on the heap");
+        strings.erase(strings.begin(), strings.begin() + 150);
+        strings.resize(60, "filler");
+        EXPECT_EQ(strings.size(), 60u);
+        EXPECT_EQ(strings.back(), "filler");
+
+        // Copies keep their own allocator, moves take it along. 
+        tf::Vector<std::string, 4> inlineStrings(arena);
+        inlineStrings.push_back("x");
+        inlineStrings.push_back("a string long enough to live on the heap");
+        tf::Vector<std::string, 4> copy(inlineStrings, tf::DefaultAllocator());
+        copy = inlineStrings;
+        EXPECT_EQ(&copy.GetAllocator(), &tf::DefaultAllocator());
+        tf::Vector<std::string, 4> moved(std::move(inlineStrings));
+        EXPECT_TRUE(inlineStrings.empty());
+        EXPECT_EQ(&moved.GetAllocator(), &arena);
+        EXPECT_EQ(moved[1], copy[1]);
+        copy.swap(moved);
+        EXPECT_EQ(&copy.GetAllocator(), &arena);
+        EXPECT_EQ(copy[0], "x");
+
+        tf::Vector<int> list = { 3, 1, 2 };
+        std::sort(list.begin(), list.end());
+        EXPECT_EQ(list[0], 1);
+        EXPECT_EQ(list[2], 3);
+    }
+
+    TEST(tiny_base, vector_relocation)
+    {
+        // Trivially relocatable elements are moved with memcpy, never through their constructors. 
+        RelocationCounter::s_moveCount = 0;
+        tf::Vector<RelocationCounter, 2> counters;
+        for (int i = 0; i < 1000; ++i)
+        {
+            counters.emplace_back(i);
+        }
+        counters.erase(counters.begin() + 10, counters.begin() + 20);
+        counters.emplace(counters.begin() + 5, -1);
+        EXPECT_EQ(RelocationCounter::s_moveCount, 0);
+        EXPECT_EQ(counters[5].m_value, -1);
+        EXPECT_EQ(counters[6].m_value, 5);
+        EXPECT_EQ(counters[20].m_value, 29);
+
+        // Growth resizes the block in place when the allocator can. 
+        tf::FrameArenaAllocator arena(1024 * 1024);
+        tf::Vector<float> values(arena);
+        values.reserve(16);
+        const float* data = values.data();
+        for (int i = 0; i < 10000; ++i)
+        {
+            values.emplace_back_uninitialized() = static_cast<float>(i);
+        }
+        EXPECT_EQ(values.data(), data);
+        EXPECT_EQ(values[9999], 9999.0f);
+        values.resize_uninitialized(20000);
+        EXPECT_EQ(values.data(), data);
+        EXPECT_EQ(values[9999], 9999.0f);
+    }
+
+    TEST(tiny_base, vector_throughput)
+    {
+        // Per-draw pattern: a short list built and thrown away for each of many draws. 
+        struct DrawItem
+        {
+            uint32_t    m_mesh;
+            uint32_t    m_material;
+            float       m_depth;
+        };
+        const int kDrawCount = 200000;
+        const int kItemsPerDraw = 6;
+        uint64_t checksum[2] = { 0, 0 };
+
+        auto begin = std::chrono::high_resolution_clock::now();
+        for (int draw = 0; draw < kDrawCount; ++draw)
+        {
+            std::vector<DrawItem> items;
+            for (int i = 0; i < kItemsPerDraw; ++i)
+            {
+                items.push_back(DrawItem{ static_cast<uint32_t>(draw), static_cast<uint32_t>(i), 1.0f });
+            }
+            checksum[0] += items.back().m_mesh + items.size();
+        }
+        const double stdMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+
+        begin = std::chrono::high_resolution_clock::now();
+        for (int draw = 0; draw < kDrawCount; ++draw)
+        {
+            tf::Vector<DrawItem, 8> items;
+            for (int i = 0; i < kItemsPerDraw; ++i)
+            {
+                DrawItem& item = items.emplace_back_uninitialized();
+                item.m_mesh = static_cast<uint32_t>(draw);
+                item.m_material = static_cast<uint32_t>(i);
+                item.m_depth = 1.0f;
+            }
+            checksum[1] += items.back().m_mesh + items.size();
+        }
+        const double tfMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+
+        EXPECT_EQ(checksum[0], checksum[1]);
+        printf("%d draws x %d items: std::vector %.2f ms, tf::Vector<T, 8> %.2f ms\n", kDrawCount, kItemsPerDraw, stdMs, tfMs);
+    }
+
+    TEST(tiny_base, flat_hash_map)
+    {
+        tf::FlatHashMap<int, int> map;
+        EXPECT_TRUE(map.begin() == map.end());
+        EXPECT_TRUE(map.find(1) == map.end());
+        for (int i = 0; i < 10000; ++i)
+        {
+            EXPECT_TRUE(map.try_emplace(i, i * 2).second);
+        }
+        EXPECT_FALSE(map.insert(std::make_pair(5, 0)).second);
+        EXPECT_EQ(map.size(), 10000u);
+        for (int i = 0; i < 10000; i += 2)
+        {
+            EXPECT_EQ(map.erase(i), 1u);
+        }
+        EXPECT_EQ(map.erase(0), 0u);
+        for (int i = 0; i < 10000; ++i)
+        {
+            auto it = map.find(i);
+            if (i & 1)
+            {
+                ASSERT_TRUE(it != map.end());
+                EXPECT_EQ(it->second, i * 2);
+            }
+            else
+            {
+                EXPECT_TRUE(it == map.end());
+            }
+        }
+        int64_t sum = 0;
+        size_t count = 0;
+        for (const auto& value : map)
+        {
+            sum += value.second;
+            count++;
+        }
+        EXPECT_EQ(count, map.size());
+        EXPECT_EQ(sum, 2 * 25000000);
+
+        // Churn on a reserved map reuses tombstones instead of growing. 
+        tf::FlatHashMap<int, int> churn;
+        ASSERT_TRUE(churn.reserve(1000));
+        const size_t capacity = churn.capacity();
+        for (int i = 0; i < 100000; ++i)
+        {
+            churn[i] = i;
+            if (i >= 1000)
+            {
+                churn.erase(churn.find(i - 1000));
+            }
+        }
+        EXPECT_EQ(churn.size(), 1000u);
+        EXPECT_EQ(churn.capacity(), capacity);
+        EXPECT_EQ(churn[99999], 99999);
+
+        // Every key on the same probe sequence. 
+        struct ConstantHash
+        {
+            size_t operator()(int) const { return 42; }
+        };
+        tf::FlatHashMap<int, int, ConstantHash> collisions;
+        for (int i = 0; i < 200; ++i)
+        {
+            collisions[i] = -i;
+        }
+        for (int i = 0; i < 200; ++i)
+        {
+            EXPECT_EQ(collisions.find(i)->second, -i);
+        }
+        EXPECT_FALSE(collisions.contains(200));
+    }
+
+    TEST(tiny_base, flat_hash_map_strings)
+    {
+        tf::FrameArenaAllocator arena(1024 * 1024);
+        tf::FlatHashMap<std::string, std::string, tf::StringHash, tf::StringEqual> names(arena);
+        for (int i = 0; i < 1000; ++i)
+        {
+            names.try_emplace("pipeline_state_" + std::to_string(i), std::to_string(i));
+        }
+        EXPECT_EQ(&names.GetAllocator(), &arena);
+
+        // Heterogeneous lookup, no std::string is built for the key. 
+        const char* key = "pipeline_state_123";
+        ASSERT_TRUE(names.find(key) != names.end());
+        EXPECT_EQ(names.find(key)->second, "123");
+        EXPECT_TRUE(names.contains("pipeline_state_999"));
+        EXPECT_FALSE(names.contains("pipeline_state_1000"));
+        EXPECT_EQ(names.erase("pipeline_state_0"), 1u);
+        EXPECT_EQ(names.count(std::string("pipeline_state_0")), 0u);
+        tf::FlatHashMap<std::string, std::string, tf::StringHash, tf::StringEqual>::iterator next = names.erase(names.find("pipeline_state_1"));
+        EXPECT_TRUE(next == names.end() || next->first != "pipeline_state_1");
+        EXPECT_FALSE(names.contains("pipeline_state_1"));
+        names.try_emplace("pipeline_state_1", "1");
+
+        // Copies and moves of non-trivial elements. 
+        tf::FlatHashMap<std::string, std::string, tf::StringHash, tf::StringEqual> copy(names);
+        EXPECT_EQ(copy.size(), 999u);
+        EXPECT_EQ(copy["pipeline_state_500"], "500");
+        tf::FlatHashMap<std::string, std::string, tf::StringHash, tf::StringEqual> moved(std::move(copy));
+        EXPECT_TRUE(copy.empty());
+        EXPECT_EQ(moved.find("pipeline_state_998")->second, "998");
+        for (auto it = moved.begin(); it != moved.end(); )
+        {
+            it = (it->second.back() == '5') ? moved.erase(it) : ++it;
+        }
+        EXPECT_EQ(moved.size(), 899u);
+        EXPECT_FALSE(moved.contains("pipeline_state_995"));
+        moved.clear();
+        EXPECT_TRUE(moved.begin() == moved.end());
+        moved["a"] = "b";
+        EXPECT_EQ(moved.size(), 1u);
+    }
+
+    TEST(tiny_base, flat_hash_map_benchmark)
+    {
+#if defined(TF_DEBUG)
+        const size_t kSizes[] = { 1000, 100000 };
+#else
+        const size_t kSizes[] = { 1000, 100000, 10000000 };
+#endif
+        for (size_t size : kSizes)
+        {
+            // Lookups go in random order and repeat over the keys, so small maps run as many operations. 
+            const size_t lookupCount = (size < 1000000) ? 1000000 : size;
+            auto keyOf = [](size_t i) { return static_cast<uint64_t>(i) * 0x9E3779B97F4A7C15ull; };
+            std::vector<uint64_t> lookups(lookupCount);
+            std::mt19937 random(12345);
+            for (size_t i = 0; i < lookupCount; ++i)
+            {
+                lookups[i] = keyOf(random() % size);
+            }
+            double times[2][3];
+            uint64_t checksum[2] = { 0, 0 };
+
+            {
+                std::unordered_map<uint64_t, uint32_t> map;
+                auto begin = std::chrono::high_resolution_clock::now();
+                for (size_t i = 0; i < size; ++i)
+                {
+                    map[keyOf(i)] = static_cast<uint32_t>(i);
+                }
+                auto middle = std::chrono::high_resolution_clock::now();
+                for (size_t i = 0; i < lookupCount; ++i)
+                {
+                    checksum[0] += map.find(lookups[i])->second;
+                }
+                auto end = std::chrono::high_resolution_clock::now();
+                for (size_t i = 0; i < lookupCount; ++i)
+                {
+                    checksum[0] += map.count(lookups[i] + 1);
+                }
+                times[0][0] = std::chrono::duration<double, std::milli>(middle - begin).count();
+                times[0][1] = std::chrono::duration<double, std::milli>(end - middle).count();
+                times[0][2] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - end).count();
+            }
+            {
+                tf::FlatHashMap<uint64_t, uint32_t> map;
+                auto begin = std::chrono::high_resolution_clock::now();
+                for (size_t i = 0; i < size; ++i)
+                {
+                    map[keyOf(i)] = static_cast<uint32_t>(i);
+                }
+                auto middle = std::chrono::high_resolution_clock::now();
+                for (size_t i = 0; i < lookupCount; ++i)
+                {
+                    checksum[1] += map.find(lookups[i])->second;
+                }
+                auto end = std::chrono::high_resolution_clock::now();
+                for (size_t i = 0; i < lookupCount; ++i)
+                {
+                    checksum[1] += map.count(lookups[i] + 1);
+                }
+                times[1][0] = std::chrono::duration<double, std::milli>(middle - begin).count();
+                times[1][1] = std::chrono::duration<double, std::milli>(end - middle).count();
+                times[1][2] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - end).count();
+            }
+            EXPECT_EQ(checksum[0], checksum[1]);
+            printf("%zu entries: insert %.2f / %.2f ms, %zu hits %.2f / %.2f ms, %zu misses %.2f / %.2f ms (std::unordered_map / tf::FlatHashMap)\n",
+                   size, times[0][0], times[1][0], lookupCount, times[0][1], times[1][1], lookupCount, times[0][2], times[1][2]);
+        }
+    }
+
+    TEST(tiny_base, slot_map)
+    {
+        tf::SlotMap<std::string> map;
+        typedef tf::SlotMap<std::string>::Handle Handle;
+        EXPECT_FALSE(Handle().IsValid());
+        EXPECT_EQ(map.Get(Handle()), nullptr);
+
+        std::vector<Handle> handles;
+        for (int i = 0; i < 100; ++i)
+        {
+            handles.push_back(map.Emplace(std::to_string(i)));
+            EXPECT_TRUE(handles.back().IsValid());
+        }
+        for (int i = 0; i < 100; i += 3)
+        {
+            EXPECT_TRUE(map.Erase(handles[i]));
+            EXPECT_FALSE(map.Erase(handles[i]));
+        }
+        for (int i = 0; i < 100; ++i)
+        {
+            const std::string* value = map.Get(handles[i]);
+            if (i % 3 == 0)
+            {
+                EXPECT_EQ(value, nullptr);
+            }
+            else
+            {
+                ASSERT_NE(value, nullptr);
+                EXPECT_EQ(*value, std::to_string(i));
+            }
+        }
+
+        // Dense storage: live elements are contiguous and know their handles. 
+        EXPECT_EQ(map.GetSize(), 66u);
+        EXPECT_EQ(map.end() - map.begin(), 66);
+        for (size_t i = 0; i < map.GetSize(); ++i)
+        {
+            EXPECT_EQ(map.Get(map.GetHandle(i)), map.GetData() + i);
+        }
+
+        // A reused slot gets a new generation, old handles do not alias the new element. 
+        const Handle reused = map.Insert("reused");
+        EXPECT_EQ(reused.GetIndex(), handles[0].GetIndex());
+        EXPECT_NE(reused.GetGeneration(), handles[0].GetGeneration());
+        EXPECT_EQ(map.Get(handles[0]), nullptr);
+        EXPECT_EQ(*map.Get(reused), "reused");
+
+        map.Clear();
+        EXPECT_TRUE(map.IsEmpty());
+        EXPECT_FALSE(map.Contains(reused));
+        EXPECT_FALSE(map.Contains(handles[1]));
+
+        // Cycle one slot until its generation wraps back to a stale handle while the slot is free. 
+        tf::SlotMap<int> ints;
+        const tf::SlotMap<int>::Handle stale = ints.Insert(0);
+        EXPECT_TRUE(ints.Erase(stale));
+        const uint32_t generationCount = tf::SlotMap<int>::Handle::kGenerationMask;
+        for (uint32_t i = 1; i < generationCount; ++i)
+        {
+            const tf::SlotMap<int>::Handle handle = ints.Insert(static_cast<int>(i));
+            ASSERT_EQ(handle.GetIndex(), stale.GetIndex());
+            EXPECT_TRUE(ints.Erase(handle));
+        }
+        EXPECT_EQ(ints.Get(stale), nullptr);
+        EXPECT_FALSE(ints.Contains(stale));
+        EXPECT_FALSE(ints.Erase(stale));
+        EXPECT_EQ(ints.Insert(1).GetGeneration(), stale.GetGeneration());
+    }
+
+    TEST(tiny_base, slot_map_churn)
+    {
+        // Random insert/erase against a reference model. 
+        struct Particle
+        {
+            float       m_position[3];
+            uint32_t    m_id;
+        };
+        tf::SlotMap<Particle> particles;
+        std::unordered_map<uint32_t, tf::SlotMap<Particle>::Handle> live;
+        std::vector<tf::SlotMap<Particle>::Handle> dead;
+        std::mt19937 random(7);
+        uint32_t nextId = 0;
+        for (int i = 0; i < 100000; ++i)
+        {
+            if (live.empty() || random() % 3 != 0)
+            {
+                Particle particle = { { 0.0f, 0.0f, 0.0f }, nextId };
+                live[nextId++] = particles.Insert(particle);
+            }
+            else
+            {
+                auto it = live.begin();
+                std::advance(it, random() % (live.size() < 8 ? live.size() : 8));
+                EXPECT_TRUE(particles.Erase(it->second));
+                dead.push_back(it->second);
+                live.erase(it);
+            }
+        }
+        EXPECT_EQ(particles.GetSize(), live.size());
+        for (const auto& entry : live)
+        {
+            const Particle* particle = particles.Get(entry.second);
+            ASSERT_NE(particle, nullptr);
+            EXPECT_EQ(particle->m_id, entry.first);
+        }
+        size_t resolved = 0;
+        for (const auto& handle : dead)
+        {
+            resolved += particles.Contains(handle) ? 1 : 0;
+        }
+        EXPECT_EQ(resolved, 0u);
+
+        // Per-frame update over the dense array. 
+        for (Particle& particle : particles)
+        {
+            particle.m_position[1] += 1.0f;
+        }
+        EXPECT_EQ(particles.Get(live.begin()->second)->m_position[1], 1.0f);
+    }
+
+    TEST(tiny_base, soa)
+    {
+        // x, y, z, id 
+        tf::SoA<float, float, float, uint32_t> particles;
+        const size_t alignment = tf::SoA<float, float, float, uint32_t>::kAlignment;
+        EXPECT_GE(alignment, static_cast<size_t>(TF_CACHELINE_SIZE));
+        for (uint32_t i = 0; i < 1000; ++i)
+        {
+            EXPECT_EQ(particles.PushBack(static_cast<float>(i), 0.0f, -static_cast<float>(i), i), i);
+        }
+        EXPECT_EQ(particles.GetSize(), 1000u);
+        EXPECT_EQ(particles.GetCapacity() % 16, 0u);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(particles.Get<0>()) % alignment, 0u);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(particles.Get<1>()) % alignment, 0u);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(particles.Get<2>()) % alignment, 0u);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(particles.Get<3>()) % alignment, 0u);
+
+        particles.SwapErase(10);
+        EXPECT_EQ(particles.GetSize(), 999u);
+        EXPECT_EQ(particles.Get<3>()[10], 999u);
+        EXPECT_EQ(particles.Get<0>()[10], 999.0f);
+        EXPECT_EQ(particles.Get<2>()[10], -999.0f);
+        particles.PopBack();
+
+        // New rows are zeroed, old rows survive the reallocation. 
+        ASSERT_TRUE(particles.Resize(5000));
+        EXPECT_EQ(particles.Get<3>()[997], 997u);
+        EXPECT_EQ(particles.Get<0>()[4999], 0.0f);
+        EXPECT_EQ(particles.Get<3>()[998], 0u);
+
+        // A kernel over the view, split in two slices the way a job would. 
+        tf::SoA<float, float, float, uint32_t>::View view = particles.GetView();
+        const size_t half = view.GetSize() / 2;
+        for (const auto& slice : { view.Slice(0, half), view.Slice(half, view.GetSize() - half) })
+        {
+            float* x = slice.Get<0>();
+            float* y = slice.Get<1>();
+            const float* z = slice.Get<2>();
+            for (size_t i = 0; i < slice.GetSize(); ++i)
+            {
+                y[i] = x[i] + z[i] + 1.0f;
+            }
+        }
+        const tf::SoA<float, float, float, uint32_t>& constParticles = particles;
+        const float* y = constParticles.GetView().Get<1>();
+        for (size_t i = 0; i < particles.GetSize(); ++i)
+        {
+            ASSERT_EQ(y[i], 1.0f);
+        }
+
+        // Appending a row read from the container itself while it grows. 
+        tf::SoA<uint32_t, double> copies;
+        copies.PushBack(7u, 0.5);
+        for (size_t i = 1; i < 100; ++i)
+        {
+            copies.PushBack(copies.Get<0>()[i - 1], copies.Get<1>()[i - 1]);
+        }
+        for (size_t i = 0; i < copies.GetSize(); ++i)
+        {
+            ASSERT_EQ(copies.Get<0>()[i], 7u);
+            ASSERT_EQ(copies.Get<1>()[i], 0.5);
+        }
+
+        particles.Clear();
+        EXPECT_TRUE(particles.IsEmpty());
+        tf::FrameArenaAllocator arena(64 * 1024);
+        tf::SoA<double, uint8_t> small(arena);
+        ASSERT_TRUE(small.Reserve(100));
+        EXPECT_EQ(&small.GetAllocator(), &arena);
+        EXPECT_GT(arena.GetUsedBytes(), 100u * (sizeof(double) + sizeof(uint8_t)));
+    }
+
+    TEST(tiny_base, soa_throughput)
+    {
+        // Integrate positions of particles whose other fields the kernel does not touch. 
+        struct Particle
+        {
+            float       m_x, m_y, m_z;
+            float       m_velocityX, m_velocityY, m_velocityZ;
+            float       m_color[4];
+            uint32_t    m_id;
+            uint32_t    m_flags;
+        };
+        const size_t kCount = 1000000;
+        const int kFrameCount = 20;
+        const float kDeltaTime = 1.0f / 60.0f;
+
+        std::vector<Particle> aos(kCount);
+        tf::SoA<float, float, float, float, float, float, uint32_t> soa;
+        ASSERT_TRUE(soa.Resize(kCount));
+        for (size_t i = 0; i < kCount; ++i)
+        {
+            aos[i] = Particle{ 0.0f, 0.0f, 0.0f, 1.0f, 2.0f, 3.0f, { 1.0f, 1.0f, 1.0f, 1.0f }, static_cast<uint32_t>(i), 0 };
+            soa.Get<3>()[i] = 1.0f;
+            soa.Get<4>()[i] = 2.0f;
+            soa.Get<5>()[i] = 3.0f;
+        }
+
+        auto begin = std::chrono::high_resolution_clock::now();
+        for (int frame = 0; frame < kFrameCount; ++frame)
+        {
+            for (Particle& particle : aos)
+            {
+                particle.m_x += particle.m_velocityX * kDeltaTime;
+                particle.m_y += particle.m_velocityY * kDeltaTime;
+                particle.m_z += particle.m_velocityZ * kDeltaTime;
+            }
+        }
+        const double aosMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+
+        begin = std::chrono::high_resolution_clock::now();
+        for (int frame = 0; frame < kFrameCount; ++frame)
+        {
+            auto view = soa.GetView();
+            float* x = view.Get<0>();
+            float* y = view.Get<1>();
+            float* z = view.Get<2>();
+            const float* velocityX = view.Get<3>();
+            const float* velocityY = view.Get<4>();
+            const float* velocityZ = view.Get<5>();
+            for (size_t i = 0; i < view.GetSize(); ++i)
+            {
+                x[i] += velocityX[i] * kDeltaTime;
+                y[i] += velocityY[i] * kDeltaTime;
+                z[i] += velocityZ[i] * kDeltaTime;
+            }
+        }
+        const double soaMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+
+        EXPECT_EQ(aos[kCount - 1].m_z, soa.Get<2>()[kCount - 1]);
+        printf("%zu particles x %d frames: array of structs %.2f ms, tf::SoA %.2f ms\n", kCount, kFrameCount, aosMs, soaMs);
+    }
+
+    TEST(tiny_base, bitmap_allocator)
+    {
+        const uint32_t kInvalid = tf::BitmapAllocator::kInvalidIndex;
+
+        // Three levels: 10000 leaves, 157 summary bits, 3 root bits. 
+        tf::BitmapAllocator bitmap(10000);
+        for (uint32_t i = 0; i < 10000; ++i)
+        {
+            ASSERT_EQ(bitmap.Allocate(), i);
+        }
+        EXPECT_EQ(bitmap.GetUsedCount(), 10000u);
+        EXPECT_EQ(bitmap.Allocate(), kInvalid);
+        EXPECT_EQ(bitmap.AllocateRange(2), kInvalid);
+
+        // The lowest free index is reused first. 
+        bitmap.Free(9000);
+        bitmap.Free(70);
+        bitmap.Free(4500);
+        EXPECT_FALSE(bitmap.IsAllocated(70));
+        EXPECT_EQ(bitmap.Allocate(), 70u);
+        EXPECT_EQ(bitmap.Allocate(), 4500u);
+        EXPECT_EQ(bitmap.Allocate(), 9000u);
+
+        // Ranges skip holes that are too small, including ones across word boundaries. 
+        bitmap.FreeRange(100, 3);
+        bitmap.FreeRange(126, 5);
+        bitmap.FreeRange(6000, 300);
+        EXPECT_EQ(bitmap.AllocateRange(4), 126u);
+        EXPECT_EQ(bitmap.AllocateRange(3), 100u);
+        EXPECT_EQ(bitmap.AllocateRange(200), 6000u);
+        EXPECT_EQ(bitmap.AllocateRange(101), kInvalid);
+        EXPECT_EQ(bitmap.AllocateRange(100), 6200u);
+        EXPECT_EQ(bitmap.Allocate(), 130u);
+        EXPECT_EQ(bitmap.GetUsedCount(), 10000u);
+
+        ASSERT_TRUE(bitmap.Reset(1));
+        EXPECT_EQ(bitmap.Allocate(), 0u);
+        EXPECT_EQ(bitmap.Allocate(), kInvalid);
+        tf::BitmapAllocator empty;
+        EXPECT_EQ(empty.Allocate(), kInvalid);
+        EXPECT_EQ(empty.AllocateRange(4), kInvalid);
+
+        // Random operations against a reference model. 
+        const uint32_t kCapacity = 5000;
+        ASSERT_TRUE(bitmap.Reset(kCapacity));
+        std::vector<bool> used(kCapacity, false);
+        std::vector<std::pair<uint32_t, uint32_t>> ranges;
+        std::mt19937 random(11);
+        for (int i = 0; i < 20000; ++i)
+        {
+            if (ranges.empty() || random() % 5 < 3)
+            {
+                const uint32_t count = 1 + random() % ((random() % 8 == 0) ? 200 : 4);
+                uint32_t expected = kInvalid;
+                for (uint32_t first = 0, run = 0; first < kCapacity; ++first)
+                {
+                    run = used[first] ? 0 : run + 1;
+                    if (run == count)
+                    {
+                        expected = first + 1 - count;
+                        break;
+                    }
+                }
+                const uint32_t first = bitmap.AllocateRange(count);
+                ASSERT_EQ(first, expected);
+                if (first != kInvalid)
+                {
+                    std::fill(used.begin() + first, used.begin() + first + count, true);
+                    ranges.emplace_back(first, count);
+                }
+            }
+            else
+            {
+                const size_t index = random() % ranges.size();
+                bitmap.FreeRange(ranges[index].first, ranges[index].second);
+                std::fill(used.begin() + ranges[index].first, used.begin() + ranges[index].first + ranges[index].second, false);
+                ranges[index] = ranges.back();
+                ranges.pop_back();
+            }
+        }
+        EXPECT_EQ(bitmap.GetUsedCount(), static_cast<uint32_t>(std::count(used.begin(), used.end(), true)));
+        for (uint32_t i = 0; i < kCapacity; ++i)
+        {
+            ASSERT_EQ(bitmap.IsAllocated(i), used[i]);
+        }
+    }
+
+    TEST(tiny_base, atomic_bitmap_allocator)
+    {
+        const uint32_t kInvalid = tf::AtomicBitmapAllocator::kInvalidIndex;
+        {
+            tf::AtomicBitmapAllocator bitmap(130);
+            EXPECT_EQ(bitmap.Allocate(), 0u);
+            EXPECT_EQ(bitmap.AllocateRange(64), 64u);
+            EXPECT_EQ(bitmap.AllocateRange(3), 1u);
+            EXPECT_EQ(bitmap.AllocateRange(61), kInvalid);
+            EXPECT_EQ(bitmap.AllocateRange(60), 4u);
+            EXPECT_EQ(bitmap.AllocateRange(2), 128u);
+            EXPECT_EQ(bitmap.Allocate(), kInvalid);
+            bitmap.FreeRange(64, 64);
+            EXPECT_EQ(bitmap.GetUsedCount(), 66u);
+            EXPECT_EQ(bitmap.AllocateRange(64), 64u);
+        }
+
+        // Threads allocate and free concurrently, every index has at most one owner at a time. 
+        const int kThreadCount = 4;
+        const int kIterationCount = 100000;
+        tf::AtomicBitmapAllocator bitmap(1000);
+        std::vector<std::atomic<int>> owners(1000);
+        for (auto& owner : owners)
+        {
+            owner.store(-1);
+        }
+        std::atomic<bool> failed(false);
+        std::vector<std::thread> threads;
+        for (int thread = 0; thread < kThreadCount; ++thread)
+        {
+            threads.emplace_back([&, thread]()
+            {
+                std::mt19937 random(thread);
+                std::vector<std::pair<uint32_t, uint32_t>> held;
+                for (int i = 0; i < kIterationCount; ++i)
+                {
+                    if (held.size() < 32 && random() % 2 == 0)
+                    {
+                        const uint32_t count = 1 + random() % 4;
+                        const uint32_t first = bitmap.AllocateRange(count);
+                        if (first == kInvalid)
+                        {
+                            continue;
+                        }
+                        for (uint32_t index = first; index < first + count; ++index)
+                        {
+                            int expected = -1;
+                            failed = failed || !owners[index].compare_exchange_strong(expected, thread);
+                        }
+                        held.emplace_back(first, count);
+                    }
+                    else if (!held.empty())
+                    {
+                        const auto range = held.back();
+                        held.pop_back();
+                        for (uint32_t index = range.first; index < range.first + range.second; ++index)
+                        {
+                            owners[index].store(-1);
+                        }
+                        bitmap.FreeRange(range.first, range.second);
+                    }
+                }
+                for (const auto& range : held)
+                {
+                    for (uint32_t index = range.first; index < range.first + range.second; ++index)
+                    {
+                        owners[index].store(-1);
+                    }
+                    bitmap.FreeRange(range.first, range.second);
+                }
+            });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        EXPECT_FALSE(failed);
+        EXPECT_EQ(bitmap.GetUsedCount(), 0u);
+        for (uint32_t i = 0; i < 1000; ++i)
+        {
+            ASSERT_EQ(bitmap.Allocate(), i);
+        }
+    }
+
+    TEST(tiny_base, job_deque)
+    {
+        tf::JobDeque deque(8);
+        int values[10] = {};
+        tf::Job job = {};
+        EXPECT_FALSE(deque.Pop(job));
+        EXPECT_FALSE(deque.Steal(job));
+        for (int i = 0; i < 8; ++i)
+        {
+            const tf::Job pushed = { nullptr, &values[i], nullptr };
+            ASSERT_TRUE(deque.Push(pushed));
+        }
+        const tf::Job overflow = { nullptr, &values[8], nullptr };
+        EXPECT_FALSE(deque.Push(overflow));
+        EXPECT_EQ(deque.GetSize(), 8u);
+
+        // The owner takes the newest, thieves the oldest. 
+        ASSERT_TRUE(deque.Pop(job));
+        EXPECT_EQ(job.m_data, &values[7]);
+        ASSERT_TRUE(deque.Steal(job));
+        EXPECT_EQ(job.m_data, &values[0]);
+        EXPECT_TRUE(deque.Push(overflow));
+        EXPECT_TRUE(deque.Push(overflow));
+        EXPECT_EQ(deque.GetSize(), 8u);
+        while (deque.Pop(job))
+        {
+        }
+        EXPECT_EQ(deque.GetSize(), 0u);
+
+        // Owner pushes and pops while thieves steal, every job must be taken exactly once. 
+        const int kJobCount = 200000;
+        const int kThiefCount = 3;
+        std::vector<std::atomic<int>> taken(kJobCount);
+        for (auto& count : taken)
+        {
+            count.store(0);
+        }
+        tf::JobDeque shared(256);
+        std::atomic<bool> done(false);
+        std::vector<std::thread> thieves;
+        for (int thief = 0; thief < kThiefCount; ++thief)
+        {
+            thieves.emplace_back([&]()
+            {
+                tf::Job stolen;
+                while (!done.load())
+                {
+                    if (shared.Steal(stolen))
+                    {
+                        taken[reinterpret_cast<uintptr_t>(stolen.m_data)]++;
+                    }
+                }
+            });
+        }
+        std::mt19937 random(5);
+        for (int i = 0; i < kJobCount; )
+        {
+            const tf::Job pushed = { nullptr, reinterpret_cast<void*>(static_cast<uintptr_t>(i)), nullptr };
+            if (shared.Push(pushed))
+            {
+                ++i;
+            }
+            tf::Job popped;
+            if (random() % 3 == 0 && shared.Pop(popped))
+            {
+                taken[reinterpret_cast<uintptr_t>(popped.m_data)]++;
+            }
+        }
+        tf::Job popped;
+        while (shared.GetSize() > 0)
+        {
+            if (shared.Pop(popped))
+            {
+                taken[reinterpret_cast<uintptr_t>(popped.m_data)]++;
+            }
+        }
+        done = true;
+        for (auto& thief : thieves)
+        {
+            thief.join();
+        }
+        int wrong = 0;
+        for (auto& count : taken)
+        {
+            wrong += (count.load() != 1) ? 1 : 0;
+        }
+        EXPECT_EQ(wrong, 0);
+    }
+
+    TEST(tiny_base, job_system)
+    {
+        struct Context
+        {
+            tf::JobSystem*          m_system;
+            std::atomic<int64_t>    m_sum;
+            std::atomic<int>        m_leafCount;
+        };
+
+        // A group of jobs on a single worker runs inside WaitForCounter(). 
+        {
+            tf::JobSystem single(1);
+            EXPECT_EQ(single.GetWorkerCount(), 1u);
+            EXPECT_EQ(single.GetCurrentWorkerIndex(), 0u);
+            Context context = { &single, { 0 }, { 0 } };
+            tf::JobCounter counter;
+            std::vector<tf::JobDecl> jobs(100, tf::JobDecl{ [](void* data) { static_cast<Context*>(data)->m_sum++; }, &context });
+            single.Run(jobs.data(), static_cast<uint32_t>(jobs.size()), &counter);
+            EXPECT_EQ(counter.GetValue(), 100);
+            single.WaitForCounter(counter);
+            EXPECT_TRUE(counter.IsDone());
+            EXPECT_EQ(context.m_sum.load(), 100);
+        }
+
+        tf::JobSystem system(4);
+        EXPECT_EQ(system.GetWorkerCount(), 4u);
+        EXPECT_EQ(system.GetCurrentWorkerIndex(), 0u);
+
+        // Jobs spawn children and wait for them, more levels deep than there are workers. 
+        struct Node
+        {
+            Context*    m_context;
+            int         m_depth;
+        };
+        struct Recursive
+        {
+            static void Run(void* data)
+            {
+                Node* node = static_cast<Node*>(data);
+                Context& context = *node->m_context;
+                const uint32_t kInvalidWorker = tf::JobSystem::kInvalidWorkerIndex;
+                EXPECT_NE(context.m_system->GetCurrentWorkerIndex(), kInvalidWorker);
+                if (node->m_depth == 0)
+                {
+                    context.m_leafCount++;
+                    return;
+                }
+                Node children[4];
+                tf::JobDecl jobs[4];
+                for (int i = 0; i < 4; ++i)
+                {
+                    children[i].m_context = &context;
+                    children[i].m_depth = node->m_depth - 1;
+                    jobs[i].m_function = &Recursive::Run;
+                    jobs[i].m_data = &children[i];
+                }
+                tf::JobCounter counter;
+                context.m_system->Run(jobs, 4, &counter);
+                context.m_system->WaitForCounter(counter);
+            }
+        };
+        Context context = { &system, { 0 }, { 0 } };
+        Node root = { &context, 6 };
+        tf::JobCounter rootCounter;
+        system.Run(&Recursive::Run, &root, &rootCounter);
+        system.WaitForCounter(rootCounter);
+        EXPECT_EQ(context.m_leafCount.load(), 4 * 4 * 4 * 4 * 4 * 4);
+
+        // Jobs run from a thread outside the system, waited on from there. 
+        std::thread external([&]()
+        {
+            const uint32_t kInvalidWorker = tf::JobSystem::kInvalidWorkerIndex;
+            EXPECT_EQ(system.GetCurrentWorkerIndex(), kInvalidWorker);
+            tf::JobCounter counter;
+            for (int i = 0; i < 1000; ++i)
+            {
+                system.Run([](void* data) { static_cast<Context*>(data)->m_sum += 2; }, &context, &counter);
+            }
+            system.WaitForCounter(counter);
+        });
+        external.join();
+        EXPECT_EQ(context.m_sum.load(), 2000);
+
+        // Waiting for part of a group. 
+        tf::JobCounter partial;
+        std::atomic<bool> release(false);
+        system.Run([](void* data) { while (!static_cast<std::atomic<bool>*>(data)->load()) { std::this_thread::yield(); } }, &release, &partial);
+        system.Run([](void*) {}, nullptr, &partial);
+        system.WaitForCounter(partial, 1);
+        EXPECT_EQ(partial.GetValue(), 1);
+        release = true;
+        system.WaitForCounter(partial);
+    }
+
+    TEST(tiny_base, job_system_scaling)
+    {
+        // Fixed amount of arithmetic split into jobs, from 1 to N workers. 
+        const uint32_t kJobCount = 2048;
+        const uint32_t kIterationCount = 20000;
+        struct Slice
+        {
+            uint32_t    m_seed;
+            uint32_t    m_result;
+        };
+        std::vector<Slice> slices(kJobCount);
+        std::vector<tf::JobDecl> jobs(kJobCount);
+        for (uint32_t i = 0; i < kJobCount; ++i)
+        {
+            slices[i].m_seed = i + 1;
+            jobs[i].m_function = [](void* data)
+            {
+                Slice* slice = static_cast<Slice*>(data);
+                uint32_t value = slice->m_seed;
+                for (uint32_t n = 0; n < kIterationCount; ++n)
+                {
+                    value ^= value << 13;
+                    value ^= value >> 17;
+                    value ^= value << 5;
+                }
+                slice->m_result = value;
+            };
+            jobs[i].m_data = &slices[i];
+        }
+
+        const uint32_t maxWorkerCount = (std::thread::hardware_concurrency() > 1) ? std::thread::hardware_concurrency() : 1;
+        double singleMs = 0.0;
+        uint32_t expected = 0;
+        for (uint32_t workerCount = 1; workerCount <= maxWorkerCount; workerCount *= 2)
+        {
+            tf::JobSystem system(workerCount);
+            tf::JobCounter counter;
+            const auto begin = std::chrono::high_resolution_clock::now();
+            system.Run(jobs.data(), kJobCount, &counter);
+            system.WaitForCounter(counter);
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+
+            uint32_t checksum = 0;
+            for (const Slice& slice : slices)
+            {
+                checksum += slice.m_result;
+            }
+            expected = (workerCount == 1) ? checksum : expected;
+            EXPECT_EQ(checksum, expected);
+            singleMs = (workerCount == 1) ? ms : singleMs;
+            printf("%u jobs on %u workers: %.2f ms (x%.2f)\n", kJobCount, workerCount, ms, singleMs / ms);
+            if (workerCount < maxWorkerCount && workerCount * 2 > maxWorkerCount)
+            {
+                workerCount = maxWorkerCount / 2;
+            }
+        }
+    }
+
+    TEST(tiny_base, job_system_fibers)
+    {
+        // A job waiting for a child suspends its fiber, the single worker runs the child meanwhile. 
+        {
+            tf::JobSystem system(tf::JobSystemDesc(1, 8));
+            EXPECT_EQ(system.GetFiberCount(), 8u);
+            struct Parent
+            {
+                tf::JobSystem*  m_system;
+                uint32_t        m_waitingCount;
+                int             m_order;
+                int             m_childOrder;
+            };
+            Parent parent = { &system, 0, 0, 0 };
+            tf::JobCounter counter;
+            system.Run([](void* data)
+            {
+                Parent* parent = static_cast<Parent*>(data);
+                tf::JobCounter childCounter;
+                parent->m_system->Run([](void* data)
+                {
+                    Parent* parent = static_cast<Parent*>(data);
+                    parent->m_waitingCount = parent->m_system->GetWaitingFiberCount();
+                    parent->m_childOrder = ++parent->m_order;
+                }, parent, &childCounter);
+                parent->m_system->WaitForCounter(childCounter);
+                ++parent->m_order;
+            }, &parent, &counter);
+            system.WaitForCounter(counter);
+            EXPECT_EQ(parent.m_waitingCount, 1u);
+            EXPECT_EQ(parent.m_childOrder, 1);
+            EXPECT_EQ(parent.m_order, 2);
+            EXPECT_EQ(system.GetWaitingFiberCount(), 0u);
+        }
+
+        // Deep spawn and wait trees on several workers. Waits outnumber the fibers, so some of them 
+        // fall back to running jobs on the waiting stack. After every wait the worker index must still 
+        // match the thread the job continues on, whichever that is. 
+        struct Context
+        {
+            tf::JobSystem*                                  m_system;
+            std::atomic<int>                                m_leafCount;
+            std::atomic<int>                                m_mismatchCount;
+            std::mutex                                      m_mutex;
+            std::unordered_map<uint32_t, std::thread::id>   m_workerThreads;
+        };
+        struct Node
+        {
+            Context*    m_context;
+            int         m_depth;
+        };
+        struct Recursive
+        {
+            static void Run(void* data)
+            {
+                Node* node = static_cast<Node*>(data);
+                Context& context = *node->m_context;
+                if (node->m_depth == 0)
+                {
+                    context.m_leafCount++;
+                    return;
+                }
+                Node children[3];
+                tf::JobDecl jobs[3];
+                for (int i = 0; i < 3; ++i)
+                {
+                    children[i].m_context = &context;
+                    children[i].m_depth = node->m_depth - 1;
+                    jobs[i].m_function = &Recursive::Run;
+                    jobs[i].m_data = &children[i];
+                }
+                tf::JobCounter counter;
+                context.m_system->Run(jobs, 3, &counter);
+                context.m_system->WaitForCounter(counter);
+                const std::thread::id after = std::this_thread::get_id();
+
+                const uint32_t workerIndex = context.m_system->GetCurrentWorkerIndex();
+                std::lock_guard<std::mutex> lock(context.m_mutex);
+                auto it = context.m_workerThreads.emplace(workerIndex, after).first;
+                context.m_mismatchCount += (it->second != after) ? 1 : 0;
+            }
+        };
+        tf::JobSystem system(tf::JobSystemDesc(4, 48));
+        Context context;
+        context.m_system = &system;
+        context.m_leafCount = 0;
+        context.m_mismatchCount = 0;
+        for (int round = 0; round < 10; ++round)
+        {
+            Node root = { &context, 7 };
+            tf::JobCounter counter;
+            system.Run(&Recursive::Run, &root, &counter);
+            system.WaitForCounter(counter);
+        }
+        EXPECT_EQ(context.m_leafCount.load(), 10 * 3 * 3 * 3 * 3 * 3 * 3 * 3);
+        EXPECT_EQ(context.m_mismatchCount.load(), 0);
+        EXPECT_EQ(system.GetWaitingFiberCount(), 0u);
+
+        // A thread outside the system runs fibers while it waits. 
+        std::thread external([&]()
+        {
+            Node root = { &context, 4 };
+            tf::JobCounter counter;
+            system.Run(&Recursive::Run, &root, &counter);
+            system.WaitForCounter(counter);
+        });
+        external.join();
+        EXPECT_EQ(context.m_leafCount.load(), 10 * 3 * 3 * 3 * 3 * 3 * 3 * 3 + 3 * 3 * 3 * 3);
+    }
+
+    TEST(tiny_base, job_system_fiber_pool_exhausted)
+    {
+        // Worker 0 (this thread) and two worker threads, each thread holding one of the three fibers 
+        // once it waits. The parent job parks on the fiber left, this thread then finds the pool 
+        // empty, waits on its own stack and steals the child. Once the child is done both worker 
+        // threads are asleep, and the parked parent must still be resumed. 
+        struct Context
+        {
+            tf::JobSystem*              m_system;
+            tf::JobCounter              m_childCounter;
+            std::atomic<bool>           m_blockerStarted;
+            std::atomic<bool>           m_spinnerStarted;
+            std::atomic<bool>           m_release;
+            std::atomic<bool>           m_childOnMainThread;
+            std::thread::id             m_mainThread;
+
+            static void Block(void* data)
+            {
+                Context* context = static_cast<Context*>(data);
+                context->m_blockerStarted = true;
+                while (!context->m_release.load())
+                {
+                    std::this_thread::yield();
+                }
+            }
+
+            static void Spin(void* data)
+            {
+                Context* context = static_cast<Context*>(data);
+                context->m_spinnerStarted = true;
+                while (!context->m_release.load())
+                {
+                    std::this_thread::yield();
+                }
+            }
+
+            static void Child(void* data)
+            {
+                Context* context = static_cast<Context*>(data);
+                context->m_childOnMainThread = (std::this_thread::get_id() == context->m_mainThread);
+                context->m_release = true;
+                // Long enough for both workers to run out of work and go to sleep. 
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            }
+
+            static void Parent(void* data)
+            {
+                Context* context = static_cast<Context*>(data);
+                context->m_system->Run(&Child, context, &context->m_childCounter);
+                // Popped first by the fiber that takes over this worker, the child stays for thieves. 
+                context->m_system->Run(&Spin, context, nullptr);
+                context->m_system->WaitForCounter(context->m_childCounter);
+            }
+        };
+        tf::JobSystem system(tf::JobSystemDesc(3, 3));
+        Context context;
+        context.m_system = &system;
+        context.m_blockerStarted = false;
+        context.m_spinnerStarted = false;
+        context.m_release = false;
+        context.m_childOnMainThread = false;
+        context.m_mainThread = std::this_thread::get_id();
+
+        std::mutex doneMutex;
+        std::condition_variable doneCondition;
+        bool done = false;
+        std::thread watchdog([&]()
+        {
+            std::unique_lock<std::mutex> lock(doneMutex);
+            if (!doneCondition.wait_for(lock, std::chrono::seconds(20), [&]() { return done; }))
+            {
+                fprintf(stderr, "job_system_fiber_pool_exhausted: deadlock, %u fibers waiting\n", system.GetWaitingFiberCount());
+                std::abort();
+            }
+        });
+
+        tf::JobCounter blockerCounter;
+        system.Run(&Context::Block, &context, &blockerCounter);
+        while (!context.m_blockerStarted.load())
+        {
+            std::this_thread::yield();
+        }
+        tf::JobCounter parentCounter;
+        system.Run(&Context::Parent, &context, &parentCounter);
+        while (!context.m_spinnerStarted.load() || system.GetWaitingFiberCount() != 1)
+        {
+            std::this_thread::yield();
+        }
+        system.WaitForCounter(parentCounter);
+        system.WaitForCounter(blockerCounter);
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            done = true;
+        }
+        doneCondition.notify_one();
+        watchdog.join();
+        EXPECT_TRUE(context.m_childOnMainThread.load());
+        EXPECT_EQ(system.GetWaitingFiberCount(), 0u);
+    }
+
+    TEST(tiny_base, task_graph)
+    {
+        struct Log
+        {
+            std::vector<int>            m_order;
+
+            struct Entry
+            {
+                Log*                    m_log;
+                int                     m_id;
+
+                static void Run(void* data)
+                {
+                    const Entry* entry = static_cast<const Entry*>(data);
+                    entry->m_log->m_order.push_back(entry->m_id);
+                }
+            };
+        };
+        Log log;
+        Log::Entry entries[5];
+        for (int i = 0; i < 5; ++i)
+        {
+            entries[i].m_log = &log;
+            entries[i].m_id = i;
+        }
+        const tf::TaskResource positions = tf::MakeTaskResource("positions");
+        const tf::TaskResource bounds = tf::MakeTaskResource("bounds");
+
+        tf::TaskGraph graph;
+        auto build = [&]()
+        {
+            graph.Clear();
+            const tf::TaskId clear = graph.AddTask("clear", &Log::Entry::Run, &entries[0]);
+            const tf::TaskId simulate = graph.AddTask("simulate", &Log::Entry::Run, &entries[1]);
+            const tf::TaskId bound = graph.AddTask("bound", &Log::Entry::Run, &entries[2]);
+            const tf::TaskId cull = graph.AddTask("cull", &Log::Entry::Run, &entries[3]);
+            const tf::TaskId draw = graph.AddTask("draw", &Log::Entry::Run, &entries[4]);
+            graph.Read(cull, bounds);
+            graph.Write(bound, bounds);
+            graph.Read(bound, positions);
+            graph.Write(simulate, positions);
+            graph.DependOn(draw, cull);
+            graph.DependOn(draw, clear);
+        };
+        build();
+        // The accesses were declared in any order, the task order decides which write a read sees. 
+        EXPECT_TRUE(graph.Compile());
+        EXPECT_EQ(graph.GetTaskCount(), 5u);
+        EXPECT_EQ(graph.GetCompileCount(), 1u);
+        EXPECT_EQ(graph.GetPriority(0), 2u);
+        EXPECT_EQ(graph.GetPriority(1), 4u);
+        EXPECT_EQ(graph.GetPriority(2), 3u);
+        EXPECT_EQ(graph.GetPriority(3), 2u);
+        EXPECT_EQ(graph.GetPriority(4), 1u);
+        EXPECT_EQ(graph.GetCriticalPathCost(), 4u);
+        graph.RunSerial();
+        EXPECT_EQ(log.m_order, (std::vector<int>{ 1, 2, 0, 3, 4 }));
+
+        // Same topology next frame: the schedule is reused. 
+        build();
+        EXPECT_TRUE(graph.Compile());
+        EXPECT_EQ(graph.GetCompileCount(), 1u);
+
+        // A write after the reads waits for every reader. 
+        graph.Clear();
+        const tf::TaskId writeA = graph.AddTask("a", &Log::Entry::Run, &entries[0]);
+        const tf::TaskId readB = graph.AddTask("b", &Log::Entry::Run, &entries[1], 5);
+        const tf::TaskId readC = graph.AddTask("c", &Log::Entry::Run, &entries[2]);
+        const tf::TaskId writeD = graph.AddTask("d", &Log::Entry::Run, &entries[3]);
+        graph.Write(writeA, positions);
+        graph.Read(readB, positions);
+        graph.Read(readC, positions);
+        graph.Write(writeD, positions);
+        EXPECT_TRUE(graph.Compile());
+        EXPECT_EQ(graph.GetCompileCount(), 2u);
+        EXPECT_EQ(graph.GetCriticalPathCost(), 7u);
+        log.m_order.clear();
+        graph.RunSerial();
+        EXPECT_EQ(log.m_order, (std::vector<int>{ 0, 1, 2, 3 }));
+    }
+
+    TEST(tiny_base, task_graph_cycle)
+    {
+        struct Nop
+        {
+            static void Run(void*)
+            {
+            }
+        };
+        tf::TaskGraph graph;
+        const tf::TaskId a = graph.AddTask("a", &Nop::Run, nullptr);
+        const tf::TaskId b = graph.AddTask("b", &Nop::Run, nullptr);
+        graph.DependOn(a, b);
+        graph.DependOn(b, a);
+#if defined(NDEBUG)
+        EXPECT_FALSE(graph.Compile());
+#else
+        EXPECT_DEATH(graph.Compile(), "cycle");
+#endif
+    }
+
+    TEST(tiny_base, task_graph_parallel)
+    {
+        // Layers of tasks, each reading every resource written by the layer before. 
+        static const int kLayerCount = 6;
+        static const int kLayerWidth = 8;
+        struct Context
+        {
+            std::atomic<int>            m_finished[kLayerCount];
+            std::atomic<int>            m_violationCount;
+        };
+        struct Task
+        {
+            Context*                    m_context;
+            int                         m_layer;
+
+            static void Run(void* data)
+            {
+                const Task* task = static_cast<const Task*>(data);
+                Context& context = *task->m_context;
+                if (task->m_layer > 0 && context.m_finished[task->m_layer - 1].load() != kLayerWidth)
+                {
+                    ++context.m_violationCount;
+                }
+                volatile uint64_t sink = 0;
+                for (int i = 0; i < 20000; ++i)
+                {
+                    sink = sink + i;
+                }
+                ++context.m_finished[task->m_layer];
+            }
+        };
+        Context context;
+        Task tasks[kLayerCount][kLayerWidth];
+        tf::JobSystem system(4);
+        tf::TaskGraph graph;
+        for (int frame = 0; frame < 20; ++frame)
+        {
+            for (int layer = 0; layer < kLayerCount; ++layer)
+            {
+                context.m_finished[layer] = 0;
+            }
+            context.m_violationCount = 0;
+            graph.Clear();
+            for (int layer = 0; layer < kLayerCount; ++layer)
+            {
+                for (int i = 0; i < kLayerWidth; ++i)
+                {
+                    tasks[layer][i].m_context = &context;
+                    tasks[layer][i].m_layer = layer;
+                    const tf::TaskId task = graph.AddTask("layer", &Task::Run, &tasks[layer][i]);
+                    graph.Write(task, static_cast<tf::TaskResource>(layer * kLayerWidth + i));
+                    for (int j = 0; layer > 0 && j < kLayerWidth; ++j)
+                    {
+                        graph.Read(task, static_cast<tf::TaskResource>((layer - 1) * kLayerWidth + j));
+                    }
+                }
+            }
+            ASSERT_TRUE(graph.Compile());
+            graph.Run(system);
+            EXPECT_EQ(context.m_finished[kLayerCount - 1].load(), kLayerWidth);
+            EXPECT_EQ(context.m_violationCount.load(), 0);
+        }
+        EXPECT_EQ(graph.GetCompileCount(), 1u);
+        EXPECT_EQ(graph.GetCriticalPathCost(), static_cast<uint64_t>(kLayerCount));
+    }
+
+    TEST(tiny_base, parallel_algorithms)
+    {
+        tf::JobSystem system(4);
+        const size_t kSizes[] = { 0, 1, 100, 4097, 100000 };
+        for (size_t size : kSizes)
+        {
+            // Every index exactly once, with the default and a small explicit grain. 
+            std::vector<std::atomic<int>> visits(size);
+            tf::ParallelFor(system, 0, size, [&](size_t i) { ++visits[i]; });
+            tf::ParallelFor(system, 0, size, [&](size_t i) { ++visits[i]; }, tf::ParallelDesc(7, 0));
+            size_t wrongCount = 0;
+            for (size_t i = 0; i < size; ++i)
+            {
+                wrongCount += (visits[i].load() != 2) ? 1 : 0;
+            }
+            EXPECT_EQ(wrongCount, 0u);
+
+            const uint64_t sum = tf::ParallelReduce(system, 0, size, uint64_t(0),
+                                                    [](size_t i) { return static_cast<uint64_t>(i) * i; },
+                                                    [](uint64_t a, uint64_t b) { return a + b; }, tf::ParallelDesc(100, 0));
+            uint64_t expected = 0;
+            for (size_t i = 0; i < size; ++i)
+            {
+                expected += static_cast<uint64_t>(i) * i;
+            }
+            EXPECT_EQ(sum, expected);
+
+            // Scan in place, and a non-commutative combine (keeps the last value) out of place. 
+            std::vector<uint32_t> values(size);
+            std::mt19937 random(static_cast<uint32_t>(size));
+            for (uint32_t& value : values)
+            {
+                value = random() % 1000;
+            }
+            std::vector<uint32_t> scanned = values;
+            tf::ParallelInclusiveScan(system, scanned.data(), scanned.data(), size, [](uint32_t a, uint32_t b) { return a + b; }, tf::ParallelDesc(0, 0));
+            std::vector<uint32_t> expectedScan(size);
+            std::partial_sum(values.begin(), values.end(), expectedScan.begin());
+            EXPECT_EQ(scanned, expectedScan);
+            std::vector<uint32_t> lastValues(size);
+            tf::ParallelInclusiveScan(system, values.data(), lastValues.data(), size, [](uint32_t, uint32_t b) { return b; }, tf::ParallelDesc(0, 0));
+            EXPECT_EQ(lastValues, values);
+
+            // Duplicates, and a grain that leaves an odd number of runs. 
+            std::vector<uint32_t> expectedSort = values;
+            std::sort(expectedSort.begin(), expectedSort.end());
+            std::vector<uint32_t> sorted = values;
+            tf::ParallelSort(system, sorted.data(), sorted.data() + size, std::less<uint32_t>(), tf::ParallelDesc(0, 0));
+            EXPECT_EQ(sorted, expectedSort);
+            sorted = values;
+            tf::ParallelSort(system, sorted.data(), sorted.data() + size, std::greater<uint32_t>(), tf::ParallelDesc(333, 0));
+            EXPECT_TRUE(std::equal(sorted.begin(), sorted.end(), expectedSort.rbegin()));
+
+            // Scratch from a frame arena instead of the heap. 
+            tf::FrameArenaAllocator arena(1024 * 1024);
+            sorted = values;
+            tf::ParallelSort(system, sorted.data(), sorted.data() + size, std::less<uint32_t>(), tf::ParallelDesc(0, 0), arena);
+            EXPECT_EQ(sorted, expectedSort);
+            EXPECT_EQ(tf::ParallelReduce(system, 0, size, uint64_t(0), [](size_t i) { return static_cast<uint64_t>(i) * i; },
+                                         [](uint64_t a, uint64_t b) { return a + b; }, tf::ParallelDesc(100, 0), arena), expected);
+            tf::ParallelInclusiveScan(system, values.data(), scanned.data(), size, [](uint32_t a, uint32_t b) { return a + b; }, tf::ParallelDesc(0, 0), arena);
+            EXPECT_EQ(scanned, expectedScan);
+            EXPECT_EQ(arena.GetUsedBytes() > 0, size > 0);
+        }
+
+        // Called from jobs, nested loops share the workers. 
+        struct Nested
+        {
+            tf::JobSystem*              m_system;
+            std::atomic<uint64_t>       m_sum;
+
+            static void Run(void* data)
+            {
+                Nested* nested = static_cast<Nested*>(data);
+                tf::ParallelFor(*nested->m_system, 0, 64, [nested](size_t i)
+                {
+                    nested->m_sum += tf::ParallelReduce(*nested->m_system, 0, 1000, uint64_t(0),
+                                                        [i](size_t j) { return static_cast<uint64_t>(i + j); },
+                                                        [](uint64_t a, uint64_t b) { return a + b; }, tf::ParallelDesc(10, 0));
+                }, tf::ParallelDesc(1, 0));
+            }
+        };
+        Nested nested;
+        nested.m_system = &system;
+        nested.m_sum = 0;
+        tf::JobCounter counter;
+        system.Run(&Nested::Run, &nested, &counter);
+        system.WaitForCounter(counter);
+        EXPECT_EQ(nested.m_sum.load(), 64u * 999 * 1000 / 2 + 1000u * 63 * 64 / 2);
+    }
+
+    TEST(tiny_base, parallel_algorithms_benchmark)
+    {
+#if defined(TF_DEBUG)
+        const size_t kCount = 1000000;
+#else
+        const size_t kCount = 10000000;
+#endif
+        std::vector<uint32_t> values(kCount);
+        std::mt19937 random(12345);
+        for (uint32_t& value : values)
+        {
+            value = random();
+        }
+        auto work = [](uint32_t& value)
+        {
+            for (int n = 0; n < 8; ++n)
+            {
+                value ^= value << 13;
+                value ^= value >> 17;
+                value ^= value << 5;
+            }
+        };
+        auto elapsed = [](std::chrono::high_resolution_clock::time_point begin)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+        };
+        tf::JobSystem system;
+
+        std::vector<uint32_t> expected = values;
+        auto begin = std::chrono::high_resolution_clock::now();
+        std::for_each(expected.begin(), expected.end(), work);
+        const double forEachMs = elapsed(begin);
+        std::vector<uint32_t> data = values;
+        begin = std::chrono::high_resolution_clock::now();
+        tf::ParallelFor(system, 0, kCount, [&](size_t i) { work(data[i]); });
+        const double parallelForMs = elapsed(begin);
+        EXPECT_EQ(data, expected);
+        printf("for_each %zu: std::for_each %.2f ms, tf::ParallelFor %.2f ms on %u workers\n", kCount, forEachMs, parallelForMs, system.GetWorkerCount());
+
+        expected = values;
+        begin = std::chrono::high_resolution_clock::now();
+        std::sort(expected.begin(), expected.end());
+        const double sortMs = elapsed(begin);
+        data = values;
+        begin = std::chrono::high_resolution_clock::now();
+        tf::ParallelSort(system, data.data(), data.data() + kCount);
+        const double parallelSortMs = elapsed(begin);
+        EXPECT_EQ(data, expected);
+        printf("sort %zu: std::sort %.2f ms, tf::ParallelSort %.2f ms on %u workers\n", kCount, sortMs, parallelSortMs, system.GetWorkerCount());
+
+        begin = std::chrono::high_resolution_clock::now();
+        const uint64_t serialSum = std::accumulate(values.begin(), values.end(), uint64_t(0));
+        const double accumulateMs = elapsed(begin);
+        begin = std::chrono::high_resolution_clock::now();
+        const uint64_t sum = tf::ParallelReduce(system, 0, kCount, uint64_t(0), [&](size_t i) { return uint64_t(values[i]); }, std::plus<uint64_t>());
+        const double reduceMs = elapsed(begin);
+        EXPECT_EQ(sum, serialSum);
+        begin = std::chrono::high_resolution_clock::now();
+        std::partial_sum(values.begin(), values.end(), expected.begin());
+        const double partialSumMs = elapsed(begin);
+        begin = std::chrono::high_resolution_clock::now();
+        tf::ParallelInclusiveScan(system, values.data(), data.data(), kCount, std::plus<uint32_t>());
+        const double scanMs = elapsed(begin);
+        EXPECT_EQ(data, expected);
+        printf("reduce %zu: std::accumulate %.2f ms, tf::ParallelReduce %.2f ms; scan: std::partial_sum %.2f ms, tf::ParallelInclusiveScan %.2f ms\n",
+               kCount, accumulateMs, reduceMs, partialSumMs, scanMs);
+    }
+
+    TEST(tiny_base, atomic)
+    {
+        tf::Atomic<uint32_t> value(5);
+        EXPECT_EQ(value.Load(std::memory_order_relaxed), 5u);
+        EXPECT_EQ(value.FetchAdd(3, std::memory_order_relaxed), 5u);
+        EXPECT_EQ(value.FetchSub(1, std::memory_order_acq_rel), 8u);
+        EXPECT_EQ(value.FetchOr(0x100, std::memory_order_relaxed), 7u);
+        EXPECT_EQ(value.FetchAnd(0xff, std::memory_order_relaxed), 0x107u);
+        uint32_t expected = 6;
+        EXPECT_FALSE(value.CompareExchange(expected, 9, std::memory_order_acq_rel, std::memory_order_acquire));
+        EXPECT_EQ(expected, 7u);
+        EXPECT_TRUE(value.CompareExchange(expected, 9, std::memory_order_acq_rel, std::memory_order_acquire));
+        EXPECT_EQ(value.Exchange(1, std::memory_order_seq_cst), 9u);
+        value.Store(2, std::memory_order_release);
+        EXPECT_EQ(value.Load(std::memory_order_acquire), 2u);
+
+        int items[2] = {};
+        tf::Atomic<int*> pointer(&items[0]);
+        EXPECT_EQ(pointer.FetchAdd(1, std::memory_order_relaxed), &items[0]);
+        EXPECT_EQ(pointer.Load(std::memory_order_relaxed), &items[1]);
+    }
+
+    TEST(tiny_base, spin_lock_and_mutex)
+    {
+        const int kThreadCount = 4;
+        const int kIterationCount = 20000;
+        auto hammer = [&](auto& lock)
+        {
+            uint64_t counter = 0;
+            std::vector<std::thread> threads;
+            for (int t = 0; t < kThreadCount; ++t)
+            {
+                threads.emplace_back([&]()
+                {
+                    for (int i = 0; i < kIterationCount; ++i)
+                    {
+                        std::lock_guard<typename std::remove_reference<decltype(lock)>::type> guard(lock);
+                        ++counter;
+                    }
+                });
+            }
+            for (std::thread& thread : threads)
+            {
+                thread.join();
+            }
+            return counter;
+        };
+        tf::SpinLock spinLock;
+        EXPECT_EQ(hammer(spinLock), static_cast<uint64_t>(kThreadCount) * kIterationCount);
+        EXPECT_TRUE(spinLock.TryLock());
+        EXPECT_FALSE(spinLock.TryLock());
+        spinLock.Unlock();
+
+        tf::Mutex mutex;
+        EXPECT_EQ(hammer(mutex), static_cast<uint64_t>(kThreadCount) * kIterationCount);
+        EXPECT_TRUE(mutex.TryLock());
+        EXPECT_FALSE(mutex.TryLock());
+        mutex.Unlock();
+
+        // A locked mutex puts the other thread to sleep until the unlock. 
+        mutex.Lock();
+        std::atomic<bool> acquired(false);
+        std::thread waiter([&]()
+        {
+            mutex.Lock();
+            acquired = true;
+            mutex.Unlock();
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        EXPECT_FALSE(acquired.load());
+        mutex.Unlock();
+        waiter.join();
+        EXPECT_TRUE(acquired.load());
+    }
+
+    TEST(tiny_base, event)
+    {
+        // Auto reset: two threads hand a turn back and forth. 
+        const int kRoundCount = 2000;
+        tf::Event ping;
+        tf::Event pong;
+        int turns = 0;
+        std::thread other([&]()
+        {
+            for (int i = 0; i < kRoundCount; ++i)
+            {
+                ping.Wait();
+                ++turns;
+                pong.Set();
+            }
+        });
+        for (int i = 0; i < kRoundCount; ++i)
+        {
+            ping.Set();
+            pong.Wait();
+            ++turns;
+        }
+        other.join();
+        EXPECT_EQ(turns, 2 * kRoundCount);
+        EXPECT_FALSE(ping.IsSet());
+        EXPECT_FALSE(ping.TryWait());
+        ping.Set();
+        EXPECT_TRUE(ping.TryWait());
+        EXPECT_FALSE(ping.TryWait());
+
+        // Manual reset: one Set() releases every waiter and stays set. 
+        tf::Event gate(true);
+        std::atomic<int> passed(0);
+        std::vector<std::thread> waiters;
+        for (int i = 0; i < 4; ++i)
+        {
+            waiters.emplace_back([&]()
+            {
+                gate.Wait();
+                ++passed;
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        EXPECT_EQ(passed.load(), 0);
+        gate.Set();
+        for (std::thread& waiter : waiters)
+        {
+            waiter.join();
+        }
+        EXPECT_EQ(passed.load(), 4);
+        EXPECT_TRUE(gate.TryWait());
+        gate.Reset();
+        EXPECT_FALSE(gate.IsSet());
+    }
+
+    TEST(tiny_base, lock_contention_benchmark)
+    {
+#if defined(TF_DEBUG)
+        const int kIterationCount = 20000;
+#else
+        const int kIterationCount = 200000;
+#endif
+        // A few shared cache lines of work per critical section, as in an allocator free list. 
+        struct Shared
+        {
+            uint64_t                    m_values[16];
+        };
+        auto measure = [&](auto& lock, int threadCount)
+        {
+            Shared shared = {};
+            std::vector<std::thread> threads;
+            const auto begin = std::chrono::high_resolution_clock::now();
+            for (int t = 0; t < threadCount; ++t)
+            {
+                threads.emplace_back([&, t]()
+                {
+                    for (int i = 0; i < kIterationCount; ++i)
+                    {
+                        std::lock_guard<typename std::remove_reference<decltype(lock)>::type> guard(lock);
+                        shared.m_values[(i + t) & 15] += i;
+                    }
+                });
+            }
+            for (std::thread& thread : threads)
+            {
+                thread.join();
+            }
+            const double ns = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - begin).count();
+            uint64_t sum = 0;
+            for (uint64_t value : shared.m_values)
+            {
+                sum += value;
+            }
+            EXPECT_EQ(sum, static_cast<uint64_t>(threadCount) * kIterationCount * (kIterationCount - 1) / 2);
+            return ns / (static_cast<double>(threadCount) * kIterationCount);
+        };
+        const int kThreadCounts[] = { 1, 2, 4, 8 };
+        for (int threadCount : kThreadCounts)
+        {
+            std::mutex stdMutex;
+            tf::SpinLock spinLock;
+            tf::Mutex mutex;
+            const double stdMutexNs = measure(stdMutex, threadCount);
+            const double spinLockNs = measure(spinLock, threadCount);
+            const double mutexNs = measure(mutex, threadCount);
+            printf("%d threads: %.1f / %.1f / %.1f ns per lock (std::mutex / tf::SpinLock / tf::Mutex), %u hardware threads\n",
+                   threadCount, stdMutexNs, spinLockNs, mutexNs, std::thread::hardware_concurrency());
+        }
+    }
 
 
 } // namespace unittest 
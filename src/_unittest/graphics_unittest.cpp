@@ -12,6 +12,7 @@ namespace tf_unittest
     class UnitTestDirectXApplicationAdapter : public tf::ApplicationAdapter
     {
         tf::Allocator&              m_allocator;
+        tf::FrameArenaAllocator     m_frameAllocator;
         tf::gpu::Device*            m_device;
         tf::gpu::CommandContext*    m_commandContext;
         tf::gpu::SwapChain*         m_swapChain;
@@ -31,6 +32,7 @@ namespace tf_unittest
     UnitTestDirectXApplicationAdapter::UnitTestDirectXApplicationAdapter(const std::wstring& name)
         : ApplicationAdapter(name)
         , m_allocator       (tf::DefaultAllocator())
+        , m_frameAllocator  (64 * 1024)
         , m_device          (nullptr)
         , m_commandContext  (nullptr)
         , m_swapChain       (nullptr)
@@ -57,9 +59,14 @@ namespace tf_unittest
 
         m_frameIndex = m_swapChain->GetCurrentFrameBufferIndex();
         EXPECT_GE(m_frameIndex, 0);
+        m_frameAllocator.BeginFrame(m_frameIndex);
 
         m_fence = m_device->CreateSynchronizationObject(m_allocator);
         EXPECT_NE(m_fence, nullptr);
+
+        EXPECT_EQ(m_device->Resolve(m_commandContext->GetHandle()), m_commandContext);
+        EXPECT_EQ(m_device->Resolve(m_swapChain->GetHandle()), m_swapChain);
+        EXPECT_EQ(m_device->Resolve(m_fence->GetHandle()), m_fence);
     }
 
     void UnitTestDirectXApplicationAdapter::Update()
@@ -87,12 +94,29 @@ namespace tf_unittest
         }
         {
             m_fence->MoveToNextFrame(*m_commandContext, *m_swapChain, m_frameIndex);
+
+            // The GPU is done with the new frame index, its scratch memory can be recycled. 
+            m_frameAllocator.BeginFrame(m_frameIndex);
         }
     }
 
     void UnitTestDirectXApplicationAdapter::Terminate()
     {
         m_fence->WaitForGpu(*m_commandContext, m_frameIndex);
+
+        const tf::gpu::CommandContextHandle commandContextHandle = m_commandContext->GetHandle();
+        m_device->Destroy(m_fence, m_allocator);
+        m_device->Destroy(m_swapChain, m_allocator);
+        m_device->Destroy(m_commandContext, m_allocator);
+        m_fence             = nullptr;
+        m_swapChain         = nullptr;
+        m_commandContext    = nullptr;
+
+        // Stale handles no longer resolve. 
+        EXPECT_EQ(m_device->Resolve(commandContextHandle), nullptr);
+
+        delete m_device;
+        m_device = nullptr;
     }
 
     TEST(tiny_graphics, create_device)
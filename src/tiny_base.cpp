@@ -2,10 +2,151 @@
 #define WIN32_LEAN_AND_MEAN
 #include <tiny_base.h>
 #include <malloc.h>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#if defined(TF_COMPILER_MSVC)
+#include <intrin.h>
+#endif
+
+#if defined(TF_PLATFORM_WINDOWS)
+#include <windows.h>
+#if defined(TF_COMPILER_MSVC)
+#pragma comment(lib, "Synchronization.lib") // WaitOnAddress
+#endif
+#else
+#include <cstdlib>
+#include <dlfcn.h>
+#include <execinfo.h>
+#if defined(TF_PLATFORM_LINUX)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include <sys/mman.h>
+#include <unistd.h>
+#if !defined(__x86_64__) || !defined(__ELF__) || defined(TF_FIBER_UCONTEXT)
+#include <ucontext.h>
+#endif
+#endif
 
 namespace tf
 {
 
+    // Synchronization. 
+    void FutexWait(const Atomic<uint32_t>& address, uint32_t expected)
+    {
+#if defined(TF_PLATFORM_WINDOWS)
+        WaitOnAddress(const_cast<void*>(address.GetAddress()), &expected, sizeof(expected), INFINITE);
+#elif defined(TF_PLATFORM_LINUX)
+        syscall(SYS_futex, address.GetAddress(), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+        TF_UNUSED(expected);
+        std::this_thread::yield();
+#endif
+    }
+
+    void FutexWake(const Atomic<uint32_t>& address, bool all)
+    {
+#if defined(TF_PLATFORM_WINDOWS)
+        if (all)
+        {
+            WakeByAddressAll(const_cast<void*>(address.GetAddress()));
+        }
+        else
+        {
+            WakeByAddressSingle(const_cast<void*>(address.GetAddress()));
+        }
+#elif defined(TF_PLATFORM_LINUX)
+        syscall(SYS_futex, address.GetAddress(), FUTEX_WAKE_PRIVATE, all ? INT32_MAX : 1, nullptr, nullptr, 0);
+#else
+        TF_UNUSED(address);
+        TF_UNUSED(all);
+#endif
+    }
+
+    // Pauses between two looks at a SpinLock double up to this, then waiters yield the core. 
+    static const uint32_t kSpinBackoffLimit = 64;
+    // Attempts of a contended Mutex::Lock() before it sleeps. 
+    static const uint32_t kMutexSpinCount = 100;
+
+    void SpinLock::LockSlow()
+    {
+        uint32_t backoff = 1;
+        for (;;)
+        {
+            // Spin on a load, only try the exchange once the lock looks free. 
+            while (m_locked.Load(std::memory_order_relaxed) != 0)
+            {
+                if (backoff <= kSpinBackoffLimit)
+                {
+                    for (uint32_t i = 0; i < backoff; ++i)
+                    {
+                        TF_CPU_PAUSE();
+                    }
+                    backoff *= 2;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+            if (m_locked.Exchange(1, std::memory_order_acquire) == 0)
+            {
+                return;
+            }
+        }
+    }
+
+    void Mutex::LockSlow()
+    {
+        // A short spin first, the owner may be about to unlock. 
+        for (uint32_t i = 0; i < kMutexSpinCount; ++i)
+        {
+            uint32_t state = m_state.Load(std::memory_order_relaxed);
+            if (state == 0 && m_state.CompareExchange(state, 1, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                return;
+            }
+            if (state == 2)
+            {
+                break;
+            }
+            TF_CPU_PAUSE();
+        }
+        // Locked as contended from here on: the thread that gets it cannot tell whether others still 
+        // sleep, so its Unlock() wakes one. 
+        while (m_state.Exchange(2, std::memory_order_acquire) != 0)
+        {
+            FutexWait(m_state, 2);
+        }
+    }
+
+    void Event::Set()
+    {
+        // Both sides are seq_cst: either a waiter sees the signal before sleeping or Set() sees the waiter. 
+        if (m_signaled.Exchange(1, std::memory_order_seq_cst) == 0 && m_waiterCount.Load(std::memory_order_seq_cst) > 0)
+        {
+            FutexWake(m_signaled, m_manualReset);
+        }
+    }
+
+    void Event::WaitSlow()
+    {
+        m_waiterCount.FetchAdd(1, std::memory_order_seq_cst);
+        while (!TryWait())
+        {
+            FutexWait(m_signaled, 0);
+        }
+        m_waiterCount.FetchSub(1, std::memory_order_relaxed);
+    }
+
     Allocator::Allocator()
     {
     }
@@ -14,6 +155,59 @@ namespace tf
     {
     }
 
+    void* Allocator::Reallocate(void* block, size_t oldSize, size_t newSize, size_t alignment)
+    {
+        if (block == nullptr)
+        {
+            return Allocate(newSize, alignment);
+        }
+        if (newSize == 0)
+        {
+            Free(block);
+            return nullptr;
+        }
+        if (TryExpandInPlace(block, oldSize, newSize))
+        {
+            return block;
+        }
+
+        void* newBlock = Allocate(newSize, alignment);
+        if (newBlock == nullptr)
+        {
+            return nullptr;
+        }
+        memcpy(newBlock, block, (oldSize < newSize) ? oldSize : newSize);
+        Free(block);
+        return newBlock;
+    }
+
+    bool Allocator::TryExpandInPlace(void* block, size_t oldSize, size_t newSize)
+    {
+        TF_UNUSED(block);
+        return newSize <= oldSize;
+    }
+
+    size_t Allocator::AllocateBatch(size_t count, size_t size, size_t alignment, void** blocks)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            blocks[i] = Allocate(size, alignment);
+            if (blocks[i] == nullptr)
+            {
+                return i;
+            }
+        }
+        return count;
+    }
+
+    void Allocator::FreeBatch(void** blocks, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            Free(blocks[i]);
+        }
+    }
+
     class DefaultMemoryAllocator : public Allocator
     {
 
@@ -28,21 +222,4958 @@ namespace tf
 
         virtual void* Allocate(size_t size, size_t alignment) override
         {
-            return _aligned_malloc(size, alignment);
+            return HeapAllocatorPolicy().Allocate(size, alignment);
         }
 
         virtual void Free(void* block)
         {
-            _aligned_free(block);
+            HeapAllocatorPolicy().Free(block);
+        }
+
+        virtual void* Reallocate(void* block, size_t oldSize, size_t newSize, size_t alignment) override
+        {
+            if (block == nullptr || newSize == 0)
+            {
+                return Allocator::Reallocate(block, oldSize, newSize, alignment);
+            }
+#if defined(TF_PLATFORM_WINDOWS)
+            return _aligned_realloc(block, newSize, alignment);
+#else
+            // realloc() only keeps the malloc alignment, stricter alignments take the copying path. 
+            if (alignment <= alignof(std::max_align_t))
+            {
+                return realloc(block, newSize);
+            }
+            return Allocator::Reallocate(block, oldSize, newSize, alignment);
+#endif
+        }
+
+        virtual bool TryExpandInPlace(void* block, size_t oldSize, size_t newSize) override
+        {
+#if defined(TF_PLATFORM_LINUX)
+            // The allocator usually rounds the request up, the slack can be used as it is. 
+            return (newSize <= oldSize) || (newSize <= malloc_usable_size(block));
+#else
+            return Allocator::TryExpandInPlace(block, oldSize, newSize);
+#endif
         }
 
     }; // class DefaultMemoryAllocator 
 
-    static DefaultMemoryAllocator s_defaultMemoryAllocator;
+    static DefaultMemoryAllocator   s_defaultMemoryAllocator;
+    static std::atomic<Allocator*>  s_defaultAllocator(&s_defaultMemoryAllocator);
 
     Allocator& DefaultAllocator()
     {
-        return s_defaultMemoryAllocator;
+        return *s_defaultAllocator.load(std::memory_order_acquire);
+    }
+
+    Allocator& SetDefaultAllocator(Allocator& allocator)
+    {
+        return *s_defaultAllocator.exchange(&allocator);
+    }
+
+    static uint8_t* AlignPointer(uint8_t* ptr, size_t alignment)
+    {
+        return reinterpret_cast<uint8_t*>(TF_ALIGNMENT(reinterpret_cast<uintptr_t>(ptr), static_cast<uintptr_t>(alignment)));
+    }
+
+    FrameArenaAllocator::FrameArenaAllocator(size_t regionSize, Allocator& backing)
+        : m_backing         (backing)
+        , m_regions         ()
+        , m_frameIndex      (0)
+        , m_highWaterBytes  (0)
+        , m_overflowCount   (0)
+    {
+        assert(regionSize > 0);
+        for (int i = 0; i < BUFFERING_COUNT; ++i)
+        {
+            Region& region = m_regions[i];
+            region.m_begin      = static_cast<uint8_t*>(m_backing.Allocate(regionSize, TF_DEFAULT_ALIGNMENT_SIZE));
+            region.m_size       = (region.m_begin != nullptr) ? regionSize : 0;
+            region.m_overflow   = nullptr;
+            ResetRegion(region);
+        }
+    }
+
+    FrameArenaAllocator::~FrameArenaAllocator()
+    {
+        for (int i = 0; i < BUFFERING_COUNT; ++i)
+        {
+            Region& region = m_regions[i];
+            region.m_usedBytes = 0;
+            ResetRegion(region);
+            if (region.m_begin)
+            {
+                m_backing.Free(region.m_begin);
+                region.m_begin = nullptr;
+            }
+        }
+    }
+
+    void* FrameArenaAllocator::Allocate(size_t size, size_t alignment)
+    {
+        assert((alignment & (alignment - 1)) == 0); // alignment must be power of two.
+        Region& region = m_regions[m_frameIndex];
+
+        uint8_t* ptr = AlignPointer(region.m_current, alignment);
+        if (TF_LIKELY(ptr + size <= region.m_limit))
+        {
+            region.m_usedBytes += static_cast<size_t>((ptr + size) - region.m_current);
+            region.m_current    = ptr + size;
+            return ptr;
+        }
+        return AllocateOverflow(region, size, alignment);
+    }
+
+    void FrameArenaAllocator::Free(void* block)
+    {
+        // Memory is released in bulk by BeginFrame(). 
+        TF_UNUSED(block);
+    }
+
+    bool FrameArenaAllocator::TryExpandInPlace(void* block, size_t oldSize, size_t newSize)
+    {
+        Region& region = m_regions[m_frameIndex];
+        uint8_t* ptr = static_cast<uint8_t*>(block);
+        if (ptr + oldSize != region.m_current)
+        {
+            return newSize <= oldSize;
+        }
+        if (newSize > static_cast<size_t>(region.m_limit - ptr))
+        {
+            return false;
+        }
+        region.m_usedBytes  = region.m_usedBytes - oldSize + newSize;
+        region.m_current    = ptr + newSize;
+        return true;
+    }
+
+    size_t FrameArenaAllocator::AllocateBatch(size_t count, size_t size, size_t alignment, void** blocks)
+    {
+        assert((alignment & (alignment - 1)) == 0); // alignment must be power of two.
+        if (count == 0)
+        {
+            return 0;
+        }
+        Region& region = m_regions[m_frameIndex];
+
+        const size_t stride = TF_ALIGNMENT(size, alignment);
+        uint8_t* ptr = AlignPointer(region.m_current, alignment);
+        uint8_t* end = ptr + stride * (count - 1) + size;
+        if (TF_UNLIKELY(end > region.m_limit))
+        {
+            // Let Allocate() chain the overflow blocks one by one. 
+            return Allocator::AllocateBatch(count, size, alignment, blocks);
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            blocks[i] = ptr + i * stride;
+        }
+        region.m_usedBytes += static_cast<size_t>(end - region.m_current);
+        region.m_current    = end;
+        return count;
+    }
+
+    void FrameArenaAllocator::FreeBatch(void** blocks, size_t count)
+    {
+        TF_UNUSED(blocks);
+        TF_UNUSED(count);
+    }
+
+    void* FrameArenaAllocator::AllocateOverflow(Region& region, size_t size, size_t alignment)
+    {
+        // Chain another block from the backing allocator, at least as large as the region itself. 
+        const size_t headerSize = TF_ALIGNMENT(sizeof(OverflowBlock), TF_DEFAULT_ALIGNMENT_SIZE);
+        size_t blockSize = headerSize + size + alignment;
+        if (blockSize < region.m_size)
+        {
+            blockSize = region.m_size;
+        }
+
+        OverflowBlock* block = static_cast<OverflowBlock*>(m_backing.Allocate(blockSize, TF_DEFAULT_ALIGNMENT_SIZE));
+        assert(block != nullptr);
+        if (block == nullptr)
+        {
+            return nullptr;
+        }
+        block->m_next       = region.m_overflow;
+        block->m_size       = blockSize;
+        region.m_overflow   = block;
+        m_overflowCount++;
+
+        region.m_current    = reinterpret_cast<uint8_t*>(block) + headerSize;
+        region.m_limit      = reinterpret_cast<uint8_t*>(block) + blockSize;
+
+        uint8_t* ptr = AlignPointer(region.m_current, alignment);
+        region.m_usedBytes += static_cast<size_t>((ptr + size) - region.m_current);
+        region.m_current    = ptr + size;
+        return ptr;
+    }
+
+    void FrameArenaAllocator::ResetRegion(Region& region)
+    {
+        const bool overflowed = (region.m_overflow != nullptr);
+        while (region.m_overflow)
+        {
+            OverflowBlock* next = region.m_overflow->m_next;
+            m_backing.Free(region.m_overflow);
+            region.m_overflow = next;
+        }
+
+        // Grow the region to the observed usage so the next cycle fits without chaining. 
+        if (overflowed && region.m_usedBytes > region.m_size)
+        {
+            const size_t newSize = TF_ALIGNMENT(region.m_usedBytes, TF_DEFAULT_ALIGNMENT_SIZE);
+            uint8_t* newBegin = static_cast<uint8_t*>(m_backing.Allocate(newSize, TF_DEFAULT_ALIGNMENT_SIZE));
+            if (newBegin)
+            {
+                m_backing.Free(region.m_begin);
+                region.m_begin  = newBegin;
+                region.m_size   = newSize;
+            }
+        }
+
+        region.m_current    = region.m_begin;
+        region.m_limit      = region.m_begin + region.m_size;
+        region.m_usedBytes  = 0;
+    }
+
+    void FrameArenaAllocator::BeginFrame(int frameIndex)
+    {
+        assert(frameIndex >= 0 && frameIndex < BUFFERING_COUNT);
+
+        const size_t usedBytes = m_regions[frameIndex].m_usedBytes;
+        if (usedBytes > m_highWaterBytes)
+        {
+            m_highWaterBytes = usedBytes;
+        }
+        ResetRegion(m_regions[frameIndex]);
+        m_frameIndex = frameIndex;
+    }
+
+    void FrameArenaAllocator::Reset()
+    {
+        for (int i = 0; i < BUFFERING_COUNT; ++i)
+        {
+            BeginFrame(i);
+        }
+        m_frameIndex = 0;
+    }
+
+    size_t FrameArenaAllocator::GetHighWaterBytes() const
+    {
+        const size_t usedBytes = m_regions[m_frameIndex].m_usedBytes;
+        return (usedBytes > m_highWaterBytes) ? usedBytes : m_highWaterBytes;
+    }
+
+    // Header placed right before every block handed out by ThreadCachingAllocator. 
+    struct ThreadCachingBlockHeader
+    {
+        void*                           m_owner;
+        uint32_t                        m_sizeClass;
+        uint32_t                        m_offset;
+    }; // struct ThreadCachingBlockHeader 
+
+    static const size_t kThreadCachingHeaderSize = TF_ALIGNMENT(sizeof(ThreadCachingBlockHeader), TF_DEFAULT_ALIGNMENT_SIZE);
+    static const uint32_t kThreadCachingLargeClass = 0xffffffffu;
+
+    struct ThreadCachingFreeBlock
+    {
+        ThreadCachingFreeBlock*         m_next;
+    }; // struct ThreadCachingFreeBlock 
+
+    struct ThreadCachingAllocator::ThreadCache
+    {
+        struct Magazine
+        {
+            ThreadCachingFreeBlock*     m_head;
+            size_t                      m_count;
+        }; // struct Magazine 
+
+        Magazine                                m_magazines[kSizeClassCount];
+        std::atomic<ThreadCachingFreeBlock*>    m_remoteFree;
+        std::atomic<uint64_t>                   m_hitCount;
+        std::atomic<uint64_t>                   m_missCount;
+        std::atomic<uint64_t>                   m_remoteFreeCount;
+        std::atomic<size_t>                     m_cachedBytes;
+        std::thread::id                         m_thread;
+        ThreadCache*                            m_next;
+    }; // struct ThreadCachingAllocator::ThreadCache 
+
+    // Thread local slot, indexed by the allocator serial modulo the slot count. 
+    struct ThreadLocalSlot
+    {
+        uint64_t                        m_serial;
+        void*                           m_cache;
+    }; // struct ThreadLocalSlot 
+
+    // The calling thread's entry of an instance: its slot when the slot holds this instance, otherwise 
+    // a search of the entries the instance registered (m_thread, m_next), which takes the slot over. 
+    // Instances sharing a slot keep their entries, a switch between them only costs the search. 
+    template<typename T> static T* FindThreadLocalEntry(ThreadLocalSlot& slot, uint64_t serial, T* head)
+    {
+        if (TF_LIKELY(slot.m_serial == serial))
+        {
+            return static_cast<T*>(slot.m_cache);
+        }
+        const std::thread::id thread = std::this_thread::get_id();
+        for (T* entry = head; entry != nullptr; entry = entry->m_next)
+        {
+            if (entry->m_thread == thread)
+            {
+                slot.m_serial = serial;
+                slot.m_cache  = entry;
+                return entry;
+            }
+        }
+        return nullptr;
+    }
+
+    static TF_THREAD_LS ThreadLocalSlot s_threadCacheSlots[ThreadCachingAllocator::kMaxInstanceCount];
+    static std::atomic<uint64_t>        s_threadLocalSlotSerial(1);
+
+    static ThreadCachingBlockHeader* GetThreadCachingHeader(void* block)
+    {
+        return reinterpret_cast<ThreadCachingBlockHeader*>(static_cast<uint8_t*>(block) - kThreadCachingHeaderSize);
+    }
+
+    static size_t GetThreadCachingClassSize(size_t sizeClass)
+    {
+        return ThreadCachingAllocator::kMinClassSize << sizeClass;
+    }
+
+    static size_t GetThreadCachingSizeClass(size_t size)
+    {
+        size_t sizeClass = 0;
+        while (GetThreadCachingClassSize(sizeClass) < size)
+        {
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+
+    // Relaxed increment, only the owner thread writes the counters. 
+    template<typename T> static void IncrementCounter(std::atomic<T>& counter, T value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    ThreadCachingAllocator::ThreadCachingAllocator(Allocator& backing)
+        : m_backing     (backing)
+        , m_serial      (s_threadLocalSlotSerial.fetch_add(1))
+        , m_threadCaches(nullptr)
+    {
+    }
+
+    ThreadCachingAllocator::~ThreadCachingAllocator()
+    {
+        ThreadCache* cache = m_threadCaches.exchange(nullptr);
+        while (cache)
+        {
+            ReclaimRemoteBlocks(*cache);
+            for (size_t i = 0; i < kSizeClassCount; ++i)
+            {
+                ReleaseBlocks(*cache, i, cache->m_magazines[i].m_count);
+            }
+            ThreadCache* next = cache->m_next;
+            cache->~ThreadCache();
+            m_backing.Free(cache);
+            cache = next;
+        }
+
+        ThreadLocalSlot& slot = s_threadCacheSlots[m_serial % kMaxInstanceCount];
+        if (slot.m_serial == m_serial)
+        {
+            slot.m_serial = 0;
+            slot.m_cache  = nullptr;
+        }
+    }
+
+    ThreadCachingAllocator::ThreadCache* ThreadCachingAllocator::FindThreadCache() const
+    {
+        return FindThreadLocalEntry(s_threadCacheSlots[m_serial % kMaxInstanceCount], m_serial, m_threadCaches.load(std::memory_order_acquire));
+    }
+
+    ThreadCachingAllocator::ThreadCache* ThreadCachingAllocator::GetThreadCache()
+    {
+        ThreadCache* cache = FindThreadCache();
+        if (TF_LIKELY(cache != nullptr))
+        {
+            return cache;
+        }
+
+        void* memory = m_backing.Allocate(sizeof(ThreadCache), TF_DEFAULT_ALIGNMENT_SIZE);
+        if (memory == nullptr)
+        {
+            return nullptr;
+        }
+        cache = new (memory) ThreadCache();
+        for (size_t i = 0; i < kSizeClassCount; ++i)
+        {
+            cache->m_magazines[i].m_head  = nullptr;
+            cache->m_magazines[i].m_count = 0;
+        }
+        cache->m_remoteFree.store(nullptr);
+        cache->m_hitCount.store(0);
+        cache->m_missCount.store(0);
+        cache->m_remoteFreeCount.store(0);
+        cache->m_cachedBytes.store(0);
+        cache->m_thread = std::this_thread::get_id();
+
+        // Register so the destructor can release every thread's cache, and so this thread finds it 
+        // again when another instance took its slot. 
+        ThreadCache* head = m_threadCaches.load();
+        do
+        {
+            cache->m_next = head;
+        } while (!m_threadCaches.compare_exchange_weak(head, cache, std::memory_order_release, std::memory_order_relaxed));
+
+        ThreadLocalSlot& slot = s_threadCacheSlots[m_serial % kMaxInstanceCount];
+        slot.m_serial = m_serial;
+        slot.m_cache  = cache;
+        return cache;
+    }
+
+    void* ThreadCachingAllocator::Allocate(size_t size, size_t alignment)
+    {
+        assert((alignment & (alignment - 1)) == 0); // alignment must be power of two.
+
+        if (size <= kMaxCachedSize && alignment <= TF_DEFAULT_ALIGNMENT_SIZE)
+        {
+            ThreadCache* cache = GetThreadCache();
+            if (TF_LIKELY(cache != nullptr))
+            {
+                const size_t sizeClass = GetThreadCachingSizeClass(size);
+                ThreadCache::Magazine& magazine = cache->m_magazines[sizeClass];
+                if (magazine.m_head == nullptr && cache->m_remoteFree.load(std::memory_order_relaxed) != nullptr)
+                {
+                    ReclaimRemoteBlocks(*cache);
+                }
+
+                if (TF_LIKELY(magazine.m_head != nullptr))
+                {
+                    ThreadCachingFreeBlock* block = magazine.m_head;
+                    magazine.m_head = block->m_next;
+                    magazine.m_count--;
+                    IncrementCounter<uint64_t>(cache->m_hitCount, 1);
+                    IncrementCounter<size_t>(cache->m_cachedBytes, static_cast<size_t>(0) - GetThreadCachingClassSize(sizeClass));
+                    return block;
+                }
+
+                IncrementCounter<uint64_t>(cache->m_missCount, 1);
+                uint8_t* memory = static_cast<uint8_t*>(m_backing.Allocate(kThreadCachingHeaderSize + GetThreadCachingClassSize(sizeClass), TF_DEFAULT_ALIGNMENT_SIZE));
+                if (memory == nullptr)
+                {
+                    return nullptr;
+                }
+                ThreadCachingBlockHeader* header = reinterpret_cast<ThreadCachingBlockHeader*>(memory);
+                header->m_owner     = cache;
+                header->m_sizeClass = static_cast<uint32_t>(sizeClass);
+                header->m_offset    = static_cast<uint32_t>(kThreadCachingHeaderSize);
+                return memory + kThreadCachingHeaderSize;
+            }
+        }
+
+        // Large or over-aligned requests go straight to the wrapped allocator. 
+        const size_t offset = (alignment > kThreadCachingHeaderSize) ? alignment : kThreadCachingHeaderSize;
+        uint8_t* memory = static_cast<uint8_t*>(m_backing.Allocate(offset + size, (alignment > TF_DEFAULT_ALIGNMENT_SIZE) ? alignment : TF_DEFAULT_ALIGNMENT_SIZE));
+        if (memory == nullptr)
+        {
+            return nullptr;
+        }
+        ThreadCachingBlockHeader* header = GetThreadCachingHeader(memory + offset);
+        header->m_owner     = nullptr;
+        header->m_sizeClass = kThreadCachingLargeClass;
+        header->m_offset    = static_cast<uint32_t>(offset);
+        return memory + offset;
+    }
+
+    void ThreadCachingAllocator::Free(void* block)
+    {
+        if (block == nullptr)
+        {
+            return;
+        }
+
+        ThreadCachingBlockHeader* header = GetThreadCachingHeader(block);
+        if (header->m_sizeClass == kThreadCachingLargeClass)
+        {
+            m_backing.Free(static_cast<uint8_t*>(block) - header->m_offset);
+            return;
+        }
+
+        ThreadCache* owner = static_cast<ThreadCache*>(header->m_owner);
+        ThreadCachingFreeBlock* freeBlock = static_cast<ThreadCachingFreeBlock*>(block);
+        if (owner->m_thread == std::this_thread::get_id())
+        {
+            ThreadCache::Magazine& magazine = owner->m_magazines[header->m_sizeClass];
+            freeBlock->m_next = magazine.m_head;
+            magazine.m_head = freeBlock;
+            magazine.m_count++;
+            IncrementCounter<size_t>(owner->m_cachedBytes, GetThreadCachingClassSize(header->m_sizeClass));
+
+            // Give half of a full magazine back in one go. 
+            if (magazine.m_count > kMagazineCapacity)
+            {
+                ReleaseBlocks(*owner, header->m_sizeClass, kMagazineCapacity / 2);
+            }
+            return;
+        }
+
+        // Remote free: hand the block back to its owner thread. 
+        ThreadCachingFreeBlock* head = owner->m_remoteFree.load(std::memory_order_relaxed);
+        do
+        {
+            freeBlock->m_next = head;
+        } while (!owner->m_remoteFree.compare_exchange_weak(head, freeBlock, std::memory_order_release, std::memory_order_relaxed));
+        owner->m_remoteFreeCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t ThreadCachingAllocator::AllocateBatch(size_t count, size_t size, size_t alignment, void** blocks)
+    {
+        assert((alignment & (alignment - 1)) == 0); // alignment must be power of two.
+
+        ThreadCache* cache = (size <= kMaxCachedSize && alignment <= TF_DEFAULT_ALIGNMENT_SIZE) ? GetThreadCache() : nullptr;
+        if (cache == nullptr)
+        {
+            return Allocator::AllocateBatch(count, size, alignment, blocks);
+        }
+
+        const size_t sizeClass = GetThreadCachingSizeClass(size);
+        const size_t classSize = GetThreadCachingClassSize(sizeClass);
+        ThreadCache::Magazine& magazine = cache->m_magazines[sizeClass];
+        if (magazine.m_count < count && cache->m_remoteFree.load(std::memory_order_relaxed) != nullptr)
+        {
+            ReclaimRemoteBlocks(*cache);
+        }
+
+        size_t allocated = 0;
+        for (; allocated < count && magazine.m_head != nullptr; ++allocated)
+        {
+            ThreadCachingFreeBlock* block = magazine.m_head;
+            magazine.m_head = block->m_next;
+            blocks[allocated] = block;
+        }
+        magazine.m_count -= allocated;
+        IncrementCounter<uint64_t>(cache->m_hitCount, allocated);
+        IncrementCounter<size_t>(cache->m_cachedBytes, static_cast<size_t>(0) - allocated * classSize);
+        if (allocated == count)
+        {
+            return count;
+        }
+
+        // Misses are taken from the wrapped allocator in one batch. 
+        IncrementCounter<uint64_t>(cache->m_missCount, count - allocated);
+        const size_t missed = m_backing.AllocateBatch(count - allocated, kThreadCachingHeaderSize + classSize, TF_DEFAULT_ALIGNMENT_SIZE, blocks + allocated);
+        for (size_t i = allocated; i < allocated + missed; ++i)
+        {
+            uint8_t* memory = static_cast<uint8_t*>(blocks[i]);
+            ThreadCachingBlockHeader* header = reinterpret_cast<ThreadCachingBlockHeader*>(memory);
+            header->m_owner     = cache;
+            header->m_sizeClass = static_cast<uint32_t>(sizeClass);
+            header->m_offset    = static_cast<uint32_t>(kThreadCachingHeaderSize);
+            blocks[i] = memory + kThreadCachingHeaderSize;
+        }
+        return allocated + missed;
+    }
+
+    void ThreadCachingAllocator::FreeBatch(void** blocks, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            ThreadCachingAllocator::Free(blocks[i]);
+        }
+    }
+
+    void ThreadCachingAllocator::ReleaseBlocks(ThreadCache& cache, size_t sizeClass, size_t count)
+    {
+        ThreadCache::Magazine& magazine = cache.m_magazines[sizeClass];
+        for (size_t i = 0; i < count && magazine.m_head != nullptr; ++i)
+        {
+            ThreadCachingFreeBlock* block = magazine.m_head;
+            magazine.m_head = block->m_next;
+            magazine.m_count--;
+            IncrementCounter<size_t>(cache.m_cachedBytes, static_cast<size_t>(0) - GetThreadCachingClassSize(sizeClass));
+            m_backing.Free(reinterpret_cast<uint8_t*>(block) - kThreadCachingHeaderSize);
+        }
+    }
+
+    void ThreadCachingAllocator::ReclaimRemoteBlocks(ThreadCache& cache)
+    {
+        ThreadCachingFreeBlock* block = cache.m_remoteFree.exchange(nullptr, std::memory_order_acquire);
+        while (block)
+        {
+            ThreadCachingFreeBlock* next = block->m_next;
+            const uint32_t sizeClass = GetThreadCachingHeader(block)->m_sizeClass;
+            ThreadCache::Magazine& magazine = cache.m_magazines[sizeClass];
+            block->m_next = magazine.m_head;
+            magazine.m_head = block;
+            magazine.m_count++;
+            IncrementCounter<size_t>(cache.m_cachedBytes, GetThreadCachingClassSize(sizeClass));
+            block = next;
+        }
+        for (size_t i = 0; i < kSizeClassCount; ++i)
+        {
+            if (cache.m_magazines[i].m_count > kMagazineCapacity)
+            {
+                ReleaseBlocks(cache, i, cache.m_magazines[i].m_count - kMagazineCapacity);
+            }
+        }
+    }
+
+    void ThreadCachingAllocator::FlushThreadCache()
+    {
+        ThreadCache* cache = FindThreadCache();
+        if (cache == nullptr)
+        {
+            return;
+        }
+        ReclaimRemoteBlocks(*cache);
+        for (size_t i = 0; i < kSizeClassCount; ++i)
+        {
+            ReleaseBlocks(*cache, i, cache->m_magazines[i].m_count);
+        }
+    }
+
+    ThreadCachingAllocator::ThreadStatistics ThreadCachingAllocator::GetThreadStatistics() const
+    {
+        ThreadStatistics statistics = {};
+        const ThreadCache* cache = FindThreadCache();
+        if (cache)
+        {
+            statistics.m_hitCount           = cache->m_hitCount.load(std::memory_order_relaxed);
+            statistics.m_missCount          = cache->m_missCount.load(std::memory_order_relaxed);
+            statistics.m_remoteFreeCount    = cache->m_remoteFreeCount.load(std::memory_order_relaxed);
+            statistics.m_cachedBytes        = cache->m_cachedBytes.load(std::memory_order_relaxed);
+        }
+        return statistics;
+    }
+
+    size_t ThreadCachingAllocator::CollectThreadStatistics(ThreadStatistics* statistics, size_t maxCount) const
+    {
+        size_t count = 0;
+        for (const ThreadCache* cache = m_threadCaches.load(); cache != nullptr; cache = cache->m_next)
+        {
+            if (count < maxCount)
+            {
+                statistics[count].m_hitCount        = cache->m_hitCount.load(std::memory_order_relaxed);
+                statistics[count].m_missCount       = cache->m_missCount.load(std::memory_order_relaxed);
+                statistics[count].m_remoteFreeCount = cache->m_remoteFreeCount.load(std::memory_order_relaxed);
+                statistics[count].m_cachedBytes     = cache->m_cachedBytes.load(std::memory_order_relaxed);
+            }
+            count++;
+        }
+        return count;
+    }
+
+    // Bit scan helpers. 
+    static uint32_t FindFirstSetBit(uint32_t value)
+    {
+        assert(value != 0);
+#if defined(TF_COMPILER_MSVC)
+        unsigned long index;
+        _BitScanForward(&index, value);
+        return static_cast<uint32_t>(index);
+#else
+        return static_cast<uint32_t>(__builtin_ctz(value));
+#endif
+    }
+
+    static uint32_t FindLastSetBit(uint32_t value)
+    {
+        assert(value != 0);
+#if defined(TF_COMPILER_MSVC)
+        unsigned long index;
+        _BitScanReverse(&index, value);
+        return static_cast<uint32_t>(index);
+#else
+        return static_cast<uint32_t>(31 - __builtin_clz(value));
+#endif
+    }
+
+    static uint32_t FindLastSetBit64(uint64_t value)
+    {
+        const uint32_t high = static_cast<uint32_t>(value >> 32);
+        return (high != 0) ? (FindLastSetBit(high) + 32) : FindLastSetBit(static_cast<uint32_t>(value));
+    }
+
+    // Every block starts with this header, the payload follows at kAlignSize. 
+    // Free blocks keep their free list links at the beginning of the payload. 
+    struct TlsfAllocator::BlockHeader
+    {
+        BlockHeader*                    m_prevPhysical;
+        size_t                          m_size;
+    }; // struct TlsfAllocator::BlockHeader 
+
+    struct TlsfFreeLinks
+    {
+        void*                           m_nextFree;
+        void*                           m_prevFree;
+    }; // struct TlsfFreeLinks 
+
+    static const size_t kTlsfBlockFreeBit   = 1;
+    static const size_t kTlsfPrevFreeBit    = 2;
+    static const size_t kTlsfFlagMask       = kTlsfBlockFreeBit | kTlsfPrevFreeBit;
+    static const size_t kTlsfMinBlockSize   = TlsfAllocator::kAlignSize;
+    static const size_t kTlsfMaxBlockSize   = static_cast<size_t>(1) << (TlsfAllocator::kFirstLevelMax - 1);
+
+    template<typename Block> static size_t TlsfGetSize(const Block* block)
+    {
+        return block->m_size & ~kTlsfFlagMask;
+    }
+
+    template<typename Block> static void TlsfSetSize(Block* block, size_t size)
+    {
+        block->m_size = size | (block->m_size & kTlsfFlagMask);
+    }
+
+    template<typename Block> static uint8_t* TlsfGetPayload(const Block* block)
+    {
+        return reinterpret_cast<uint8_t*>(const_cast<Block*>(block)) + TlsfAllocator::kAlignSize;
+    }
+
+    template<typename Block> static Block* TlsfGetNextPhysical(const Block* block)
+    {
+        return reinterpret_cast<Block*>(TlsfGetPayload(block) + TlsfGetSize(block));
+    }
+
+    template<typename Block> static TlsfFreeLinks* TlsfGetLinks(const Block* block)
+    {
+        return reinterpret_cast<TlsfFreeLinks*>(TlsfGetPayload(block));
+    }
+
+    static void TlsfMappingInsert(size_t size, size_t& firstLevel, size_t& secondLevel)
+    {
+        if (size < TlsfAllocator::kSmallBlockSize)
+        {
+            firstLevel  = 0;
+            secondLevel = size / (TlsfAllocator::kSmallBlockSize / TlsfAllocator::kSecondLevelCount);
+        }
+        else
+        {
+            const size_t lastBit = FindLastSetBit64(size);
+            secondLevel = (size >> (lastBit - TlsfAllocator::kSecondLevelLog2)) ^ TlsfAllocator::kSecondLevelCount;
+            firstLevel  = lastBit - (TlsfAllocator::kFirstLevelShift - 1);
+        }
+    }
+
+    // Round up to the next list so any block found there is large enough. 
+    static void TlsfMappingSearch(size_t size, size_t& firstLevel, size_t& secondLevel)
+    {
+        if (size >= TlsfAllocator::kSmallBlockSize)
+        {
+            size += (static_cast<size_t>(1) << (FindLastSetBit64(size) - TlsfAllocator::kSecondLevelLog2)) - 1;
+        }
+        TlsfMappingInsert(size, firstLevel, secondLevel);
+    }
+
+    TlsfAllocator::TlsfAllocator(void* memory, size_t size)
+        : m_blocks              ()
+        , m_firstLevelBitmap    (0)
+        , m_secondLevelBitmap   ()
+        , m_firstBlock          (nullptr)
+        , m_totalBytes          (0)
+        , m_usedBytes           (0)
+        , m_allocationCount     (0)
+    {
+        static_assert(sizeof(BlockHeader) <= kAlignSize, "TLSF block header must fit in the alignment size.");
+        static_assert(sizeof(TlsfFreeLinks) <= kTlsfMinBlockSize, "TLSF free links must fit in the minimum block.");
+
+        uint8_t* begin = AlignPointer(static_cast<uint8_t*>(memory), kAlignSize);
+        uint8_t* end   = static_cast<uint8_t*>(memory) + size;
+        end -= reinterpret_cast<uintptr_t>(end) & (kAlignSize - 1);
+
+        // First block header, its payload, and the zero sized sentinel at the end. 
+        assert(memory != nullptr && end > begin && static_cast<size_t>(end - begin) >= 2 * kAlignSize + kTlsfMinBlockSize);
+        if (memory == nullptr || end <= begin || static_cast<size_t>(end - begin) < 2 * kAlignSize + kTlsfMinBlockSize)
+        {
+            return;
+        }
+        size_t payloadSize = static_cast<size_t>(end - begin) - 2 * kAlignSize;
+        if (payloadSize > kTlsfMaxBlockSize)
+        {
+            payloadSize = kTlsfMaxBlockSize;
+        }
+
+        BlockHeader* block      = reinterpret_cast<BlockHeader*>(begin);
+        block->m_prevPhysical   = nullptr;
+        block->m_size           = payloadSize | kTlsfBlockFreeBit;
+
+        BlockHeader* sentinel   = TlsfGetNextPhysical(block);
+        sentinel->m_prevPhysical= block;
+        sentinel->m_size        = 0 | kTlsfPrevFreeBit;
+
+        m_firstBlock = block;
+        m_totalBytes = payloadSize;
+        InsertFreeBlock(block);
+    }
+
+    TlsfAllocator::~TlsfAllocator()
+    {
+    }
+
+    void TlsfAllocator::InsertFreeBlock(BlockHeader* block)
+    {
+        size_t firstLevel, secondLevel;
+        TlsfMappingInsert(TlsfGetSize(block), firstLevel, secondLevel);
+
+        BlockHeader*& head = m_blocks[firstLevel][secondLevel];
+        TlsfFreeLinks* links = TlsfGetLinks(block);
+        links->m_nextFree = head;
+        links->m_prevFree = nullptr;
+        if (head)
+        {
+            TlsfGetLinks(head)->m_prevFree = block;
+        }
+        head = block;
+
+        m_firstLevelBitmap              |= (1u << firstLevel);
+        m_secondLevelBitmap[firstLevel] |= (1u << secondLevel);
+    }
+
+    void TlsfAllocator::RemoveFreeBlock(BlockHeader* block)
+    {
+        size_t firstLevel, secondLevel;
+        TlsfMappingInsert(TlsfGetSize(block), firstLevel, secondLevel);
+
+        TlsfFreeLinks* links = TlsfGetLinks(block);
+        BlockHeader* next = static_cast<BlockHeader*>(links->m_nextFree);
+        BlockHeader* prev = static_cast<BlockHeader*>(links->m_prevFree);
+        if (next)
+        {
+            TlsfGetLinks(next)->m_prevFree = prev;
+        }
+        if (prev)
+        {
+            TlsfGetLinks(prev)->m_nextFree = next;
+        }
+
+        BlockHeader*& head = m_blocks[firstLevel][secondLevel];
+        if (head == block)
+        {
+            head = next;
+            if (head == nullptr)
+            {
+                m_secondLevelBitmap[firstLevel] &= ~(1u << secondLevel);
+                if (m_secondLevelBitmap[firstLevel] == 0)
+                {
+                    m_firstLevelBitmap &= ~(1u << firstLevel);
+                }
+            }
+        }
+    }
+
+    TlsfAllocator::BlockHeader* TlsfAllocator::FindFreeBlock(size_t size)
+    {
+        size_t firstLevel, secondLevel;
+        TlsfMappingSearch(size, firstLevel, secondLevel);
+        if (firstLevel >= kFirstLevelCount)
+        {
+            return nullptr;
+        }
+
+        uint32_t secondLevelMap = m_secondLevelBitmap[firstLevel] & (~0u << secondLevel);
+        if (secondLevelMap == 0)
+        {
+            const uint32_t firstLevelMap = (firstLevel + 1 < 32) ? (m_firstLevelBitmap & (~0u << (firstLevel + 1))) : 0;
+            if (firstLevelMap == 0)
+            {
+                return nullptr;
+            }
+            firstLevel      = FindFirstSetBit(firstLevelMap);
+            secondLevelMap  = m_secondLevelBitmap[firstLevel];
+        }
+        secondLevel = FindFirstSetBit(secondLevelMap);
+
+        BlockHeader* block = m_blocks[firstLevel][secondLevel];
+        assert(block != nullptr && TlsfGetSize(block) >= size);
+        RemoveFreeBlock(block);
+        return block;
+    }
+
+    TlsfAllocator::BlockHeader* TlsfAllocator::SplitBlock(BlockHeader* block, size_t size)
+    {
+        const size_t blockSize = TlsfGetSize(block);
+        if (blockSize >= size + kAlignSize + kTlsfMinBlockSize)
+        {
+            BlockHeader* remaining      = reinterpret_cast<BlockHeader*>(TlsfGetPayload(block) + size);
+            remaining->m_prevPhysical   = block;
+            remaining->m_size           = (blockSize - size - kAlignSize) | kTlsfBlockFreeBit;
+            TlsfSetSize(block, size);
+
+            BlockHeader* next = TlsfGetNextPhysical(remaining);
+            next->m_prevPhysical = remaining;
+            next->m_size        |= kTlsfPrevFreeBit;
+            InsertFreeBlock(remaining);
+        }
+        return block;
+    }
+
+    TlsfAllocator::BlockHeader* TlsfAllocator::MergeBlock(BlockHeader* block)
+    {
+        if (block->m_size & kTlsfPrevFreeBit)
+        {
+            BlockHeader* prev = block->m_prevPhysical;
+            assert(prev != nullptr && (prev->m_size & kTlsfBlockFreeBit));
+            RemoveFreeBlock(prev);
+            TlsfSetSize(prev, TlsfGetSize(prev) + kAlignSize + TlsfGetSize(block));
+            block = prev;
+            TlsfGetNextPhysical(block)->m_prevPhysical = block;
+        }
+
+        BlockHeader* next = TlsfGetNextPhysical(block);
+        if (next->m_size & kTlsfBlockFreeBit)
+        {
+            RemoveFreeBlock(next);
+            TlsfSetSize(block, TlsfGetSize(block) + kAlignSize + TlsfGetSize(next));
+            TlsfGetNextPhysical(block)->m_prevPhysical = block;
+        }
+        return block;
+    }
+
+    void* TlsfAllocator::Allocate(size_t size, size_t alignment)
+    {
+        assert((alignment & (alignment - 1)) == 0); // alignment must be power of two.
+        if (size > kTlsfMaxBlockSize)
+        {
+            return nullptr;
+        }
+        size_t adjustedSize = TF_ALIGNMENT(size, kAlignSize);
+        if (adjustedSize < kTlsfMinBlockSize)
+        {
+            adjustedSize = kTlsfMinBlockSize;
+        }
+
+        BlockHeader* block = nullptr;
+        if (alignment <= kAlignSize)
+        {
+            block = FindFreeBlock(adjustedSize);
+        }
+        else
+        {
+            // Search with room for the alignment gap, then give the gap back as a free block. 
+            const size_t gapMinimum = kAlignSize + kTlsfMinBlockSize;
+            block = FindFreeBlock(adjustedSize + alignment + gapMinimum);
+            if (block)
+            {
+                uint8_t* payload = TlsfGetPayload(block);
+                uint8_t* aligned = AlignPointer(payload, alignment);
+                if (aligned != payload && static_cast<size_t>(aligned - payload) < gapMinimum)
+                {
+                    aligned = AlignPointer(payload + gapMinimum, alignment);
+                }
+
+                const size_t gap = static_cast<size_t>(aligned - payload);
+                if (gap > 0)
+                {
+                    BlockHeader* alignedBlock   = reinterpret_cast<BlockHeader*>(aligned - kAlignSize);
+                    alignedBlock->m_prevPhysical= block;
+                    alignedBlock->m_size        = (TlsfGetSize(block) - gap) | kTlsfBlockFreeBit | kTlsfPrevFreeBit;
+                    TlsfGetNextPhysical(alignedBlock)->m_prevPhysical = alignedBlock;
+
+                    TlsfSetSize(block, gap - kAlignSize);
+                    InsertFreeBlock(block);
+                    block = alignedBlock;
+                }
+            }
+        }
+
+        if (block == nullptr)
+        {
+            return nullptr;
+        }
+
+        SplitBlock(block, adjustedSize);
+        block->m_size &= ~kTlsfBlockFreeBit;
+        TlsfGetNextPhysical(block)->m_size &= ~kTlsfPrevFreeBit;
+
+        m_usedBytes += TlsfGetSize(block);
+        m_allocationCount++;
+        return TlsfGetPayload(block);
+    }
+
+    void TlsfAllocator::Free(void* ptr)
+    {
+        if (ptr == nullptr)
+        {
+            return;
+        }
+
+        BlockHeader* block = reinterpret_cast<BlockHeader*>(static_cast<uint8_t*>(ptr) - kAlignSize);
+        assert((block->m_size & kTlsfBlockFreeBit) == 0); // double free.
+        m_usedBytes -= TlsfGetSize(block);
+        m_allocationCount--;
+
+        block->m_size |= kTlsfBlockFreeBit;
+        TlsfGetNextPhysical(block)->m_size |= kTlsfPrevFreeBit;
+        InsertFreeBlock(MergeBlock(block));
+    }
+
+    bool TlsfAllocator::TryExpandInPlace(void* ptr, size_t oldSize, size_t newSize)
+    {
+        TF_UNUSED(oldSize);
+        if (newSize > kTlsfMaxBlockSize)
+        {
+            return false;
+        }
+        size_t adjustedSize = TF_ALIGNMENT(newSize, kAlignSize);
+        if (adjustedSize < kTlsfMinBlockSize)
+        {
+            adjustedSize = kTlsfMinBlockSize;
+        }
+
+        BlockHeader* block = reinterpret_cast<BlockHeader*>(static_cast<uint8_t*>(ptr) - kAlignSize);
+        assert((block->m_size & kTlsfBlockFreeBit) == 0);
+        BlockHeader* next = TlsfGetNextPhysical(block);
+        const bool isNextFree = (next->m_size & kTlsfBlockFreeBit) != 0;
+        if (adjustedSize > TlsfGetSize(block) && (!isNextFree || TlsfGetSize(block) + kAlignSize + TlsfGetSize(next) < adjustedSize))
+        {
+            return false;
+        }
+
+        m_usedBytes -= TlsfGetSize(block);
+        if (isNextFree)
+        {
+            // Absorb the free neighbour, the tail goes back to the free lists below. 
+            RemoveFreeBlock(next);
+            TlsfSetSize(block, TlsfGetSize(block) + kAlignSize + TlsfGetSize(next));
+            next = TlsfGetNextPhysical(block);
+            next->m_prevPhysical = block;
+            next->m_size        &= ~kTlsfPrevFreeBit;
+        }
+        SplitBlock(block, adjustedSize);
+        m_usedBytes += TlsfGetSize(block);
+        return true;
+    }
+
+    size_t TlsfAllocator::GetLargestFreeBlock() const
+    {
+        if (m_firstLevelBitmap == 0)
+        {
+            return 0;
+        }
+        const uint32_t firstLevel  = FindLastSetBit(m_firstLevelBitmap);
+        const uint32_t secondLevel = FindLastSetBit(m_secondLevelBitmap[firstLevel]);
+
+        size_t largest = 0;
+        for (const BlockHeader* block = m_blocks[firstLevel][secondLevel]; block != nullptr; block = static_cast<const BlockHeader*>(TlsfGetLinks(block)->m_nextFree))
+        {
+            if (TlsfGetSize(block) > largest)
+            {
+                largest = TlsfGetSize(block);
+            }
+        }
+        return largest;
+    }
+
+    TlsfAllocator::Statistics TlsfAllocator::GetStatistics() const
+    {
+        Statistics statistics = {};
+        statistics.m_totalBytes         = m_totalBytes;
+        statistics.m_usedBytes          = m_usedBytes;
+        statistics.m_allocationCount    = m_allocationCount;
+        statistics.m_largestFreeBlock   = GetLargestFreeBlock();
+
+        for (size_t i = 0; i < kFirstLevelCount; ++i)
+        {
+            for (size_t j = 0; j < kSecondLevelCount; ++j)
+            {
+                for (const BlockHeader* block = m_blocks[i][j]; block != nullptr; block = static_cast<const BlockHeader*>(TlsfGetLinks(block)->m_nextFree))
+                {
+                    statistics.m_freeBytes += TlsfGetSize(block);
+                    statistics.m_freeBlockCount++;
+                }
+            }
+        }
+        if (statistics.m_freeBytes > 0)
+        {
+            statistics.m_fragmentation = 1.0f - static_cast<float>(statistics.m_largestFreeBlock) / static_cast<float>(statistics.m_freeBytes);
+        }
+        return statistics;
+    }
+
+    bool TlsfAllocator::Validate() const
+    {
+        if (m_firstBlock == nullptr)
+        {
+            return false;
+        }
+
+        size_t usedBytes = 0;
+        const BlockHeader* prev = nullptr;
+        for (const BlockHeader* block = m_firstBlock; ; block = TlsfGetNextPhysical(block))
+        {
+            const bool isFree       = (block->m_size & kTlsfBlockFreeBit) != 0;
+            const bool isPrevFree   = (block->m_size & kTlsfPrevFreeBit) != 0;
+            const bool prevWasFree  = (prev != nullptr) && (prev->m_size & kTlsfBlockFreeBit) != 0;
+            if (block->m_prevPhysical != prev || isPrevFree != prevWasFree)
+            {
+                return false;
+            }
+            if (isFree && prevWasFree)
+            {
+                return false; // adjacent free blocks must have been merged.
+            }
+            if (TlsfGetSize(block) == 0)
+            {
+                break; // sentinel.
+            }
+            if (isFree)
+            {
+                size_t firstLevel, secondLevel;
+                TlsfMappingInsert(TlsfGetSize(block), firstLevel, secondLevel);
+                if ((m_secondLevelBitmap[firstLevel] & (1u << secondLevel)) == 0)
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                usedBytes += TlsfGetSize(block);
+            }
+            prev = block;
+        }
+        return usedBytes == m_usedBytes;
+    }
+
+    // Virtual memory helpers. 
+    static void* ReserveVirtualMemory(size_t size)
+    {
+#if defined(TF_PLATFORM_WINDOWS)
+        return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+        void* ptr = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return (ptr == MAP_FAILED) ? nullptr : ptr;
+#endif
+    }
+
+    static void ReleaseVirtualMemory(void* ptr, size_t size)
+    {
+#if defined(TF_PLATFORM_WINDOWS)
+        TF_UNUSED(size);
+        VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+        munmap(ptr, size);
+#endif
+    }
+
+    static bool CommitVirtualMemory(void* ptr, size_t size)
+    {
+#if defined(TF_PLATFORM_WINDOWS)
+        return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+        return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+    }
+
+    static void DecommitVirtualMemory(void* ptr, size_t size)
+    {
+#if defined(TF_PLATFORM_WINDOWS)
+        VirtualFree(ptr, size, MEM_DECOMMIT);
+#else
+        madvise(ptr, size, MADV_DONTNEED);
+        mprotect(ptr, size, PROT_NONE);
+#endif
+    }
+
+    size_t VirtualArena::GetPageSize()
+    {
+#if defined(TF_PLATFORM_WINDOWS)
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        return static_cast<size_t>(systemInfo.dwPageSize);
+#else
+        return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+    VirtualArena::VirtualArena(size_t reserveSize, size_t decommitWatermark, bool useHugePages)
+        : m_reservedBegin       (nullptr)
+        , m_begin               (nullptr)
+        , m_current             (nullptr)
+        , m_committedEnd        (nullptr)
+        , m_end                 (nullptr)
+        , m_reservedBytes       (0)
+        , m_decommitWatermark   (decommitWatermark)
+        , m_commitGranularity   (kCommitGranularity)
+        , m_highWaterBytes      (0)
+        , m_useHugePages        (false)
+    {
+#if defined(TF_PLATFORM_LINUX) && defined(MADV_HUGEPAGE)
+        m_useHugePages = useHugePages;
+#else
+        TF_UNUSED(useHugePages);
+#endif
+        if (m_useHugePages)
+        {
+            m_commitGranularity = kHugePageSize;
+        }
+
+        const size_t size = TF_ALIGNMENT(reserveSize, m_commitGranularity);
+        m_reservedBytes = m_useHugePages ? (size + kHugePageSize) : size;
+        m_reservedBegin = static_cast<uint8_t*>(ReserveVirtualMemory(m_reservedBytes));
+        assert(m_reservedBegin != nullptr);
+        if (m_reservedBegin == nullptr)
+        {
+            m_reservedBytes = 0;
+            return;
+        }
+
+        // Huge pages need a 2MB aligned range, the reservation is padded for it. 
+        m_begin         = m_useHugePages ? AlignPointer(m_reservedBegin, kHugePageSize) : m_reservedBegin;
+        m_current       = m_begin;
+        m_committedEnd  = m_begin;
+        m_end           = m_begin + size;
+#if defined(TF_PLATFORM_LINUX) && defined(MADV_HUGEPAGE)
+        if (m_useHugePages)
+        {
+            madvise(m_begin, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    VirtualArena::~VirtualArena()
+    {
+        if (m_reservedBegin)
+        {
+            ReleaseVirtualMemory(m_reservedBegin, m_reservedBytes);
+            m_reservedBegin = nullptr;
+        }
+    }
+
+    bool VirtualArena::Commit(uint8_t* end)
+    {
+        size_t committedSize = TF_ALIGNMENT(static_cast<size_t>(end - m_begin), m_commitGranularity);
+        if (committedSize > GetReservedBytes())
+        {
+            committedSize = GetReservedBytes();
+        }
+
+        uint8_t* committedEnd = m_begin + committedSize;
+        if (!CommitVirtualMemory(m_committedEnd, static_cast<size_t>(committedEnd - m_committedEnd)))
+        {
+            return false;
+        }
+        m_committedEnd = committedEnd;
+        return true;
+    }
+
+    void* VirtualArena::Allocate(size_t size, size_t alignment)
+    {
+        assert((alignment & (alignment - 1)) == 0); // alignment must be power of two.
+
+        uint8_t* ptr = AlignPointer(m_current, alignment);
+        if (TF_UNLIKELY(ptr > m_end || size > static_cast<size_t>(m_end - ptr)))
+        {
+            return nullptr;
+        }
+        if (TF_UNLIKELY(ptr + size > m_committedEnd) && !Commit(ptr + size))
+        {
+            return nullptr;
+        }
+        m_current = ptr + size;
+        return ptr;
+    }
+
+    bool VirtualArena::TryExpandInPlace(void* block, size_t oldSize, size_t newSize)
+    {
+        uint8_t* ptr = static_cast<uint8_t*>(block);
+        if (ptr + oldSize != m_current)
+        {
+            return newSize <= oldSize;
+        }
+        if (newSize > static_cast<size_t>(m_end - ptr))
+        {
+            return false;
+        }
+        if (ptr + newSize > m_committedEnd && !Commit(ptr + newSize))
+        {
+            return false;
+        }
+        m_current = ptr + newSize;
+        return true;
+    }
+
+    size_t VirtualArena::AllocateBatch(size_t count, size_t size, size_t alignment, void** blocks)
+    {
+        assert((alignment & (alignment - 1)) == 0); // alignment must be power of two.
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        const size_t stride = TF_ALIGNMENT(size, alignment);
+        uint8_t* ptr = AlignPointer(m_current, alignment);
+        if (TF_UNLIKELY(ptr > m_end || stride * (count - 1) + size > static_cast<size_t>(m_end - ptr)))
+        {
+            // Hand out what still fits. 
+            return Allocator::AllocateBatch(count, size, alignment, blocks);
+        }
+        uint8_t* end = ptr + stride * (count - 1) + size;
+        if (TF_UNLIKELY(end > m_committedEnd) && !Commit(end))
+        {
+            return Allocator::AllocateBatch(count, size, alignment, blocks);
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            blocks[i] = ptr + i * stride;
+        }
+        m_current = end;
+        return count;
+    }
+
+    void VirtualArena::FreeBatch(void** blocks, size_t count)
+    {
+        TF_UNUSED(blocks);
+        TF_UNUSED(count);
+    }
+
+    void VirtualArena::Free(void* block)
+    {
+        // Memory is released in bulk by Reset(). 
+        TF_UNUSED(block);
+    }
+
+    void VirtualArena::Reset()
+    {
+        if (GetUsedBytes() > m_highWaterBytes)
+        {
+            m_highWaterBytes = GetUsedBytes();
+        }
+        m_current = m_begin;
+
+        const size_t keepSize = TF_ALIGNMENT(m_decommitWatermark, m_commitGranularity);
+        if (GetCommittedBytes() > keepSize)
+        {
+            DecommitVirtualMemory(m_begin + keepSize, GetCommittedBytes() - keepSize);
+            m_committedEnd = m_begin + keepSize;
+        }
+    }
+
+    // Slab page metadata, kept in a table outside the pages so blocks need no header. 
+    struct SlabAllocator::Page
+    {
+        void*                           m_freeList;
+        Page*                           m_next;
+        Page*                           m_prev;
+        uint32_t                        m_sizeClass;
+        uint32_t                        m_usedCount;
+        uint32_t                        m_capacity;
+        uint32_t                        m_bumpOffset;   //!< Blocks past this offset were never handed out.
+    }; // struct SlabAllocator::Page 
+
+    struct SlabAllocator::PageHeap
+    {
+        Mutex                           m_lock;
+        Page*                           m_freePages;
+        size_t                          m_touchedPageCount;
+        std::atomic<size_t>             m_committedBytes;
+    }; // struct SlabAllocator::PageHeap 
+
+    // One lock per size class, each on its own cache line. 
+    struct TF_CACHELINE_ALIGNED SlabAllocator::SizeClass
+    {
+        Mutex                           m_lock;
+        Page*                           m_available;    //!< Pages with at least one free block.
+        size_t                          m_usedBytes;
+    }; // struct SlabAllocator::SizeClass 
+
+    template<typename Page> static void SlabLinkPage(Page*& head, Page* page)
+    {
+        page->m_prev = nullptr;
+        page->m_next = head;
+        if (head)
+        {
+            head->m_prev = page;
+        }
+        head = page;
+    }
+
+    template<typename Page> static void SlabUnlinkPage(Page*& head, Page* page)
+    {
+        if (page->m_prev)
+        {
+            page->m_prev->m_next = page->m_next;
+        }
+        else
+        {
+            head = page->m_next;
+        }
+        if (page->m_next)
+        {
+            page->m_next->m_prev = page->m_prev;
+        }
+        page->m_next = nullptr;
+        page->m_prev = nullptr;
+    }
+
+    SlabAllocator::SlabAllocator(size_t reserveSize, Allocator& backing)
+        : m_backing         (backing)
+        , m_reservedBegin   (nullptr)
+        , m_reservedBytes   (0)
+        , m_base            (nullptr)
+        , m_pages           (nullptr)
+        , m_pageCount       (0)
+        , m_pageHeap        (nullptr)
+        , m_sizeClasses     (nullptr)
+    {
+        assert(GetSizeClassSize(kSizeClassCount - 1) == kMaxSmallSize && GetSizeClass(kMaxSmallSize) == kSizeClassCount - 1);
+
+        m_pageHeap = new (m_backing.Allocate(sizeof(PageHeap), TF_DEFAULT_ALIGNMENT_SIZE)) PageHeap();
+        m_pageHeap->m_freePages         = nullptr;
+        m_pageHeap->m_touchedPageCount  = 0;
+        m_pageHeap->m_committedBytes.store(0);
+
+        static_assert(sizeof(SizeClass) % TF_CACHELINE_SIZE == 0, "SlabAllocator: size classes must not share a cache line.");
+        const size_t sizeClassAlignment = (alignof(SizeClass) > TF_DEFAULT_ALIGNMENT_SIZE) ? alignof(SizeClass) : TF_DEFAULT_ALIGNMENT_SIZE;
+        m_sizeClasses = static_cast<SizeClass*>(m_backing.Allocate(sizeof(SizeClass) * kSizeClassCount, sizeClassAlignment));
+        for (size_t i = 0; i < kSizeClassCount; ++i)
+        {
+            SizeClass* sizeClass = new (&m_sizeClasses[i]) SizeClass();
+            sizeClass->m_available = nullptr;
+            sizeClass->m_usedBytes = 0;
+        }
+
+        // Over-reserve by one page so the range can start on a page boundary. 
+        const size_t size = TF_ALIGNMENT(reserveSize, kPageSize);
+        m_reservedBegin = static_cast<uint8_t*>(ReserveVirtualMemory(size + kPageSize));
+        assert(m_reservedBegin != nullptr);
+        if (m_reservedBegin == nullptr)
+        {
+            return;
+        }
+        m_reservedBytes = size + kPageSize;
+        m_base          = AlignPointer(m_reservedBegin, kPageSize);
+        m_pageCount     = size / kPageSize;
+
+        // Entries are initialized when their page is first used, the table is only touched as the heap grows. 
+        m_pages = static_cast<Page*>(m_backing.Allocate(sizeof(Page) * m_pageCount, TF_DEFAULT_ALIGNMENT_SIZE));
+        if (m_pages == nullptr)
+        {
+            ReleaseVirtualMemory(m_reservedBegin, m_reservedBytes);
+            m_reservedBegin = nullptr;
+            m_reservedBytes = 0;
+            m_base          = nullptr;
+            m_pageCount     = 0;
+        }
+    }
+
+    SlabAllocator::~SlabAllocator()
+    {
+        if (m_reservedBegin)
+        {
+            ReleaseVirtualMemory(m_reservedBegin, m_reservedBytes);
+            m_reservedBegin = nullptr;
+        }
+        m_backing.Free(m_pages);
+        for (size_t i = 0; i < kSizeClassCount; ++i)
+        {
+            m_sizeClasses[i].~SizeClass();
+        }
+        m_backing.Free(m_sizeClasses);
+        m_pageHeap->~PageHeap();
+        m_backing.Free(m_pageHeap);
+    }
+
+    size_t SlabAllocator::GetSizeClassSize(size_t sizeClass)
+    {
+        // 16 byte steps up to 128, then four classes per power of two. 
+        if (sizeClass < 8)
+        {
+            return (sizeClass + 1) * 16;
+        }
+        const size_t base = static_cast<size_t>(128) << ((sizeClass - 8) / 4);
+        return base + ((sizeClass - 8) % 4 + 1) * (base / 4);
+    }
+
+    size_t SlabAllocator::GetSizeClass(size_t size)
+    {
+        if (size <= 128)
+        {
+            return (size == 0) ? 0 : (size - 1) / 16;
+        }
+        const size_t lastBit = FindLastSetBit64(size - 1);
+        return 8 + (lastBit - 7) * 4 + ((size - 1) >> (lastBit - 2)) - 4;
+    }
+
+    size_t SlabAllocator::GetAllocationClass(size_t size, size_t alignment) const
+    {
+        if (size > kMaxSmallSize || alignment > kMaxSmallSize || m_pageCount == 0)
+        {
+            return kSizeClassCount;
+        }
+        if (alignment <= TF_DEFAULT_ALIGNMENT_SIZE)
+        {
+            return GetSizeClass(size);
+        }
+
+        // Blocks sit at multiples of the class size from a page boundary, 
+        // pick a class whose size is a multiple of the alignment (every power of two is a class). 
+        size_t sizeClass = GetSizeClass((size < alignment) ? alignment : size);
+        while (GetSizeClassSize(sizeClass) & (alignment - 1))
+        {
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+
+    SlabAllocator::Page* SlabAllocator::FindPage(const void* block) const
+    {
+        const uintptr_t offset = reinterpret_cast<uintptr_t>(block) - reinterpret_cast<uintptr_t>(m_base);
+        return (offset < (m_pageCount << kPageShift)) ? &m_pages[offset >> kPageShift] : nullptr;
+    }
+
+    uint8_t* SlabAllocator::GetPageAddress(const Page* page) const
+    {
+        return m_base + (static_cast<size_t>(page - m_pages) << kPageShift);
+    }
+
+    SlabAllocator::Page* SlabAllocator::AcquirePage(size_t sizeClass)
+    {
+        Page* page = nullptr;
+        {
+            std::lock_guard<Mutex> lock(m_pageHeap->m_lock);
+            if (m_pageHeap->m_freePages)
+            {
+                page = m_pageHeap->m_freePages;
+                m_pageHeap->m_freePages = page->m_next;
+            }
+            else if (m_pageHeap->m_touchedPageCount < m_pageCount)
+            {
+                page = &m_pages[m_pageHeap->m_touchedPageCount++];
+            }
+        }
+        if (page == nullptr)
+        {
+            return nullptr;
+        }
+
+        if (!CommitVirtualMemory(GetPageAddress(page), kPageSize))
+        {
+            std::lock_guard<Mutex> lock(m_pageHeap->m_lock);
+            page->m_next = m_pageHeap->m_freePages;
+            m_pageHeap->m_freePages = page;
+            return nullptr;
+        }
+        m_pageHeap->m_committedBytes.fetch_add(kPageSize, std::memory_order_relaxed);
+
+        const size_t classSize = GetSizeClassSize(sizeClass);
+        page->m_freeList    = nullptr;
+        page->m_next        = nullptr;
+        page->m_prev        = nullptr;
+        page->m_sizeClass   = static_cast<uint32_t>(sizeClass);
+        page->m_usedCount   = 0;
+        page->m_capacity    = static_cast<uint32_t>(kPageSize / classSize);
+        page->m_bumpOffset  = 0;
+        return page;
+    }
+
+    void SlabAllocator::ReleasePage(Page* page)
+    {
+        DecommitVirtualMemory(GetPageAddress(page), kPageSize);
+        m_pageHeap->m_committedBytes.fetch_sub(kPageSize, std::memory_order_relaxed);
+
+        std::lock_guard<Mutex> lock(m_pageHeap->m_lock);
+        page->m_next = m_pageHeap->m_freePages;
+        m_pageHeap->m_freePages = page;
+    }
+
+    void* SlabAllocator::AllocateBlock(size_t sizeClass)
+    {
+        // The size class lock is held by the caller. 
+        SizeClass& slabClass = m_sizeClasses[sizeClass];
+        Page* page = slabClass.m_available;
+        if (TF_UNLIKELY(page == nullptr))
+        {
+            page = AcquirePage(sizeClass);
+            if (page == nullptr)
+            {
+                return nullptr;
+            }
+            SlabLinkPage(slabClass.m_available, page);
+        }
+
+        const size_t classSize = GetSizeClassSize(sizeClass);
+        void* block = page->m_freeList;
+        if (block)
+        {
+            page->m_freeList = *static_cast<void**>(block);
+        }
+        else
+        {
+            block = GetPageAddress(page) + page->m_bumpOffset;
+            page->m_bumpOffset += static_cast<uint32_t>(classSize);
+        }
+        page->m_usedCount++;
+        slabClass.m_usedBytes += classSize;
+
+        if (page->m_usedCount == page->m_capacity)
+        {
+            SlabUnlinkPage(slabClass.m_available, page);
+        }
+        return block;
+    }
+
+    void* SlabAllocator::Allocate(size_t size, size_t alignment)
+    {
+        assert((alignment & (alignment - 1)) == 0); // alignment must be power of two.
+
+        const size_t sizeClass = GetAllocationClass(size, alignment);
+        if (sizeClass < kSizeClassCount)
+        {
+            void* block = nullptr;
+            {
+                std::lock_guard<Mutex> lock(m_sizeClasses[sizeClass].m_lock);
+                block = AllocateBlock(sizeClass);
+            }
+            if (TF_LIKELY(block != nullptr))
+            {
+                return block;
+            }
+        }
+        // Large requests, or the reserved range is exhausted. 
+        return m_backing.Allocate(size, alignment);
+    }
+
+    size_t SlabAllocator::AllocateBatch(size_t count, size_t size, size_t alignment, void** blocks)
+    {
+        assert((alignment & (alignment - 1)) == 0); // alignment must be power of two.
+
+        const size_t sizeClass = GetAllocationClass(size, alignment);
+        size_t allocated = 0;
+        if (sizeClass < kSizeClassCount)
+        {
+            std::lock_guard<Mutex> lock(m_sizeClasses[sizeClass].m_lock);
+            for (; allocated < count; ++allocated)
+            {
+                blocks[allocated] = AllocateBlock(sizeClass);
+                if (blocks[allocated] == nullptr)
+                {
+                    break;
+                }
+            }
+        }
+        if (allocated == count)
+        {
+            return count;
+        }
+        return allocated + m_backing.AllocateBatch(count - allocated, size, alignment, blocks + allocated);
+    }
+
+    void SlabAllocator::FreeBlock(Page* page, void* block)
+    {
+        // The size class lock is held by the caller. 
+        SizeClass& slabClass = m_sizeClasses[page->m_sizeClass];
+        assert(page->m_usedCount > 0);
+
+        *static_cast<void**>(block) = page->m_freeList;
+        page->m_freeList = block;
+        if (page->m_usedCount == page->m_capacity)
+        {
+            SlabLinkPage(slabClass.m_available, page);
+        }
+        page->m_usedCount--;
+        slabClass.m_usedBytes -= GetSizeClassSize(page->m_sizeClass);
+
+        // Give empty pages back to the system, but keep the last one of the class to avoid thrashing. 
+        if (page->m_usedCount == 0 && (slabClass.m_available != page || page->m_next != nullptr))
+        {
+            SlabUnlinkPage(slabClass.m_available, page);
+            ReleasePage(page);
+        }
+    }
+
+    void SlabAllocator::Free(void* block)
+    {
+        if (block == nullptr)
+        {
+            return;
+        }
+        Page* page = FindPage(block);
+        if (page == nullptr)
+        {
+            m_backing.Free(block);
+            return;
+        }
+
+        std::lock_guard<Mutex> lock(m_sizeClasses[page->m_sizeClass].m_lock);
+        FreeBlock(page, block);
+    }
+
+    void SlabAllocator::FreeBatch(void** blocks, size_t count)
+    {
+        // A run of blocks from one size class shares one lock acquisition. 
+        SizeClass* locked = nullptr;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (blocks[i] == nullptr)
+            {
+                continue;
+            }
+            Page* page = FindPage(blocks[i]);
+            if (page == nullptr)
+            {
+                m_backing.Free(blocks[i]);
+                continue;
+            }
+            SizeClass* slabClass = &m_sizeClasses[page->m_sizeClass];
+            if (slabClass != locked)
+            {
+                if (locked)
+                {
+                    locked->m_lock.unlock();
+                }
+                slabClass->m_lock.lock();
+                locked = slabClass;
+            }
+            FreeBlock(page, blocks[i]);
+        }
+        if (locked)
+        {
+            locked->m_lock.unlock();
+        }
+    }
+
+    bool SlabAllocator::TryExpandInPlace(void* block, size_t oldSize, size_t newSize)
+    {
+        const Page* page = FindPage(block);
+        if (page == nullptr)
+        {
+            return Allocator::TryExpandInPlace(block, oldSize, newSize);
+        }
+        return newSize <= GetSizeClassSize(page->m_sizeClass);
+    }
+
+    size_t SlabAllocator::GetBlockSize(const void* block) const
+    {
+        const Page* page = FindPage(block);
+        return (page != nullptr) ? GetSizeClassSize(page->m_sizeClass) : 0;
+    }
+
+    size_t SlabAllocator::GetUsedBytes() const
+    {
+        size_t usedBytes = 0;
+        for (size_t i = 0; i < kSizeClassCount; ++i)
+        {
+            std::lock_guard<Mutex> lock(m_sizeClasses[i].m_lock);
+            usedBytes += m_sizeClasses[i].m_usedBytes;
+        }
+        return usedBytes;
+    }
+
+    size_t SlabAllocator::GetCommittedBytes() const
+    {
+        return m_pageHeap->m_committedBytes.load(std::memory_order_relaxed);
+    }
+
+    // Header in front of every RelocatableAllocator block, live or hole. 
+    struct RelocatableBlockHeader
+    {
+        uint32_t                        m_handleIndex;
+        uint32_t                        m_prevBytes;    // size of the previous block, 0 for the first one.
+        size_t                          m_bytes;        // size of this block, header included.
+    }; // struct RelocatableBlockHeader 
+
+    // Hole list links, kept in the payload of the hole. 
+    struct RelocatableHoleLinks
+    {
+        size_t                          m_next;
+        size_t                          m_prev;
+    }; // struct RelocatableHoleLinks 
+
+    static const size_t     kRelocatableHeaderSize      = TF_ALIGNMENT(sizeof(RelocatableBlockHeader), RelocatableAllocator::kAlignment);
+    static const size_t     kRelocatableMinBlockBytes   = kRelocatableHeaderSize + TF_ALIGNMENT(sizeof(RelocatableHoleLinks), RelocatableAllocator::kAlignment);
+    static const size_t     kRelocatableMaxCapacity     = 0xffffffffu & ~(RelocatableAllocator::kAlignment - 1);
+    static const size_t     kRelocatableNoHole          = ~static_cast<size_t>(0);
+    static const uint32_t   kRelocatableFreeIndex       = 0xffffffffu;
+    static const uint32_t   kRelocatableGenerationMask  = (1u << (32 - RelocatableAllocator::kIndexBits)) - 1;
+
+    static RelocatableBlockHeader* GetRelocatableHeader(uint8_t* buffer, size_t offset)
+    {
+        return reinterpret_cast<RelocatableBlockHeader*>(buffer + offset);
+    }
+
+    static RelocatableHoleLinks* GetRelocatableLinks(uint8_t* buffer, size_t offset)
+    {
+        return reinterpret_cast<RelocatableHoleLinks*>(buffer + offset + kRelocatableHeaderSize);
+    }
+
+    RelocatableAllocator::RelocatableAllocator(size_t capacity, size_t maxHandleCount, Allocator& backing)
+        : m_backing         (backing)
+        , m_buffer          (nullptr)
+        , m_capacity        (0)
+        , m_top             (0)
+        , m_lastBytes       (0)
+        , m_holes           (kRelocatableNoHole)
+        , m_holeBytes       (0)
+        , m_usedBytes       (0)
+        , m_liveCount       (0)
+        , m_handles         (nullptr)
+        , m_handleCount     (0)
+        , m_freeHandle      (kRelocatableFreeIndex)
+    {
+        // Block sizes are linked with 32-bit fields. 
+        assert(capacity <= kRelocatableMaxCapacity);
+        assert(maxHandleCount > 0 && maxHandleCount <= kMaxHandleCount);
+        capacity = (capacity < kRelocatableMaxCapacity) ? (capacity & ~(kAlignment - 1)) : kRelocatableMaxCapacity;
+
+        m_buffer  = static_cast<uint8_t*>(m_backing.Allocate(capacity, kAlignment));
+        m_handles = static_cast<HandleEntry*>(m_backing.Allocate(sizeof(HandleEntry) * maxHandleCount, TF_DEFAULT_ALIGNMENT_SIZE));
+        assert(m_buffer != nullptr && m_handles != nullptr);
+        if (m_buffer == nullptr || m_handles == nullptr)
+        {
+            return;
+        }
+        m_capacity      = capacity;
+        m_handleCount   = maxHandleCount;
+
+        for (size_t i = 0; i < m_handleCount; ++i)
+        {
+            m_handles[i].m_offset       = 0;
+            m_handles[i].m_generation   = 1;
+            m_handles[i].m_nextFree     = (i + 1 < m_handleCount) ? static_cast<uint32_t>(i + 1) : kRelocatableFreeIndex;
+        }
+        m_freeHandle = 0;
+    }
+
+    RelocatableAllocator::~RelocatableAllocator()
+    {
+        m_backing.Free(m_handles);
+        m_backing.Free(m_buffer);
+    }
+
+    const RelocatableAllocator::HandleEntry* RelocatableAllocator::FindEntry(Handle handle) const
+    {
+        const size_t index = handle & (kMaxHandleCount - 1);
+        if (index >= m_handleCount)
+        {
+            return nullptr;
+        }
+        const HandleEntry& entry = m_handles[index];
+        return (entry.m_generation == (handle >> kIndexBits) && entry.m_nextFree == kRelocatableFreeIndex) ? &entry : nullptr;
+    }
+
+    void RelocatableAllocator::InsertHole(size_t offset)
+    {
+        RelocatableHoleLinks* links = GetRelocatableLinks(m_buffer, offset);
+        links->m_next = m_holes;
+        links->m_prev = kRelocatableNoHole;
+        if (m_holes != kRelocatableNoHole)
+        {
+            GetRelocatableLinks(m_buffer, m_holes)->m_prev = offset;
+        }
+        m_holes      = offset;
+        m_holeBytes += GetRelocatableHeader(m_buffer, offset)->m_bytes;
+    }
+
+    void RelocatableAllocator::RemoveHole(size_t offset)
+    {
+        const RelocatableHoleLinks* links = GetRelocatableLinks(m_buffer, offset);
+        if (links->m_prev != kRelocatableNoHole)
+        {
+            GetRelocatableLinks(m_buffer, links->m_prev)->m_next = links->m_next;
+        }
+        else
+        {
+            m_holes = links->m_next;
+        }
+        if (links->m_next != kRelocatableNoHole)
+        {
+            GetRelocatableLinks(m_buffer, links->m_next)->m_prev = links->m_prev;
+        }
+        m_holeBytes -= GetRelocatableHeader(m_buffer, offset)->m_bytes;
+    }
+
+    size_t RelocatableAllocator::FindHole(size_t blockBytes, size_t limit) const
+    {
+        // Lowest address first, so the top keeps shrinking. 
+        size_t found = m_capacity;
+        for (size_t hole = m_holes; hole != kRelocatableNoHole; hole = GetRelocatableLinks(m_buffer, hole)->m_next)
+        {
+            if (hole < found && hole < limit && GetRelocatableHeader(m_buffer, hole)->m_bytes >= blockBytes)
+            {
+                found = hole;
+            }
+        }
+        return found;
+    }
+
+    void RelocatableAllocator::SetPrevBytes(size_t offset, size_t prevBytes)
+    {
+        if (offset < m_top)
+        {
+            GetRelocatableHeader(m_buffer, offset)->m_prevBytes = static_cast<uint32_t>(prevBytes);
+        }
+        else
+        {
+            m_lastBytes = prevBytes;
+        }
+    }
+
+    void RelocatableAllocator::PlaceBlock(size_t holeOffset, size_t blockBytes)
+    {
+        RemoveHole(holeOffset);
+        RelocatableBlockHeader* header = GetRelocatableHeader(m_buffer, holeOffset);
+        if (header->m_bytes - blockBytes >= kRelocatableMinBlockBytes)
+        {
+            const size_t remaining = holeOffset + blockBytes;
+            RelocatableBlockHeader* remainingHeader = GetRelocatableHeader(m_buffer, remaining);
+            remainingHeader->m_handleIndex  = kRelocatableFreeIndex;
+            remainingHeader->m_prevBytes    = static_cast<uint32_t>(blockBytes);
+            remainingHeader->m_bytes        = header->m_bytes - blockBytes;
+            header->m_bytes                 = blockBytes;
+            InsertHole(remaining);
+            SetPrevBytes(remaining + remainingHeader->m_bytes, remainingHeader->m_bytes);
+        }
+    }
+
+    void RelocatableAllocator::MakeHole(size_t offset)
+    {
+        // Holes never touch each other or the top: merge with the neighbours, or give the space back to the top. 
+        RelocatableBlockHeader* header = GetRelocatableHeader(m_buffer, offset);
+        header->m_handleIndex = kRelocatableFreeIndex;
+
+        const size_t next = offset + header->m_bytes;
+        if (next < m_top && GetRelocatableHeader(m_buffer, next)->m_handleIndex == kRelocatableFreeIndex)
+        {
+            RemoveHole(next);
+            header->m_bytes += GetRelocatableHeader(m_buffer, next)->m_bytes;
+        }
+        if (header->m_prevBytes != 0)
+        {
+            const size_t prev = offset - header->m_prevBytes;
+            RelocatableBlockHeader* prevHeader = GetRelocatableHeader(m_buffer, prev);
+            if (prevHeader->m_handleIndex == kRelocatableFreeIndex)
+            {
+                RemoveHole(prev);
+                prevHeader->m_bytes += header->m_bytes;
+                offset = prev;
+                header = prevHeader;
+            }
+        }
+
+        if (offset + header->m_bytes == m_top)
+        {
+            m_top       = offset;
+            m_lastBytes = header->m_prevBytes;
+            return;
+        }
+        InsertHole(offset);
+        SetPrevBytes(offset + header->m_bytes, header->m_bytes);
+    }
+
+    RelocatableAllocator::Handle RelocatableAllocator::Allocate(size_t size)
+    {
+        if (m_freeHandle == kRelocatableFreeIndex || size > m_capacity)
+        {
+            return kInvalidHandle;
+        }
+        size_t blockBytes = kRelocatableHeaderSize + TF_ALIGNMENT(size, kAlignment);
+        if (blockBytes < kRelocatableMinBlockBytes)
+        {
+            blockBytes = kRelocatableMinBlockBytes;
+        }
+
+        size_t offset = FindHole(blockBytes, m_top);
+        if (offset != m_capacity)
+        {
+            PlaceBlock(offset, blockBytes);
+        }
+        else if (blockBytes <= m_capacity - m_top)
+        {
+            offset = m_top;
+            RelocatableBlockHeader* header = GetRelocatableHeader(m_buffer, offset);
+            header->m_prevBytes = static_cast<uint32_t>(m_lastBytes);
+            header->m_bytes     = blockBytes;
+            m_top      += blockBytes;
+            m_lastBytes = blockBytes;
+        }
+        else
+        {
+            return kInvalidHandle;
+        }
+
+        const uint32_t index = m_freeHandle;
+        HandleEntry& entry = m_handles[index];
+        m_freeHandle     = entry.m_nextFree;
+        entry.m_nextFree = kRelocatableFreeIndex;
+        entry.m_offset   = offset;
+
+        RelocatableBlockHeader* header = GetRelocatableHeader(m_buffer, offset);
+        header->m_handleIndex = index;
+        m_usedBytes += header->m_bytes;
+        m_liveCount++;
+        return (entry.m_generation << kIndexBits) | index;
+    }
+
+    void RelocatableAllocator::Free(Handle handle)
+    {
+        const HandleEntry* found = FindEntry(handle);
+        assert(handle == kInvalidHandle || found != nullptr); // stale handle.
+        if (found == nullptr)
+        {
+            return;
+        }
+
+        const uint32_t index = static_cast<uint32_t>(found - m_handles);
+        HandleEntry& entry = m_handles[index];
+        m_usedBytes -= GetRelocatableHeader(m_buffer, entry.m_offset)->m_bytes;
+        m_liveCount--;
+        MakeHole(entry.m_offset);
+
+        entry.m_generation = (entry.m_generation + 1) & kRelocatableGenerationMask;
+        if (entry.m_generation == 0)
+        {
+            entry.m_generation = 1;
+        }
+        entry.m_nextFree = m_freeHandle;
+        m_freeHandle = index;
+    }
+
+    void* RelocatableAllocator::Resolve(Handle handle) const
+    {
+        const HandleEntry* entry = FindEntry(handle);
+        return (entry != nullptr) ? m_buffer + entry->m_offset + kRelocatableHeaderSize : nullptr;
+    }
+
+    size_t RelocatableAllocator::GetSize(Handle handle) const
+    {
+        const HandleEntry* entry = FindEntry(handle);
+        return (entry != nullptr) ? GetRelocatableHeader(m_buffer, entry->m_offset)->m_bytes - kRelocatableHeaderSize : 0;
+    }
+
+    size_t RelocatableAllocator::Defragment(size_t maxBytes)
+    {
+        size_t movedBytes = 0;
+        while (m_holes != kRelocatableNoHole)
+        {
+            // Move the last block into the lowest hole that holds it, which lowers the top, 
+            // otherwise slide the block after the lowest hole down, which moves the hole up. 
+            const size_t last = m_top - m_lastBytes;
+            size_t hole = FindHole(GetRelocatableHeader(m_buffer, last)->m_bytes, last);
+            const bool moveLast = (hole != m_capacity);
+            if (!moveLast)
+            {
+                hole = FindHole(0, m_capacity);
+            }
+            const size_t source = moveLast ? last : hole + GetRelocatableHeader(m_buffer, hole)->m_bytes;
+
+            RelocatableBlockHeader* sourceHeader = GetRelocatableHeader(m_buffer, source);
+            const size_t blockBytes = sourceHeader->m_bytes;
+            const uint32_t index    = sourceHeader->m_handleIndex;
+            assert(index != kRelocatableFreeIndex);
+
+            // Always make progress, even when a single block is larger than the budget. 
+            if (movedBytes >= maxBytes || (movedBytes > 0 && movedBytes + blockBytes > maxBytes))
+            {
+                break;
+            }
+
+            if (moveLast)
+            {
+                PlaceBlock(hole, blockBytes);
+                memcpy(m_buffer + hole + kRelocatableHeaderSize, m_buffer + source + kRelocatableHeaderSize, blockBytes - kRelocatableHeaderSize);
+                RelocatableBlockHeader* header = GetRelocatableHeader(m_buffer, hole);
+                header->m_handleIndex = index;
+                m_usedBytes += header->m_bytes - blockBytes;
+                MakeHole(source);
+            }
+            else
+            {
+                RemoveHole(hole);
+                const size_t holeBytes = GetRelocatableHeader(m_buffer, hole)->m_bytes;
+                const uint32_t prevBytes = GetRelocatableHeader(m_buffer, hole)->m_prevBytes;
+                memmove(m_buffer + hole, m_buffer + source, blockBytes);
+                GetRelocatableHeader(m_buffer, hole)->m_prevBytes = prevBytes;
+
+                RelocatableBlockHeader* newHole = GetRelocatableHeader(m_buffer, hole + blockBytes);
+                newHole->m_prevBytes    = static_cast<uint32_t>(blockBytes);
+                newHole->m_bytes        = holeBytes;
+                MakeHole(hole + blockBytes);
+            }
+            m_handles[index].m_offset = hole;
+            movedBytes += blockBytes;
+        }
+        return movedBytes;
+    }
+
+    // Header in front of every MirroredRingBuffer record. 
+    struct RingRecordHeader
+    {
+        uint32_t                        m_size;
+        std::atomic<uint32_t>           m_ready;
+    }; // struct RingRecordHeader 
+
+    static size_t GetRingRecordBytes(size_t size)
+    {
+        return TF_ALIGNMENT(sizeof(RingRecordHeader) + size, MirroredRingBuffer::kRecordAlignment);
+    }
+
+    MirroredRingBuffer::MirroredRingBuffer(size_t capacity)
+        : m_data        (nullptr)
+        , m_capacity    (0)
+        , m_mapping     (0)
+        , m_writeIndex  (0)
+        , m_readIndex   (0)
+    {
+        static_assert(sizeof(RingRecordHeader) == kRecordAlignment, "Ring record header must keep records aligned.");
+        static_assert(offsetof(MirroredRingBuffer, m_readIndex) - offsetof(MirroredRingBuffer, m_writeIndex) >= TF_CACHELINE_SIZE, "Ring indices must not share a cache line.");
+
+#if defined(TF_PLATFORM_WINDOWS)
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        const size_t granularity = static_cast<size_t>(systemInfo.dwAllocationGranularity);
+#else
+        const size_t granularity = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+        size_t size = granularity;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+
+#if defined(TF_PLATFORM_WINDOWS)
+        const uint64_t mappingSize = static_cast<uint64_t>(size);
+        HANDLE mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(mappingSize >> 32), static_cast<DWORD>(mappingSize), nullptr);
+        if (mapping == nullptr)
+        {
+            return;
+        }
+
+        // Find a free range for both views; another thread may take it in between, so retry. 
+        for (int retry = 0; retry < 16 && m_data == nullptr; ++retry)
+        {
+            uint8_t* base = static_cast<uint8_t*>(VirtualAlloc(nullptr, 2 * size, MEM_RESERVE, PAGE_NOACCESS));
+            if (base == nullptr)
+            {
+                break;
+            }
+            VirtualFree(base, 0, MEM_RELEASE);
+
+            void* first  = MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size, base);
+            void* second = (first != nullptr) ? MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size, base + size) : nullptr;
+            if (first != nullptr && second != nullptr)
+            {
+                m_data = base;
+                break;
+            }
+            if (first)
+            {
+                UnmapViewOfFile(first);
+            }
+        }
+        if (m_data == nullptr)
+        {
+            CloseHandle(mapping);
+            return;
+        }
+        m_mapping = reinterpret_cast<intptr_t>(mapping);
+#else
+        const int fd = memfd_create("tf_mirrored_ring_buffer", MFD_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        uint8_t* base = nullptr;
+        if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+        {
+            void* reserved = mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            base = (reserved != MAP_FAILED) ? static_cast<uint8_t*>(reserved) : nullptr;
+        }
+        if (base != nullptr)
+        {
+            const bool mapped =
+                mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+                mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+            if (!mapped)
+            {
+                munmap(base, 2 * size);
+                base = nullptr;
+            }
+        }
+        close(fd); // the mappings keep the memory alive.
+        if (base == nullptr)
+        {
+            return;
+        }
+        m_data = base;
+#endif
+        m_capacity = size;
+    }
+
+    MirroredRingBuffer::~MirroredRingBuffer()
+    {
+        if (m_data == nullptr)
+        {
+            return;
+        }
+#if defined(TF_PLATFORM_WINDOWS)
+        UnmapViewOfFile(m_data);
+        UnmapViewOfFile(m_data + m_capacity);
+        CloseHandle(reinterpret_cast<HANDLE>(m_mapping));
+#else
+        munmap(m_data, 2 * m_capacity);
+#endif
+        m_data = nullptr;
+    }
+
+    void* MirroredRingBuffer::Reserve(uint64_t writeIndex, size_t size)
+    {
+        RingRecordHeader* header = reinterpret_cast<RingRecordHeader*>(m_data + (writeIndex & (m_capacity - 1)));
+        header->m_size = static_cast<uint32_t>(size);
+        return header + 1;
+    }
+
+    void* MirroredRingBuffer::BeginWrite(size_t size)
+    {
+        const size_t bytes = GetRingRecordBytes(size);
+        if (bytes > m_capacity)
+        {
+            return nullptr;
+        }
+        const uint64_t writeIndex = m_writeIndex.load(std::memory_order_relaxed);
+        if (writeIndex + bytes - m_readIndex.load(std::memory_order_acquire) > m_capacity)
+        {
+            return nullptr;
+        }
+        // The consumer waits for the ready flag, so the index can move before the record is written. 
+        m_writeIndex.store(writeIndex + bytes, std::memory_order_relaxed);
+        return Reserve(writeIndex, size);
+    }
+
+    void* MirroredRingBuffer::BeginWriteConcurrent(size_t size)
+    {
+        const size_t bytes = GetRingRecordBytes(size);
+        if (bytes > m_capacity)
+        {
+            return nullptr;
+        }
+        uint64_t writeIndex = m_writeIndex.load(std::memory_order_relaxed);
+        do
+        {
+            if (writeIndex + bytes - m_readIndex.load(std::memory_order_acquire) > m_capacity)
+            {
+                return nullptr;
+            }
+        } while (!m_writeIndex.compare_exchange_weak(writeIndex, writeIndex + bytes, std::memory_order_relaxed, std::memory_order_relaxed));
+        return Reserve(writeIndex, size);
+    }
+
+    void MirroredRingBuffer::EndWrite(void* payload)
+    {
+        RingRecordHeader* header = static_cast<RingRecordHeader*>(payload) - 1;
+        header->m_ready.store(1, std::memory_order_release);
+    }
+
+    bool MirroredRingBuffer::Write(const void* data, size_t size)
+    {
+        void* payload = BeginWrite(size);
+        if (payload == nullptr)
+        {
+            return false;
+        }
+        memcpy(payload, data, size);
+        EndWrite(payload);
+        return true;
+    }
+
+    bool MirroredRingBuffer::WriteConcurrent(const void* data, size_t size)
+    {
+        void* payload = BeginWriteConcurrent(size);
+        if (payload == nullptr)
+        {
+            return false;
+        }
+        memcpy(payload, data, size);
+        EndWrite(payload);
+        return true;
+    }
+
+    const void* MirroredRingBuffer::BeginRead(size_t& size)
+    {
+        const uint64_t readIndex = m_readIndex.load(std::memory_order_relaxed);
+        if (readIndex == m_writeIndex.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        const RingRecordHeader* header = reinterpret_cast<const RingRecordHeader*>(m_data + (readIndex & (m_capacity - 1)));
+        if (header->m_ready.load(std::memory_order_acquire) == 0)
+        {
+            return nullptr;
+        }
+        size = header->m_size;
+        return header + 1;
+    }
+
+    void MirroredRingBuffer::EndRead()
+    {
+        const uint64_t readIndex = m_readIndex.load(std::memory_order_relaxed);
+        RingRecordHeader* header = reinterpret_cast<RingRecordHeader*>(m_data + (readIndex & (m_capacity - 1)));
+        assert(header->m_ready.load(std::memory_order_relaxed) != 0);
+        const size_t bytes = GetRingRecordBytes(header->m_size);
+
+        // Producers find a zero ready flag wherever their record header lands. 
+        memset(reinterpret_cast<uint8_t*>(header + 1), 0, bytes - sizeof(RingRecordHeader));
+        header->m_size = 0;
+        header->m_ready.store(0, std::memory_order_relaxed);
+        m_readIndex.store(readIndex + bytes, std::memory_order_release);
+    }
+
+    // Bits [0, count) set, count <= 64. 
+    static uint64_t GetLowMask(uint32_t count)
+    {
+        return (count >= 64) ? ~0ull : ((1ull << count) - 1);
+    }
+
+    BitmapAllocator::BitmapAllocator(uint32_t capacity, Allocator& allocator)
+        : m_allocator   (allocator)
+        , m_levels      ()
+        , m_levelBitCounts()
+        , m_levelCount  (0)
+        , m_capacity    (0)
+        , m_usedCount   (0)
+    {
+        if (capacity > 0)
+        {
+            Reset(capacity);
+        }
+    }
+
+    BitmapAllocator::~BitmapAllocator()
+    {
+        if (m_levels[0] != nullptr)
+        {
+            m_allocator.Free(m_levels[0]);
+        }
+    }
+
+    bool BitmapAllocator::Reset(uint32_t capacity)
+    {
+        uint32_t bitCounts[kMaxLevelCount] = {};
+        uint32_t levelCount = 0;
+        size_t wordCount = 0;
+        for (uint32_t bits = (capacity > 0) ? capacity : 1; ; bits = (bits + 63) / 64)
+        {
+            assert(levelCount < kMaxLevelCount);
+            bitCounts[levelCount++] = bits;
+            wordCount += (bits + 63) / 64;
+            if (bits <= 64)
+            {
+                break;
+            }
+        }
+        uint64_t* words = static_cast<uint64_t*>(m_allocator.Allocate(wordCount * sizeof(uint64_t), TF_DEFAULT_ALIGNMENT_SIZE));
+        if (words == nullptr)
+        {
+            return false;
+        }
+        if (m_levels[0] != nullptr)
+        {
+            m_allocator.Free(m_levels[0]);
+        }
+
+        // Every index is free, so every summary bit is set too. Bits past the end stay clear. 
+        memset(m_levels, 0, sizeof(m_levels));
+        for (uint32_t level = 0; level < levelCount; ++level)
+        {
+            m_levels[level] = words;
+            m_levelBitCounts[level] = (capacity > 0) ? bitCounts[level] : 0;
+            const uint32_t fullWords = m_levelBitCounts[level] / 64;
+            const uint32_t wordsInLevel = (bitCounts[level] + 63) / 64;
+            for (uint32_t i = 0; i < wordsInLevel; ++i)
+            {
+                words[i] = (i < fullWords) ? ~0ull : GetLowMask(m_levelBitCounts[level] & 63);
+            }
+            words += wordsInLevel;
+        }
+        m_levelCount = levelCount;
+        m_capacity = capacity;
+        m_usedCount = 0;
+        return true;
+    }
+
+    // Update the summary bits above level 0 word wordIndex after it changed. 
+    void BitmapAllocator::Propagate(uint32_t wordIndex, bool wasEmpty)
+    {
+        for (uint32_t level = 0; level + 1 < m_levelCount; ++level)
+        {
+            const bool isEmpty = (m_levels[level][wordIndex] == 0);
+            if (isEmpty == wasEmpty)
+            {
+                return;
+            }
+            uint64_t& parent = m_levels[level + 1][wordIndex >> 6];
+            wasEmpty = (parent == 0);
+            const uint64_t bit = 1ull << (wordIndex & 63);
+            parent = isEmpty ? (parent & ~bit) : (parent | bit);
+            wordIndex >>= 6;
+        }
+    }
+
+    // First set bit at or after from on level, skipping empty words through the level above. 
+    uint32_t BitmapAllocator::FindNextFree(uint32_t level, uint32_t from) const
+    {
+        while (from < m_levelBitCounts[level])
+        {
+            const uint32_t wordIndex = from >> 6;
+            const uint64_t word = m_levels[level][wordIndex] & (~0ull << (from & 63));
+            if (word != 0)
+            {
+                return (wordIndex << 6) + CountTrailingZeros(word);
+            }
+            if (level + 1 == m_levelCount)
+            {
+                break;
+            }
+            const uint32_t nextWord = FindNextFree(level + 1, wordIndex + 1);
+            if (nextWord == kInvalidIndex)
+            {
+                break;
+            }
+            from = nextWord << 6;
+        }
+        return kInvalidIndex;
+    }
+
+    // First allocated index in [from, limit), or limit. 
+    uint32_t BitmapAllocator::FindNextUsed(uint32_t from, uint32_t limit) const
+    {
+        while (from < limit)
+        {
+            const uint32_t wordIndex = from >> 6;
+            const uint64_t word = ~m_levels[0][wordIndex] & (~0ull << (from & 63));
+            if (word != 0)
+            {
+                const uint32_t index = (wordIndex << 6) + CountTrailingZeros(word);
+                return (index < limit) ? index : limit;
+            }
+            from = (wordIndex + 1) << 6;
+        }
+        return limit;
+    }
+
+    void BitmapAllocator::MarkRange(uint32_t first, uint32_t count, bool free)
+    {
+        assert(count > 0 && first < m_capacity && count <= m_capacity - first);
+        const uint32_t last = first + count - 1;
+        for (uint32_t wordIndex = first >> 6; wordIndex <= (last >> 6); ++wordIndex)
+        {
+            const uint32_t begin = (wordIndex == (first >> 6)) ? (first & 63) : 0;
+            const uint32_t end = (wordIndex == (last >> 6)) ? (last & 63) + 1 : 64;
+            const uint64_t mask = GetLowMask(end - begin) << begin;
+
+            uint64_t& word = m_levels[0][wordIndex];
+            const bool wasEmpty = (word == 0);
+            assert((word & mask) == (free ? 0 : mask)); // double free or allocation of a used index.
+            word = free ? (word | mask) : (word & ~mask);
+            Propagate(wordIndex, wasEmpty);
+        }
+    }
+
+    uint32_t BitmapAllocator::Allocate()
+    {
+        if (m_usedCount == m_capacity)
+        {
+            return kInvalidIndex;
+        }
+        uint32_t index = 0;
+        for (uint32_t level = m_levelCount; level-- > 0; )
+        {
+            const uint64_t word = m_levels[level][index];
+            assert(word != 0); // summary bits only point at words with free bits.
+            index = (index << 6) + CountTrailingZeros(word);
+        }
+        uint64_t& word = m_levels[0][index >> 6];
+        word &= ~(1ull << (index & 63));
+        Propagate(index >> 6, false);
+        m_usedCount++;
+        return index;
+    }
+
+    uint32_t BitmapAllocator::AllocateRange(uint32_t count)
+    {
+        assert(count > 0);
+        if (count == 1)
+        {
+            return Allocate();
+        }
+        if (count > m_capacity - m_usedCount)
+        {
+            return kInvalidIndex;
+        }
+        for (uint32_t from = 0; ; )
+        {
+            const uint32_t first = FindNextFree(0, from);
+            if (first == kInvalidIndex || count > m_capacity - first)
+            {
+                return kInvalidIndex;
+            }
+            const uint32_t end = FindNextUsed(first, first + count);
+            if (end == first + count)
+            {
+                MarkRange(first, count, false);
+                m_usedCount += count;
+                return first;
+            }
+            from = end;
+        }
+    }
+
+    void BitmapAllocator::Free(uint32_t index)
+    {
+        FreeRange(index, 1);
+    }
+
+    void BitmapAllocator::FreeRange(uint32_t first, uint32_t count)
+    {
+        if (first == kInvalidIndex)
+        {
+            return;
+        }
+        MarkRange(first, count, true);
+        m_usedCount -= count;
+    }
+
+    AtomicBitmapAllocator::AtomicBitmapAllocator(uint32_t capacity, Allocator& allocator)
+        : m_allocator   (allocator)
+        , m_summary     (nullptr)
+        , m_leaves      (nullptr)
+        , m_capacity    (0)
+        , m_leafCount   ((capacity + 63) / 64)
+        , m_summaryCount((m_leafCount + 63) / 64)
+        , m_usedCount   (0)
+    {
+        if (m_leafCount == 0)
+        {
+            return;
+        }
+        void* block = m_allocator.Allocate((m_summaryCount + m_leafCount) * sizeof(std::atomic<uint64_t>), TF_DEFAULT_ALIGNMENT_SIZE);
+        assert(block != nullptr);
+        if (block == nullptr)
+        {
+            m_leafCount = 0;
+            m_summaryCount = 0;
+            return;
+        }
+        m_summary = static_cast<std::atomic<uint64_t>*>(block);
+        m_leaves = m_summary + m_summaryCount;
+        for (uint32_t i = 0; i < m_summaryCount; ++i)
+        {
+            const uint32_t bits = m_leafCount - i * 64;
+            new (m_summary + i) std::atomic<uint64_t>(GetLowMask((bits < 64) ? bits : 64));
+        }
+        for (uint32_t i = 0; i < m_leafCount; ++i)
+        {
+            const uint32_t bits = capacity - i * 64;
+            new (m_leaves + i) std::atomic<uint64_t>(GetLowMask((bits < 64) ? bits : 64));
+        }
+        m_capacity = capacity;
+    }
+
+    AtomicBitmapAllocator::~AtomicBitmapAllocator()
+    {
+        if (m_summary != nullptr)
+        {
+            m_allocator.Free(m_summary);
+        }
+    }
+
+    uint32_t AtomicBitmapAllocator::TryAllocate(uint32_t leafIndex, uint32_t count)
+    {
+        std::atomic<uint64_t>& leaf = m_leaves[leafIndex];
+        uint64_t word = leaf.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            // Bits that start a run of count free bits. 
+            uint64_t starts = word;
+            for (uint32_t length = 1; length < count && starts != 0; )
+            {
+                const uint32_t shift = (length < count - length) ? length : count - length;
+                starts &= starts >> shift;
+                length += shift;
+            }
+            if (starts == 0)
+            {
+                return kInvalidIndex;
+            }
+            const uint32_t bit = CountTrailingZeros(starts);
+            const uint64_t remaining = word & ~(GetLowMask(count) << bit);
+            if (leaf.compare_exchange_weak(word, remaining, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                if (remaining == 0)
+                {
+                    // Clear the hint, then restore it if a Free() refilled the word in between. 
+                    const uint64_t summaryBit = 1ull << (leafIndex & 63);
+                    m_summary[leafIndex >> 6].fetch_and(~summaryBit, std::memory_order_seq_cst);
+                    if (leaf.load(std::memory_order_seq_cst) != 0)
+                    {
+                        m_summary[leafIndex >> 6].fetch_or(summaryBit, std::memory_order_seq_cst);
+                    }
+                }
+                m_usedCount.fetch_add(count, std::memory_order_relaxed);
+                return (leafIndex << 6) + bit;
+            }
+        }
+    }
+
+    uint32_t AtomicBitmapAllocator::AllocateRange(uint32_t count)
+    {
+        assert(count > 0 && count <= kMaxRangeCount);
+        for (uint32_t summaryIndex = 0; summaryIndex < m_summaryCount; ++summaryIndex)
+        {
+            for (uint64_t summary = m_summary[summaryIndex].load(std::memory_order_acquire); summary != 0; summary &= summary - 1)
+            {
+                const uint32_t index = TryAllocate((summaryIndex << 6) + CountTrailingZeros(summary), count);
+                if (index != kInvalidIndex)
+                {
+                    return index;
+                }
+            }
+        }
+        for (uint32_t leafIndex = 0; leafIndex < m_leafCount; ++leafIndex)
+        {
+            const uint32_t index = TryAllocate(leafIndex, count);
+            if (index != kInvalidIndex)
+            {
+                return index;
+            }
+        }
+        return kInvalidIndex;
+    }
+
+    void AtomicBitmapAllocator::FreeRange(uint32_t first, uint32_t count)
+    {
+        if (first == kInvalidIndex)
+        {
+            return;
+        }
+        assert(count > 0 && first < m_capacity && count <= m_capacity - first);
+        assert((first & 63) + count <= 64); // ranges never cross a leaf word.
+        const uint64_t mask = GetLowMask(count) << (first & 63);
+        const uint64_t previous = m_leaves[first >> 6].fetch_or(mask, std::memory_order_seq_cst);
+        assert((previous & mask) == 0); // double free.
+        if (previous == 0)
+        {
+            m_summary[first >> 12].fetch_or(1ull << ((first >> 6) & 63), std::memory_order_seq_cst);
+        }
+        m_usedCount.fetch_sub(count, std::memory_order_relaxed);
+    }
+
+    size_t HashBytes(const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return static_cast<size_t>(hash);
+    }
+
+    // Job system. 
+
+    JobDeque::JobDeque(uint32_t capacity, Allocator& allocator)
+        : m_top         (0)
+        , m_bottom      (0)
+        , m_allocator   (allocator)
+        , m_slots       (nullptr)
+        , m_mask        (0)
+    {
+        static_assert(alignof(JobDeque) >= TF_CACHELINE_SIZE, "Deque top and bottom must not share a cache line.");
+        assert(reinterpret_cast<uintptr_t>(&m_bottom) - reinterpret_cast<uintptr_t>(&m_top) >= TF_CACHELINE_SIZE);
+        assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+        m_slots = static_cast<Slot*>(m_allocator.Allocate(sizeof(Slot) * capacity, TF_DEFAULT_ALIGNMENT_SIZE));
+        if (m_slots == nullptr)
+        {
+            assert(!"tf::JobDeque: out of memory.");
+            TF_PLATFORM_DEBUG_BREAK();
+        }
+        for (uint32_t i = 0; i < capacity; ++i)
+        {
+            new (m_slots + i) Slot();
+        }
+        m_mask = static_cast<int64_t>(capacity) - 1;
+    }
+
+    JobDeque::~JobDeque()
+    {
+        m_allocator.Free(m_slots);
+    }
+
+    bool JobDeque::Push(const Job& job)
+    {
+        const int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        const int64_t top = m_top.load(std::memory_order_acquire);
+        if (bottom - top > m_mask)
+        {
+            return false;
+        }
+        Slot& slot = m_slots[bottom & m_mask];
+        slot.m_function.store(job.m_function, std::memory_order_relaxed);
+        slot.m_data.store(job.m_data, std::memory_order_relaxed);
+        slot.m_counter.store(job.m_counter, std::memory_order_relaxed);
+        m_bottom.store(bottom + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool JobDeque::Pop(Job& job)
+    {
+        // Reserve the bottom slot first, then look at the top: the fence orders the two against Steal(). 
+        const int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = m_top.load(std::memory_order_relaxed);
+        if (top > bottom)
+        {
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+        const Slot& slot = m_slots[bottom & m_mask];
+        job.m_function = slot.m_function.load(std::memory_order_relaxed);
+        job.m_data = slot.m_data.load(std::memory_order_relaxed);
+        job.m_counter = slot.m_counter.load(std::memory_order_relaxed);
+        if (top != bottom)
+        {
+            return true;
+        }
+
+        // The last job, race the thieves for it. 
+        const bool taken = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return taken;
+    }
+
+    bool JobDeque::Steal(Job& job)
+    {
+        int64_t top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = m_bottom.load(std::memory_order_acquire);
+        if (top >= bottom)
+        {
+            return false;
+        }
+        const Slot& slot = m_slots[top & m_mask];
+        job.m_function = slot.m_function.load(std::memory_order_relaxed);
+        job.m_data = slot.m_data.load(std::memory_order_relaxed);
+        job.m_counter = slot.m_counter.load(std::memory_order_relaxed);
+        return m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    // Fiber contexts: Win32 fibers on Windows, a hand written switch on x86-64 System V ELF targets 
+    // (its assembler directives are ELF only), ucontext elsewhere, including x86-64 Mach-O. 
+#if defined(TF_FIBER_UCONTEXT)
+    // Forced by the build, e.g. to test the portable path. 
+#elif defined(TF_PLATFORM_WINDOWS)
+    #define TF_FIBER_WIN32                  (1)
+#elif defined(__x86_64__) && defined(__ELF__) && (defined(TF_COMPILER_GCC) || defined(TF_COMPILER_CLANG))
+    #define TF_FIBER_X64                    (1)
+#else
+    #define TF_FIBER_UCONTEXT               (1)
+#endif
+#if defined(__SANITIZE_THREAD__)
+    #define TF_FIBER_TSAN                   (1)
+#elif defined(__SANITIZE_ADDRESS__)
+    #define TF_FIBER_ASAN                   (1)
+#elif defined(__has_feature)
+    #if __has_feature(thread_sanitizer)
+        #define TF_FIBER_TSAN               (1)
+    #elif __has_feature(address_sanitizer)
+        #define TF_FIBER_ASAN               (1)
+    #endif
+#endif
+
+#if defined(TF_FIBER_TSAN)
+    extern "C" void*    __tsan_get_current_fiber();
+    extern "C" void*    __tsan_create_fiber(unsigned flags);
+    extern "C" void     __tsan_destroy_fiber(void* fiber);
+    extern "C" void     __tsan_switch_to_fiber(void* fiber, unsigned flags);
+#elif defined(TF_FIBER_ASAN)
+    extern "C" void     __sanitizer_start_switch_fiber(void** fakeStackSave, const void* bottom, size_t size);
+    extern "C" void     __sanitizer_finish_switch_fiber(void* fakeStackSave, const void** bottomOld, size_t* sizeOld);
+    extern "C" void     __asan_unpoison_memory_region(void const volatile* address, size_t size);
+#endif
+
+#if defined(TF_FIBER_X64)
+    // Pushes the callee-saved registers and the MXCSR / x87 control words, stores the stack pointer 
+    // to *from and pops the same frame from to. A new fiber's frame returns into tf_start_fiber, 
+    // which calls r13(r12) and never returns. 
+    extern "C" void tf_switch_fiber_context(void** from, void* to);
+    extern "C" void tf_start_fiber();
+
+    __asm__(
+        ".pushsection .text\n"
+        ".globl tf_switch_fiber_context\n"
+        ".hidden tf_switch_fiber_context\n"
+        ".type tf_switch_fiber_context, @function\n"
+        "tf_switch_fiber_context:\n"
+        "    pushq %rbp\n"
+        "    pushq %rbx\n"
+        "    pushq %r12\n"
+        "    pushq %r13\n"
+        "    pushq %r14\n"
+        "    pushq %r15\n"
+        "    subq $8, %rsp\n"
+        "    stmxcsr (%rsp)\n"
+        "    fnstcw 4(%rsp)\n"
+        "    movq %rsp, (%rdi)\n"
+        "    movq %rsi, %rsp\n"
+        "    ldmxcsr (%rsp)\n"
+        "    fldcw 4(%rsp)\n"
+        "    addq $8, %rsp\n"
+        "    popq %r15\n"
+        "    popq %r14\n"
+        "    popq %r13\n"
+        "    popq %r12\n"
+        "    popq %rbx\n"
+        "    popq %rbp\n"
+        "    ret\n"
+        ".size tf_switch_fiber_context, .-tf_switch_fiber_context\n"
+        ".globl tf_start_fiber\n"
+        ".hidden tf_start_fiber\n"
+        ".type tf_start_fiber, @function\n"
+        "tf_start_fiber:\n"
+        "    movq %r12, %rdi\n"
+        "    callq *%r13\n"
+        "    ud2\n"
+        ".size tf_start_fiber, .-tf_start_fiber\n"
+        ".popsection\n");
+#endif
+
+    struct FiberContext
+    {
+#if defined(TF_FIBER_WIN32)
+        void*                           m_handle;
+#elif defined(TF_FIBER_X64)
+        void*                           m_stackPointer;
+#else
+        ucontext_t                      m_context;
+#endif
+        void                            (*m_entry)(void*);
+        void*                           m_argument;
+#if defined(TF_FIBER_TSAN)
+        void*                           m_tsanFiber;
+#elif defined(TF_FIBER_ASAN)
+        const void*                     m_asanStackBottom;
+        size_t                          m_asanStackSize;
+#endif
+    }; // struct FiberContext 
+
+#if defined(TF_FIBER_ASAN)
+    // The context being switched away from, it learns its stack bounds from the side switched to. 
+    static TF_NO_INLINE FiberContext*& GetAsanSwitchSource()
+    {
+        static TF_THREAD_LS FiberContext* s_source;
+        __asm__ __volatile__("");
+        return s_source;
+    }
+
+    static void FinishAsanSwitch(void* fakeStack)
+    {
+        FiberContext* source = GetAsanSwitchSource();
+        __sanitizer_finish_switch_fiber(fakeStack, &source->m_asanStackBottom, &source->m_asanStackSize);
+    }
+#endif
+
+    static void StartFiberContext(void* context)
+    {
+#if defined(TF_FIBER_ASAN)
+        FinishAsanSwitch(nullptr);
+#endif
+        FiberContext* fiberContext = static_cast<FiberContext*>(context);
+        fiberContext->m_entry(fiberContext->m_argument);
+    }
+
+#if defined(TF_FIBER_WIN32)
+    static void WINAPI Win32FiberStart(void* context)
+    {
+        StartFiberContext(context);
+    }
+#elif defined(TF_FIBER_UCONTEXT)
+    // makecontext() only passes int arguments. 
+    static void UcontextFiberStart(int high, int low)
+    {
+        const uint64_t address = (static_cast<uint64_t>(static_cast<uint32_t>(high)) << 32) | static_cast<uint32_t>(low);
+        StartFiberContext(reinterpret_cast<void*>(static_cast<uintptr_t>(address)));
+    }
+#endif
+
+    //! The stack is unused with Win32 fibers, which allocate their own. 
+    static bool CreateFiberContext(FiberContext& context, uint8_t* stack, size_t stackSize, void (*entry)(void*), void* argument)
+    {
+        context.m_entry = entry;
+        context.m_argument = argument;
+#if defined(TF_FIBER_TSAN)
+        context.m_tsanFiber = __tsan_create_fiber(0);
+#elif defined(TF_FIBER_ASAN)
+        // The pages may be a recycled mapping still carrying the poison of older stack frames. 
+        if (stack != nullptr)
+        {
+            __asan_unpoison_memory_region(stack, stackSize);
+        }
+        context.m_asanStackBottom = stack;
+        context.m_asanStackSize = stackSize;
+#endif
+#if defined(TF_FIBER_WIN32)
+        TF_UNUSED(stack);
+        context.m_handle = CreateFiberEx(0, stackSize, FIBER_FLAG_FLOAT_SWITCH, &Win32FiberStart, &context);
+        return context.m_handle != nullptr;
+#elif defined(TF_FIBER_X64)
+        uint64_t* frame = reinterpret_cast<uint64_t*>((reinterpret_cast<uintptr_t>(stack) + stackSize) & ~static_cast<uintptr_t>(15)) - 8;
+        frame[0] = 0x0000037f00001f80ull;                   // default MXCSR, x87 control word
+        frame[1] = 0;                                       // r15
+        frame[2] = 0;                                       // r14
+        frame[3] = reinterpret_cast<uint64_t>(&StartFiberContext);  // r13
+        frame[4] = reinterpret_cast<uint64_t>(&context);            // r12
+        frame[5] = 0;                                       // rbx
+        frame[6] = 0;                                       // rbp
+        frame[7] = reinterpret_cast<uint64_t>(&tf_start_fiber);
+        context.m_stackPointer = frame;
+        return true;
+#else
+        if (getcontext(&context.m_context) != 0)
+        {
+            return false;
+        }
+        const uint64_t address = reinterpret_cast<uintptr_t>(&context);
+        context.m_context.uc_stack.ss_sp = stack;
+        context.m_context.uc_stack.ss_size = stackSize;
+        context.m_context.uc_link = nullptr;
+        makecontext(&context.m_context, reinterpret_cast<void (*)()>(&UcontextFiberStart), 2,
+                    static_cast<int>(address >> 32), static_cast<int>(address & 0xffffffffu));
+        return true;
+#endif
+    }
+
+    static void DestroyFiberContext(FiberContext& context)
+    {
+#if defined(TF_FIBER_TSAN)
+        __tsan_destroy_fiber(context.m_tsanFiber);
+#endif
+#if defined(TF_FIBER_WIN32)
+        DeleteFiber(context.m_handle);
+#endif
+        TF_UNUSED(context);
+    }
+
+    //! Make the calling thread's own stack a context that fibers can switch back to. 
+    //! Returns true when the thread had to be converted to a fiber. 
+    static bool EnterThreadFiberContext(FiberContext& context)
+    {
+#if defined(TF_FIBER_TSAN)
+        context.m_tsanFiber = __tsan_get_current_fiber();
+#endif
+#if defined(TF_FIBER_WIN32)
+        if (IsThreadAFiber())
+        {
+            context.m_handle = GetCurrentFiber();
+            return false;
+        }
+        context.m_handle = ConvertThreadToFiberEx(nullptr, FIBER_FLAG_FLOAT_SWITCH);
+        return true;
+#else
+        TF_UNUSED(context);
+        return false;
+#endif
+    }
+
+    static void LeaveThreadFiberContext(bool converted)
+    {
+#if defined(TF_FIBER_WIN32)
+        if (converted)
+        {
+            ConvertFiberToThread();
+        }
+#endif
+        TF_UNUSED(converted);
+    }
+
+    static void SwitchFiberContext(FiberContext& from, FiberContext& to)
+    {
+#if defined(TF_FIBER_TSAN)
+        __tsan_switch_to_fiber(to.m_tsanFiber, 0);
+#elif defined(TF_FIBER_ASAN)
+        void* fakeStack = nullptr;
+        GetAsanSwitchSource() = &from;
+        __sanitizer_start_switch_fiber(&fakeStack, to.m_asanStackBottom, to.m_asanStackSize);
+#endif
+#if defined(TF_FIBER_WIN32)
+        TF_UNUSED(from);
+        SwitchToFiber(to.m_handle);
+#elif defined(TF_FIBER_X64)
+        tf_switch_fiber_context(&from.m_stackPointer, to.m_stackPointer);
+#else
+        swapcontext(&from.m_context, &to.m_context);
+#endif
+#if defined(TF_FIBER_ASAN)
+        FinishAsanSwitch(fakeStack);
+#endif
+    }
+
+    struct JobSystem::Worker
+    {
+        JobDeque                        m_deque;
+        std::thread                     m_thread;
+
+        explicit Worker(Allocator& allocator)
+            : m_deque   (kDequeCapacity, allocator)
+            , m_thread  ()
+        {
+        }
+    }; // struct JobSystem::Worker 
+
+    struct JobSystem::Fiber
+    {
+        FiberContext                    m_context;
+        JobSystem*                      m_system;
+        uint32_t                        m_index;
+        JobCounter*                     m_waitCounter;
+        int32_t                         m_waitValue;
+    }; // struct JobSystem::Fiber 
+
+    // A thread's own stack, parked while the thread runs fibers. The fibers switch back to it once 
+    // the counter drops, or at shutdown for the worker threads (no counter). 
+    struct JobSystem::ThreadWait
+    {
+        FiberContext                    m_context;
+        JobCounter*                     m_counter;
+        int32_t                         m_value;
+    }; // struct JobSystem::ThreadWait 
+
+    // Per thread scheduler state. A fiber can leave a thread at any wait, so it is reached through 
+    // GetThreadState() again after every switch instead of being kept in a local. 
+    struct JobSystem::ThreadState
+    {
+        JobSystem*                      m_system;
+        uint32_t                        m_workerIndex;
+        uint32_t                        m_stealRandom;
+        Fiber*                          m_fiber;            // fiber running on this thread, null on its own stack.
+        ThreadWait*                     m_threadWait;       // set while the thread runs fibers.
+        Fiber*                          m_releasedFiber;    // just switched away from, returns to the pool.
+        Fiber*                          m_waitingFiber;     // just switched away from, goes to the waiting list.
+    }; // struct JobSystem::ThreadState 
+
+    // State shared by every worker: the queue of jobs run from other threads, the idle sleep and 
+    // the fiber pool. 
+    struct JobSystem::Shared
+    {
+        std::mutex                      m_mutex;
+        std::condition_variable         m_wakeCondition;
+        Vector<Job>                     m_jobs;
+        size_t                          m_jobHead;
+        std::atomic<uint32_t>           m_jobCount;
+
+        Fiber*                          m_fibers;
+        AtomicBitmapAllocator           m_freeFibers;
+        uint8_t*                        m_fiberStacks;
+        size_t                          m_fiberStacksSize;
+        std::mutex                      m_waitingMutex;
+        Vector<Fiber*>                  m_waitingFibers;
+        std::atomic<uint32_t>           m_waitingCount;
+
+        Shared(uint32_t fiberCount, Allocator& allocator)
+            : m_mutex           ()
+            , m_wakeCondition   ()
+            , m_jobs            (allocator)
+            , m_jobHead         (0)
+            , m_jobCount        (0)
+            , m_fibers          (nullptr)
+            , m_freeFibers      (fiberCount, allocator)
+            , m_fiberStacks     (nullptr)
+            , m_fiberStacksSize (0)
+            , m_waitingMutex    ()
+            , m_waitingFibers   (allocator)
+            , m_waitingCount    (0)
+        {
+        }
+    }; // struct JobSystem::Shared 
+
+    static const uint32_t kJobSpinCount = 64;
+
+    TF_NO_INLINE JobSystem::ThreadState& JobSystem::GetThreadState()
+    {
+        static TF_THREAD_LS ThreadState s_state;
+#if !defined(TF_COMPILER_MSVC)
+        // Keeps the compiler from treating the call as const and reusing its result across a fiber switch. 
+        __asm__ __volatile__("");
+#endif
+        return s_state;
+    }
+
+    JobSystem::JobSystem(uint32_t workerCount, Allocator& allocator)
+        : JobSystem(JobSystemDesc(workerCount), allocator)
+    {
+    }
+
+    JobSystem::JobSystem(const JobSystemDesc& desc, Allocator& allocator)
+        : m_allocator           (allocator)
+        , m_workers             (nullptr)
+        , m_shared              (nullptr)
+        , m_workerCount         (0)
+        , m_fiberCount          (0)
+        , m_queuedCount         (0)
+        , m_sleepingCount       (0)
+        , m_quit                (false)
+        , m_previousSystem      (GetThreadState().m_system)
+        , m_previousWorkerIndex (GetThreadState().m_workerIndex)
+    {
+        uint32_t workerCount = (desc.m_workerCount > 0) ? desc.m_workerCount : std::thread::hardware_concurrency();
+        workerCount = (workerCount < 1) ? 1 : (workerCount > kMaxWorkerCount) ? kMaxWorkerCount : workerCount;
+
+        void* shared = m_allocator.Allocate(sizeof(Shared), alignof(Shared));
+        m_workers = static_cast<Worker*>(m_allocator.Allocate(sizeof(Worker) * workerCount, alignof(Worker)));
+        if (shared == nullptr || m_workers == nullptr)
+        {
+            assert(!"tf::JobSystem: out of memory.");
+            TF_PLATFORM_DEBUG_BREAK();
+        }
+        m_shared = new (shared) Shared(desc.m_fiberCount, m_allocator);
+        for (uint32_t i = 0; i < workerCount; ++i)
+        {
+            new (m_workers + i) Worker(m_allocator);
+        }
+        m_workerCount = workerCount;
+        if (desc.m_fiberCount > 0)
+        {
+            CreateFibers(desc.m_fiberCount, desc.m_fiberStackSize);
+        }
+
+        ThreadState& state = GetThreadState();
+        state.m_system = this;
+        state.m_workerIndex = 0;
+        for (uint32_t i = 1; i < workerCount; ++i)
+        {
+            m_workers[i].m_thread = std::thread([this, i]() { WorkerMain(i); });
+        }
+    }
+
+    JobSystem::~JobSystem()
+    {
+        assert(GetCurrentWorkerIndex() == 0); // destroyed by its creator thread.
+        assert(m_queuedCount.load() == 0); // jobs left behind would never run.
+        {
+            std::lock_guard<std::mutex> lock(m_shared->m_mutex);
+            m_quit.store(true, std::memory_order_release);
+            m_shared->m_wakeCondition.notify_all();
+        }
+        for (uint32_t i = 0; i < m_workerCount; ++i)
+        {
+            if (m_workers[i].m_thread.joinable())
+            {
+                m_workers[i].m_thread.join();
+            }
+            m_workers[i].~Worker();
+        }
+        m_allocator.Free(m_workers);
+        DestroyFibers();
+        m_shared->~Shared();
+        m_allocator.Free(m_shared);
+
+        ThreadState& state = GetThreadState();
+        state.m_system = m_previousSystem;
+        state.m_workerIndex = m_previousWorkerIndex;
+    }
+
+    void JobSystem::CreateFibers(uint32_t fiberCount, size_t stackSize)
+    {
+        const size_t pageSize = VirtualArena::GetPageSize();
+        stackSize = TF_ALIGNMENT(stackSize, pageSize);
+        m_shared->m_fibers = static_cast<Fiber*>(m_allocator.Allocate(sizeof(Fiber) * fiberCount, alignof(Fiber)));
+#if !defined(TF_FIBER_WIN32)
+        // Every stack sits above a page that is never committed, so an overflow faults right away 
+        // instead of running into the next stack. 
+        m_shared->m_fiberStacksSize = (pageSize + stackSize) * fiberCount;
+        m_shared->m_fiberStacks = static_cast<uint8_t*>(ReserveVirtualMemory(m_shared->m_fiberStacksSize));
+        if (m_shared->m_fiberStacks == nullptr)
+        {
+            m_shared->m_fiberStacksSize = 0;
+        }
+#endif
+        if (m_shared->m_fibers == nullptr || (m_shared->m_fiberStacks == nullptr && m_shared->m_fiberStacksSize > 0))
+        {
+            assert(!"tf::JobSystem: out of memory.");
+            TF_PLATFORM_DEBUG_BREAK();
+        }
+        for (uint32_t i = 0; i < fiberCount; ++i)
+        {
+            Fiber& fiber = *new (m_shared->m_fibers + i) Fiber();
+            fiber.m_system = this;
+            fiber.m_index = i;
+            uint8_t* stack = nullptr;
+#if !defined(TF_FIBER_WIN32)
+            stack = m_shared->m_fiberStacks + (pageSize + stackSize) * i + pageSize;
+            if (!CommitVirtualMemory(stack, stackSize))
+            {
+                assert(!"tf::JobSystem: out of memory.");
+                TF_PLATFORM_DEBUG_BREAK();
+            }
+#endif
+            if (!CreateFiberContext(fiber.m_context, stack, stackSize, &JobSystem::FiberEntry, &fiber))
+            {
+                assert(!"tf::JobSystem: fiber creation failed.");
+                TF_PLATFORM_DEBUG_BREAK();
+            }
+        }
+        m_fiberCount = fiberCount;
+    }
+
+    void JobSystem::DestroyFibers()
+    {
+        assert(m_shared->m_freeFibers.GetUsedCount() == 0 && m_shared->m_waitingFibers.empty());
+        for (uint32_t i = 0; i < m_fiberCount; ++i)
+        {
+            DestroyFiberContext(m_shared->m_fibers[i].m_context);
+        }
+        if (m_shared->m_fiberStacks != nullptr)
+        {
+            ReleaseVirtualMemory(m_shared->m_fiberStacks, m_shared->m_fiberStacksSize);
+        }
+        if (m_shared->m_fibers != nullptr)
+        {
+            m_allocator.Free(m_shared->m_fibers);
+        }
+        m_fiberCount = 0;
+    }
+
+    uint32_t JobSystem::GetCurrentWorkerIndex() const
+    {
+        const ThreadState& state = GetThreadState();
+        return (state.m_system == this) ? state.m_workerIndex : kInvalidWorkerIndex;
+    }
+
+    uint32_t JobSystem::GetWaitingFiberCount() const
+    {
+        return m_shared->m_waitingCount.load(std::memory_order_relaxed);
+    }
+
+    void JobSystem::Run(const JobDecl* jobs, uint32_t count, JobCounter* counter)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        if (counter != nullptr)
+        {
+            counter->m_value.fetch_add(static_cast<int32_t>(count), std::memory_order_relaxed);
+        }
+        m_queuedCount.fetch_add(static_cast<int32_t>(count), std::memory_order_seq_cst);
+
+        for (uint32_t i = 0; i < count; )
+        {
+            // Looked up again after a job ran inline, which may have moved this fiber to another thread. 
+            const uint32_t workerIndex = GetCurrentWorkerIndex();
+            if (workerIndex == kInvalidWorkerIndex)
+            {
+                std::lock_guard<std::mutex> lock(m_shared->m_mutex);
+                for (; i < count; ++i)
+                {
+                    const Job job = { jobs[i].m_function, jobs[i].m_data, counter };
+                    m_shared->m_jobs.push_back(job);
+                    m_shared->m_jobCount.fetch_add(1, std::memory_order_release);
+                }
+                break;
+            }
+            JobDeque& deque = m_workers[workerIndex].m_deque;
+            for (; i < count; ++i)
+            {
+                const Job job = { jobs[i].m_function, jobs[i].m_data, counter };
+                if (!deque.Push(job))
+                {
+                    // Full, run it here rather than wait for a thief. 
+                    m_queuedCount.fetch_sub(1, std::memory_order_relaxed);
+                    Execute(job);
+                    ++i;
+                    break;
+                }
+            }
+        }
+        WakeWorkers(count);
+    }
+
+    void JobSystem::WaitForCounter(JobCounter& counter, int32_t value)
+    {
+        if (counter.m_value.load(std::memory_order_acquire) <= value)
+        {
+            return;
+        }
+        if (m_fiberCount > 0)
+        {
+            Fiber* fiber = GetThreadState().m_fiber;
+            if (fiber == nullptr)
+            {
+                // On the thread's own stack: park it and run fibers until the counter drops. 
+                ThreadWait wait;
+                wait.m_counter = &counter;
+                wait.m_value = value;
+                if (RunFibers(wait))
+                {
+                    return;
+                }
+            }
+            else if (Fiber* next = AcquireFiber())
+            {
+                fiber->m_waitCounter = &counter;
+                fiber->m_waitValue = value;
+                GetThreadState().m_waitingFiber = fiber;
+                SwitchTo(next);
+                // Resumed by a worker that saw the counter drop, possibly on another thread. 
+                return;
+            }
+            // Every fiber is in use, help on this stack instead. 
+        }
+
+        Job job;
+        while (counter.m_value.load(std::memory_order_acquire) > value)
+        {
+            Fiber* fiber = (m_fiberCount > 0) ? GetThreadState().m_fiber : nullptr;
+            Fiber* ready = (fiber != nullptr) ? TakeReadyFiber() : nullptr;
+            if (ready != nullptr)
+            {
+                // A parked fiber can go on now: hand it this thread and park here instead. 
+                fiber->m_waitCounter = &counter;
+                fiber->m_waitValue = value;
+                GetThreadState().m_waitingFiber = fiber;
+                SwitchTo(ready);
+                return;
+            }
+            if (TryGetJob(GetCurrentWorkerIndex(), job))
+            {
+                Execute(job);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool JobSystem::TryGetJob(uint32_t workerIndex, Job& job)
+    {
+        bool found = (workerIndex != kInvalidWorkerIndex) && m_workers[workerIndex].m_deque.Pop(job);
+        if (!found && m_shared->m_jobCount.load(std::memory_order_acquire) > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_shared->m_mutex);
+            if (m_shared->m_jobHead < m_shared->m_jobs.size())
+            {
+                job = m_shared->m_jobs[m_shared->m_jobHead++];
+                if (m_shared->m_jobHead == m_shared->m_jobs.size())
+                {
+                    m_shared->m_jobs.clear();
+                    m_shared->m_jobHead = 0;
+                }
+                m_shared->m_jobCount.fetch_sub(1, std::memory_order_relaxed);
+                found = true;
+            }
+        }
+        if (!found && m_workerCount > 1)
+        {
+            // xorshift32, only used to spread the thieves over the victims. 
+            ThreadState& state = GetThreadState();
+            uint32_t random = (state.m_stealRandom != 0) ? state.m_stealRandom : (workerIndex * 2654435761u) | 1;
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            state.m_stealRandom = random;
+            for (uint32_t i = 0; i < m_workerCount && !found; ++i)
+            {
+                const uint32_t victim = (random + i) % m_workerCount;
+                found = (victim != workerIndex) && m_workers[victim].m_deque.Steal(job);
+            }
+        }
+        if (found)
+        {
+            m_queuedCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return found;
+    }
+
+    void JobSystem::Execute(const Job& job)
+    {
+        job.m_function(job.m_data);
+        if (job.m_counter != nullptr)
+        {
+            // seq_cst pairs with the sleeping count increment in WaitForWork(), as in WakeWorkers(). 
+            job.m_counter->m_value.fetch_sub(1, std::memory_order_seq_cst);
+            if (m_shared->m_waitingCount.load(std::memory_order_seq_cst) > 0)
+            {
+                // A fiber parked on the counter may be ready now while every worker sleeps, e.g. when 
+                // the last job ran on a thread waiting on its own stack, which cannot resume fibers. 
+                WakeWorkers(1);
+            }
+        }
+    }
+
+    void JobSystem::WakeWorkers(uint32_t count)
+    {
+        // Pairs with the sleeping count increment in WaitForWork(): either the worker sees the queued 
+        // jobs before it waits, or this sees the sleeper and the mutex orders the notify after its wait. 
+        if (m_sleepingCount.load(std::memory_order_seq_cst) > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_shared->m_mutex);
+            if (count > 1)
+            {
+                m_shared->m_wakeCondition.notify_all();
+            }
+            else
+            {
+                m_shared->m_wakeCondition.notify_one();
+            }
+        }
+    }
+
+    void JobSystem::WaitForWork()
+    {
+        std::unique_lock<std::mutex> lock(m_shared->m_mutex);
+        m_sleepingCount.fetch_add(1, std::memory_order_seq_cst);
+        m_shared->m_wakeCondition.wait(lock, [this]()
+        {
+            return m_queuedCount.load(std::memory_order_seq_cst) > 0 || m_quit.load(std::memory_order_acquire) || HasReadyFiber();
+        });
+        m_sleepingCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void JobSystem::WorkerMain(uint32_t workerIndex)
+    {
+        ThreadState& state = GetThreadState();
+        state.m_system = this;
+        state.m_workerIndex = workerIndex;
+        if (m_fiberCount > 0)
+        {
+            ThreadWait wait;
+            wait.m_counter = nullptr;
+            wait.m_value = 0;
+            if (RunFibers(wait))
+            {
+                return;
+            }
+        }
+
+        Job job;
+        uint32_t idleCount = 0;
+        while (!m_quit.load(std::memory_order_acquire))
+        {
+            if (TryGetJob(workerIndex, job))
+            {
+                Execute(job);
+                idleCount = 0;
+            }
+            else if (++idleCount < kJobSpinCount)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                WaitForWork();
+                idleCount = 0;
+            }
+        }
+    }
+
+    JobSystem::Fiber* JobSystem::AcquireFiber()
+    {
+        const uint32_t index = m_shared->m_freeFibers.Allocate();
+        return (index != AtomicBitmapAllocator::kInvalidIndex) ? &m_shared->m_fibers[index] : nullptr;
+    }
+
+    JobSystem::Fiber* JobSystem::TakeReadyFiber()
+    {
+        if (m_shared->m_waitingCount.load(std::memory_order_acquire) == 0)
+        {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(m_shared->m_waitingMutex);
+        Vector<Fiber*>& waiting = m_shared->m_waitingFibers;
+        for (size_t i = 0; i < waiting.size(); ++i)
+        {
+            Fiber* fiber = waiting[i];
+            if (fiber->m_waitCounter->m_value.load(std::memory_order_acquire) <= fiber->m_waitValue)
+            {
+                waiting.erase_unordered(waiting.begin() + i);
+                m_shared->m_waitingCount.fetch_sub(1, std::memory_order_relaxed);
+                return fiber;
+            }
+        }
+        return nullptr;
+    }
+
+    bool JobSystem::HasReadyFiber() const
+    {
+        if (m_shared->m_waitingCount.load(std::memory_order_seq_cst) == 0)
+        {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_shared->m_waitingMutex);
+        for (const Fiber* fiber : m_shared->m_waitingFibers)
+        {
+            if (fiber->m_waitCounter->m_value.load(std::memory_order_seq_cst) <= fiber->m_waitValue)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool JobSystem::RunFibers(ThreadWait& wait)
+    {
+        Fiber* fiber = AcquireFiber();
+        if (fiber == nullptr)
+        {
+            return false;
+        }
+        ThreadState& state = GetThreadState();
+        assert(state.m_threadWait == nullptr && state.m_fiber == nullptr);
+        const bool converted = EnterThreadFiberContext(wait.m_context);
+        state.m_threadWait = &wait;
+        SwitchTo(fiber);
+
+        // Back on this thread's own stack, see FiberMain(). 
+        GetThreadState().m_threadWait = nullptr;
+        LeaveThreadFiberContext(converted);
+        return true;
+    }
+
+    void JobSystem::SwitchTo(Fiber* fiber)
+    {
+        // From what this thread runs now to fiber, or back to the thread's own stack when null. 
+        ThreadState& state = GetThreadState();
+        FiberContext& from = (state.m_fiber != nullptr) ? state.m_fiber->m_context : state.m_threadWait->m_context;
+        FiberContext& to = (fiber != nullptr) ? fiber->m_context : state.m_threadWait->m_context;
+        state.m_fiber = fiber;
+        SwitchFiberContext(from, to);
+        FinishSwitch();
+    }
+
+    void JobSystem::FinishSwitch()
+    {
+        // The fiber switched away from is only handed over now that its context has been saved, 
+        // otherwise another thread could resume it half way through the switch. 
+        ThreadState& state = GetThreadState();
+        if (state.m_releasedFiber != nullptr)
+        {
+            m_shared->m_freeFibers.Free(state.m_releasedFiber->m_index);
+            state.m_releasedFiber = nullptr;
+        }
+        if (state.m_waitingFiber != nullptr)
+        {
+            std::lock_guard<std::mutex> lock(m_shared->m_waitingMutex);
+            m_shared->m_waitingFibers.push_back(state.m_waitingFiber);
+            m_shared->m_waitingCount.fetch_add(1, std::memory_order_release);
+            state.m_waitingFiber = nullptr;
+        }
+    }
+
+    void JobSystem::FiberEntry(void* fiber)
+    {
+        static_cast<Fiber*>(fiber)->m_system->FiberMain();
+    }
+
+    void JobSystem::FiberMain()
+    {
+        FinishSwitch();
+        Job job;
+        uint32_t idleCount = 0;
+        for (;;)
+        {
+            const ThreadWait& wait = *GetThreadState().m_threadWait;
+            const bool done = (wait.m_counter != nullptr) ? (wait.m_counter->m_value.load(std::memory_order_acquire) <= wait.m_value)
+                                                          : m_quit.load(std::memory_order_acquire);
+            Fiber* ready = done ? nullptr : TakeReadyFiber();
+            if (done || ready != nullptr)
+            {
+                // This fiber goes back to the pool, it continues from here when it is picked again. 
+                GetThreadState().m_releasedFiber = GetThreadState().m_fiber;
+                SwitchTo(ready);
+                idleCount = 0;
+            }
+            else if (TryGetJob(GetCurrentWorkerIndex(), job))
+            {
+                Execute(job);
+                idleCount = 0;
+            }
+            else if (++idleCount < kJobSpinCount || wait.m_counter != nullptr)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                WaitForWork();
+                idleCount = 0;
+            }
+        }
+    }
+
+    // Task graph. 
+    struct TaskGraph::RunState
+    {
+        std::mutex                      m_mutex;
+        Vector<TaskId>                  m_ready;            // max heap on the priority.
+        Vector<uint32_t>                m_pending;          // unfinished dependencies per task.
+        uint32_t                        m_activeRunners;
+        uint32_t                        m_maxRunners;
+        JobSystem*                      m_jobSystem;
+        JobCounter                      m_runners;
+
+        explicit RunState(Allocator& allocator)
+            : m_mutex           ()
+            , m_ready           (allocator)
+            , m_pending         (allocator)
+            , m_activeRunners   (0)
+            , m_maxRunners      (0)
+            , m_jobSystem       (nullptr)
+            , m_runners         ()
+        {
+        }
+    }; // struct TaskGraph::RunState 
+
+    TaskGraph::TaskGraph(Allocator& allocator)
+        : m_allocator       (allocator)
+        , m_tasks           (allocator)
+        , m_accesses        (allocator)
+        , m_dependencies    (allocator)
+        , m_nodes           (allocator)
+        , m_successors      (allocator)
+        , m_roots           (allocator)
+        , m_order           (allocator)
+        , m_topologyHash    (0)
+        , m_criticalPathCost(0)
+        , m_compileCount    (0)
+        , m_compiled        (false)
+        , m_runState        (nullptr)
+    {
+        void* runState = m_allocator.Allocate(sizeof(RunState), alignof(RunState));
+        if (runState == nullptr)
+        {
+            assert(!"tf::TaskGraph: out of memory.");
+            TF_PLATFORM_DEBUG_BREAK();
+        }
+        m_runState = new (runState) RunState(m_allocator);
+    }
+
+    TaskGraph::~TaskGraph()
+    {
+        m_runState->~RunState();
+        m_allocator.Free(m_runState);
+    }
+
+    void TaskGraph::Clear()
+    {
+        m_tasks.clear();
+        m_accesses.clear();
+        m_dependencies.clear();
+        m_compiled = false;
+    }
+
+    TaskId TaskGraph::AddTask(const char* name, JobFunction function, void* data, uint32_t cost)
+    {
+        assert(function != nullptr);
+        const Task task = { name, function, data, cost };
+        m_tasks.push_back(task);
+        m_compiled = false;
+        return static_cast<TaskId>(m_tasks.size() - 1);
+    }
+
+    void TaskGraph::Read(TaskId task, TaskResource resource)
+    {
+        assert(task < m_tasks.size());
+        const Access access = { task, resource, 0 };
+        m_accesses.push_back(access);
+        m_compiled = false;
+    }
+
+    void TaskGraph::Write(TaskId task, TaskResource resource)
+    {
+        assert(task < m_tasks.size());
+        const Access access = { task, resource, 1 };
+        m_accesses.push_back(access);
+        m_compiled = false;
+    }
+
+    void TaskGraph::DependOn(TaskId task, TaskId dependency)
+    {
+        assert(task < m_tasks.size() && dependency < m_tasks.size());
+        const Edge edge = { dependency, task };
+        m_dependencies.push_back(edge);
+        m_compiled = false;
+    }
+
+    uint64_t TaskGraph::HashTopology() const
+    {
+        // Functions, data and names may change from frame to frame, only the costs and the edges matter. 
+        uint64_t hash = m_tasks.size();
+        for (const Task& task : m_tasks)
+        {
+            hash = (hash ^ task.m_cost) * 0x100000001b3ull;
+        }
+        hash = (hash ^ HashBytes(m_accesses.data(), m_accesses.size() * sizeof(Access))) * 0x100000001b3ull;
+        hash = (hash ^ m_accesses.size()) * 0x100000001b3ull;
+        hash = (hash ^ HashBytes(m_dependencies.data(), m_dependencies.size() * sizeof(Edge))) * 0x100000001b3ull;
+        return (hash ^ m_dependencies.size()) * 0x100000001b3ull;
+    }
+
+    bool TaskGraph::Compile()
+    {
+        if (m_compiled)
+        {
+            return true;
+        }
+        const uint64_t hash = HashTopology();
+        if (hash == m_topologyHash && m_nodes.size() == m_tasks.size() && m_compileCount > 0)
+        {
+            m_compiled = true;
+            return true;
+        }
+        m_topologyHash = hash;
+        ++m_compileCount;
+        m_compiled = Build();
+        if (!m_compiled)
+        {
+            m_nodes.clear();
+        }
+        return m_compiled;
+    }
+
+    bool TaskGraph::Build()
+    {
+        const uint32_t taskCount = static_cast<uint32_t>(m_tasks.size());
+        Vector<Edge> edges(m_allocator);
+        edges.reserve(m_dependencies.size() + m_accesses.size());
+        for (const Edge& edge : m_dependencies)
+        {
+            edges.push_back(edge);
+        }
+
+        // Hazards per resource, in declaration order; a task reading and writing a resource reads first. 
+        Vector<Access> accesses(m_allocator);
+        accesses.resize_uninitialized(m_accesses.size());
+        std::copy(m_accesses.begin(), m_accesses.end(), accesses.begin());
+        std::sort(accesses.begin(), accesses.end(), [](const Access& a, const Access& b)
+        {
+            if (a.m_resource != b.m_resource)
+            {
+                return a.m_resource < b.m_resource;
+            }
+            return (a.m_task != b.m_task) ? (a.m_task < b.m_task) : (a.m_write < b.m_write);
+        });
+        Vector<TaskId> readers(m_allocator);
+        TaskId writer = kInvalidTaskId;
+        for (size_t i = 0; i < accesses.size(); ++i)
+        {
+            const Access& access = accesses[i];
+            if (i == 0 || access.m_resource != accesses[i - 1].m_resource)
+            {
+                readers.clear();
+                writer = kInvalidTaskId;
+            }
+            if (access.m_write == 0)
+            {
+                // Read after write. 
+                if (writer != kInvalidTaskId && writer != access.m_task)
+                {
+                    const Edge edge = { writer, access.m_task };
+                    edges.push_back(edge);
+                }
+                readers.push_back(access.m_task);
+                continue;
+            }
+            if (!readers.empty())
+            {
+                // Write after read, the readers already come after the previous writer. 
+                for (TaskId reader : readers)
+                {
+                    if (reader != access.m_task)
+                    {
+                        const Edge edge = { reader, access.m_task };
+                        edges.push_back(edge);
+                    }
+                }
+                readers.clear();
+            }
+            else if (writer != kInvalidTaskId && writer != access.m_task)
+            {
+                // Write after write. 
+                const Edge edge = { writer, access.m_task };
+                edges.push_back(edge);
+            }
+            writer = access.m_task;
+        }
+
+        std::sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b)
+        {
+            return (a.m_from != b.m_from) ? (a.m_from < b.m_from) : (a.m_to < b.m_to);
+        });
+        Edge* edgesEnd = std::unique(edges.begin(), edges.end(), [](const Edge& a, const Edge& b)
+        {
+            return a.m_from == b.m_from && a.m_to == b.m_to;
+        });
+        edges.resize(static_cast<size_t>(edgesEnd - edges.begin()));
+
+        // Successor lists, in compressed rows. 
+        const Node emptyNode = { 0, 0, 0, 0 };
+        m_nodes.clear();
+        m_nodes.resize(taskCount, emptyNode);
+        m_successors.clear();
+        m_successors.reserve(edges.size());
+        for (const Edge& edge : edges)
+        {
+            if (edge.m_from == edge.m_to)
+            {
+                assert(!"tf::TaskGraph: a task depends on itself.");
+                return false;
+            }
+            Node& node = m_nodes[edge.m_from];
+            if (node.m_successorCount == 0)
+            {
+                node.m_successorBegin = static_cast<uint32_t>(m_successors.size());
+            }
+            ++node.m_successorCount;
+            ++m_nodes[edge.m_to].m_dependencyCount;
+            m_successors.push_back(edge.m_to);
+        }
+
+        // Topological order (Kahn), which also finds cycles. 
+        Vector<uint32_t> pending(m_allocator);
+        Vector<TaskId> topological(m_allocator);
+        pending.resize(taskCount);
+        topological.reserve(taskCount);
+        for (TaskId task = 0; task < taskCount; ++task)
+        {
+            pending[task] = m_nodes[task].m_dependencyCount;
+            if (pending[task] == 0)
+            {
+                topological.push_back(task);
+            }
+        }
+        for (size_t i = 0; i < topological.size(); ++i)
+        {
+            const Node& node = m_nodes[topological[i]];
+            for (uint32_t s = 0; s < node.m_successorCount; ++s)
+            {
+                const TaskId successor = m_successors[node.m_successorBegin + s];
+                if (--pending[successor] == 0)
+                {
+                    topological.push_back(successor);
+                }
+            }
+        }
+        if (topological.size() != taskCount)
+        {
+            assert(!"tf::TaskGraph: dependency cycle.");
+            return false;
+        }
+
+        // Longest path to the end of the graph, successors first. 
+        m_criticalPathCost = 0;
+        for (size_t i = taskCount; i-- > 0; )
+        {
+            Node& node = m_nodes[topological[i]];
+            uint64_t longest = 0;
+            for (uint32_t s = 0; s < node.m_successorCount; ++s)
+            {
+                const uint64_t priority = m_nodes[m_successors[node.m_successorBegin + s]].m_priority;
+                longest = (priority > longest) ? priority : longest;
+            }
+            node.m_priority = m_tasks[topological[i]].m_cost + longest;
+            m_criticalPathCost = (node.m_priority > m_criticalPathCost) ? node.m_priority : m_criticalPathCost;
+        }
+
+        // Serial order: always the ready task with the longest remaining path. 
+        const auto less = [this](TaskId a, TaskId b) { return IsLowerPriority(a, b); };
+        m_roots.clear();
+        for (TaskId task = 0; task < taskCount; ++task)
+        {
+            pending[task] = m_nodes[task].m_dependencyCount;
+            if (pending[task] == 0)
+            {
+                m_roots.push_back(task);
+            }
+        }
+        Vector<TaskId> ready(m_allocator);
+        ready.resize_uninitialized(m_roots.size());
+        std::copy(m_roots.begin(), m_roots.end(), ready.begin());
+        std::make_heap(ready.begin(), ready.end(), less);
+        m_order.clear();
+        m_order.reserve(taskCount);
+        while (!ready.empty())
+        {
+            std::pop_heap(ready.begin(), ready.end(), less);
+            const TaskId task = ready.back();
+            ready.pop_back();
+            m_order.push_back(task);
+            const Node& node = m_nodes[task];
+            for (uint32_t s = 0; s < node.m_successorCount; ++s)
+            {
+                const TaskId successor = m_successors[node.m_successorBegin + s];
+                if (--pending[successor] == 0)
+                {
+                    ready.push_back(successor);
+                    std::push_heap(ready.begin(), ready.end(), less);
+                }
+            }
+        }
+        return true;
+    }
+
+    void TaskGraph::RunSerial()
+    {
+        if (!Compile())
+        {
+            return;
+        }
+        for (TaskId task : m_order)
+        {
+            m_tasks[task].m_function(m_tasks[task].m_data);
+        }
+    }
+
+    void TaskGraph::Run(JobSystem& jobSystem)
+    {
+        if (!Compile() || m_tasks.empty())
+        {
+            return;
+        }
+        RunState& state = *m_runState;
+        state.m_jobSystem = &jobSystem;
+        state.m_maxRunners = (jobSystem.GetWorkerCount() > 1) ? jobSystem.GetWorkerCount() : 1;
+        state.m_pending.resize(m_nodes.size());
+        for (size_t i = 0; i < m_nodes.size(); ++i)
+        {
+            state.m_pending[i] = m_nodes[i].m_dependencyCount;
+        }
+        state.m_ready.clear();
+        for (TaskId root : m_roots)
+        {
+            state.m_ready.push_back(root);
+        }
+        std::make_heap(state.m_ready.begin(), state.m_ready.end(), [this](TaskId a, TaskId b) { return IsLowerPriority(a, b); });
+
+        // One runner per ready task, more are started as tasks become ready. 
+        const uint32_t readyCount = static_cast<uint32_t>(state.m_ready.size());
+        const uint32_t runnerCount = (readyCount < state.m_maxRunners) ? readyCount : state.m_maxRunners;
+        state.m_activeRunners = runnerCount;
+        JobDecl runners[JobSystem::kMaxWorkerCount];
+        for (uint32_t i = 0; i < runnerCount; ++i)
+        {
+            runners[i].m_function = &TaskGraph::RunnerMain;
+            runners[i].m_data = this;
+        }
+        jobSystem.Run(runners, runnerCount, &state.m_runners);
+        jobSystem.WaitForCounter(state.m_runners);
+    }
+
+    // Runs ready tasks, highest priority first, until none is left. A runner that makes tasks ready 
+    // keeps going, so the queue never holds tasks without a runner to take them. 
+    void TaskGraph::RunnerMain(void* data)
+    {
+        TaskGraph& graph = *static_cast<TaskGraph*>(data);
+        RunState& state = *graph.m_runState;
+        const auto less = [&graph](TaskId a, TaskId b) { return graph.IsLowerPriority(a, b); };
+        TaskId task = kInvalidTaskId;
+        for (;;)
+        {
+            uint32_t spawnCount = 0;
+            {
+                std::lock_guard<std::mutex> lock(state.m_mutex);
+                if (task != kInvalidTaskId)
+                {
+                    const Node& node = graph.m_nodes[task];
+                    for (uint32_t s = 0; s < node.m_successorCount; ++s)
+                    {
+                        const TaskId successor = graph.m_successors[node.m_successorBegin + s];
+                        if (--state.m_pending[successor] == 0)
+                        {
+                            state.m_ready.push_back(successor);
+                            std::push_heap(state.m_ready.begin(), state.m_ready.end(), less);
+                        }
+                    }
+                }
+                if (state.m_ready.empty())
+                {
+                    --state.m_activeRunners;
+                    return;
+                }
+                std::pop_heap(state.m_ready.begin(), state.m_ready.end(), less);
+                task = state.m_ready.back();
+                state.m_ready.pop_back();
+
+                const uint32_t idleRunners = state.m_maxRunners - state.m_activeRunners;
+                const uint32_t readyCount = static_cast<uint32_t>(state.m_ready.size());
+                spawnCount = (readyCount < idleRunners) ? readyCount : idleRunners;
+                state.m_activeRunners += spawnCount;
+            }
+            if (spawnCount > 0)
+            {
+                JobDecl runners[JobSystem::kMaxWorkerCount];
+                for (uint32_t i = 0; i < spawnCount; ++i)
+                {
+                    runners[i].m_function = &TaskGraph::RunnerMain;
+                    runners[i].m_data = &graph;
+                }
+                state.m_jobSystem->Run(runners, spawnCount, &state.m_runners);
+            }
+            graph.m_tasks[task].m_function(graph.m_tasks[task].m_data);
+        }
+    }
+
+    // Parallel algorithms. 
+    struct ParallelRangeContext;
+
+    struct ParallelRange
+    {
+        ParallelRangeContext*           m_context;
+        size_t                          m_begin;
+        size_t                          m_end;
+    }; // struct ParallelRange 
+
+    struct ParallelRangeContext
+    {
+        JobSystem*                      m_system;
+        ParallelRangeFunction           m_function;
+        void*                           m_data;
+        size_t                          m_grainSize;
+        JobCounter                      m_counter;
+        Vector<ParallelRange, 64>       m_ranges;           // storage of the split off halves, never grows.
+        std::atomic<uint32_t>           m_rangeCount;
+    }; // struct ParallelRangeContext 
+
+    // At most this many halves per worker are split off, a piece split further runs serially. 
+    static const uint32_t kParallelRangesPerWorker = 16;
+
+    static void RunParallelRange(void* data)
+    {
+        const ParallelRange& range = *static_cast<const ParallelRange*>(data);
+        ParallelRangeContext& context = *range.m_context;
+        const uint32_t workerCount = context.m_system->GetWorkerCount();
+        const uint32_t capacity = static_cast<uint32_t>(context.m_ranges.size());
+        size_t begin = range.m_begin;
+        size_t end = range.m_end;
+        while (begin < end)
+        {
+            if (end - begin >= 2 * context.m_grainSize &&
+                context.m_system->GetQueuedJobCount() < workerCount &&
+                context.m_rangeCount.load(std::memory_order_relaxed) < capacity)
+            {
+                const uint32_t index = context.m_rangeCount.fetch_add(1, std::memory_order_relaxed);
+                if (index < capacity)
+                {
+                    const size_t middle = begin + (end - begin) / 2;
+                    ParallelRange& half = context.m_ranges[index];
+                    half.m_context = &context;
+                    half.m_begin = middle;
+                    half.m_end = end;
+                    end = middle;
+                    context.m_system->Run(&RunParallelRange, &half, &context.m_counter);
+                    continue;
+                }
+            }
+            const size_t pieceEnd = (end - begin > context.m_grainSize) ? (begin + context.m_grainSize) : end;
+            context.m_function(context.m_data, begin, pieceEnd);
+            begin = pieceEnd;
+        }
+    }
+
+    void ParallelForRange(JobSystem& system, size_t begin, size_t end, ParallelRangeFunction function, void* data, const ParallelDesc& desc)
+    {
+        if (begin >= end)
+        {
+            return;
+        }
+        const size_t count = end - begin;
+        if (IsParallelSerial(system, count, desc))
+        {
+            function(data, begin, end);
+            return;
+        }
+        ParallelRangeContext context;
+        context.m_system = &system;
+        context.m_function = function;
+        context.m_data = data;
+        context.m_grainSize = GetParallelGrainSize(system, count, desc);
+        const size_t pieceCount = (count + context.m_grainSize - 1) / context.m_grainSize;
+        const size_t maxRangeCount = static_cast<size_t>(system.GetWorkerCount()) * kParallelRangesPerWorker;
+        context.m_ranges.resize((pieceCount < maxRangeCount) ? pieceCount : maxRangeCount);
+        context.m_rangeCount.store(0, std::memory_order_relaxed);
+
+        // The calling thread works on the whole range and splits it like any worker. 
+        ParallelRange range = { &context, begin, end };
+        RunParallelRange(&range);
+        system.WaitForCounter(context.m_counter);
+    }
+
+    // Memory tags. 
+    static const char*              s_memoryTagNames[kMaxMemoryTagCount] = { "default" };
+    static std::atomic<uint32_t>    s_memoryTagCount(1);
+    static TF_THREAD_LS MemoryTag   s_currentMemoryTag;
+
+    MemoryTag RegisterMemoryTag(const char* name)
+    {
+        uint32_t count = s_memoryTagCount.load();
+        do
+        {
+            assert(count < kMaxMemoryTagCount); // too many memory tags.
+            if (count >= kMaxMemoryTagCount)
+            {
+                return kMemoryTagDefault;
+            }
+        } while (!s_memoryTagCount.compare_exchange_weak(count, count + 1));
+
+        s_memoryTagNames[count] = name;
+        return static_cast<MemoryTag>(count);
+    }
+
+    const char* GetMemoryTagName(MemoryTag tag)
+    {
+        return (tag < kMaxMemoryTagCount && s_memoryTagNames[tag] != nullptr) ? s_memoryTagNames[tag] : "";
+    }
+
+    MemoryTag SetCurrentMemoryTag(MemoryTag tag)
+    {
+        const MemoryTag previous = s_currentMemoryTag;
+        s_currentMemoryTag = tag;
+        return previous;
+    }
+
+    MemoryTag GetCurrentMemoryTag()
+    {
+        return s_currentMemoryTag;
+    }
+
+#if TF_MEMORY_TRACKING
+    // Header placed right before every block handed out by TrackingAllocator. 
+    struct TrackingBlockHeader
+    {
+        uint64_t                        m_size;
+        uint32_t                        m_tag;
+        uint32_t                        m_offset;
+    }; // struct TrackingBlockHeader 
+
+    static const size_t kTrackingHeaderSize = TF_ALIGNMENT(sizeof(TrackingBlockHeader), TF_DEFAULT_ALIGNMENT_SIZE);
+
+    // Counters of one thread, written by that thread only. 
+    struct TrackingAllocator::ThreadCounters
+    {
+        enum
+        {
+            kAllocationCount,
+            kAllocatedBytes,
+            kFreeCount,
+            kFreedBytes,
+            kCounterCount,
+        };
+
+        std::atomic<uint64_t>           m_tags[kMaxMemoryTagCount][kCounterCount];
+        std::atomic<uint64_t>           m_histogram[kHistogramBucketCount];
+        std::thread::id                 m_thread;
+        ThreadCounters*                 m_next;
+    }; // struct TrackingAllocator::ThreadCounters 
+
+    static const size_t kTrackingInstanceCount = 8;
+    static TF_THREAD_LS ThreadLocalSlot s_trackingCounterSlots[kTrackingInstanceCount];
+
+    static size_t GetTrackingHistogramBucket(size_t size)
+    {
+        if (size <= TrackingAllocator::GetHistogramBucketLimit(0))
+        {
+            return 0;
+        }
+        const size_t bucket = FindLastSetBit64(size - 1) - 3;
+        return (bucket < TrackingAllocator::kHistogramBucketCount) ? bucket : (TrackingAllocator::kHistogramBucketCount - 1);
+    }
+
+    TrackingAllocator::TrackingAllocator(Allocator& backing)
+        : m_backing                     (backing)
+        , m_serial                      (s_threadLocalSlotSerial.fetch_add(1))
+        , m_threadCounters              (nullptr)
+        , m_frameBeginAllocationCount   ()
+        , m_frameBeginAllocatedBytes    ()
+        , m_frameAllocationCount        ()
+        , m_frameAllocatedBytes         ()
+    {
+        for (size_t i = 0; i < kMaxMemoryTagCount; ++i)
+        {
+            m_liveBytes[i].store(0);
+            m_peakBytes[i].store(0);
+        }
+    }
+
+    TrackingAllocator::~TrackingAllocator()
+    {
+        ThreadCounters* counters = m_threadCounters.exchange(nullptr);
+        while (counters)
+        {
+            ThreadCounters* next = counters->m_next;
+            counters->~ThreadCounters();
+            m_backing.Free(counters);
+            counters = next;
+        }
+
+        ThreadLocalSlot& slot = s_trackingCounterSlots[m_serial % kTrackingInstanceCount];
+        if (slot.m_serial == m_serial)
+        {
+            slot.m_serial = 0;
+            slot.m_cache  = nullptr;
+        }
+    }
+
+    TrackingAllocator::ThreadCounters* TrackingAllocator::GetThreadCounters()
+    {
+        ThreadLocalSlot& slot = s_trackingCounterSlots[m_serial % kTrackingInstanceCount];
+        ThreadCounters* found = FindThreadLocalEntry(slot, m_serial, m_threadCounters.load(std::memory_order_acquire));
+        if (TF_LIKELY(found != nullptr))
+        {
+            return found;
+        }
+
+        void* memory = m_backing.Allocate(sizeof(ThreadCounters), TF_DEFAULT_ALIGNMENT_SIZE);
+        if (memory == nullptr)
+        {
+            return nullptr;
+        }
+        ThreadCounters* counters = new (memory) ThreadCounters();
+        for (size_t i = 0; i < kMaxMemoryTagCount; ++i)
+        {
+            for (size_t j = 0; j < ThreadCounters::kCounterCount; ++j)
+            {
+                counters->m_tags[i][j].store(0);
+            }
+        }
+        for (size_t i = 0; i < kHistogramBucketCount; ++i)
+        {
+            counters->m_histogram[i].store(0);
+        }
+        counters->m_thread = std::this_thread::get_id();
+
+        ThreadCounters* head = m_threadCounters.load();
+        do
+        {
+            counters->m_next = head;
+        } while (!m_threadCounters.compare_exchange_weak(head, counters, std::memory_order_release, std::memory_order_relaxed));
+
+        slot.m_serial = m_serial;
+        slot.m_cache  = counters;
+        return counters;
+    }
+
+    void* TrackingAllocator::Allocate(size_t size, size_t alignment)
+    {
+        return AllocateTagged(s_currentMemoryTag, size, alignment);
+    }
+
+    void* TrackingAllocator::AllocateTagged(MemoryTag tag, size_t size, size_t alignment)
+    {
+        assert((alignment & (alignment - 1)) == 0); // alignment must be power of two.
+        if (tag >= kMaxMemoryTagCount)
+        {
+            tag = kMemoryTagDefault;
+        }
+
+        const size_t offset = (alignment > kTrackingHeaderSize) ? alignment : kTrackingHeaderSize;
+        uint8_t* memory = static_cast<uint8_t*>(m_backing.Allocate(offset + size, (alignment > TF_DEFAULT_ALIGNMENT_SIZE) ? alignment : TF_DEFAULT_ALIGNMENT_SIZE));
+        if (memory == nullptr)
+        {
+            return nullptr;
+        }
+
+        TrackingBlockHeader* header = reinterpret_cast<TrackingBlockHeader*>(memory + offset - kTrackingHeaderSize);
+        header->m_size      = size;
+        header->m_tag       = tag;
+        header->m_offset    = static_cast<uint32_t>(offset);
+
+        ThreadCounters* counters = GetThreadCounters();
+        if (counters)
+        {
+            IncrementCounter<uint64_t>(counters->m_tags[tag][ThreadCounters::kAllocationCount], 1);
+            IncrementCounter<uint64_t>(counters->m_tags[tag][ThreadCounters::kAllocatedBytes], size);
+            IncrementCounter<uint64_t>(counters->m_histogram[GetTrackingHistogramBucket(size)], 1);
+        }
+
+        const int64_t liveBytes = m_liveBytes[tag].fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed) + static_cast<int64_t>(size);
+        int64_t peakBytes = m_peakBytes[tag].load(std::memory_order_relaxed);
+        while (liveBytes > peakBytes && !m_peakBytes[tag].compare_exchange_weak(peakBytes, liveBytes, std::memory_order_relaxed))
+        {
+        }
+        return memory + offset;
+    }
+
+    void TrackingAllocator::Free(void* block)
+    {
+        if (block == nullptr)
+        {
+            return;
+        }
+
+        const TrackingBlockHeader* header = reinterpret_cast<const TrackingBlockHeader*>(static_cast<uint8_t*>(block) - kTrackingHeaderSize);
+        ThreadCounters* counters = GetThreadCounters();
+        if (counters)
+        {
+            IncrementCounter<uint64_t>(counters->m_tags[header->m_tag][ThreadCounters::kFreeCount], 1);
+            IncrementCounter<uint64_t>(counters->m_tags[header->m_tag][ThreadCounters::kFreedBytes], header->m_size);
+        }
+        m_liveBytes[header->m_tag].fetch_sub(static_cast<int64_t>(header->m_size), std::memory_order_relaxed);
+        m_backing.Free(static_cast<uint8_t*>(block) - header->m_offset);
+    }
+
+    void TrackingAllocator::SumTagCounters(MemoryTag tag, uint64_t sums[4]) const
+    {
+        for (size_t i = 0; i < ThreadCounters::kCounterCount; ++i)
+        {
+            sums[i] = 0;
+        }
+        for (const ThreadCounters* counters = m_threadCounters.load(); counters != nullptr; counters = counters->m_next)
+        {
+            for (size_t i = 0; i < ThreadCounters::kCounterCount; ++i)
+            {
+                sums[i] += counters->m_tags[tag][i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void TrackingAllocator::NextFrame()
+    {
+        for (MemoryTag tag = 0; tag < kMaxMemoryTagCount; ++tag)
+        {
+            uint64_t sums[ThreadCounters::kCounterCount];
+            SumTagCounters(tag, sums);
+
+            m_frameAllocationCount[tag]         = sums[ThreadCounters::kAllocationCount] - m_frameBeginAllocationCount[tag];
+            m_frameAllocatedBytes[tag]          = sums[ThreadCounters::kAllocatedBytes]  - m_frameBeginAllocatedBytes[tag];
+            m_frameBeginAllocationCount[tag]    = sums[ThreadCounters::kAllocationCount];
+            m_frameBeginAllocatedBytes[tag]     = sums[ThreadCounters::kAllocatedBytes];
+        }
+    }
+
+    TrackingAllocator::TagStatistics TrackingAllocator::GetTagStatistics(MemoryTag tag) const
+    {
+        TagStatistics statistics = {};
+        if (tag >= kMaxMemoryTagCount)
+        {
+            return statistics;
+        }
+
+        uint64_t sums[ThreadCounters::kCounterCount];
+        SumTagCounters(tag, sums);
+        statistics.m_liveBytes              = static_cast<int64_t>(sums[ThreadCounters::kAllocatedBytes]  - sums[ThreadCounters::kFreedBytes]);
+        statistics.m_liveCount              = static_cast<int64_t>(sums[ThreadCounters::kAllocationCount] - sums[ThreadCounters::kFreeCount]);
+        const int64_t peakBytes             = m_peakBytes[tag].load(std::memory_order_relaxed);
+        statistics.m_peakBytes              = (statistics.m_liveBytes > peakBytes) ? statistics.m_liveBytes : peakBytes;
+        statistics.m_allocationCount        = sums[ThreadCounters::kAllocationCount];
+        statistics.m_frameAllocationCount   = m_frameAllocationCount[tag];
+        statistics.m_frameAllocatedBytes    = m_frameAllocatedBytes[tag];
+        return statistics;
+    }
+
+    void TrackingAllocator::GetSizeHistogram(uint64_t histogram[kHistogramBucketCount]) const
+    {
+        for (size_t i = 0; i < kHistogramBucketCount; ++i)
+        {
+            histogram[i] = 0;
+        }
+        for (const ThreadCounters* counters = m_threadCounters.load(); counters != nullptr; counters = counters->m_next)
+        {
+            for (size_t i = 0; i < kHistogramBucketCount; ++i)
+            {
+                histogram[i] += counters->m_histogram[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+#else
+    TrackingAllocator::TrackingAllocator(Allocator& backing)
+        : m_backing(backing)
+    {
+    }
+
+    TrackingAllocator::~TrackingAllocator()
+    {
+    }
+
+    void* TrackingAllocator::Allocate(size_t size, size_t alignment)
+    {
+        return m_backing.Allocate(size, alignment);
+    }
+
+    void* TrackingAllocator::AllocateTagged(MemoryTag tag, size_t size, size_t alignment)
+    {
+        TF_UNUSED(tag);
+        return m_backing.Allocate(size, alignment);
+    }
+
+    void TrackingAllocator::Free(void* block)
+    {
+        m_backing.Free(block);
+    }
+
+    void TrackingAllocator::NextFrame()
+    {
+    }
+
+    TrackingAllocator::TagStatistics TrackingAllocator::GetTagStatistics(MemoryTag tag) const
+    {
+        TF_UNUSED(tag);
+        TagStatistics statistics = {};
+        return statistics;
+    }
+
+    void TrackingAllocator::GetSizeHistogram(uint64_t histogram[kHistogramBucketCount]) const
+    {
+        for (size_t i = 0; i < kHistogramBucketCount; ++i)
+        {
+            histogram[i] = 0;
+        }
+    }
+#endif // TF_MEMORY_TRACKING 
+
+    // Header placed right before every block handed out by SamplingAllocator. 
+    struct SamplingBlockHeader
+    {
+        uint32_t                        m_record;
+        uint32_t                        m_offset;
+    }; // struct SamplingBlockHeader 
+
+    static const size_t     kSamplingHeaderSize = TF_ALIGNMENT(sizeof(SamplingBlockHeader), TF_DEFAULT_ALIGNMENT_SIZE);
+    static const uint32_t   kSamplingNotSampled = 0xffffffffu;
+
+    // One sample, or in the history the freed samples of one stack folded together. 
+    struct SamplingRecord
+    {
+        void*                           m_frames[SamplingAllocator::kMaxStackDepth];
+        uint32_t                        m_depth;
+        uint32_t                        m_live;
+        uint32_t                        m_count;        // Samples folded in, zero for a free record.
+        uint32_t                        m_nextFree;
+        uint64_t                        m_size;
+        double                          m_weight;
+    }; // struct SamplingRecord 
+
+    // Live samples keep their record (the block header holds its index) until freed, then the 
+    // record goes on a free list and the sample is folded into the history by stack, so memory 
+    // follows the live samples and the distinct stacks rather than every sample ever taken. 
+    struct SamplingAllocator::SampleTable
+    {
+        typedef SamplingRecord          Record;
+
+        mutable std::mutex              m_mutex;
+        Record*                         m_records;
+        size_t                          m_count;
+        size_t                          m_capacity;
+        uint32_t                        m_freeRecord;
+        Record*                         m_history;
+        size_t                          m_historyCount;
+        size_t                          m_historyCapacity;
+        size_t                          m_sampleCount;
+    }; // struct SamplingAllocator::SampleTable 
+
+    // Distance to the next sample of one thread for one instance, written by that thread only. 
+    struct SamplingAllocator::ThreadSampler
+    {
+        int64_t                         m_bytesUntilSample;
+        std::thread::id                 m_thread;
+        ThreadSampler*                  m_next;
+    }; // struct SamplingAllocator::ThreadSampler 
+
+    static const size_t kSamplingInstanceCount = 8;
+    static TF_THREAD_LS ThreadLocalSlot s_threadSamplerSlots[kSamplingInstanceCount];
+
+    // Random state of the thread, shared by every SamplingAllocator. 
+    static TF_THREAD_LS uint64_t    s_samplingRandomState;
+
+    // Bytes to the next sample, exponentially distributed with the given mean. 
+    static int64_t NextSamplingDistance(size_t samplingInterval)
+    {
+        if (s_samplingRandomState == 0)
+        {
+            int local = 0;
+            s_samplingRandomState = (reinterpret_cast<uintptr_t>(&local) * 0x9e3779b97f4a7c15ull) | 1;
+        }
+        uint64_t x = s_samplingRandomState;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        s_samplingRandomState = x;
+
+        const double uniform  = static_cast<double>((x >> 11) + 1) * (1.0 / 9007199254740992.0);
+        const double distance = -std::log(uniform) * static_cast<double>(samplingInterval);
+        return (distance < 1.0) ? 1 : static_cast<int64_t>(distance);
+    }
+
+    static uint32_t CaptureCallStack(void** frames, uint32_t maxDepth, uint32_t skipCount)
+    {
+#if defined(TF_PLATFORM_WINDOWS)
+        return CaptureStackBackTrace(skipCount + 1, maxDepth, frames, nullptr);
+#else
+        void* buffer[SamplingAllocator::kMaxStackDepth + 8];
+        const int captured = backtrace(buffer, static_cast<int>(TF_ARRAY_SIZE(buffer)));
+        uint32_t depth = 0;
+        for (int i = static_cast<int>(skipCount) + 1; i < captured && depth < maxDepth; ++i)
+        {
+            frames[depth++] = buffer[i];
+        }
+        return depth;
+#endif
+    }
+
+    // "module+0xoffset" (or "module!symbol+0xoffset" when the symbol is exported). 
+    static void FormatStackFrame(void* pc, char* buffer, size_t bufferSize)
+    {
+#if defined(TF_PLATFORM_WINDOWS)
+        HMODULE module = nullptr;
+        char    path[MAX_PATH] = "?";
+        if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, static_cast<LPCSTR>(pc), &module))
+        {
+            GetModuleFileNameA(module, path, MAX_PATH);
+        }
+        const char* name = strrchr(path, '\\');
+        name = name ? (name + 1) : path;
+        snprintf(buffer, bufferSize, "%s+0x%llx", name, static_cast<unsigned long long>(static_cast<uint8_t*>(pc) - reinterpret_cast<uint8_t*>(module)));
+#else
+        Dl_info info;
+        if (dladdr(pc, &info) && info.dli_fname)
+        {
+            const char* name = strrchr(info.dli_fname, '/');
+            name = name ? (name + 1) : info.dli_fname;
+            if (info.dli_sname)
+            {
+                snprintf(buffer, bufferSize, "%s!%s+0x%llx", name, info.dli_sname, static_cast<unsigned long long>(static_cast<uint8_t*>(pc) - static_cast<uint8_t*>(info.dli_saddr)));
+            }
+            else
+            {
+                snprintf(buffer, bufferSize, "%s+0x%llx", name, static_cast<unsigned long long>(static_cast<uint8_t*>(pc) - static_cast<uint8_t*>(info.dli_fbase)));
+            }
+        }
+        else
+        {
+            snprintf(buffer, bufferSize, "%p", pc);
+        }
+#endif
+    }
+
+    SamplingAllocator::SamplingAllocator(Allocator& backing, size_t samplingInterval)
+        : m_backing         (backing)
+        , m_samples         (nullptr)
+        , m_samplingInterval((samplingInterval > 0) ? samplingInterval : 1)
+        , m_serial          (s_threadLocalSlotSerial.fetch_add(1))
+        , m_threadSamplers  (nullptr)
+    {
+        void* memory = m_backing.Allocate(sizeof(SampleTable), TF_DEFAULT_ALIGNMENT_SIZE);
+        assert(memory != nullptr);
+        m_samples = new (memory) SampleTable();
+        m_samples->m_records            = nullptr;
+        m_samples->m_count              = 0;
+        m_samples->m_capacity           = 0;
+        m_samples->m_freeRecord         = kSamplingNotSampled;
+        m_samples->m_history            = nullptr;
+        m_samples->m_historyCount       = 0;
+        m_samples->m_historyCapacity    = 0;
+        m_samples->m_sampleCount        = 0;
+    }
+
+    SamplingAllocator::~SamplingAllocator()
+    {
+        if (m_samples)
+        {
+            m_backing.Free(m_samples->m_records);
+            m_backing.Free(m_samples->m_history);
+            m_samples->~SampleTable();
+            m_backing.Free(m_samples);
+            m_samples = nullptr;
+        }
+
+        ThreadSampler* sampler = m_threadSamplers.exchange(nullptr);
+        while (sampler)
+        {
+            ThreadSampler* next = sampler->m_next;
+            sampler->~ThreadSampler();
+            m_backing.Free(sampler);
+            sampler = next;
+        }
+
+        ThreadLocalSlot& slot = s_threadSamplerSlots[m_serial % kSamplingInstanceCount];
+        if (slot.m_serial == m_serial)
+        {
+            slot.m_serial = 0;
+            slot.m_cache  = nullptr;
+        }
+    }
+
+    SamplingAllocator::ThreadSampler* SamplingAllocator::GetThreadSampler()
+    {
+        ThreadLocalSlot& slot = s_threadSamplerSlots[m_serial % kSamplingInstanceCount];
+        ThreadSampler* found = FindThreadLocalEntry(slot, m_serial, m_threadSamplers.load(std::memory_order_acquire));
+        if (TF_LIKELY(found != nullptr))
+        {
+            return found;
+        }
+
+        void* memory = m_backing.Allocate(sizeof(ThreadSampler), TF_DEFAULT_ALIGNMENT_SIZE);
+        if (memory == nullptr)
+        {
+            return nullptr;
+        }
+        ThreadSampler* sampler = new (memory) ThreadSampler();
+        sampler->m_bytesUntilSample = NextSamplingDistance(m_samplingInterval);
+        sampler->m_thread = std::this_thread::get_id();
+
+        ThreadSampler* head = m_threadSamplers.load();
+        do
+        {
+            sampler->m_next = head;
+        } while (!m_threadSamplers.compare_exchange_weak(head, sampler, std::memory_order_release, std::memory_order_relaxed));
+
+        slot.m_serial = m_serial;
+        slot.m_cache  = sampler;
+        return sampler;
+    }
+
+    void* SamplingAllocator::Allocate(size_t size, size_t alignment)
+    {
+        assert((alignment & (alignment - 1)) == 0); // alignment must be power of two.
+
+        ThreadSampler* sampler = GetThreadSampler();
+        if (TF_LIKELY(sampler != nullptr))
+        {
+            sampler->m_bytesUntilSample -= static_cast<int64_t>(size);
+            if (TF_UNLIKELY(sampler->m_bytesUntilSample <= 0))
+            {
+                sampler->m_bytesUntilSample = NextSamplingDistance(m_samplingInterval);
+                return AllocateSampled(size, alignment);
+            }
+        }
+
+        const size_t offset = (alignment > kSamplingHeaderSize) ? alignment : kSamplingHeaderSize;
+        uint8_t* memory = static_cast<uint8_t*>(m_backing.Allocate(offset + size, (alignment > TF_DEFAULT_ALIGNMENT_SIZE) ? alignment : TF_DEFAULT_ALIGNMENT_SIZE));
+        if (memory == nullptr)
+        {
+            return nullptr;
+        }
+        SamplingBlockHeader* header = reinterpret_cast<SamplingBlockHeader*>(memory + offset - kSamplingHeaderSize);
+        header->m_record = kSamplingNotSampled;
+        header->m_offset = static_cast<uint32_t>(offset);
+        return memory + offset;
+    }
+
+    TF_NO_INLINE void* SamplingAllocator::AllocateSampled(size_t size, size_t alignment)
+    {
+        const size_t offset = (alignment > kSamplingHeaderSize) ? alignment : kSamplingHeaderSize;
+        uint8_t* memory = static_cast<uint8_t*>(m_backing.Allocate(offset + size, (alignment > TF_DEFAULT_ALIGNMENT_SIZE) ? alignment : TF_DEFAULT_ALIGNMENT_SIZE));
+        if (memory == nullptr)
+        {
+            return nullptr;
+        }
+        SamplingBlockHeader* header = reinterpret_cast<SamplingBlockHeader*>(memory + offset - kSamplingHeaderSize);
+        header->m_record = kSamplingNotSampled;
+        header->m_offset = static_cast<uint32_t>(offset);
+
+        SampleTable::Record record;
+        record.m_depth      = CaptureCallStack(record.m_frames, kMaxStackDepth, 2);
+        record.m_live       = 1;
+        record.m_count      = 1;
+        record.m_nextFree   = kSamplingNotSampled;
+        record.m_size       = size;
+        record.m_weight     = (size > 0)
+                            ? static_cast<double>(size) / (1.0 - std::exp(-static_cast<double>(size) / static_cast<double>(m_samplingInterval)))
+                            : static_cast<double>(m_samplingInterval);
+
+        std::lock_guard<std::mutex> lock(m_samples->m_mutex);
+        if (m_samples->m_freeRecord != kSamplingNotSampled)
+        {
+            header->m_record = m_samples->m_freeRecord;
+            m_samples->m_freeRecord = m_samples->m_records[header->m_record].m_nextFree;
+            m_samples->m_records[header->m_record] = record;
+            m_samples->m_sampleCount++;
+            return memory + offset;
+        }
+        if (m_samples->m_count == m_samples->m_capacity)
+        {
+            const size_t capacity = (m_samples->m_capacity > 0) ? (m_samples->m_capacity * 2) : 256;
+            if (capacity >= kSamplingNotSampled)
+            {
+                return memory + offset;
+            }
+            SampleTable::Record* records = static_cast<SampleTable::Record*>(m_backing.Allocate(capacity * sizeof(SampleTable::Record), TF_DEFAULT_ALIGNMENT_SIZE));
+            if (records == nullptr)
+            {
+                return memory + offset;
+            }
+            if (m_samples->m_records)
+            {
+                memcpy(records, m_samples->m_records, m_samples->m_count * sizeof(SampleTable::Record));
+                m_backing.Free(m_samples->m_records);
+            }
+            m_samples->m_records    = records;
+            m_samples->m_capacity   = capacity;
+        }
+        header->m_record = static_cast<uint32_t>(m_samples->m_count);
+        m_samples->m_records[m_samples->m_count++] = record;
+        m_samples->m_sampleCount++;
+        return memory + offset;
+    }
+
+    static bool IsSameStack(const SamplingRecord& a, const SamplingRecord& b)
+    {
+        return a.m_depth == b.m_depth && memcmp(a.m_frames, b.m_frames, a.m_depth * sizeof(void*)) == 0;
+    }
+
+    static bool IsStackLess(const SamplingRecord& a, const SamplingRecord& b)
+    {
+        if (a.m_depth != b.m_depth)
+        {
+            return a.m_depth < b.m_depth;
+        }
+        return memcmp(a.m_frames, b.m_frames, a.m_depth * sizeof(void*)) < 0;
+    }
+
+    // Merge history records of the same stack, returns the new count. 
+    static size_t CompactSamplingHistory(SamplingRecord* history, size_t count)
+    {
+        std::sort(history, history + count, IsStackLess);
+        size_t merged = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (merged > 0 && IsSameStack(history[merged - 1], history[i]))
+            {
+                history[merged - 1].m_count  += history[i].m_count;
+                history[merged - 1].m_size   += history[i].m_size;
+                history[merged - 1].m_weight += history[i].m_weight;
+            }
+            else
+            {
+                history[merged++] = history[i];
+            }
+        }
+        return merged;
+    }
+
+    // Fold a freed sample into the history, returns false when the history cannot take it. 
+    static bool AddSamplingHistory(Allocator& backing, SamplingRecord*& history, size_t& count, size_t& capacity, const SamplingRecord& record)
+    {
+        if (count == capacity)
+        {
+            count = CompactSamplingHistory(history, count);
+            // Grow once compaction frees less than half of the history, so compactions stay amortized. 
+            if (count * 2 > capacity || capacity == 0)
+            {
+                const size_t newCapacity = (capacity > 0) ? (capacity * 2) : 256;
+                SamplingRecord* records = static_cast<SamplingRecord*>(backing.Allocate(newCapacity * sizeof(SamplingRecord), TF_DEFAULT_ALIGNMENT_SIZE));
+                if (records != nullptr)
+                {
+                    if (history)
+                    {
+                        memcpy(records, history, count * sizeof(SamplingRecord));
+                        backing.Free(history);
+                    }
+                    history  = records;
+                    capacity = newCapacity;
+                }
+            }
+            if (count == capacity)
+            {
+                return false;
+            }
+        }
+        history[count] = record;
+        history[count].m_live = 0;
+        count++;
+        return true;
+    }
+
+    void SamplingAllocator::Free(void* block)
+    {
+        if (block == nullptr)
+        {
+            return;
+        }
+
+        const SamplingBlockHeader* header = reinterpret_cast<const SamplingBlockHeader*>(static_cast<uint8_t*>(block) - kSamplingHeaderSize);
+        if (TF_UNLIKELY(header->m_record != kSamplingNotSampled))
+        {
+            std::lock_guard<std::mutex> lock(m_samples->m_mutex);
+            SampleTable::Record& record = m_samples->m_records[header->m_record];
+            record.m_live = 0;
+            // Without room in the history the dead record stays in place and is still reported. 
+            if (AddSamplingHistory(m_backing, m_samples->m_history, m_samples->m_historyCount, m_samples->m_historyCapacity, record))
+            {
+                record.m_count = 0;
+                record.m_nextFree = m_samples->m_freeRecord;
+                m_samples->m_freeRecord = header->m_record;
+            }
+        }
+        m_backing.Free(static_cast<uint8_t*>(block) - header->m_offset);
+    }
+
+    size_t SamplingAllocator::GetSampleCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_samples->m_mutex);
+        return m_samples->m_sampleCount;
+    }
+
+    size_t SamplingAllocator::GetLiveSampleCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_samples->m_mutex);
+        size_t count = 0;
+        for (size_t i = 0; i < m_samples->m_count; ++i)
+        {
+            count += m_samples->m_records[i].m_live;
+        }
+        return count;
+    }
+
+    uint64_t SamplingAllocator::GetEstimatedLiveBytes() const
+    {
+        std::lock_guard<std::mutex> lock(m_samples->m_mutex);
+        double bytes = 0.0;
+        for (size_t i = 0; i < m_samples->m_count; ++i)
+        {
+            if (m_samples->m_records[i].m_live)
+            {
+                bytes += m_samples->m_records[i].m_weight;
+            }
+        }
+        return static_cast<uint64_t>(bytes);
+    }
+
+    // The live and history records in use, ordered so identical stacks are adjacent. 
+    static const SamplingRecord** SortSamplesByStack(Allocator& alloc, const SamplingRecord* records, size_t recordCount,
+                                                     const SamplingRecord* history, size_t historyCount, size_t& count)
+    {
+        const SamplingRecord** order = static_cast<const SamplingRecord**>(alloc.Allocate((recordCount + historyCount + 1) * sizeof(SamplingRecord*), TF_DEFAULT_ALIGNMENT_SIZE));
+        if (order == nullptr)
+        {
+            return nullptr;
+        }
+        count = 0;
+        for (size_t i = 0; i < recordCount; ++i)
+        {
+            if (records[i].m_count > 0)
+            {
+                order[count++] = &records[i];
+            }
+        }
+        for (size_t i = 0; i < historyCount; ++i)
+        {
+            order[count++] = &history[i];
+        }
+        std::sort(order, order + count, [](const SamplingRecord* a, const SamplingRecord* b)
+        {
+            return IsStackLess(*a, *b);
+        });
+        return order;
+    }
+
+    bool SamplingAllocator::WriteFoldedStacks(const char* path, bool liveOnly) const
+    {
+        FILE* file = fopen(path, "w");
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_samples->m_mutex);
+        size_t count = 0;
+        const SampleTable::Record** order = SortSamplesByStack(m_backing, m_samples->m_records, m_samples->m_count,
+                                                               m_samples->m_history, m_samples->m_historyCount, count);
+        if (order == nullptr)
+        {
+            fclose(file);
+            return false;
+        }
+
+        for (size_t i = 0; i < count; )
+        {
+            const SampleTable::Record& first = *order[i];
+            double bytes = 0.0;
+            for (; i < count && IsSameStack(first, *order[i]); ++i)
+            {
+                if (!liveOnly || order[i]->m_live)
+                {
+                    bytes += order[i]->m_weight;
+                }
+            }
+            if (bytes <= 0.0)
+            {
+                continue;
+            }
+
+            for (uint32_t frame = first.m_depth; frame > 0; --frame)
+            {
+                char name[256];
+                FormatStackFrame(first.m_frames[frame - 1], name, sizeof(name));
+                fprintf(file, (frame == first.m_depth) ? "%s" : ";%s", name);
+            }
+            fprintf(file, " %llu\n", static_cast<unsigned long long>(bytes));
+        }
+
+        m_backing.Free(order);
+        fclose(file);
+        return true;
+    }
+
+    bool SamplingAllocator::WriteHeapProfile(const char* path) const
+    {
+        FILE* file = fopen(path, "w");
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_samples->m_mutex);
+        size_t count = 0;
+        const SampleTable::Record** order = SortSamplesByStack(m_backing, m_samples->m_records, m_samples->m_count,
+                                                               m_samples->m_history, m_samples->m_historyCount, count);
+        if (order == nullptr)
+        {
+            fclose(file);
+            return false;
+        }
+
+        // pprof un-samples heap_v2 profiles itself, so raw sampled counts and sizes are written. 
+        unsigned long long totals[4] = {};
+        for (size_t i = 0; i < count; ++i)
+        {
+            totals[0] += order[i]->m_live;
+            totals[1] += order[i]->m_live ? order[i]->m_size : 0;
+            totals[2] += order[i]->m_count;
+            totals[3] += order[i]->m_size;
+        }
+        fprintf(file, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%llu\n",
+                totals[0], totals[1], totals[2], totals[3], static_cast<unsigned long long>(m_samplingInterval));
+
+        for (size_t i = 0; i < count; )
+        {
+            const SampleTable::Record& first = *order[i];
+            unsigned long long counts[4] = {};
+            for (; i < count && IsSameStack(first, *order[i]); ++i)
+            {
+                const SampleTable::Record& record = *order[i];
+                counts[0] += record.m_live;
+                counts[1] += record.m_live ? record.m_size : 0;
+                counts[2] += record.m_count;
+                counts[3] += record.m_size;
+            }
+            fprintf(file, "%llu: %llu [%llu: %llu] @", counts[0], counts[1], counts[2], counts[3]);
+            for (uint32_t frame = 0; frame < first.m_depth; ++frame)
+            {
+                fprintf(file, " %p", first.m_frames[frame]);
+            }
+            fprintf(file, "\n");
+        }
+        m_backing.Free(order);
+
+#if defined(TF_PLATFORM_LINUX)
+        // The address map lets pprof symbolize the raw addresses. 
+        fprintf(file, "\nMAPPED_LIBRARIES:\n");
+        FILE* maps = fopen("/proc/self/maps", "r");
+        if (maps)
+        {
+            char line[1024];
+            while (fgets(line, sizeof(line), maps))
+            {
+                fputs(line, file);
+            }
+            fclose(maps);
+        }
+#endif // TF_PLATFORM_LINUX 
+
+        fclose(file);
+        return true;
     }
 
 } // namespace tf 
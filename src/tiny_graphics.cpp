@@ -10,6 +10,7 @@
 #include <dxgi1_4.h>
 #include <cassert>
 #include <cstring>
+#include <new>
 #include <wrl.h>
 #include <shellapi.h>
 
@@ -24,9 +25,50 @@ namespace tf
         , m_frameLeft(-1)
         , m_width(kApplicationDefaultWidth)
         , m_height(kApplicationDefaultHeight)
+        , m_jobSystem(nullptr)
+        , m_updateGraph()
+        , m_renderGraph()
     {
     }
 
+    void ApplicationAdapter::RunGraph(TaskGraph& graph)
+    {
+        if (!graph.Compile())
+        {
+            return;
+        }
+        if (m_jobSystem != nullptr)
+        {
+            graph.Run(*m_jobSystem);
+        }
+        else
+        {
+            graph.RunSerial();
+        }
+    }
+
+    void ApplicationAdapter::RunFrame()
+    {
+        m_updateGraph.Clear();
+        if (BuildUpdateGraph(m_updateGraph))
+        {
+            RunGraph(m_updateGraph);
+        }
+        else
+        {
+            Update();
+        }
+        m_renderGraph.Clear();
+        if (BuildRenderGraph(m_renderGraph))
+        {
+            RunGraph(m_renderGraph);
+        }
+        else
+        {
+            Render();
+        }
+    }
+
     void ApplicationAdapter::SetFrameCount(int frameCount)
     {
         m_frameLeft = frameCount;
@@ -66,8 +108,7 @@ namespace tf
         case WM_PAINT:
             if (adapter)
             {
-                adapter->Update();
-                adapter->Render();
+                adapter->RunFrame();
                 adapter->DeclementFrameCount();
                 if (adapter->FinishByFrameLimit())
                 {
@@ -214,19 +255,117 @@ namespace gpu
 
     }; // class CommandContextImpl 
 
+    //! Descriptor heap whose slots are handed out by a BitmapAllocator. 
+    //! Views that live as long as their resource take a range here instead of owning a heap each. 
+    class DescriptorHeapAllocator : private NonCopyable
+    {
+    public:
+        static const uint32_t           kInvalidIndex   = BitmapAllocator::kInvalidIndex;
+
+    private:
+        ComPtr<ID3D12DescriptorHeap>    m_heap;
+        BitmapAllocator                 m_slots;
+        D3D12_CPU_DESCRIPTOR_HANDLE     m_cpuStart;
+        D3D12_GPU_DESCRIPTOR_HANDLE     m_gpuStart;
+        UINT                            m_descriptorSize;
+
+    public:
+        DescriptorHeapAllocator()
+            : m_heap            (nullptr)
+            , m_slots           ()
+            , m_cpuStart        ()
+            , m_gpuStart        ()
+            , m_descriptorSize  (0)
+        {
+        }
+
+        bool                            Initialize(ID3D12Device*                pDevice,
+                                                   D3D12_DESCRIPTOR_HEAP_TYPE   type,
+                                                   uint32_t                     capacity,
+                                                   D3D12_DESCRIPTOR_HEAP_FLAGS  flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE);
+        void                            Terminate();
+
+        //! First index of count contiguous descriptors, kInvalidIndex when the heap is full. 
+        uint32_t                        Allocate(uint32_t count = 1)
+        {
+            return m_slots.AllocateRange(count);
+        }
+
+        void                            Free(uint32_t index, uint32_t count = 1)
+        {
+            m_slots.FreeRange(index, count);
+        }
+
+        D3D12_CPU_DESCRIPTOR_HANDLE     GetCpuHandle(uint32_t index) const
+        {
+            assert(m_slots.IsAllocated(index));
+            return CD3DX12_CPU_DESCRIPTOR_HANDLE(m_cpuStart, static_cast<INT>(index), m_descriptorSize);
+        }
+
+        //! Only valid for shader visible heaps. 
+        D3D12_GPU_DESCRIPTOR_HANDLE     GetGpuHandle(uint32_t index) const
+        {
+            assert(m_slots.IsAllocated(index) && m_gpuStart.ptr != 0);
+            return CD3DX12_GPU_DESCRIPTOR_HANDLE(m_gpuStart, static_cast<INT>(index), m_descriptorSize);
+        }
+
+        ID3D12DescriptorHeap*           GetHeap() const
+        {
+            return m_heap.Get();
+        }
+
+        UINT                            GetDescriptorSize() const
+        {
+            return m_descriptorSize;
+        }
+
+    }; // class DescriptorHeapAllocator 
+
+    bool DescriptorHeapAllocator::Initialize(ID3D12Device*                 pDevice,
+                                             D3D12_DESCRIPTOR_HEAP_TYPE    type,
+                                             uint32_t                      capacity,
+                                             D3D12_DESCRIPTOR_HEAP_FLAGS   flags)
+    {
+        D3D12_DESCRIPTOR_HEAP_DESC heapDesc = {};
+        heapDesc.NumDescriptors = capacity;
+        heapDesc.Type           = type;
+        heapDesc.Flags          = flags;
+        if (FAILED(pDevice->CreateDescriptorHeap(&heapDesc, IID_PPV_ARGS(&m_heap))) || !m_slots.Reset(capacity))
+        {
+            m_heap = nullptr;
+            return false;
+        }
+        m_cpuStart = m_heap->GetCPUDescriptorHandleForHeapStart();
+        if ((flags & D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE) != 0)
+        {
+            m_gpuStart = m_heap->GetGPUDescriptorHandleForHeapStart();
+        }
+        m_descriptorSize = pDevice->GetDescriptorHandleIncrementSize(type);
+        return true;
+    }
+
+    void DescriptorHeapAllocator::Terminate()
+    {
+        assert(m_slots.GetUsedCount() == 0);
+        m_slots.Reset(0);
+        m_heap = nullptr;
+    }
+
     class SwapChainImpl
     {
     private:
         ComPtr<IDXGISwapChain3>         m_swapChain;
-        ComPtr<ID3D12DescriptorHeap>    m_renderTargetViewHeap;
+        DescriptorHeapAllocator         m_renderTargetViewHeap;
         ComPtr<ID3D12Resource>          m_renderTargets[BUFFERING_COUNT];
 
-        UINT                            m_renderTargetViewDescriptorSize;
+        uint32_t                        m_renderTargetViewIndex;
+        UINT                            m_bufferCount;
     public:
         SwapChainImpl()
             : m_swapChain           (nullptr)
-            , m_renderTargetViewHeap(nullptr)
-            , m_renderTargetViewDescriptorSize(0L)
+            , m_renderTargetViewHeap()
+            , m_renderTargetViewIndex(DescriptorHeapAllocator::kInvalidIndex)
+            , m_bufferCount         (0)
         {
             for (int i = 0; i < BUFFERING_COUNT; ++i)
             {
@@ -258,14 +397,9 @@ namespace gpu
             return m_renderTargets[GetCurrentFrameBufferIndex()].Get();
         }
 
-        ID3D12DescriptorHeap*           GetRenderTargetViewHeap() const
-        {
-            return m_renderTargetViewHeap.Get();
-        }
-
-        UINT                            GetRenderTargetViewDescriptorSize() const
+        D3D12_CPU_DESCRIPTOR_HANDLE     GetCurrentRenderTargetView() const
         {
-            return m_renderTargetViewDescriptorSize;
+            return m_renderTargetViewHeap.GetCpuHandle(m_renderTargetViewIndex + GetCurrentFrameBufferIndex());
         }
 
     }; // class SwapChainImpl 
@@ -298,23 +432,17 @@ namespace gpu
         swapChain.As(&m_swapChain);
 
         {
-            D3D12_DESCRIPTOR_HEAP_DESC rtvHeapDesc = {};
-            rtvHeapDesc.NumDescriptors  = desc.m_bufferCount;
-            rtvHeapDesc.Type            = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
-            rtvHeapDesc.Flags           = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
-            pDevice->CreateDescriptorHeap(&rtvHeapDesc, IID_PPV_ARGS(&m_renderTargetViewHeap));
-
-            m_renderTargetViewDescriptorSize = pDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
+            m_renderTargetViewHeap.Initialize(pDevice, D3D12_DESCRIPTOR_HEAP_TYPE_RTV, desc.m_bufferCount);
+            m_renderTargetViewIndex = m_renderTargetViewHeap.Allocate(desc.m_bufferCount);
+            m_bufferCount = desc.m_bufferCount;
+            assert(m_renderTargetViewIndex != DescriptorHeapAllocator::kInvalidIndex);
         }
         {
-            CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle(m_renderTargetViewHeap->GetCPUDescriptorHandleForHeapStart());
-
             // Create a RTV for each frame.
             for (UINT n = 0; n < desc.m_bufferCount; n++)
             {
                 m_swapChain->GetBuffer(n, IID_PPV_ARGS(&m_renderTargets[n]));
-                pDevice->CreateRenderTargetView(m_renderTargets[n].Get(), nullptr, rtvHandle);
-                rtvHandle.Offset(1, m_renderTargetViewDescriptorSize);
+                pDevice->CreateRenderTargetView(m_renderTargets[n].Get(), nullptr, m_renderTargetViewHeap.GetCpuHandle(m_renderTargetViewIndex + n));
             }
         }
     }
@@ -326,6 +454,12 @@ namespace gpu
 
     void SwapChainImpl::Terminate()
     {
+        if (m_renderTargetViewIndex != DescriptorHeapAllocator::kInvalidIndex)
+        {
+            m_renderTargetViewHeap.Free(m_renderTargetViewIndex, m_bufferCount);
+            m_renderTargetViewIndex = DescriptorHeapAllocator::kInvalidIndex;
+        }
+        m_renderTargetViewHeap.Terminate();
     }
 
 
@@ -489,10 +623,7 @@ namespace gpu
                                                                                 D3D12_RESOURCE_STATE_PRESENT,
                                                                                 D3D12_RESOURCE_STATE_RENDER_TARGET));
 
-        CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle(swapChain.GetRenderTargetViewHeap()->GetCPUDescriptorHandleForHeapStart(),
-                                                swapChain.GetCurrentFrameBufferIndex(),
-                                                swapChain.GetRenderTargetViewDescriptorSize());
-        m_rtvHandle = rtvHandle;
+        m_rtvHandle = swapChain.GetCurrentRenderTargetView();
     }
 
     void CommandContextImpl::SetClearColor(const float clearColorRGBA[4])
@@ -520,6 +651,22 @@ namespace gpu
         m_commandQueue->ExecuteCommandLists(_countof(ppCommandLists), ppCommandLists);
     }
 
+    // The facade and its implementation are placed in one block from the caller's allocator. 
+    template<typename FacadeType, typename ImplType> struct ObjectBlock
+    {
+        static const size_t kImplOffset = TF_ALIGNMENT(sizeof(FacadeType), alignof(ImplType));
+        static const size_t kSize       = kImplOffset + sizeof(ImplType);
+        static const size_t kAlignment  = (alignof(FacadeType) > alignof(ImplType))
+                                        ? ((alignof(FacadeType) > TF_DEFAULT_ALIGNMENT_SIZE) ? alignof(FacadeType) : TF_DEFAULT_ALIGNMENT_SIZE)
+                                        : ((alignof(ImplType)   > TF_DEFAULT_ALIGNMENT_SIZE) ? alignof(ImplType)   : TF_DEFAULT_ALIGNMENT_SIZE);
+
+        static void* GetImplAddress(void* block)
+        {
+            return static_cast<uint8_t*>(block) + kImplOffset;
+        }
+
+    }; // struct ObjectBlock 
+
     class DeviceImpl
     {
     private:
@@ -527,6 +674,11 @@ namespace gpu
         ComPtr<ID3D12Device>            m_device;
         bool                            m_useWarpDevice;
 
+        // Live objects created by this device. 
+        SlotMap<CommandContext*>        m_commandContexts;
+        SlotMap<SwapChain*>             m_swapChains;
+        SlotMap<SynchronizationObject*> m_synchronizationObjects;
+
     public:
         DeviceImpl()
             : m_device          (nullptr)
@@ -547,6 +699,43 @@ namespace gpu
         SwapChain*                      CreateSwapChain(Allocator& alloc, CommandContext& command, const SwapChainDesc& desc);
         SynchronizationObject*          CreateSynchronizationObject(Allocator& alloc);
 
+        void                            Destroy(CommandContext* command, Allocator& alloc);
+        void                            Destroy(SwapChain* swapChain, Allocator& alloc);
+        void                            Destroy(SynchronizationObject* synchronizationObject, Allocator& alloc);
+
+        CommandContext*                 Resolve(CommandContextHandle handle) const
+        {
+            CommandContext* const* object = m_commandContexts.Get(handle);
+            return (object != nullptr) ? *object : nullptr;
+        }
+
+        SwapChain*                      Resolve(SwapChainHandle handle) const
+        {
+            SwapChain* const* object = m_swapChains.Get(handle);
+            return (object != nullptr) ? *object : nullptr;
+        }
+
+        SynchronizationObject*          Resolve(SynchronizationObjectHandle handle) const
+        {
+            SynchronizationObject* const* object = m_synchronizationObjects.Get(handle);
+            return (object != nullptr) ? *object : nullptr;
+        }
+
+    private:
+        template<typename FacadeType, typename ImplType> FacadeType* ConstructObject(Allocator& alloc)
+        {
+            typedef ObjectBlock<FacadeType, ImplType> Block;
+
+            void* block = alloc.Allocate(Block::kSize, Block::kAlignment);
+            assert(block != nullptr);
+            if (block == nullptr)
+            {
+                return nullptr;
+            }
+            ImplType* impl = new (Block::GetImplAddress(block)) ImplType();
+            return new (block) FacadeType(impl);
+        }
+
     }; // class GpuDeviceImpl 
 
     void DeviceImpl::Initialize()
@@ -586,36 +775,89 @@ namespace gpu
 
     void DeviceImpl::Terminate()
     {
-
+        // Every object must be destroyed before its device. 
+        assert(m_commandContexts.IsEmpty());
+        assert(m_swapChains.IsEmpty());
+        assert(m_synchronizationObjects.IsEmpty());
     }
 
     CommandContext* DeviceImpl::CreateCommandContext(Allocator& alloc, const CommandContextDesc& desc)
     {
-        CommandContext* createdContext = new CommandContext();
+        CommandContext* createdContext = ConstructObject<CommandContext, CommandContextImpl>(alloc);
+        if (createdContext == nullptr)
+        {
+            return nullptr;
+        }
         assert(createdContext->m_impl != nullptr);
         createdContext->m_impl->Initialize(m_device.Get());
+        createdContext->m_handle = m_commandContexts.Insert(createdContext);
 
         return createdContext;
     }
 
     SwapChain* DeviceImpl::CreateSwapChain(Allocator& alloc, CommandContext& command, const SwapChainDesc& desc)
     {
-        SwapChain* createdSwapChain = new SwapChain();
+        SwapChain* createdSwapChain = ConstructObject<SwapChain, SwapChainImpl>(alloc);
+        if (createdSwapChain == nullptr)
+        {
+            return nullptr;
+        }
         assert(createdSwapChain->m_impl != nullptr);
         createdSwapChain->m_impl->Initialize(m_device.Get(), m_dxgiFactory.Get(), command, desc);
+        createdSwapChain->m_handle = m_swapChains.Insert(createdSwapChain);
 
         return createdSwapChain;
     }
 
     SynchronizationObject* DeviceImpl::CreateSynchronizationObject(Allocator& alloc)
     {
-        SynchronizationObject* createdSynchronizationObject = new SynchronizationObject();
-        assert(createdSynchronizationObject != nullptr);
+        SynchronizationObject* createdSynchronizationObject = ConstructObject<SynchronizationObject, SynchronizationObjectImpl>(alloc);
+        if (createdSynchronizationObject == nullptr)
+        {
+            return nullptr;
+        }
+        assert(createdSynchronizationObject->m_impl != nullptr);
         createdSynchronizationObject->m_impl->Initialize(m_device.Get());
+        createdSynchronizationObject->m_handle = m_synchronizationObjects.Insert(createdSynchronizationObject);
 
         return createdSynchronizationObject;
     }
 
+    void DeviceImpl::Destroy(CommandContext* command, Allocator& alloc)
+    {
+        if (command == nullptr)
+        {
+            return;
+        }
+        m_commandContexts.Erase(command->m_handle);
+        command->m_impl->Terminate();
+        command->~CommandContext();
+        alloc.Free(command);
+    }
+
+    void DeviceImpl::Destroy(SwapChain* swapChain, Allocator& alloc)
+    {
+        if (swapChain == nullptr)
+        {
+            return;
+        }
+        m_swapChains.Erase(swapChain->m_handle);
+        swapChain->m_impl->Terminate();
+        swapChain->~SwapChain();
+        alloc.Free(swapChain);
+    }
+
+    void DeviceImpl::Destroy(SynchronizationObject* synchronizationObject, Allocator& alloc)
+    {
+        if (synchronizationObject == nullptr)
+        {
+            return;
+        }
+        m_synchronizationObjects.Erase(synchronizationObject->m_handle);
+        synchronizationObject->~SynchronizationObject();
+        alloc.Free(synchronizationObject);
+    }
+
 
     Device::Device()
         : m_impl(nullptr)
@@ -662,21 +904,57 @@ namespace gpu
         return m_impl->CreateSynchronizationObject(alloc);
     }
 
+    void Device::Destroy(CommandContext* command, Allocator& alloc)
+    {
+        assert(m_impl != nullptr);
+        m_impl->Destroy(command, alloc);
+    }
+
+    void Device::Destroy(SwapChain* swapChain, Allocator& alloc)
+    {
+        assert(m_impl != nullptr);
+        m_impl->Destroy(swapChain, alloc);
+    }
+
+    void Device::Destroy(SynchronizationObject* synchronizationObject, Allocator& alloc)
+    {
+        assert(m_impl != nullptr);
+        m_impl->Destroy(synchronizationObject, alloc);
+    }
+
+    CommandContext* Device::Resolve(CommandContextHandle handle) const
+    {
+        assert(m_impl != nullptr);
+        return m_impl->Resolve(handle);
+    }
+
+    SwapChain* Device::Resolve(SwapChainHandle handle) const
+    {
+        assert(m_impl != nullptr);
+        return m_impl->Resolve(handle);
+    }
+
+    SynchronizationObject* Device::Resolve(SynchronizationObjectHandle handle) const
+    {
+        assert(m_impl != nullptr);
+        return m_impl->Resolve(handle);
+    }
+
     DeviceImpl* Device::GetImpl() const
     {
         return m_impl;
     }
 
-    CommandContext::CommandContext()
-        : m_impl(nullptr)
+    CommandContext::CommandContext(CommandContextImpl* impl)
+        : m_impl(impl)
+        , m_handle()
     {
-        m_impl = new CommandContextImpl;
     }
 
     CommandContext::~CommandContext()
     {
         assert(m_impl != nullptr);
-        delete m_impl;
+        m_impl->~CommandContextImpl();
         m_impl = nullptr;
     }
 
@@ -722,21 +1000,26 @@ namespace gpu
         m_impl->ExecuteList();
     }
 
+    CommandContextHandle CommandContext::GetHandle() const
+    {
+        return m_handle;
+    }
+
     CommandContextImpl * CommandContext::GetImpl() const
     {
         return m_impl;
     }
 
-    SwapChain::SwapChain()
-        : m_impl(nullptr)
+    SwapChain::SwapChain(SwapChainImpl* impl)
+        : m_impl(impl)
+        , m_handle()
     {
-        m_impl = new SwapChainImpl;
     }
 
     SwapChain::~SwapChain()
     {
         assert(m_impl != nullptr);
-        delete m_impl;
+        m_impl->~SwapChainImpl();
         m_impl = nullptr;
     }
 
@@ -752,21 +1035,26 @@ namespace gpu
         m_impl->Present();
     }
 
+    SwapChainHandle SwapChain::GetHandle() const
+    {
+        return m_handle;
+    }
+
     SwapChainImpl* SwapChain::GetImpl() const
     {
         return m_impl;
     }
 
-    SynchronizationObject::SynchronizationObject()
-        : m_impl(nullptr)
+    SynchronizationObject::SynchronizationObject(SynchronizationObjectImpl* impl)
+        : m_impl(impl)
+        , m_handle()
     {
-        m_impl = new SynchronizationObjectImpl;
     }
 
     SynchronizationObject::~SynchronizationObject()
     {
         assert(m_impl != nullptr);
-        delete m_impl;
+        m_impl->~SynchronizationObjectImpl();
         m_impl = nullptr;
     }
 
@@ -788,6 +1076,11 @@ namespace gpu
         m_impl->MoveToNextFrame(command.GetImpl()->GetNativeCommandQueue(), swapChain.GetImpl()->GetSwapChain(), frameIndex);
     }
 
+    SynchronizationObjectHandle SynchronizationObject::GetHandle() const
+    {
+        return m_handle;
+    }
+
     SynchronizationObjectImpl* SynchronizationObject::GetImpl() const
     {
         return m_impl;